@@ -11,18 +11,6 @@
 #include <Windows.h>
 #include <process.h>
 
-#include "msxml2.h"     // use MSXML
-#pragma comment (lib,"msxml2.lib")
-
-/**
- * @brief CoInitialize/CoUnInitializeをスコープ内で実施するクラス
- */
-class CsyCoInitializer {
-public:
-    CsyCoInitializer ( void ) { ::CoInitialize( NULL ); }
-    ~CsyCoInitializer( void ) { ::CoUninitialize( );    }
-};
-
 /**
  * @brief Application実行パスを取得します。
  */
@@ -94,6 +82,98 @@ sy_single_join ( _In_ HANDLE   handle,
     return sy_multi_join ( 1, &handle, FALSE, milisec, is_check_msg );
 }
 
+/**
+* @brief 複数の同期待ち合わせ（全て）。MAXIMUM_WAIT_OBJECTS を超える数を扱えます。
+*
+* @param[in] handles ... 同期ハンドルのリスト
+* @param[in] deadline ... 待機期限（GetTickCount64()の値）
+*
+* @retval TRUE ... 全てシグナル状態になった  FALSE ... 期限切れ/エラー
+*/
+inline BOOL
+sy_wait_all_until ( _In_ const std::vector<HANDLE>&   handles,
+                    _In_ ULONGLONG                    deadline ) {
+
+    for ( size_t i = 0; i < handles.size(); i += MAXIMUM_WAIT_OBJECTS ) {
+        size_t    _rest = handles.size() - i;
+        DWORD     _num  = static_cast<DWORD>(
+                    _rest < MAXIMUM_WAIT_OBJECTS ? _rest : MAXIMUM_WAIT_OBJECTS );
+        ULONGLONG _now  = ::GetTickCount64();
+        DWORD     _ms   = _now < deadline ? static_cast<DWORD>( deadline - _now ) : 0;
+
+        DWORD _result = ::WaitForMultipleObjects( _num, &handles[ i ], TRUE, _ms );
+        if ( _result >= WAIT_OBJECT_0 + _num )
+            return FALSE;   // timeout or failed.
+    }
+    return TRUE;
+}
+
+/**
+ * @brief 高分解能カウンタの現在値を取得します。
+ */
+inline LONGLONG
+sy_perf_counter( void ) {
+    LARGE_INTEGER _now;
+    ::QueryPerformanceCounter( &_now );
+    return _now.QuadPart;
+}
+
+/**
+ * @brief 高分解能カウンタの差分をミリ秒に変換します。
+ *
+ * @param[in] begin ... 開始時の sy_perf_counter()
+ * @param[in] end ... 終了時の sy_perf_counter() (0.. 現在)
+ */
+inline double
+sy_perf_ms( _In_ LONGLONG begin, _In_ LONGLONG end = 0 ) {
+    LARGE_INTEGER _freq;
+    ::QueryPerformanceFrequency( &_freq );
+    if ( !end ) end = sy_perf_counter();
+    return static_cast<double>( end - begin ) * 1000.0 / _freq.QuadPart;
+}
+
+/**
+ * @brief func(0) ～ func(count-1) をスレッドプールで並列に実行し、全ての完了を待ちます。
+ *
+ * @param[in] count ... 実行回数
+ * @param[in] func ... 関数オブジェクト。引数はインデックス
+ */
+inline void
+sy_parallel_for( _In_ size_t                        count,
+                 _In_ std::function<void(size_t)>   func ) {
+
+    if ( count == 0 ) return;
+    if ( count == 1 ) { func( 0 ); return; }
+
+    struct TPARALLEL_ARG {
+        std::function<void(size_t)>*    func_p;
+        volatile LONG                   next;
+        volatile LONG                   rest;
+        HANDLE                          done;
+
+        void Execute( void ) {
+            (*func_p)( static_cast<size_t>( ::InterlockedIncrement( &next ) - 1 ) );
+            if ( ::InterlockedDecrement( &rest ) == 0 ) 
+                ::SetEvent( done );
+        }
+    } _arg = { &func, 0, static_cast<LONG>( count ), 
+               ::CreateEvent( NULL, TRUE, FALSE, NULL ) };
+
+    for ( size_t i = 0; i < count; i++ ) {
+        BOOL _submitted = _arg.done && ::TrySubmitThreadpoolCallback( 
+                []( PTP_CALLBACK_INSTANCE, PVOID context ) {
+                    reinterpret_cast<TPARALLEL_ARG*>( context )->Execute();
+                }, &_arg, NULL );
+
+        if ( !_submitted ) _arg.Execute();     // fallback : 呼び出しスレッドで実行
+    }
+
+    if ( _arg.done ) {
+        ::WaitForSingleObject( _arg.done, INFINITE );
+        ::CloseHandle( _arg.done );
+    }
+}
+
 /**
  * @brief Simple Windows Thread Class.
  */
@@ -150,6 +230,7 @@ public:
 
         if ( m_hThread ) return E_FAIL;
 
+        CsyTraceScope _trace( "thread_begin" );
         TTHREAD_ARG  _args = { 
             ::CreateEvent( NULL, FALSE, FALSE, NULL ), this, argument };
 
@@ -217,161 +298,542 @@ private:
 };
 
 /**
- * @brief Processを生成します
+ * @brief Job Objectを生成し、完了ポートに関連付けます。
+ *        Job内のプロセス終了は JOB_OBJECT_MSG_EXIT_PROCESS として
+ *        完了ポートに通知されます。
  *
- * @param[in] command ... 実行コマンド
- * @param[out] proc_info ... 生成したプロセス情報
- * @param[in] current_dir ... 起動時のカレントディレクトリ（NULL.. ModuleFilePath）
+ * @param[in] iocp ... 通知先の完了ポート
+ * @param[in] key ... 通知時のCompletionKey
+ * @param[out] job ... 生成したJob Object（後でCloseHandleすること）
  */
-inline HRESULT 
-sy_create_process(  _In_    LPCTSTR                 command,
-                    _Inout_ PROCESS_INFORMATION&    proc_info,
-                    _In_    LPCTSTR                 current_dir = NULL ) {
+inline HRESULT
+sy_create_job( _In_  HANDLE     iocp,
+               _In_  ULONG_PTR  key,
+               _Out_ HANDLE&    job ) {
 
+    job = ::CreateJobObject( NULL, NULL );
+    if ( !job )
+        return HRESULT_FROM_WIN32( ::GetLastError() );
 
-    STARTUPINFO    _si;
-    GetStartupInfo( &_si );
+    JOBOBJECT_ASSOCIATE_COMPLETION_PORT _port;
+    _port.CompletionKey  = reinterpret_cast<PVOID>( key );
+    _port.CompletionPort = iocp;
 
-    size_t _arg_len = ::_tcslen( command ) + 1;
-    LPTSTR _arg_p   = new TCHAR[ _arg_len ];
-    if ( !_arg_p ) {
-        return E_OUTOFMEMORY;
+    if ( !::SetInformationJobObject( job,
+                JobObjectAssociateCompletionPortInformation, &_port, sizeof( _port ) ) ) {
+        HRESULT _hr = HRESULT_FROM_WIN32( ::GetLastError() );
+        ::CloseHandle( job );
+        job = NULL;
+        return _hr;
     }
-    ::ZeroMemory( _arg_p, _arg_len );
-    ::_tcscpy_s ( _arg_p, _arg_len, command );
+    return S_OK;
+}
 
-    ZeroMemory( &proc_info, sizeof( proc_info ) );
+/**
+ * @brief Job Object にリソース制限を設定します。
+ *        メモリ上限に達すると JOB_OBJECT_MSG_JOB_MEMORY_LIMIT が完了ポートに通知されます。
+ *
+ * @param[in] job ... Job Object
+ * @param[in] cpu_rate ... CPU使用率の上限(%, 全CPU = 100) 0.. 制限しない
+ * @param[in] memory_limit_mb ... Job全体のコミットメモリ上限(MB) 0.. 制限しない
+ * @param[in] priority_class ... 優先度クラス (IDLE_PRIORITY_CLASS ...) 0.. 変更しない
+ * @retval S_OK ... 成功
+ */
+inline HRESULT
+sy_set_job_limits( _In_ HANDLE  job,
+                   _In_ UINT    cpu_rate,
+                   _In_ DWORD   memory_limit_mb,
+                   _In_ DWORD   priority_class ) {
+
+    if ( memory_limit_mb || priority_class ) {
+        JOBOBJECT_EXTENDED_LIMIT_INFORMATION _limit;
+        ::ZeroMemory( &_limit, sizeof( _limit ) );
+        if ( memory_limit_mb ) {
+            _limit.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_JOB_MEMORY;
+            _limit.JobMemoryLimit = static_cast<SIZE_T>( memory_limit_mb ) * 1024 * 1024;
+        }
+        if ( priority_class ) {
+            _limit.BasicLimitInformation.LimitFlags   |= JOB_OBJECT_LIMIT_PRIORITY_CLASS;
+            _limit.BasicLimitInformation.PriorityClass = priority_class;
+        }
+        if ( !::SetInformationJobObject( job, 
+                    JobObjectExtendedLimitInformation, &_limit, sizeof( _limit ) ) )
+            return HRESULT_FROM_WIN32( ::GetLastError() );
+    }
 
-    // カレントパスを設定
-    ::SetCurrentDirectory( current_dir ? current_dir : sy_get_running_dir() );
+    if ( cpu_rate ) {
+        JOBOBJECT_CPU_RATE_CONTROL_INFORMATION _cpu;
+        ::ZeroMemory( &_cpu, sizeof( _cpu ) );
+        _cpu.ControlFlags = JOB_OBJECT_CPU_RATE_CONTROL_ENABLE | JOB_OBJECT_CPU_RATE_CONTROL_HARD_CAP;
+        _cpu.CpuRate      = ( std::min )( cpu_rate, 100U ) * 100;    // 1/100 %
+        if ( !::SetInformationJobObject( job, 
+                    JobObjectCpuRateControlInformation, &_cpu, sizeof( _cpu ) ) )
+            return HRESULT_FROM_WIN32( ::GetLastError() );
+    }
+    return S_OK;
+}
 
-    // Process 生成（Window非表示)
-    BOOL _ret = ::CreateProcess( NULL, _arg_p, NULL, NULL, 
-                    FALSE, CREATE_NO_WINDOW, NULL, NULL, 
-                    &_si, &proc_info ) ;
+/**
+ * @brief Job Object の kill-on-close を設定/解除します。（他の制限はそのまま）
+ *        設定すると Job の最後のハンドルが閉じた時（supervisor の異常終了を含む）に
+ *        Job 内の全てのプロセス（孫プロセスを含む）が終了します。
+ *
+ * @param[in] job ... Job Object
+ * @param[in] enable ... TRUE.. 設定  FALSE.. 解除
+ */
+inline HRESULT
+sy_set_job_kill_on_close( _In_ HANDLE job,
+                          _In_ BOOL   enable ) {
 
-    delete [] _arg_p;
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION _limit;
+    ::ZeroMemory( &_limit, sizeof( _limit ) );
+    if ( !::QueryInformationJobObject( job, 
+                JobObjectExtendedLimitInformation, &_limit, sizeof( _limit ), NULL ) )
+        return HRESULT_FROM_WIN32( ::GetLastError() );
 
-    if ( !_ret ) {
+    if ( enable ) 
+        _limit.BasicLimitInformation.LimitFlags |=  JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+    else
+        _limit.BasicLimitInformation.LimitFlags &= ~JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+
+    if ( !::SetInformationJobObject( job, 
+                JobObjectExtendedLimitInformation, &_limit, sizeof( _limit ) ) )
         return HRESULT_FROM_WIN32( ::GetLastError() );
-    }
+    return S_OK;
+}
+
+/**
+ * @brief Job Object 内で実行中のプロセス数を取得します。（取得できない場合は 0）
+ */
+inline DWORD
+sy_job_active_processes( _In_ HANDLE job ) {
+    JOBOBJECT_BASIC_ACCOUNTING_INFORMATION _info;
+    if ( !job || !::QueryInformationJobObject( job, 
+                JobObjectBasicAccountingInformation, &_info, sizeof( _info ), NULL ) )
+        return 0;
+    return _info.ActiveProcesses;
+}
+
+/**
+ * @brief Job Object 内の全てのプロセス（孫プロセスを含む）を一度に終了します。
+ *        終了は待ちません。全て終了すると、Job に関連付けた完了ポートへ
+ *        JOB_OBJECT_MSG_ACTIVE_PROCESS_ZERO が届きます。
+ *
+ * @param[in] job ... Job Object
+ * @param[in] exit_code ... 終了コード
+ */
+inline HRESULT
+sy_terminate_job( _In_ HANDLE job,
+                  _In_ UINT   exit_code ) {
 
+    if ( !::TerminateJobObject( job, exit_code ) )
+        return HRESULT_FROM_WIN32( ::GetLastError() );
     return S_OK;
 }
 
 /**
- * @brief XMLを読み込んで、DOMを生成します。
+ * @brief 実行中のプロセスの子孫（孫プロセスを含む）を Job Object に入れます。
+ *        プロセス一覧を親 pid で辿ります。親より前に作成されたプロセスは pid が再利用された別のプロセスとして除きます。
+ *        辿っている間に Job の外のプロセスが起動した子孫も入れるため、新しく入ったものが無くなるまで繰り返します。
  *
- * @param[in] xml_file_name ... 読み込むXMLファイル名
- * @param[out] xml_document_pp ... XML DOM DOcument (後で解放すること）
+ * @param[in] job ... Job Object（root は入れ済みであること）
+ * @param[in] root ... 子孫を辿るプロセス
+ * @retval Job に入れた子孫の数
  */
-inline HRESULT 
-sy_xml_open( _In_  LPCTSTR             xml_file_name, 
-             _Out_ IXMLDOMDocument2    **xml_document_pp ) 
-{
-    if ( !xml_document_pp ) return E_POINTER;
-    USES_CONVERSION;
-    try {
-        CComPtr< IXMLDOMDocument2 > _xml_doc;
-
-        ATLENSURE_SUCCEEDED( _xml_doc.CoCreateInstance( CLSID_DOMDocument30 ) );
-        ATLENSURE_SUCCEEDED( _xml_doc->put_async           ( VARIANT_FALSE ) );
-        ATLENSURE_SUCCEEDED( _xml_doc->put_resolveExternals( VARIANT_FALSE ) );
-
-        // Use. "XPath"
-        ATLENSURE_SUCCEEDED( _xml_doc->setProperty( 
-                CComBSTR( L"SelectionLanguage" ), CComVariant( L"XPath" ) ) );
-
-        // Load from xml file
-        VARIANT_BOOL _is_success = VARIANT_FALSE;
-        ATLENSURE_SUCCEEDED( _xml_doc->load( 
-                        CComVariant( CT2CW( xml_file_name ) ), &_is_success ) ); 
-
-        if ( _is_success != VARIANT_TRUE ) {
-            CComPtr< IXMLDOMParseError> _error;
-            LONG _line(0), _pos(0), _err_code( 0 );
-            _xml_doc->get_parseError( &_error );
-            if ( _errno != NULL ) {
-                CComBSTR _reason;
-                _error->get_line     ( &_line     );
-                _error->get_linepos  ( &_pos      );
-                _error->get_errorCode( &_err_code );
-                _error->get_reason   ( &_reason   );
-                _SLOG( TEXT("! XML load failed. [%d:%d] code:%d\n"), 
-                    _line, _pos, _err_code);
-                return _err_code;
+inline DWORD
+sy_assign_descendants( _In_ HANDLE job,
+                       _In_ HANDLE root ) {
+
+    DWORD _assigned = 0;
+    for ( int _pass = 0; _pass < 4; _pass++ ) {
+        HANDLE _snap = ::CreateToolhelp32Snapshot( TH32CS_SNAPPROCESS, 0 );
+        if ( _snap == INVALID_HANDLE_VALUE ) 
+            break;
+        std::multimap<DWORD, DWORD> _children;     // 親 pid -> pid
+        PROCESSENTRY32 _entry = { sizeof( _entry ) };
+        for ( BOOL _ok = ::Process32First( _snap, &_entry ); _ok; _ok = ::Process32Next( _snap, &_entry ) ) 
+            if ( _entry.th32ProcessID != _entry.th32ParentProcessID ) 
+                _children.insert( std::make_pair( _entry.th32ParentProcessID, _entry.th32ProcessID ) );
+        ::CloseHandle( _snap );
+
+        // (pid, 作成時刻) の幅優先
+        FILETIME _create, _exit, _kernel, _user;
+        if ( !::GetProcessTimes( root, &_create, &_exit, &_kernel, &_user ) ) 
+            break;
+        std::vector< std::pair<DWORD, FILETIME> > _queue( 1, std::make_pair( ::GetProcessId( root ), _create ) );
+        DWORD _added = 0;
+        for ( size_t i = 0; i < _queue.size(); i++ ) {
+            auto _range = _children.equal_range( _queue[ i ].first );
+            for ( auto it = _range.first; it != _range.second; ++it ) {
+                HANDLE _process = ::OpenProcess( PROCESS_SET_QUOTA | PROCESS_TERMINATE | PROCESS_QUERY_LIMITED_INFORMATION, 
+                                                 FALSE, it->second );
+                if ( !_process ) 
+                    continue;
+                BOOL _in_job = FALSE;
+                if ( ::GetProcessTimes( _process, &_create, &_exit, &_kernel, &_user ) && 
+                     ::CompareFileTime( &_create, &_queue[ i ].second ) >= 0 ) {
+                    _queue.push_back( std::make_pair( it->second, _create ) );
+                    if ( ::IsProcessInJob( _process, job, &_in_job ) && !_in_job && 
+                         ::AssignProcessToJobObject( job, _process ) ) 
+                        _added++;
+                }
+                ::CloseHandle( _process );
             }
-            return E_FAIL;
         }
+        _assigned += _added;
+        if ( !_added ) 
+            break;
+    }
+    return _assigned;
+}
 
-        ATLENSURE_SUCCEEDED( _xml_doc.QueryInterface( xml_document_pp ) ); 
+/**
+ * @brief sy_create_process の起動オプション
+ */
+class CsySpawnOption {
+public:
+    LPCTSTR     m_current_dir;  ///< 起動時のカレントディレクトリ（NULL.. ModuleFilePath）
+    HANDLE      m_job;          ///< 所属させるJob Object（NULL.. 所属させない）
+    HANDLE      m_std_output;   ///< 標準出力（継承可能なハンドル NULL.. リダイレクトしない）
+    HANDLE      m_std_error;    ///< 標準エラー出力（NULL.. m_std_output と同じ）
+    KAFFINITY   m_affinity;     ///< CPU affinity mask（0.. 変更しない）
+    int         m_numa_node;    ///< 優先する NUMA node（-1.. 指定しない）
+    std::vector<CAtlString> m_environment;  ///< 追加/上書きする環境変数 "NAME=value"（空.. 継承のみ）
+    std::vector<HANDLE>     m_inherit;      ///< 継承させるハンドル（継承可能なハンドル。ソケット等）
+public:
+    CsySpawnOption( void ) 
+        : m_current_dir( NULL ),
+          m_job        ( NULL ),
+          m_std_output ( NULL ),
+          m_std_error  ( NULL ),
+          m_affinity   ( 0 ),
+          m_numa_node  ( -1 ) { }
+};
 
-    } catch ( CAtlException& e ) {
-        return e.m_hr; 
+/**
+ * @brief 自プロセスの環境変数に additions を追加/上書きした環境ブロックを作成します。
+ *
+ * @param[in] additions ... "NAME=value" のリスト
+ * @param[out] block ... CreateProcess に渡す環境ブロック (CREATE_UNICODE_ENVIRONMENT)
+ */
+inline void
+sy_build_environment( _In_  const std::vector<CAtlString>& additions,
+                      _Out_ std::vector<WCHAR>&            block ) {
+    block.clear();
+
+    // 上書きする変数名（大文字小文字は区別しない）
+    std::vector<CStringW> _names;
+    for ( auto& a : additions ) {
+        CStringW _a( a );
+        int _eq = _a.Find( L'=', 1 );
+        _names.push_back( _eq > 0 ? _a.Left( _eq ) : _a );
+    }
 
-    } catch ( ... ) {
-        return E_FAIL;
+    LPWCH _base = ::GetEnvironmentStringsW();
+    for ( LPCWSTR _p = _base; _p && *_p; _p += ::wcslen( _p ) + 1 ) {
+        LPCWSTR _eq  = ::wcschr( _p + 1, L'=' );    // "=C:=C:\" のような先頭の '=' は名前の一部
+        size_t  _len = _eq ? static_cast<size_t>( _eq - _p ) : ::wcslen( _p );
+        BOOL    _overridden = FALSE;
+        for ( auto& n : _names ) 
+            if ( static_cast<size_t>( n.GetLength() ) == _len && ::_wcsnicmp( n, _p, _len ) == 0 ) {
+                _overridden = TRUE;
+                break;
+            }
+        if ( !_overridden ) 
+            block.insert( block.end(), _p, _p + ::wcslen( _p ) + 1 );
     }
-    return S_OK;
+    if ( _base ) ::FreeEnvironmentStringsW( _base );
+
+    for ( auto& a : additions ) {
+        CStringW _a( a );
+        block.insert( block.end(), _a.GetString(), _a.GetString() + _a.GetLength() + 1 );
+    }
+    block.push_back( L'\0' );
 }
 
 /**
- * @brief XML NodeListをParseし、関数をコールバックします。
+ * @brief Processを生成します
  *
- * @param[in] xml_doc_p ... NodeListを検索する対象のXML DOM Document
- * @param[in] nodename ... nodelistを示すXPATH（例：/sylph/service/entry/process )
- * @param[out] func ... 関数オブジェクト。NodeList毎に呼ばれます。
+ * @param[in] command ... 実行コマンド
+ * @param[out] proc_info ... 生成したプロセス情報
+ * @param[in] option ... 起動オプション
+ *            job指定時は、サスペンド状態で生成し、Jobへ登録後に実行を開始します。
+ *            標準出力/m_inherit 指定時は、指定ハンドルのみを子プロセスに継承します。
+ *            環境変数指定時は、自プロセスの環境変数に追加/上書きして渡します。
  */
 inline HRESULT
-sy_xml_foreach_nodes( _In_ IXMLDOMDocument2*    xml_doc_p,
-                      _In_ LPTSTR               nodename,
-                      _In_ std::function<HRESULT(IXMLDOMNode*, long)> func ) {
+sy_create_process(  _In_    LPCTSTR                 command,
+                    _Inout_ PROCESS_INFORMATION&    proc_info,
+                    _In_    const CsySpawnOption&   option = CsySpawnOption() ) {
 
-    if ( !xml_doc_p ) return E_POINTER;
+    size_t _arg_len = ::_tcslen( command ) + 1;
+    LPTSTR _arg_p   = new TCHAR[ _arg_len ];
+    if ( !_arg_p ) {
+        return E_OUTOFMEMORY;
+    }
+    ::ZeroMemory( _arg_p, _arg_len );
+    ::_tcscpy_s ( _arg_p, _arg_len, command );
 
-    CComPtr<IXMLDOMNodeList> nodelist_p;
-    HRESULT _hr = xml_doc_p->selectNodes( CComBSTR( nodename ), &nodelist_p ); 
-    if ( FAILED( _hr ) ) 
-        return _hr;
+    ZeroMemory( &proc_info, sizeof( proc_info ) );
 
-    long _num = 0;
-    nodelist_p->get_length( &_num );
+    // カレントパス（並列起動するため、自プロセスのカレントは変更しない）
+    CAtlString _dir( option.m_current_dir ? CAtlString( option.m_current_dir ) 
+                                          : sy_get_running_dir() );
+
+    STARTUPINFOEX  _si;
+    ::ZeroMemory( &_si, sizeof( _si ) );
+    GetStartupInfo( &_si.StartupInfo );
+
+    DWORD _flags   = CREATE_NO_WINDOW | 
+                     ( option.m_job || option.m_affinity ? CREATE_SUSPENDED : 0 );
+    BOOL  _inherit = FALSE;
+
+    // 標準出力のリダイレクト。継承するハンドルは明示したものだけに限定する
+    // （並列起動時に他の子プロセスのパイプを継承しないように）
+    HANDLE  _std_in  = INVALID_HANDLE_VALUE;
+    std::vector<HANDLE> _handles( option.m_inherit );
+    USHORT  _node        = static_cast<USHORT>( option.m_numa_node );
+    std::vector<BYTE> _attr_buf;
+
+    DWORD _num_attr = ( option.m_std_output || !option.m_inherit.empty() ? 1 : 0 ) + 
+                      ( option.m_numa_node >= 0 ? 1 : 0 );
+    if ( _num_attr ) {
+        SIZE_T _attr_size = 0;
+        ::InitializeProcThreadAttributeList( NULL, _num_attr, 0, &_attr_size );
+        _attr_buf.resize( _attr_size );
+        _si.StartupInfo.cb  = sizeof( _si );
+        _si.lpAttributeList = reinterpret_cast<LPPROC_THREAD_ATTRIBUTE_LIST>( &_attr_buf[ 0 ] );
+
+        if ( !::InitializeProcThreadAttributeList( _si.lpAttributeList, _num_attr, 0, &_attr_size ) ) {
+            delete [] _arg_p;
+            return HRESULT_FROM_WIN32( ::GetLastError() );
+        }
+        _flags |= EXTENDED_STARTUPINFO_PRESENT;
+    }
+
+    // NUMA node（メモリの割り当てとスケジューリングの優先先）
+    if ( option.m_numa_node >= 0 && 
+         !::UpdateProcThreadAttribute( _si.lpAttributeList, 0, PROC_THREAD_ATTRIBUTE_PREFERRED_NODE,
+                        &_node, sizeof( _node ), NULL, NULL ) ) {
+        HRESULT _hr = HRESULT_FROM_WIN32( ::GetLastError() );
+        ::DeleteProcThreadAttributeList( _si.lpAttributeList );
+        delete [] _arg_p;
+        return _hr;
+    }
 
-    for ( long i=0; i<_num; i++ ) {
-        IXMLDOMNode* _node_p = NULL;
-        _hr = nodelist_p->get_item( i,  &_node_p );
+    if ( option.m_std_output ) {
+        SECURITY_ATTRIBUTES _sa = { sizeof( _sa ), NULL, TRUE };
+        _std_in = ::CreateFile( TEXT("NUL"), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, 
+                                &_sa, OPEN_EXISTING, 0, NULL );
+
+        _si.StartupInfo.cb         = sizeof( _si );
+        _si.StartupInfo.dwFlags   |= STARTF_USESTDHANDLES;
+        _si.StartupInfo.hStdInput  = _std_in;
+        _si.StartupInfo.hStdOutput = option.m_std_output;
+        _si.StartupInfo.hStdError  = option.m_std_error ? option.m_std_error : option.m_std_output;
+
+        _handles.push_back( _si.StartupInfo.hStdOutput );
+        if ( _si.StartupInfo.hStdError != _si.StartupInfo.hStdOutput ) 
+            _handles.push_back( _si.StartupInfo.hStdError );
+        if ( _std_in != INVALID_HANDLE_VALUE ) 
+            _handles.push_back( _std_in );
+    }
 
-        if ( _hr == S_OK ) { 
-            _hr = func( _node_p, i );
-            _node_p->Release( );
+    if ( !_handles.empty() ) {
+        if ( ::UpdateProcThreadAttribute( _si.lpAttributeList, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST, 
+                        &_handles[ 0 ], _handles.size() * sizeof( HANDLE ), NULL, NULL ) ) {
+            _inherit  = TRUE;
+        } else {
+            HRESULT _hr = HRESULT_FROM_WIN32( ::GetLastError() );
+            ::DeleteProcThreadAttributeList( _si.lpAttributeList );
+            if ( _std_in != INVALID_HANDLE_VALUE ) ::CloseHandle( _std_in );
+            delete [] _arg_p;
+            return _hr;
         }
+    }
 
-        if ( FAILED( _hr ) ) return _hr;
+    // 環境変数
+    std::vector<WCHAR> _env;
+    if ( !option.m_environment.empty() ) {
+        sy_build_environment( option.m_environment, _env );
+        _flags |= CREATE_UNICODE_ENVIRONMENT;
+    }
+
+    // Process 生成（Window非表示)
+    BOOL _ret = ::CreateProcess( NULL, _arg_p, NULL, NULL,
+                    _inherit, _flags, _env.empty() ? NULL : &_env[ 0 ], _dir.GetString(),
+                    &_si.StartupInfo, &proc_info ) ;
+    DWORD _err = ::GetLastError();
+
+    if ( _si.lpAttributeList ) ::DeleteProcThreadAttributeList( _si.lpAttributeList );
+    if ( _std_in != INVALID_HANDLE_VALUE ) ::CloseHandle( _std_in );
+    delete [] _arg_p;
+
+    if ( !_ret ) {
+        return HRESULT_FROM_WIN32( _err );
+    }
+
+    // Job へ登録し、affinity を設定してから実行を開始する
+    // （子プロセスもJobに含まれ、affinity を継承する）
+    if ( _flags & CREATE_SUSPENDED ) {
+        if ( ( option.m_job && !::AssignProcessToJobObject( option.m_job, proc_info.hProcess ) ) ||
+             ( option.m_affinity && !::SetProcessAffinityMask( proc_info.hProcess, option.m_affinity ) ) ) {
+            HRESULT _hr = HRESULT_FROM_WIN32( ::GetLastError() );
+            ::TerminateProcess( proc_info.hProcess, 0L );
+            ::CloseHandle( proc_info.hThread  );
+            ::CloseHandle( proc_info.hProcess );
+            ZeroMemory( &proc_info, sizeof( proc_info ) );
+            return _hr;
+        }
+        ::ResumeThread( proc_info.hThread );
     }
 
     return S_OK;
 }
 
+/** Ctrl イベント送信の補助プロセスのオプション ( <exe> /ctrl <event> <pid>... ) */
+#define SY_CONSOLE_CTRL_OPTION      TEXT("/ctrl")
+
+/** 補助プロセス１つで送る PID の上限（コマンドラインの長さ制限） */
+const size_t SY_CONSOLE_CTRL_BATCH = 2048;
+
+/** Ctrl-C/Ctrl-Break を無視するハンドラ（補助プロセスが自身に届いたイベントで終了しないように） */
+inline BOOL WINAPI
+sy_ignore_console_ctrl( _In_ DWORD ctrl_type ) {
+    return ( ctrl_type == CTRL_C_EVENT || ctrl_type == CTRL_BREAK_EVENT ) ? TRUE : FALSE;
+}
+
 /**
- * @brief XML Textを得ます。　
- *
- * @param[in] node_p ... 取得するテキストを含むNode
- * @param[in] name ... Node名を示すXPath
+ * @brief Ctrl イベント送信の補助プロセスとして実行します。（main の先頭で呼ぶこと）
+ *        コンソールを持たずに起動し、対象のコンソールへ順にアタッチして Ctrl イベントを送ります。
+ *        （supervisor は自身のコンソールを切り離さずに済みます）
  *
- * @retval ... テキスト（エラーの場合は、空白)
+ * @retval -1 ... 補助プロセスとしての起動ではない
+ * @retval その他 ... 送信できなかった PID の数（プロセスの終了コード）
+ */
+inline int
+sy_console_ctrl_main( _In_ int argc, _In_ _TCHAR* argv[] ) {
+
+    if ( argc < 3 || ::_tcscmp( SY_CONSOLE_CTRL_OPTION, argv[1] ) != 0 )
+        return -1;
+
+    // 送信前に登録する（イベントは送信元の自プロセスにも届く）
+    ::SetConsoleCtrlHandler( sy_ignore_console_ctrl, TRUE );
+
+    DWORD _event  = static_cast<DWORD>( ::_tcstoul( argv[2], NULL, 10 ) );
+    int   _failed = 0;
+    for ( int i = 3; i < argc; i++ ) {
+        ::FreeConsole();
+        if ( ::AttachConsole( static_cast<DWORD>( ::_tcstoul( argv[i], NULL, 10 ) ) ) &&
+             ::GenerateConsoleCtrlEvent( _event, 0 ) )
+            continue;
+        _failed++;
+    }
+    ::FreeConsole();
+    return _failed;
+}
+
+/**
+ * @brief コンソールへの Ctrl イベントをまとめて送ります。
+ *        Send() で自身の実行ファイルを補助プロセス ( /ctrl ) として起動し、送信は補助プロセスが行います。
+ *        （終了は待ちません。呼び出し元のコンソールは変更しません）
  */
-inline CAtlString 
-sy_xml_get_nodetext( _In_ IXMLDOMNode* node_p, _In_ LPCTSTR name ) {
+class CsyConsoleCtrlBatch {
+
+    std::map< DWORD, std::vector<DWORD> > m_pids;   ///< イベント毎の送信先 PID
+
+public:
+    /** 送信先を追加します。 ctrl_event ... CTRL_C_EVENT / CTRL_BREAK_EVENT */
+    void Add( _In_ DWORD pid, _In_ DWORD ctrl_event ) {
+        m_pids[ ctrl_event ].push_back( pid );
+    }
 
-    USES_CONVERSION;
-    if ( !node_p ) return CAtlString(TEXT(""));
+    /** 
+     * @brief 追加された送信先へ送ります。（補助プロセスを起動します）
+     * @retval TRUE ... 全ての補助プロセスを起動した
+     */
+    BOOL Send( void ) {
+        TCHAR _exe[ MAX_PATH ] = { 0 };
+        ::GetModuleFileName( NULL, _exe, _countof( _exe ) );
+
+        BOOL _started = TRUE;
+        for ( auto& e : m_pids ) {
+            for ( size_t i = 0; i < e.second.size(); i += SY_CONSOLE_CTRL_BATCH ) {
+                CAtlString _cmd;
+                _cmd.Format( TEXT("\"%s\" %s %u"), _exe, SY_CONSOLE_CTRL_OPTION, e.first );
+                for ( size_t n = i; n < e.second.size() && n < i + SY_CONSOLE_CTRL_BATCH; n++ ) 
+                    _cmd.AppendFormat( TEXT(" %u"), e.second[ n ] );
+
+                STARTUPINFO         _si = { sizeof( _si ) };
+                PROCESS_INFORMATION _pi = { 0 };
+                if ( !::CreateProcess( NULL, _cmd.GetBuffer(), NULL, NULL, FALSE, 
+                                       DETACHED_PROCESS, NULL, NULL, &_si, &_pi ) ) {
+                    _started = FALSE;
+                    continue;
+                }
+                ::CloseHandle( _pi.hThread  );
+                ::CloseHandle( _pi.hProcess );
+            }
+        }
+        m_pids.clear();
+        return _started;
+    }
+};
 
-    CComBSTR _val;
-    CComPtr<IXMLDOMNode> _node;
-    if ( node_p->selectSingleNode( CComBSTR( name ), &_node ) == S_OK )  
-        _node->get_text( &_val );
+/**
+ * @brief 指定プロセスのコンソールへ Ctrl イベントを送ります。（CsyConsoleCtrlBatch で１件だけ送ります）
+ *
+ * @param[in] pid ... 対象プロセスID
+ * @param[in] ctrl_event ... CTRL_C_EVENT / CTRL_BREAK_EVENT
+ * @retval TRUE ... 送信の補助プロセスを起動した
+ */
+inline BOOL
+sy_send_console_ctrl( _In_ DWORD pid, _In_ DWORD ctrl_event = CTRL_C_EVENT ) {
+    CsyConsoleCtrlBatch _batch;
+    _batch.Add( pid, ctrl_event );
+    return _batch.Send();
+}
 
-    return CAtlString( OLE2CT(_val) );
+/**
+ * @brief 指定プロセスのトップレベルウィンドウへ WM_CLOSE を送ります。
+ *
+ * @param[in] pid ... 対象プロセスID
+ * @retval TRUE ... 1つ以上のウィンドウへ送信した
+ */
+inline BOOL
+sy_close_windows( _In_ DWORD pid ) {
+
+    struct TENUM_ARG {
+        DWORD   pid;
+        BOOL    posted;
+    } _arg = { pid, FALSE };
+
+    ::EnumWindows( []( HWND hwnd, LPARAM lparam ) -> BOOL {
+            auto  _arg_p = reinterpret_cast<TENUM_ARG*>( lparam );
+            DWORD _pid   = 0;
+            ::GetWindowThreadProcessId( hwnd, &_pid );
+            if ( _pid == _arg_p->pid )
+                _arg_p->posted |= ::PostMessage( hwnd, WM_CLOSE, 0, 0 );
+            return TRUE;
+        }, reinterpret_cast<LPARAM>( &_arg ) );
+
+    return _arg.posted;
 }
 
+/**
+ * @brief テキストを数値として得ます。空の場合は value を変更しません。
+ *
+ * @param[in] text ... テキスト
+ * @param[in,out] value ... 取得した値
+ * @retval TRUE ... 取得した
+ */
+template <typename T>
+inline BOOL
+sy_parse_number( _In_ CAtlString text, _Inout_ T& value ) {
+    if ( text.Trim().IsEmpty() ) 
+        return FALSE;
+
+    value = static_cast<T>( ::_tcstoul( text, NULL, 10 ) );
+    return TRUE;
+}
 
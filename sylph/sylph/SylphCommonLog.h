@@ -9,87 +9,226 @@
  */
 #pragma once
 #include <Windows.h>
+#include <process.h>
 
 extern CAtlString  SERVICE_NAME;
 
 
-/** Trace Header */
-inline CAtlString 
-_TRACE_HEAD( void ) {
-    SYSTEMTIME _st;
-    ::ZeroMemory( &_st, sizeof( _st ) );
-    ::GetLocalTime( &_st );
-    CAtlString _s;
-    _s.Format( TEXT("[%04d-%02d-%02d %02d:%02d:%02d]: "),
-        _st.wYear, _st.wMonth, _st.wDay, _st.wHour, _st.wMinute, _st.wSecond );
-    return _s;
-}
-
-/** 
- * @brief Trace Output Template Function
- */
-template <typename TFunc>
-inline void 
-_TRACE_FT_( _In_ TFunc f, _In_ LPCTSTR format_s, ... )
-{
-    TCHAR*      _msg_p =  NULL;
-    va_list     _arg_list;
-
-    va_start( _arg_list, format_s);
+/** Logger 定数 */
+enum {
+    SY_LOG_MSG_SIZE     = 512,      ///< スロットに収める1メッセージの最大長（文字数、超える場合はヒープに確保）
+    SY_LOG_QUEUE_SIZE   = 4096,     ///< キューのスロット数（2のべき乗）
+    SY_LOG_FLUSH_MS     = 50,       ///< 出力スレッドの起床間隔(ms)
+};
 
-        const size_t _msg_len = _vsctprintf( format_s, _arg_list ) + 1;
-        const size_t _size    =  _msg_len * sizeof( TCHAR ); 
+/** ログ出力先 */
+enum SY_LOG_SINK {
+    SY_LOG_STDOUT = 0,      ///< 標準出力
+    SY_LOG_DEBUG,           ///< OutputDebugString
+};
 
-        _msg_p  = ( TCHAR* )::malloc( _size );
-        if ( !_msg_p ) goto  _TRACEF_END;
+/**
+ * @brief 非同期ロガー。
+ *
+ *        スロットを事前に確保した有界 MPSC キューと、出力スレッド１本で構成されます。
+ *        呼び出し側は空きスロットを１つ確保してそこへ直接フォーマットするだけで、
+ *        malloc/時刻文字列の生成/コンソール出力は行いません。
+ *        （SY_LOG_MSG_SIZE を超える長いメッセージだけは切り捨てずにヒープに確保します）
+ *        時刻ヘッダは出力スレッド側で付け、秒が変わった時だけ作り直します。
+ *        キューが一杯の場合、そのメッセージは捨てられます（件数を報告します）。
+ */
+class CsyAsyncLogger {
+
+    /** キューのスロット */
+    struct TLOG_SLOT {
+        std::atomic<size_t> seq;                        ///< Vyukov bounded queue sequence
+        FILETIME            time;                       ///< 呼び出し時刻
+        WORD                sink;                       ///< SY_LOG_SINK
+        TCHAR               text[ SY_LOG_MSG_SIZE ];
+        TCHAR*              heap;                       ///< SY_LOG_MSG_SIZE を超えたメッセージ (NULL.. text を使う)
+    };
+
+    std::unique_ptr<TLOG_SLOT[]>    m_slots;
+    std::atomic<size_t>             m_enqueue;      ///< 次に確保するスロット (producers)
+    size_t                          m_dequeue;      ///< 次に出力するスロット (consumer)
+    std::atomic<size_t>             m_dropped;      ///< キューが一杯で捨てた件数
+    HANDLE                          m_wake;
+    HANDLE                          m_thread;
+    volatile LONG                   m_closing;
+    INIT_ONCE                       m_once;
+    ULONGLONG                       m_head_second;  ///< 時刻ヘッダを作った秒 (consumer)
+    TCHAR                           m_head[ 32 ];   ///< 時刻ヘッダ (consumer)
+
+public:
+    CsyAsyncLogger( void )
+        : m_slots      ( new TLOG_SLOT[ SY_LOG_QUEUE_SIZE ] ),
+          m_enqueue    ( 0 ),
+          m_dequeue    ( 0 ),
+          m_dropped    ( 0 ),
+          m_wake       ( NULL ),
+          m_thread     ( NULL ),
+          m_closing    ( 0 ),
+          m_head_second( 0 ) {
+        for ( size_t i = 0; i < SY_LOG_QUEUE_SIZE; i++ ) {
+            m_slots[ i ].seq.store( i, std::memory_order_relaxed );
+            m_slots[ i ].heap = NULL;
+        }
+        ::InitOnceInitialize( &m_once );
+        m_head[ 0 ] = 0;
+    }
 
-        ::ZeroMemory  ( _msg_p, _size );
-        ::_vstprintf_s( _msg_p, _msg_len, format_s, _arg_list );
+    /** destructor. 残りのメッセージを出力して終了します */
+    ~CsyAsyncLogger( void ) {
+        ::InterlockedExchange( &m_closing, 1 );
+        if ( m_thread ) {
+            ::SetEvent( m_wake );
+            ::WaitForSingleObject( m_thread, INFINITE );
+            ::CloseHandle( m_thread );
+        }
+        if ( m_wake ) ::CloseHandle( m_wake );
+        this->Drain();
+    }
 
-        f( _msg_p );
+    /**
+     * @brief ログを書き込みます（キューへ積むだけで、出力は出力スレッドで行います）
+     */
+    void Write( _In_ SY_LOG_SINK sink, _In_z_ _Printf_format_string_ LPCTSTR format, ... ) {
+        va_list _args;
+        va_start( _args, format );
+        this->WriteV( sink, format, _args );
+        va_end( _args );
+    }
 
-_TRACEF_END:
-        if ( _msg_p ) ::free( _msg_p );
+    void WriteV( _In_ SY_LOG_SINK sink, _In_z_ LPCTSTR format, _In_ va_list args ) {
+        this->Startup();
+
+        // スロットを１つ確保 (multi producer)
+        size_t     _pos  = m_enqueue.load( std::memory_order_relaxed );
+        TLOG_SLOT* _slot = NULL;
+        for ( ;; ) {
+            _slot = &m_slots[ _pos & ( SY_LOG_QUEUE_SIZE - 1 ) ];
+            size_t   _seq  = _slot->seq.load( std::memory_order_acquire );
+            intptr_t _diff = static_cast<intptr_t>( _seq ) - static_cast<intptr_t>( _pos );
+            if ( _diff == 0 ) {
+                if ( m_enqueue.compare_exchange_weak( _pos, _pos + 1, std::memory_order_relaxed ) )
+                    break;
+            } else if ( _diff < 0 ) {
+                m_dropped.fetch_add( 1, std::memory_order_relaxed );   // queue full.
+                return;
+            } else {
+                _pos = m_enqueue.load( std::memory_order_relaxed );
+            }
+        }
+
+        ::GetSystemTimeAsFileTime( &_slot->time );
+        _slot->sink = static_cast<WORD>( sink );
+        _slot->heap = NULL;
+
+        va_list _retry;
+        va_copy( _retry, args );
+        if ( ::_vsntprintf_s( _slot->text, SY_LOG_MSG_SIZE, _TRUNCATE, format, args ) < 0 ) {
+            // スロットに収まらないメッセージ (Kill した PID の一覧、コマンドラインなど) だけヒープに確保する
+            va_list _measure;
+            va_copy( _measure, _retry );
+            int _len = ::_vsctprintf( format, _measure );
+            va_end( _measure );
+
+            if ( _len > 0 && ( _slot->heap = static_cast<TCHAR*>( ::malloc( ( _len + 1 ) * sizeof( TCHAR ) ) ) ) != NULL ) 
+                ::_vstprintf_s( _slot->heap, _len + 1, format, _retry );
+            else
+                _slot->text[ SY_LOG_MSG_SIZE - 1 ] = 0;     // 確保できなければ切り捨て
+        }
+        va_end( _retry );
+
+        _slot->seq.store( _pos + 1, std::memory_order_release );
+    }
 
-    va_end( _arg_list );
-}
+    /** キューが一杯で捨てた件数 */
+    size_t IsDropped( void ) const { return m_dropped.load( std::memory_order_relaxed ); }
+
+private:
+    /** 出力スレッドを開始します（初回のみ） */
+    void Startup( void ) {
+        ::InitOnceExecuteOnce( &m_once, []( PINIT_ONCE, PVOID param, PVOID* ) -> BOOL {
+                auto _this = reinterpret_cast<CsyAsyncLogger*>( param );
+                _this->m_wake   = ::CreateEvent( NULL, FALSE, FALSE, NULL );
+                _this->m_thread = reinterpret_cast<HANDLE>( ::_beginthreadex( 
+                            NULL, 0, CsyAsyncLogger::threadProc, _this, 0, NULL ) );
+                return TRUE;
+            }, this, NULL );
+    }
 
-// std out
-#define _TRACE_F_( fmt, ...) _TRACE_FT_( [](LPTSTR msg) { ::_tprintf_s( msg ); }, fmt, __VA_ARGS__ )
-// DebugOut
-#define _TRACE_D_( fmt, ...) _TRACE_FT_( [](LPTSTR msg) { ::OutputDebugString( msg ); }, fmt, __VA_ARGS__ )
+    /** 出力スレッド */
+    static unsigned __stdcall threadProc( _In_ void* argment ) {
+        auto _this = reinterpret_cast<CsyAsyncLogger*>( argment );
+        while ( !_this->m_closing ) {
+            ::WaitForSingleObject( _this->m_wake, SY_LOG_FLUSH_MS );
+            _this->Drain();
+        }
+        return 0;
+    }
 
+    /** キューのメッセージを全て出力します (single consumer) */
+    void Drain( void ) {
+        BOOL _out = FALSE;
+        for ( ;; ) {
+            TLOG_SLOT* _slot = &m_slots[ m_dequeue & ( SY_LOG_QUEUE_SIZE - 1 ) ];
+            if ( _slot->seq.load( std::memory_order_acquire ) != m_dequeue + 1 )
+                break;
+
+            LPCTSTR _text = _slot->heap ? _slot->heap : _slot->text;
+            if ( _slot->sink == SY_LOG_DEBUG ) {
+                ::OutputDebugString( this->Head( _slot->time ) );
+                ::OutputDebugString( _text );
+            } else {
+                ::_fputts( this->Head( _slot->time ), stdout );
+                ::_fputts( _text, stdout );
+                _out = TRUE;
+            }
+            if ( _slot->heap ) {
+                ::free( _slot->heap );
+                _slot->heap = NULL;
+            }
+
+            _slot->seq.store( m_dequeue + SY_LOG_QUEUE_SIZE, std::memory_order_release );
+            m_dequeue++;
+        }
+
+        if ( size_t _dropped = m_dropped.exchange( 0, std::memory_order_relaxed ) ) {
+            ::_ftprintf_s( stdout, TEXT("%s! %d log messages dropped.\n"), 
+                    this->Head( FILETIME() ), static_cast<int>( _dropped ) );
+            _out = TRUE;
+        }
+        if ( _out ) ::fflush( stdout );
+    }
 
-/**
- * @brief Eventlog Output
- */
-#pragma warning(push)
-#pragma warning(disable : 4793)
-inline void __cdecl 
-_EVENT_F( _In_ WORD wType, 
-          _In_z_ _Printf_format_string_ LPCTSTR pszFormat, ...) throw( ) {
-
-    const int LOG_EVENT_MSG_SIZE = 256;
-
-    TCHAR   _msg       [ LOG_EVENT_MSG_SIZE ];
-    LPTSTR  _strings   [ 1 ];
-    va_list _args;
-
-    va_start( _args, pszFormat );
-        _vsntprintf_s( _msg, LOG_EVENT_MSG_SIZE, LOG_EVENT_MSG_SIZE-1, 
-                        pszFormat, _args );
-    va_end( _args );
-
-    _msg [ LOG_EVENT_MSG_SIZE - 1 ] = 0;
-    _strings[ 0 ]                   = _msg;
-
-    if ( HANDLE _event_h = ::RegisterEventSource( NULL, SERVICE_NAME ) ) {
-        ::ReportEvent( _event_h, wType, 0, 0, NULL, 1, 0, 
-                        (LPCTSTR*) &_strings[ 0 ], NULL);
-        ::DeregisterEventSource( _event_h );
+    /** 時刻ヘッダ。秒が変わった時だけ作り直します */
+    LPCTSTR Head( _In_ FILETIME time ) {
+        if ( !time.dwLowDateTime && !time.dwHighDateTime )
+            ::GetSystemTimeAsFileTime( &time );
+
+        ULARGE_INTEGER _t;
+        _t.LowPart  = time.dwLowDateTime;
+        _t.HighPart = time.dwHighDateTime;
+        ULONGLONG _second = _t.QuadPart / 10000000;
+        if ( _second == m_head_second )
+            return m_head;
+
+        FILETIME   _local;
+        SYSTEMTIME _st;
+        ::FileTimeToLocalFileTime( &time, &_local );
+        ::FileTimeToSystemTime( &_local, &_st );
+        ::_stprintf_s( m_head, _countof( m_head ), TEXT("[%04d-%02d-%02d %02d:%02d:%02d]: "),
+            _st.wYear, _st.wMonth, _st.wDay, _st.wHour, _st.wMinute, _st.wSecond );
+        m_head_second = _second;
+        return m_head;
     }
-}
-#pragma warning(pop)  // disable 4793
+
+    CsyAsyncLogger( const CsyAsyncLogger& );
+    CsyAsyncLogger& operator=( const CsyAsyncLogger& );
+};
+
+extern CsyAsyncLogger SY_LOGGER;
 
 
 // *---------------------------------------------------------------------------
@@ -106,19 +245,10 @@ _EVENT_F( _In_ WORD wType,
     #define __UFUNC__ __FILE__
 #endif
 
-// StdOut/DebugPrint
-#define _SLOG( fmt, ...) _TRACE_F_( TEXT("%s") fmt, _TRACE_HEAD(), __VA_ARGS__ )
-#define _SDBG( fmt, ...) _TRACE_D_( TEXT("%s") fmt, _TRACE_HEAD(), __VA_ARGS__ )
+// StdOut/DebugPrint (async)
+#define _SLOG( fmt, ...) SY_LOGGER.Write( SY_LOG_STDOUT, fmt, __VA_ARGS__ )
+#define _SDBG( fmt, ...) SY_LOGGER.Write( SY_LOG_DEBUG,  fmt, __VA_ARGS__ )
 
-#define _STRACE( fmt, ...) _TRACE_F_( TEXT("[%s-(%04d)]: ") fmt, __UFILE__, __LINE__, __VA_ARGS__ )
+#define _STRACE( fmt, ...) SY_LOGGER.Write( SY_LOG_STDOUT, TEXT("[%s-(%04d)]: ") fmt, __UFILE__, __LINE__, __VA_ARGS__ )
 
 
-// Event Out
-#define EVENT_INF(...) _EVENT_F( EVENTLOG_INFORMATION_TYPE, __VA_ARGS__ )
-#define EVENT_ERR(...) _EVENT_F( EVENTLOG_ERROR_TYPE,       __VA_ARGS__ )
-#define EVENT_WAR(...) _EVENT_F( EVENTLOG_WARNING_TYPE,     __VA_ARGS__ )
-#ifdef _DEBUG
-#define EVENT_DBG(...) _EVENT_F( EVENTLOG_INFORMATION_TYPE, __VA_ARGS__ )
-#else
-#define EVENT_DBG(...) __noop
-#endif
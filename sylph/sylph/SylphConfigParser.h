@@ -0,0 +1,411 @@
+﻿/**
+ * @file     SylphConfigParser.h
+ * @brief    syconfig.xml streaming parser
+ * @author   M.Horigome
+ * @version  1.0.0.0000
+ * @date     2026-10-17
+ *
+ * https://github.com/horigome/sylph
+ */
+#pragma once
+#include "stdafx.h"
+#include "SylphProcessManager.h"
+
+/** 属性リスト (名前, 値) */
+typedef std::vector< std::pair<std::string, std::string> > SYXMLATTRS;
+
+/**
+ * @brief XML 読み込みの通知先 (SAX)
+ *        名前/テキスト/属性は UTF-8 です。テキストと属性値は実体参照を展開済みで、
+ *        要素の直下にあるテキストだけを OnEndElement で受け取ります。
+ */
+class IsyXmlHandler {
+public:
+    virtual ~IsyXmlHandler( void ) { }
+
+    /** 開始タグ */
+    virtual HRESULT OnStartElement( _In_ const std::string& name, _In_ const SYXMLATTRS& attrs ) = 0;
+
+    /** 終了タグ（空要素タグの場合も呼ばれます） */
+    virtual HRESULT OnEndElement( _In_ const std::string& name, _In_ const std::string& text ) = 0;
+};
+
+/**
+ * @brief 依存なしの最小限の XML リーダー（UTF-8 のみ）
+ *
+ *        要素/属性/テキスト/コメント/CDATA/処理命令/DOCTYPE を1パスで読みます。
+ *        名前空間や外部実体は扱いません。
+ */
+class CsyXmlReader {
+    const char*     m_begin;
+    const char*     m_error_at;     ///< エラー位置（無し.. NULL）
+public:
+    CsyXmlReader( void ) : m_begin( NULL ), m_error_at( NULL ) { }
+
+    /**
+     * @brief 読み込み
+     * @param[in] data ... XML (UTF-8)
+     * @param[in] size ... data のバイト数
+     * @param[in] handler ... 通知先
+     * @retval S_OK ... 成功
+     * @retval HRESULT_FROM_WIN32(ERROR_XML_PARSE_ERROR) ... 書式エラー（IsErrorLine で行番号）
+     * @retval 他 ... handler が返したエラー
+     */
+    HRESULT Parse( _In_reads_bytes_( size ) const char* data, _In_ size_t size, _In_ IsyXmlHandler& handler ) {
+        const char* _p   = data;
+        const char* _end = data + size;
+        m_begin    = data;
+        m_error_at = NULL;
+
+        if ( size >= 3 && ::memcmp( _p, "\xEF\xBB\xBF", 3 ) == 0 ) _p += 3;   // UTF-8 BOM
+
+        std::vector<std::string>    _stack;
+        std::string                 _text;
+        SYXMLATTRS                  _attrs;
+        HRESULT                     _hr = S_OK;
+
+        while ( _p < _end ) {
+            if ( *_p != '<' ) {
+                const char* _next = Find( _p, _end, "<" );
+                if ( !Decode( _p, _next, _text ) ) return this->Error( _p );
+                _p = _next;
+            }
+            else if ( StartsWith( _p, _end, "<!--" ) ) {
+                const char* _close = Find( _p + 4, _end, "-->" );
+                if ( _close == _end ) return this->Error( _p );
+                _p = _close + 3;
+            }
+            else if ( StartsWith( _p, _end, "<![CDATA[" ) ) {
+                const char* _close = Find( _p + 9, _end, "]]>" );
+                if ( _close == _end ) return this->Error( _p );
+                _text.append( _p + 9, _close );
+                _p = _close + 3;
+            }
+            else if ( StartsWith( _p, _end, "<?" ) ) {
+                const char* _close = Find( _p + 2, _end, "?>" );
+                if ( _close == _end ) return this->Error( _p );
+                _p = _close + 2;
+            }
+            else if ( StartsWith( _p, _end, "<!" ) ) {
+                const char* _close = Find( _p + 2, _end, ">" );
+                if ( _close == _end ) return this->Error( _p );
+                _p = _close + 1;
+            }
+            else if ( StartsWith( _p, _end, "</" ) ) {
+                const char* _name  = _p + 2;
+                const char* _close = Find( _name, _end, ">" );
+                const char* _name_end = _name;
+                while ( _name_end < _close && !IsSpace( *_name_end ) ) _name_end++;
+
+                if ( _close == _end || _stack.empty() ||
+                     _stack.back().compare( 0, std::string::npos, _name, _name_end - _name ) != 0 )
+                    return this->Error( _p );
+
+                if ( FAILED( _hr = handler.OnEndElement( _stack.back(), _text ) ) ) return _hr;
+                _text.clear();
+                _stack.pop_back();
+                _p = _close + 1;
+            }
+            else {
+                const char* _name     = _p + 1;
+                const char* _name_end = _name;
+                while ( _name_end < _end && !IsSpace( *_name_end ) && *_name_end != '>' && *_name_end != '/' )
+                    _name_end++;
+                if ( _name_end == _name ) return this->Error( _p );
+
+                // 属性 name="value" ...
+                const char* _q = _name_end;
+                BOOL        _empty = FALSE;
+                _attrs.clear();
+                for ( ;; ) {
+                    while ( _q < _end && IsSpace( *_q ) ) _q++;
+                    if ( _q == _end ) return this->Error( _p );
+                    if ( *_q == '>' ) break;
+                    if ( *_q == '/' ) {
+                        if ( _q + 1 == _end || _q[ 1 ] != '>' ) return this->Error( _q );
+                        _empty = TRUE;
+                        _q++;
+                        break;
+                    }
+
+                    const char* _attr = _q;
+                    while ( _q < _end && !IsSpace( *_q ) && *_q != '=' && *_q != '>' && *_q != '/' ) _q++;
+                    const char* _attr_end = _q;
+                    while ( _q < _end && IsSpace( *_q ) ) _q++;
+                    if ( _attr == _attr_end || _q == _end || *_q != '=' ) return this->Error( _attr );
+                    _q++;
+                    while ( _q < _end && IsSpace( *_q ) ) _q++;
+                    if ( _q == _end || ( *_q != '"' && *_q != '\'' ) ) return this->Error( _attr );
+
+                    const char* _value = _q + 1;
+                    const char* _close = std::find( _value, _end, *_q );
+                    if ( _close == _end ) return this->Error( _attr );
+
+                    _attrs.push_back( std::make_pair( std::string( _attr, _attr_end ), std::string() ) );
+                    if ( !Decode( _value, _close, _attrs.back().second ) ) return this->Error( _value );
+                    _q = _close + 1;
+                }
+
+                _stack.push_back( std::string( _name, _name_end ) );
+                _text.clear();
+                if ( FAILED( _hr = handler.OnStartElement( _stack.back(), _attrs ) ) ) return _hr;
+
+                if ( _empty ) {             // <empty/>
+                    if ( FAILED( _hr = handler.OnEndElement( _stack.back(), _text ) ) ) return _hr;
+                    _stack.pop_back();
+                }
+                _p = _q + 1;
+            }
+        }
+        return _stack.empty() ? S_OK : this->Error( _end );
+    }
+
+    /** エラー行（1～、エラー無し.. 0） */
+    int IsErrorLine( void ) const {
+        if ( !m_error_at ) return 0;
+        return 1 + static_cast<int>( std::count( m_begin, m_error_at, '\n' ) );
+    }
+
+private:
+    HRESULT Error( _In_ const char* at ) {
+        m_error_at = at;
+        return HRESULT_FROM_WIN32( ERROR_XML_PARSE_ERROR );
+    }
+
+    static BOOL IsSpace( _In_ char c ) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+
+    static BOOL StartsWith( _In_ const char* p, _In_ const char* end, _In_z_ const char* s ) {
+        size_t _len = ::strlen( s );
+        return static_cast<size_t>( end - p ) >= _len && ::memcmp( p, s, _len ) == 0;
+    }
+
+    static const char* Find( _In_ const char* p, _In_ const char* end, _In_z_ const char* s ) {
+        const char* _found = std::search( p, end, s, s + ::strlen( s ) );
+        return _found;
+    }
+
+    /** 実体参照を展開して text へ追加します */
+    static BOOL Decode( _In_ const char* p, _In_ const char* end, _Inout_ std::string& text ) {
+        while ( p < end ) {
+            const char* _amp = std::find( p, end, '&' );
+            text.append( p, _amp );
+            if ( _amp == end ) break;
+
+            const char* _semi = std::find( _amp, end, ';' );
+            if ( _semi == end ) return FALSE;
+
+            std::string _ref( _amp + 1, _semi );
+            if      ( _ref == "lt"   ) text += '<';
+            else if ( _ref == "gt"   ) text += '>';
+            else if ( _ref == "amp"  ) text += '&';
+            else if ( _ref == "quot" ) text += '"';
+            else if ( _ref == "apos" ) text += '\'';
+            else if ( _ref.size() > 1 && _ref[ 0 ] == '#' ) {
+                unsigned long _cp = ( _ref[ 1 ] == 'x' ) ? ::strtoul( _ref.c_str() + 2, NULL, 16 )
+                                                         : ::strtoul( _ref.c_str() + 1, NULL, 10 );
+                AppendUtf8( _cp, text );
+            }
+            else return FALSE;
+            p = _semi + 1;
+        }
+        return TRUE;
+    }
+
+    static void AppendUtf8( _In_ unsigned long cp, _Inout_ std::string& text ) {
+        if ( cp < 0x80 ) {
+            text += static_cast<char>( cp );
+        } else if ( cp < 0x800 ) {
+            text += static_cast<char>( 0xC0 | ( cp >> 6 ) );
+            text += static_cast<char>( 0x80 | ( cp & 0x3F ) );
+        } else if ( cp < 0x10000 ) {
+            text += static_cast<char>( 0xE0 | ( cp >> 12 ) );
+            text += static_cast<char>( 0x80 | ( ( cp >> 6 ) & 0x3F ) );
+            text += static_cast<char>( 0x80 | ( cp & 0x3F ) );
+        } else {
+            text += static_cast<char>( 0xF0 | ( cp >> 18 ) );
+            text += static_cast<char>( 0x80 | ( ( cp >> 12 ) & 0x3F ) );
+            text += static_cast<char>( 0x80 | ( ( cp >> 6 ) & 0x3F ) );
+            text += static_cast<char>( 0x80 | ( cp & 0x3F ) );
+        }
+    }
+};
+
+/**
+ * @brief syconfig.xml の内容
+ */
+class CsyServiceConfig {
+public:
+    CAtlString  m_service_name;     ///< <service_name>
+    DWORD       m_start_type;       ///< <start_type>
+    CAtlString  m_event_log;        ///< <event_log>（空.. Windows イベントログ）
+    DWORD       m_sample_interval;  ///< <sample_interval> リソース採取の間隔(ms) 0.. 採取しない
+    CAtlString  m_trace;            ///< <trace> trace の出力先 (JSON)（空.. 記録しない）
+    CAtlString  m_journal;          ///< <journal> 実行中の子プロセスの journal（空.. 記録しない）
+    SYCONFIGS   m_processes;        ///< <entry><process>
+public:
+    CsyServiceConfig( void ) 
+        : m_start_type     ( SERVICE_DEMAND_START ),
+          m_sample_interval( SY_SAMPLE_INTERVAL_MS ) { }
+};
+
+/**
+ * @brief syconfig.xml を CsyServiceConfig へ読み込む Handler
+ *
+ * ==> <sylph><service><config> ... </config>
+ * ==> <sylph><service><entry><process> ... </process></entry></service></sylph>
+ */
+class CsyConfigHandler : public IsyXmlHandler {
+    CsyServiceConfig&   m_config;
+    CsyProcConfig       m_process;
+    std::string         m_path;     ///< 現在の要素のパス ( "/sylph/service/..." )
+public:
+    explicit CsyConfigHandler( _Out_ CsyServiceConfig& config ) : m_config( config ) { }
+
+    virtual HRESULT OnStartElement( _In_ const std::string& name, _In_ const SYXMLATTRS& attrs ) override {
+        static const std::string _PROCESS( "/sylph/service/entry/process" );
+
+        m_path += '/';
+        m_path += name;
+        if ( m_path == _PROCESS )
+            m_process.Clear();
+
+        // .. <process><xxx attr="value">
+        if ( !attrs.empty() && m_path.size() == _PROCESS.size() + 1 + name.size() &&
+             m_path.compare( 0, _PROCESS.size(), _PROCESS ) == 0 ) {
+            CAtlString _name( CA2T( name.c_str(), CP_UTF8 ) );
+            for ( auto& a : attrs ) {
+                CAtlString _attr ( CA2T( a.first.c_str(),  CP_UTF8 ) );
+                CAtlString _value( CA2T( a.second.c_str(), CP_UTF8 ) );
+                if ( !m_process.SetAttribute( _name, _attr, _value ) )
+                    _SLOG( TEXT("[WAR] unknown %s@%s. [%s]\n"), _name.GetString(), _attr.GetString(), _value.GetString() );
+            }
+        }
+        return S_OK;
+    }
+
+    virtual HRESULT OnEndElement( _In_ const std::string& name, _In_ const std::string& text ) override {
+        static const std::string _PROCESS( "/sylph/service/entry/process" );
+
+        CAtlString _text( CA2T( text.c_str(), CP_UTF8 ) );
+
+        if ( m_path == "/sylph/service/config/service_name" ) {
+            m_config.m_service_name = _text.Trim();
+        }
+        else if ( m_path == "/sylph/service/config/start_type" ) {
+            m_config.m_start_type = ::_ttoi( _text );
+        }
+        else if ( m_path == "/sylph/service/config/event_log" ) {
+            m_config.m_event_log = _text.Trim();
+        }
+        else if ( m_path == "/sylph/service/config/sample_interval" ) {
+            sy_parse_number( _text, m_config.m_sample_interval );
+        }
+        else if ( m_path == "/sylph/service/config/trace" ) {
+            m_config.m_trace = _text.Trim();
+        }
+        else if ( m_path == "/sylph/service/config/journal" ) {
+            m_config.m_journal = _text.Trim();
+        }
+        else if ( m_path == _PROCESS ) {
+            if ( m_process.m_commandline.GetLength() )
+                m_config.m_processes.push_back( m_process );
+        }
+        else if ( m_path.size() == _PROCESS.size() + 1 + name.size() &&
+                  m_path.compare( 0, _PROCESS.size(), _PROCESS ) == 0 ) {
+            // .. <process><xxx>text</xxx>
+            CAtlString _name( CA2T( name.c_str(), CP_UTF8 ) );
+            if ( !m_process.SetElement( _name, _text ) )
+                _SLOG( TEXT("[WAR] unknown %s. [%s]\n"), _name.GetString(), _text.GetString() );
+        }
+
+        m_path.resize( m_path.size() - name.size() - 1 );
+        return S_OK;
+    }
+};
+
+/**
+ * @brief syconfig.xml の内容を読み込みます（既定値の補完を含む）
+ *
+ * @param[in]  data ... XML (UTF-8)
+ * @param[in]  size ... data のバイト数
+ * @param[out] config ... 読み込み結果
+ * @retval S_OK ... 成功
+ */
+inline HRESULT
+sy_config_parse( _In_reads_bytes_( size ) const char* data, _In_ size_t size, _Out_ CsyServiceConfig& config ) {
+
+    config = CsyServiceConfig();
+
+    CsyXmlReader     _reader;
+    CsyConfigHandler _handler( config );
+    HRESULT _hr = _reader.Parse( data, size, _handler );
+    if ( FAILED( _hr ) ) {
+        _SLOG( TEXT("! XML load failed. [line:%d] 0x%08x\n"), _reader.IsErrorLine(), _hr );
+        return _hr;
+    }
+
+    if ( config.m_service_name.IsEmpty() ) config.m_service_name = TEXT("SylphService");
+
+    switch ( config.m_start_type ) {
+    case SERVICE_AUTO_START:
+    case SERVICE_DEMAND_START:
+    case SERVICE_DISABLED:
+        break;
+    default:
+        config.m_start_type = SERVICE_DEMAND_START;     // Unknown value.
+    }
+
+    sy_assign_entry_names( config.m_processes );
+    for ( auto& p : config.m_processes ) 
+        p.Normalize();
+    return S_OK;
+}
+
+/**
+ * @brief ファイルを全て読み込みます
+ */
+inline HRESULT
+sy_read_file( _In_z_ LPCTSTR path, _Out_ std::string& data ) {
+    data.clear();
+
+    HANDLE _file = ::CreateFile( path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                 NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+    if ( _file == INVALID_HANDLE_VALUE )
+        return HRESULT_FROM_WIN32( ::GetLastError() );
+
+    HRESULT       _hr = S_OK;
+    LARGE_INTEGER _size;
+    if ( !::GetFileSizeEx( _file, &_size ) ) {
+        _hr = HRESULT_FROM_WIN32( ::GetLastError() );
+    } else if ( _size.QuadPart > 0x7FFFFFFF ) {
+        _hr = E_OUTOFMEMORY;
+    } else if ( _size.QuadPart ) {
+        DWORD _read = 0;
+        data.resize( static_cast<size_t>( _size.QuadPart ) );
+        if ( !::ReadFile( _file, &data[ 0 ], static_cast<DWORD>( data.size() ), &_read, NULL ) )
+            _hr = HRESULT_FROM_WIN32( ::GetLastError() );
+        data.resize( _read );
+    }
+    ::CloseHandle( _file );
+    return _hr;
+}
+
+/**
+ * @brief syconfig.xml を読み込みます
+ *
+ * @param[in]  path ... ファイル名
+ * @param[out] config ... 読み込み結果
+ * @retval S_OK ... 成功
+ */
+inline HRESULT
+sy_config_load( _In_z_ LPCTSTR path, _Out_ CsyServiceConfig& config ) {
+    std::string _data;
+    HRESULT _hr = sy_read_file( path, _data );
+    if ( FAILED( _hr ) ) {
+        _SLOG( TEXT("! XML open failed. [%s] 0x%08x\n"), path, _hr );
+        return _hr;
+    }
+    return sy_config_parse( _data.data(), _data.size(), config );
+}
@@ -0,0 +1,335 @@
+﻿/**
+ * @file     SylphConfigSnapshot.h
+ * @brief    Compiled binary snapshot of syconfig.xml
+ * @author   M.Horigome
+ * @version  1.0.0.0000
+ * @date     2026-10-17
+ *
+ * https://github.com/horigome/sylph
+ */
+#pragma once
+#include "stdafx.h"
+#include "SylphConfigParser.h"
+
+/**
+ * Snapshot 定数
+ *   SY_SNAPSHOT_VERSION は Serialize() の項目を変えたら上げること。
+ *   バージョンが違う snapshot は使わずに XML を読みます。
+ */
+enum {
+    SY_SNAPSHOT_MAGIC       = 0x42435953,   ///< 'SYCB'
+    SY_SNAPSHOT_VERSION     = 12,
+};
+
+/**
+ * @brief Snapshot ファイルヘッダ
+ *        元の XML のサイズ/更新時刻/ハッシュを持ち、XML が変わっていないかの判定に使います。
+ */
+struct TSY_SNAPSHOT_HEADER {
+    DWORD       magic;          ///< SY_SNAPSHOT_MAGIC
+    DWORD       version;        ///< SY_SNAPSHOT_VERSION
+    DWORD       char_size;      ///< sizeof(TCHAR)
+    DWORD       body_size;      ///< ヘッダに続く本体のバイト数
+    ULONGLONG   body_hash;      ///< 本体の FNV-1a
+    ULONGLONG   xml_size;       ///< 元の XML のバイト数
+    FILETIME    xml_time;       ///< 元の XML の更新時刻
+    ULONGLONG   xml_hash;       ///< 元の XML の FNV-1a
+};
+
+/**
+ * @brief FNV-1a 64bit
+ */
+inline ULONGLONG
+sy_hash64( _In_reads_bytes_( size ) const void* data, _In_ size_t size ) {
+    const BYTE* _p    = reinterpret_cast<const BYTE*>( data );
+    ULONGLONG   _hash = 14695981039346656037ULL;
+    for ( size_t i = 0; i < size; i++ ) {
+        _hash ^= _p[ i ];
+        _hash *= 1099511628211ULL;
+    }
+    return _hash;
+}
+
+/**
+ * @brief Snapshot 書き込み (Serialize visitor)
+ */
+class CsySnapshotWriter {
+    std::vector<BYTE>   m_body;
+public:
+    const std::vector<BYTE>& IsBody( void ) const { return m_body; }
+
+    template <typename T>
+    void operator()( _In_ const T& value ) {
+        static_assert( std::is_pod<T>::value, "snapshot field must be POD" );
+        this->Append( &value, sizeof( T ) );
+    }
+
+    void operator()( _In_ const CAtlString& value ) {
+        DWORD _len = static_cast<DWORD>( value.GetLength() );
+        this->Append( &_len, sizeof( _len ) );
+        this->Append( value.GetString(), _len * sizeof( TCHAR ) );
+    }
+
+    void operator()( _In_ const std::vector<CAtlString>& values ) {
+        DWORD _count = static_cast<DWORD>( values.size() );
+        this->Append( &_count, sizeof( _count ) );
+        for ( auto& v : values ) ( *this )( v );
+    }
+
+private:
+    void Append( _In_reads_bytes_( size ) const void* data, _In_ size_t size ) {
+        const BYTE* _p = reinterpret_cast<const BYTE*>( data );
+        m_body.insert( m_body.end(), _p, _p + size );
+    }
+};
+
+/**
+ * @brief Snapshot 読み込み (Serialize visitor)
+ *        マップしたビューから直接読みます。範囲外を読もうとした場合は IsValid() が FALSE になります。
+ */
+class CsySnapshotReader {
+    const BYTE*     m_p;
+    const BYTE*     m_end;
+    BOOL            m_valid;
+public:
+    CsySnapshotReader( _In_reads_bytes_( size ) const BYTE* data, _In_ size_t size )
+        : m_p( data ), m_end( data + size ), m_valid( TRUE ) { }
+
+    /** 最後まで範囲内で読めたか */
+    BOOL IsValid( void ) const { return m_valid && m_p == m_end; }
+
+    template <typename T>
+    void operator()( _Out_ T& value ) {
+        static_assert( std::is_pod<T>::value, "snapshot field must be POD" );
+        this->Copy( &value, sizeof( T ) );
+    }
+
+    void operator()( _Out_ CAtlString& value ) {
+        DWORD _len = 0;
+        this->Copy( &_len, sizeof( _len ) );
+        if ( !m_valid || _len > static_cast<size_t>( m_end - m_p ) / sizeof( TCHAR ) ) {
+            m_valid = FALSE;
+            value.Empty();
+            return;
+        }
+        value.SetString( reinterpret_cast<LPCTSTR>( m_p ), static_cast<int>( _len ) );
+        m_p += _len * sizeof( TCHAR );
+    }
+
+    void operator()( _Out_ std::vector<CAtlString>& values ) {
+        DWORD _count = 0;
+        this->Copy( &_count, sizeof( _count ) );
+        values.clear();
+        for ( DWORD i = 0; m_valid && i < _count; i++ ) {
+            values.push_back( CAtlString() );
+            ( *this )( values.back() );
+        }
+    }
+
+private:
+    void Copy( _Out_writes_bytes_( size ) void* data, _In_ size_t size ) {
+        if ( !m_valid || static_cast<size_t>( m_end - m_p ) < size ) {
+            m_valid = FALSE;
+            ::ZeroMemory( data, size );
+            return;
+        }
+        ::CopyMemory( data, m_p, size );
+        m_p += size;
+    }
+};
+
+/**
+ * @brief 設定の Serialize（読み書き共通の項目リスト）
+ *        項目を変えたら SY_SNAPSHOT_VERSION を上げること。
+ */
+template <typename A>
+inline void
+sy_serialize( _Inout_ A& ar, _Inout_ CsyProcConfig& c ) {
+    ar( c.m_commandline     );
+    ar( c.m_max_retry       );
+    ar( c.m_name            );
+    ar( c.m_depends_on      );
+    ar( c.m_group           );
+    ar( c.m_stop_signal     );
+    ar( c.m_stop_timeout    );
+    ar( c.m_retry_delay     );
+    ar( c.m_retry_delay_max );
+    ar( c.m_crash_window    );
+    ar( c.m_crash_limit     );
+    ar( c.m_stdout          );
+    ar( c.m_stderr          );
+    ar( c.m_cpu_rate        );
+    ar( c.m_memory_limit    );
+    ar( c.m_priority        );
+    ar( c.m_cpu_set         );
+    ar( c.m_cpu_auto        );
+    ar( c.m_numa_node       );
+    ar( c.m_instances_min   );
+    ar( c.m_instances_max   );
+    ar( c.m_scale_up        );
+    ar( c.m_scale_down      );
+    ar( c.m_scale_cooldown  );
+    ar( c.m_listen          );
+    ar( c.m_surge           );
+    ar( c.m_unavailable     );
+    ar( c.m_ready_wait      );
+    ar( c.m_ready_timeout   );
+    ar( c.m_notify          );
+    ar( c.m_watchdog        );
+    ar( c.m_recycle_memory     );
+    ar( c.m_recycle_memory_for );
+    ar( c.m_recycle_uptime     );
+    ar( c.m_recycle_parallel   );
+}
+
+template <typename A>
+inline void
+sy_serialize( _Inout_ A& ar, _Inout_ CsyServiceConfig& c ) {
+    ar( c.m_service_name );
+    ar( c.m_start_type   );
+    ar( c.m_event_log    );
+    ar( c.m_sample_interval );
+    ar( c.m_trace        );
+    ar( c.m_journal      );
+
+    DWORD _count = static_cast<DWORD>( c.m_processes.size() );
+    ar( _count );
+    c.m_processes.resize( _count );
+    for ( auto& p : c.m_processes ) sy_serialize( ar, p );
+}
+
+/**
+ * @brief XML を検証して snapshot を書き込みます (/compile)
+ *
+ * @param[in] xml_path ... syconfig.xml
+ * @param[in] bin_path ... 出力する snapshot
+ * @param[out] config ... 読み込んだ設定
+ * @retval S_OK ... 成功
+ */
+inline HRESULT
+sy_snapshot_compile( _In_z_ LPCTSTR xml_path, _In_z_ LPCTSTR bin_path, _Out_ CsyServiceConfig& config ) {
+
+    WIN32_FILE_ATTRIBUTE_DATA _attr;
+    if ( !::GetFileAttributesEx( xml_path, GetFileExInfoStandard, &_attr ) )
+        return HRESULT_FROM_WIN32( ::GetLastError() );
+
+    std::string _xml;
+    HRESULT _hr = sy_read_file( xml_path, _xml );
+    if ( FAILED( _hr ) )
+        return _hr;
+    if ( FAILED( _hr = sy_config_parse( _xml.data(), _xml.size(), config ) ) )
+        return _hr;
+
+    std::vector<UINT> _levels;
+    if ( FAILED( _hr = sy_resolve_start_levels( config.m_processes, _levels ) ) )
+        return _hr;
+
+    CsySnapshotWriter _writer;
+    sy_serialize( _writer, config );
+
+    TSY_SNAPSHOT_HEADER _head = { 0 };
+    _head.magic     = SY_SNAPSHOT_MAGIC;
+    _head.version   = SY_SNAPSHOT_VERSION;
+    _head.char_size = sizeof( TCHAR );
+    _head.body_size = static_cast<DWORD>( _writer.IsBody().size() );
+    _head.body_hash = sy_hash64( _writer.IsBody().data(), _writer.IsBody().size() );
+    _head.xml_size  = _xml.size();
+    _head.xml_time  = _attr.ftLastWriteTime;
+    _head.xml_hash  = sy_hash64( _xml.data(), _xml.size() );
+
+    // 一時ファイルに書いてから置き換える（読み込み中の snapshot を壊さない）
+    CAtlString _temp = CAtlString( bin_path ) + TEXT(".tmp");
+    HANDLE _file = ::CreateFile( _temp, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+    if ( _file == INVALID_HANDLE_VALUE )
+        return HRESULT_FROM_WIN32( ::GetLastError() );
+
+    DWORD _written = 0;
+    BOOL  _ok = ::WriteFile( _file, &_head, sizeof( _head ), &_written, NULL ) &&
+                ::WriteFile( _file, _writer.IsBody().data(), _head.body_size, &_written, NULL );
+    if ( !_ok ) _hr = HRESULT_FROM_WIN32( ::GetLastError() );
+    ::CloseHandle( _file );
+
+    if ( SUCCEEDED( _hr ) && !::MoveFileEx( _temp, bin_path, MOVEFILE_REPLACE_EXISTING ) )
+        _hr = HRESULT_FROM_WIN32( ::GetLastError() );
+    if ( FAILED( _hr ) )
+        ::DeleteFile( _temp );
+    return _hr;
+}
+
+/**
+ * @brief snapshot をマップして読み込みます。
+ *
+ *        XML のサイズ/更新時刻が snapshot 作成時と同じならそのまま使います。
+ *        違う場合は XML のハッシュを比べ、同じなら使います（内容が変わっていない）。
+ *
+ * @param[in] xml_path ... syconfig.xml
+ * @param[in] bin_path ... snapshot
+ * @param[out] config ... 読み込んだ設定
+ * @retval S_OK ... snapshot を使った
+ * @retval S_FALSE ... snapshot が無い/古い/壊れている（XML を読むこと）
+ */
+inline HRESULT
+sy_snapshot_load( _In_z_ LPCTSTR xml_path, _In_z_ LPCTSTR bin_path, _Out_ CsyServiceConfig& config ) {
+
+    HANDLE _file = ::CreateFile( bin_path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+                                 NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+    if ( _file == INVALID_HANDLE_VALUE )
+        return S_FALSE;
+
+    HRESULT       _hr   = S_FALSE;
+    LARGE_INTEGER _size = { 0 };
+    HANDLE        _map  = NULL;
+    const BYTE*   _view = NULL;
+
+    if ( ::GetFileSizeEx( _file, &_size ) && _size.QuadPart >= sizeof( TSY_SNAPSHOT_HEADER ) &&
+         _size.QuadPart < 0x7FFFFFFF ) {
+        if ( ( _map = ::CreateFileMapping( _file, NULL, PAGE_READONLY, 0, 0, NULL ) ) != NULL )
+            _view = reinterpret_cast<const BYTE*>( ::MapViewOfFile( _map, FILE_MAP_READ, 0, 0, 0 ) );
+    }
+
+    for ( ;; ) {
+        if ( !_view ) break;
+
+        const TSY_SNAPSHOT_HEADER* _head = reinterpret_cast<const TSY_SNAPSHOT_HEADER*>( _view );
+        const BYTE*                _body = _view + sizeof( TSY_SNAPSHOT_HEADER );
+        if ( _head->magic     != SY_SNAPSHOT_MAGIC   ||
+             _head->version   != SY_SNAPSHOT_VERSION ||
+             _head->char_size != sizeof( TCHAR )     ||
+             _head->body_size != _size.QuadPart - sizeof( TSY_SNAPSHOT_HEADER ) )
+            break;
+
+        // XML が変わっていないか
+        WIN32_FILE_ATTRIBUTE_DATA _attr;
+        if ( !::GetFileAttributesEx( xml_path, GetFileExInfoStandard, &_attr ) )
+            break;
+
+        ULARGE_INTEGER _xml_size;
+        _xml_size.LowPart  = _attr.nFileSizeLow;
+        _xml_size.HighPart = _attr.nFileSizeHigh;
+        if ( _xml_size.QuadPart != _head->xml_size )
+            break;
+
+        if ( ::CompareFileTime( &_attr.ftLastWriteTime, &_head->xml_time ) != 0 ) {
+            std::string _xml;
+            if ( FAILED( sy_read_file( xml_path, _xml ) ) ||
+                 sy_hash64( _xml.data(), _xml.size() ) != _head->xml_hash )
+                break;
+        }
+
+        if ( sy_hash64( _body, _head->body_size ) != _head->body_hash )
+            break;
+
+        CsySnapshotReader _reader( _body, _head->body_size );
+        sy_serialize( _reader, config );
+        if ( _reader.IsValid() )
+            _hr = S_OK;
+        break;
+    }
+
+    if ( _view ) ::UnmapViewOfFile( _view );
+    if ( _map  ) ::CloseHandle( _map );
+    ::CloseHandle( _file );
+
+    if ( _hr != S_OK ) config = CsyServiceConfig();
+    return _hr;
+}
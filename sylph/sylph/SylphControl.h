@@ -0,0 +1,836 @@
+﻿/**
+ * @file     SylphControl.h
+ * @brief    Local control endpoint (named pipe) and its client
+ * @author   M.Horigome
+ * @version  1.0.0.0000
+ * @date     2026-10-17
+ *
+ * https://github.com/horigome/sylph
+ */
+#pragma once
+#include "stdafx.h"
+#include "SylphProcessManager.h"
+#include "SylphConfigSnapshot.h"
+
+/**
+ * Control 定数
+ *   SY_CTL_VERSION は TSY_CTL_HEADER / payload の書式を変えたら上げること。
+ */
+enum {
+    SY_CTL_MAGIC            = 0x4c435953,   ///< 'SYCL'
+    SY_CTL_VERSION          = 1,
+    SY_CTL_REQUEST_SIZE     = 4096,         ///< 要求メッセージの上限(bytes)
+    SY_CTL_REPLY_BUFFER     = 65536,        ///< パイプの送信バッファ(bytes)
+    SY_CTL_CONNECT_MS       = 5000,         ///< client の接続待ち(ms)
+    SY_CTL_QUEUE_LIMIT      = 1024,         ///< 購読者毎の未送信 event の上限（超えたら切断）
+};
+
+/** 制御コマンド */
+enum SY_CTL_COMMAND {
+    SY_CTL_LIST             = 1,    ///< 全 entry の状態                 → TSY_CTL_PROCESS のリスト
+    SY_CTL_STATUS           = 2,    ///< entry の状態 (entry名)          → TSY_CTL_PROCESS のリスト
+    SY_CTL_START            = 3,    ///< entry を起動 (entry名)
+    SY_CTL_STOP             = 4,    ///< entry を停止 (entry名)
+    SY_CTL_RESTART          = 5,    ///< entry を rolling restart (entry名)
+    SY_CTL_SUBSCRIBE        = 6,    ///< 以降の状態変化を受け取る        → TSY_CTL_PROCESS のリスト（現在の状態）
+    SY_CTL_TRACE            = 7,    ///< trace を書き出す (S_FALSE.. trace 無効)
+    SY_CTL_DETACH           = 8,    ///< 停止時に子プロセスを停止せずに残す (<journal> が必要)
+    SY_CTL_EVENT            = 0x80, ///< (server → client) 状態変化      → TSY_CTL_PROCESS
+};
+
+/**
+ * @brief メッセージヘッダ。要求/応答/event は全て 1メッセージ = ヘッダ + payload です。
+ *        payload は snapshot と同じ書式 (CsySnapshotWriter) です。
+ */
+struct TSY_CTL_HEADER {
+    DWORD       magic;          ///< SY_CTL_MAGIC
+    WORD        version;        ///< SY_CTL_VERSION
+    WORD        command;        ///< SY_CTL_COMMAND
+    DWORD       sequence;       ///< 要求の通し番号（応答は同じ値。event は 0）
+    HRESULT     status;         ///< 応答の結果
+    DWORD       length;         ///< payload のバイト数
+};
+
+/**
+ * @brief プロセスの状態（LIST / STATUS / EVENT）
+ *        プロセスの無い entry (停止中) は pid 0, state SY_PROC_STOPPED で返します。
+ */
+struct TSY_CTL_PROCESS {
+    CAtlString  name;           ///< entry名
+    UINT        replica;        ///< replica 番号
+    DWORD       pid;
+    DWORD       state;          ///< SY_PROC_STATE
+    DWORD       exit_code;      ///< 最後の終了コード
+    UINT        restart_count;  ///< 再起動の累計
+    ULONGLONG   uptime_ms;      ///< 起動からの時間(ms)
+    BOOL        ready;
+    double      cpu_percent;    ///< 最新の採取結果 (全CPU = 100%, event では 0)
+    ULONGLONG   working_set;    ///< 最新の採取結果 (bytes, event では 0)
+    CAtlString  status;         ///< 最後に受信した STATUS (notify)
+
+    TSY_CTL_PROCESS( void )
+        : replica( 0 ), pid( 0 ), state( SY_PROC_STOPPED ), exit_code( 0 ), restart_count( 0 ),
+          uptime_ms( 0 ), ready( FALSE ), cpu_percent( 0.0 ), working_set( 0 ) { }
+};
+
+template <typename A>
+inline void
+sy_serialize( _Inout_ A& ar, _Inout_ TSY_CTL_PROCESS& r ) {
+    ar( r.name          );
+    ar( r.replica       );
+    ar( r.pid           );
+    ar( r.state         );
+    ar( r.exit_code     );
+    ar( r.restart_count );
+    ar( r.uptime_ms     );
+    ar( r.ready         );
+    ar( r.cpu_percent   );
+    ar( r.working_set   );
+    ar( r.status        );
+}
+
+/**
+ * @brief 制御パイプ名 (\\.\pipe\sylph-control-<service name>)
+ */
+inline CAtlString
+sy_ctl_pipe_name( _In_z_ LPCTSTR service_name ) {
+    CAtlString _name;
+    _name.Format( TEXT("\\\\.\\pipe\\sylph-control-%s"), service_name );
+    return _name;
+}
+
+/**
+ * @brief 状態の表示名
+ */
+inline LPCTSTR
+sy_proc_state_name( _In_ DWORD state ) {
+    switch ( state ) {
+    case SY_PROC_STOPPED:   return TEXT("stopped");
+    case SY_PROC_RUNNING:   return TEXT("running");
+    case SY_PROC_EXITED:    return TEXT("exited");
+    case SY_PROC_BACKOFF:   return TEXT("backoff");
+    case SY_PROC_PARKED:    return TEXT("parked");
+    default:                return TEXT("unknown");
+    }
+}
+
+/**
+ * @brief プロセスの状態を複写します。
+ *
+ * @param[in] p ... プロセス
+ * @param[in] now ... 現在時刻 (GetTickCount64)
+ * @param[in] snap ... リソースの採取結果 (NULL.. 無し)
+ */
+inline TSY_CTL_PROCESS
+sy_ctl_process( _In_     const CsyProcess&           p,
+                _In_     ULONGLONG                   now,
+                _In_opt_ const CsyResourceSnapshot*  snap ) {
+    TSY_CTL_PROCESS _r;
+    _r.name          = p.IsConfig().m_name;
+    _r.replica       = p.IsReplica();
+    _r.pid           = p.IsProcessID();
+    _r.state         = p.IsState();
+    _r.exit_code     = p.IsExitCode();
+    _r.restart_count = p.IsRestartCount();
+    _r.uptime_ms     = p.IsState() == SY_PROC_RUNNING ? now - p.IsStartTick() : 0;
+    _r.ready         = p.IsReady( now );
+    _r.status        = p.IsStatus();
+    const TSY_PROC_SAMPLE* _s = snap ? snap->Find( p.IsKey() ) : NULL;
+    if ( _s ) {
+        _r.cpu_percent = _s->cpu_percent;
+        _r.working_set = _s->working_set;
+    }
+    return _r;
+}
+
+/**
+ * @brief メッセージを組み立てます。
+ */
+inline void
+sy_ctl_message( _In_  WORD                      command,
+                _In_  DWORD                     sequence,
+                _In_  HRESULT                   status,
+                _In_  const std::vector<BYTE>&  payload,
+                _Out_ std::vector<BYTE>&        message ) {
+    TSY_CTL_HEADER _head = { SY_CTL_MAGIC, SY_CTL_VERSION, command, sequence, status,
+                             static_cast<DWORD>( payload.size() ) };
+    const BYTE* _p = reinterpret_cast<const BYTE*>( &_head );
+    message.assign( _p, _p + sizeof( _head ) );
+    message.insert( message.end(), payload.begin(), payload.end() );
+}
+
+/**
+ * @brief TSY_CTL_PROCESS のリストを読みます。
+ * @retval FALSE ... 書式が正しくない
+ */
+inline BOOL
+sy_ctl_read_processes( _In_  const std::vector<BYTE>&       payload,
+                       _Out_ std::vector<TSY_CTL_PROCESS>&  processes ) {
+    processes.clear();
+    if ( payload.empty() )
+        return FALSE;
+
+    CsySnapshotReader _reader( payload.data(), payload.size() );
+    DWORD _count = 0;
+    _reader( _count );
+    if ( _count > payload.size() )
+        return FALSE;
+    processes.resize( _count );
+    for ( auto& r : processes ) sy_serialize( _reader, r );
+    return _reader.IsValid();
+}
+
+/**
+ * @brief 制御エンドポイント（名前付きパイプ サーバ）
+ *
+ *        要求/応答は1メッセージずつのバイナリ (TSY_CTL_HEADER + payload) です。
+ *        LIST / STATUS / DETACH はメモリ上の状態から制御スレッドで直接応答し、
+ *        起動/停止を伴う START / STOP / RESTART と、ファイルを書く TRACE はスレッドプールで実行して、完了後に応答します。
+ *        SUBSCRIBE した接続には、以降のプロセスの状態変化を SY_CTL_EVENT で送り続けます。
+ *        パイプは既定のセキュリティ（書き込みは管理者と SYSTEM のみ）で作成し、リモートからの接続は拒否します。
+ */
+class CsyControlServer : public CsyThread, public IsyProcessObserver {
+
+    /** Completion key */
+    enum {
+        KEY_QUIT    = 0,
+        KEY_IO      = 1,    ///< パイプの I/O 完了
+        KEY_EVENT   = 2,    ///< m_events に event がある
+        KEY_REPLY   = 3,    ///< スレッドプールの処理が完了した (TREPLY)
+    };
+
+    struct TCLIENT;
+
+    /** パイプの I/O */
+    struct TOP {
+        OVERLAPPED  ov;                     ///< 先頭に置くこと
+        TCLIENT*    client;
+        BOOL        pending;                ///< 完了待ち
+    };
+
+    /** 接続 */
+    struct TCLIENT {
+        TOP                 read;           ///< 接続待ち / 受信
+        TOP                 write;          ///< 送信
+        HANDLE              pipe;
+        DWORD               id;
+        BOOL                connected;
+        BOOL                closing;
+        BOOL                subscribed;
+        std::vector< std::vector<BYTE> > queue;     ///< 送信待ち (先頭が送信中)
+        BYTE                buffer[ SY_CTL_REQUEST_SIZE ];
+    };
+
+    /** スレッドプールで実行する要求 */
+    struct TWORK {
+        CsyControlServer*   self;
+        DWORD               client;
+        DWORD               sequence;
+        WORD                command;
+        CAtlString          name;
+    };
+
+    /** スレッドプールの処理結果 */
+    struct TREPLY {
+        OVERLAPPED          ov;             ///< 先頭に置くこと（未使用）
+        DWORD               client;
+        std::vector<BYTE>   message;
+    };
+
+    CsylphProcessManager&           m_proc;
+    HANDLE                          m_iocp;
+    CAtlString                      m_name;
+    std::map<DWORD, TCLIENT*>       m_clients;      ///< 制御スレッドのみ
+    DWORD                           m_next_id;      ///< 制御スレッドのみ
+    volatile LONG                   m_subscribers;  ///< 購読中の接続数
+    volatile LONG                   m_working;      ///< 実行中の TWORK
+    CComAutoCriticalSection         m_event_lock;   ///< m_events
+    std::vector<TSY_CTL_PROCESS>    m_events;
+public:
+    explicit CsyControlServer( _In_ CsylphProcessManager& proc )
+        : m_proc( proc ), m_iocp( NULL ), m_next_id( 0 ), m_subscribers( 0 ), m_working( 0 ) { }
+
+    /** destructor */
+    virtual ~CsyControlServer( void ) {
+        this->Shutdown();
+    }
+
+    /**
+     * @brief 待ち受けを開始します。
+     * @param[in] service_name ... サービス名（パイプ名に使います）
+     */
+    HRESULT Startup( _In_z_ LPCTSTR service_name ) {
+        if ( m_iocp )
+            return S_OK;
+
+        m_name = sy_ctl_pipe_name( service_name );
+        m_iocp = ::CreateIoCompletionPort( INVALID_HANDLE_VALUE, NULL, 0, 1 );
+        if ( !m_iocp )
+            return HRESULT_FROM_WIN32( ::GetLastError() );
+
+        HRESULT _hr = this->Listen( TRUE );
+        if ( SUCCEEDED( _hr ) )
+            _hr = CsyThread::Begin( NULL );
+        if ( FAILED( _hr ) ) {
+            _SLOG( TEXT("! Control endpoint start failed. in %08x [%s]\n"), _hr, m_name );
+            this->CloseAll();
+            ::CloseHandle( m_iocp );
+            m_iocp = NULL;
+            return _hr;
+        }
+
+        m_proc.SetObserver( this );
+        _SLOG( TEXT("==> Control endpoint : %s\n"), m_name );
+        return S_OK;
+    }
+
+    /**
+     * @brief 待ち受けを終了します。実行中の START / STOP / RESTART は完了まで待ちます。
+     *        （CsylphProcessManager を停止する前に呼ぶこと）
+     */
+    void Shutdown( void ) {
+        if ( !m_iocp )
+            return;
+
+        m_proc.SetObserver( NULL );
+        while ( m_working )
+            ::Sleep( SY_READY_POLL_MS );
+
+        ::PostQueuedCompletionStatus( m_iocp, 0, KEY_QUIT, NULL );
+        CsyThread::Join();
+        this->CloseAll();
+
+        // 取り出されなかった結果を破棄
+        for ( ;; ) {
+            DWORD        _bytes = 0;
+            ULONG_PTR    _key   = 0;
+            LPOVERLAPPED _ov    = NULL;
+            if ( !::GetQueuedCompletionStatus( m_iocp, &_bytes, &_key, &_ov, 0 ) && !_ov )
+                break;
+            if ( _key == KEY_REPLY ) delete reinterpret_cast<TREPLY*>( _ov );
+        }
+
+        ::CloseHandle( m_iocp );
+        m_iocp = NULL;
+    }
+
+    /**
+     * @brief プロセスの状態変化。購読者が居れば制御スレッドへ渡します。
+     */
+    virtual void OnProcessEvent( _In_ const CsyProcess& process ) override {
+        if ( !m_subscribers )
+            return;
+
+        TSY_CTL_PROCESS _r = sy_ctl_process( process, ::GetTickCount64(), NULL );
+        BOOL _wake = FALSE;
+        {
+            CComCritSecLock<CComAutoCriticalSection> _lock( m_event_lock );
+            _wake = m_events.empty();
+            m_events.push_back( _r );
+        }
+        if ( _wake )
+            ::PostQueuedCompletionStatus( m_iocp, 0, KEY_EVENT, NULL );
+    }
+
+protected:
+    /**
+     * @brief 制御スレッド。
+     */
+    virtual DWORD run( _In_ void* /*argment*/ = NULL ) override {
+        SY_TRACE.SetThreadName( "control" );
+        for ( ;; ) {
+            DWORD        _bytes = 0;
+            ULONG_PTR    _key   = 0;
+            LPOVERLAPPED _ov    = NULL;
+
+            BOOL  _ret = ::GetQueuedCompletionStatus( m_iocp, &_bytes, &_key, &_ov, INFINITE );
+            DWORD _err = _ret ? ERROR_SUCCESS : ::GetLastError();
+            if ( !_ret && !_ov )
+                return 1;   // port closed.
+
+            switch ( _key ) {
+            case KEY_QUIT:
+                return 0;
+            case KEY_IO:
+                this->OnCompletion( reinterpret_cast<TOP*>( _ov ), _bytes, _err );
+                break;
+            case KEY_EVENT:
+                this->OnEvents();
+                break;
+            case KEY_REPLY: {
+                std::unique_ptr<TREPLY> _reply( reinterpret_cast<TREPLY*>( _ov ) );
+                auto _it = m_clients.find( _reply->client );
+                if ( _it != m_clients.end() ) {
+                    this->Send( _it->second, _reply->message );
+                    this->Reap( _it->second );
+                }
+                }
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+private:
+    /** 接続待ちのインスタンスを1つ作ります */
+    HRESULT Listen( _In_ BOOL first ) {
+        TCLIENT* _c = new TCLIENT;
+        ::ZeroMemory( &_c->read,  sizeof( _c->read  ) );
+        ::ZeroMemory( &_c->write, sizeof( _c->write ) );
+        _c->read.client  = _c;
+        _c->write.client = _c;
+        _c->id         = ++m_next_id;
+        _c->connected  = FALSE;
+        _c->closing    = FALSE;
+        _c->subscribed = FALSE;
+        _c->pipe = ::CreateNamedPipe( m_name,
+                        PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | ( first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0 ),
+                        PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                        PIPE_UNLIMITED_INSTANCES, SY_CTL_REPLY_BUFFER, SY_CTL_REQUEST_SIZE, 0, NULL );
+        if ( _c->pipe == INVALID_HANDLE_VALUE ) {
+            HRESULT _hr = HRESULT_FROM_WIN32( ::GetLastError() );
+            delete _c;
+            return _hr;
+        }
+        if ( !::CreateIoCompletionPort( _c->pipe, m_iocp, KEY_IO, 0 ) ) {
+            HRESULT _hr = HRESULT_FROM_WIN32( ::GetLastError() );
+            ::CloseHandle( _c->pipe );
+            delete _c;
+            return _hr;
+        }
+        m_clients[ _c->id ] = _c;
+
+        _c->read.pending = TRUE;
+        if ( !::ConnectNamedPipe( _c->pipe, &_c->read.ov ) ) {
+            DWORD _err = ::GetLastError();
+            if ( _err == ERROR_PIPE_CONNECTED )         // 既に接続済み（完了通知は来ない）
+                ::PostQueuedCompletionStatus( m_iocp, 0, KEY_IO, &_c->read.ov );
+            else if ( _err != ERROR_IO_PENDING ) {
+                _c->read.pending = FALSE;
+                this->Close( _c );
+                this->Reap( _c );
+                return HRESULT_FROM_WIN32( _err );
+            }
+        }
+        return S_OK;
+    }
+
+    /** I/O 完了 */
+    void OnCompletion( _In_ TOP* op, _In_ DWORD bytes, _In_ DWORD error ) {
+        TCLIENT* _c = op->client;
+        op->pending = FALSE;
+        if ( !_c->closing )
+            this->OnIo( _c, op, bytes, error );
+        this->Reap( _c );
+    }
+
+    /** I/O 完了（接続 / 受信 / 送信） */
+    void OnIo( _In_ TCLIENT* c, _In_ TOP* op, _In_ DWORD bytes, _In_ DWORD error ) {
+        if ( op == &c->write ) {
+            c->queue.erase( c->queue.begin() );
+            if ( error != ERROR_SUCCESS )
+                this->Close( c );
+            else
+                this->Flush( c );
+            return;
+        }
+
+        if ( !c->connected ) {
+            // 接続完了。次の接続の待ち受けを作ってから受信を始める
+            this->Listen( FALSE );
+            if ( error != ERROR_SUCCESS && error != ERROR_PIPE_CONNECTED ) {
+                this->Close( c );
+                return;
+            }
+            c->connected = TRUE;
+            this->Read( c );
+            return;
+        }
+
+        if ( error != ERROR_SUCCESS ) {     // 切断 / 長すぎる要求
+            this->Close( c );
+            return;
+        }
+        this->Dispatch( c, bytes );
+        if ( !c->closing )
+            this->Read( c );
+    }
+
+    /** 要求を処理します */
+    void Dispatch( _In_ TCLIENT* c, _In_ DWORD bytes ) {
+        TSY_CTL_HEADER _head;
+        if ( bytes < sizeof( _head ) ) {
+            this->Close( c );
+            return;
+        }
+        ::CopyMemory( &_head, c->buffer, sizeof( _head ) );
+        if ( _head.magic != SY_CTL_MAGIC || _head.length != bytes - sizeof( _head ) ) {
+            this->Close( c );
+            return;
+        }
+
+        std::vector<BYTE> _payload, _message;
+        if ( _head.version != SY_CTL_VERSION ) {
+            sy_ctl_message( _head.command, _head.sequence, HRESULT_FROM_WIN32( ERROR_REVISION_MISMATCH ), _payload, _message );
+            this->Send( c, _message );
+            return;
+        }
+
+        // entry名 (STATUS / START / STOP / RESTART)
+        CAtlString _name;
+        if ( _head.length ) {
+            CsySnapshotReader _reader( c->buffer + sizeof( _head ), _head.length );
+            _reader( _name );
+            if ( !_reader.IsValid() ) {
+                sy_ctl_message( _head.command, _head.sequence, E_INVALIDARG, _payload, _message );
+                this->Send( c, _message );
+                return;
+            }
+        }
+
+        HRESULT _hr = S_OK;
+        switch ( _head.command ) {
+        case SY_CTL_SUBSCRIBE:
+            if ( !c->subscribed ) {
+                c->subscribed = TRUE;
+                ::InterlockedIncrement( &m_subscribers );
+            }
+            // through (現在の状態を返す)
+        case SY_CTL_LIST:
+            _name.Empty();
+            // through
+        case SY_CTL_STATUS:
+            _hr = this->Query( _name, _payload );
+            break;
+
+        case SY_CTL_DETACH:
+            _hr = m_proc.Detach();
+            break;
+
+        case SY_CTL_START:
+        case SY_CTL_STOP:
+        case SY_CTL_RESTART:
+        case SY_CTL_TRACE:
+            _hr = this->Submit( c, _head, _name );
+            if ( SUCCEEDED( _hr ) )
+                return;     // 完了後に応答
+            break;
+
+        default:
+            _hr = E_NOTIMPL;
+            break;
+        }
+        sy_ctl_message( _head.command, _head.sequence, _hr, _payload, _message );
+        this->Send( c, _message );
+    }
+
+    /**
+     * @brief 状態を複写します。（supervisor のロックを短時間取るだけで、プロセスには問い合わせません）
+     * @param[in] name ... entry名 (空.. 全て)
+     */
+    HRESULT Query( _In_ const CAtlString& name, _Out_ std::vector<BYTE>& payload ) {
+        ULONGLONG          _now  = ::GetTickCount64();
+        SYRESOURCESNAPSHOT _snap = m_proc.GetResourceSnapshot();
+
+        std::vector<TSY_CTL_PROCESS> _list;
+        std::set<CAtlString>         _found;
+        m_proc.ForEach( [&]( CsyProcess* p ) {
+            if ( !name.IsEmpty() && p->IsConfig().m_name != name )
+                return;
+            _list.push_back( sy_ctl_process( *p, _now, _snap.get() ) );
+            _found.insert( p->IsConfig().m_name );
+        } );
+
+        // プロセスの無い entry（停止中）
+        BOOL _known = FALSE;
+        m_proc.ForEachConfig( [&]( const CsyProcConfig& c ) {
+            if ( !name.IsEmpty() && c.m_name != name )
+                return;
+            _known = TRUE;
+            if ( _found.count( c.m_name ) )
+                return;
+            TSY_CTL_PROCESS _r;
+            _r.name = c.m_name;
+            _list.push_back( _r );
+        } );
+        if ( !name.IsEmpty() && !_known && _found.empty() )
+            return E_INVALIDARG;
+
+        std::sort( _list.begin(), _list.end(), []( const TSY_CTL_PROCESS& a, const TSY_CTL_PROCESS& b ) {
+            return a.name != b.name ? a.name < b.name : a.replica < b.replica;
+        } );
+
+        CsySnapshotWriter _writer;
+        DWORD _count = static_cast<DWORD>( _list.size() );
+        _writer( _count );
+        for ( auto& r : _list ) sy_serialize( _writer, r );
+        payload = _writer.IsBody();
+        return S_OK;
+    }
+
+    /** START / STOP / RESTART / TRACE をスレッドプールで実行します */
+    HRESULT Submit( _In_ TCLIENT* c, _In_ const TSY_CTL_HEADER& head, _In_ const CAtlString& name ) {
+        if ( name.IsEmpty() && head.command != SY_CTL_TRACE )
+            return E_INVALIDARG;
+
+        TWORK* _work = new TWORK;
+        _work->self     = this;
+        _work->client   = c->id;
+        _work->sequence = head.sequence;
+        _work->command  = head.command;
+        _work->name     = name;
+
+        ::InterlockedIncrement( &m_working );
+        if ( !::TrySubmitThreadpoolCallback( &CsyControlServer::OnWork, _work, NULL ) ) {
+            HRESULT _hr = HRESULT_FROM_WIN32( ::GetLastError() );
+            ::InterlockedDecrement( &m_working );
+            delete _work;
+            return _hr;
+        }
+        return S_OK;
+    }
+
+    /** スレッドプールの処理 */
+    static void CALLBACK OnWork( _Inout_ PTP_CALLBACK_INSTANCE, _Inout_opt_ PVOID context ) {
+        std::unique_ptr<TWORK> _work( reinterpret_cast<TWORK*>( context ) );
+        CsyControlServer*      _this = _work->self;
+
+        HRESULT _hr = E_NOTIMPL;
+        switch ( _work->command ) {
+        case SY_CTL_START:   _hr = _this->m_proc.StartEntry    ( _work->name ); break;
+        case SY_CTL_STOP:    _hr = _this->m_proc.StopEntry     ( _work->name ); break;
+        case SY_CTL_RESTART: _hr = _this->m_proc.RollingRestart( _work->name ); break;
+        case SY_CTL_TRACE:   _hr = SY_TRACE.Dump();                           break;
+        default:             break;
+        }
+        _SLOG( TEXT("==> Control command %d : %s (%08x)\n"), _work->command, _work->name, _hr );
+
+        TREPLY* _reply = new TREPLY;
+        ::ZeroMemory( &_reply->ov, sizeof( _reply->ov ) );
+        _reply->client = _work->client;
+        sy_ctl_message( _work->command, _work->sequence, _hr, std::vector<BYTE>(), _reply->message );
+        ::PostQueuedCompletionStatus( _this->m_iocp, 0, KEY_REPLY, &_reply->ov );
+        ::InterlockedDecrement( &_this->m_working );
+    }
+
+    /** 状態変化を購読者へ送ります */
+    void OnEvents( void ) {
+        std::vector<TSY_CTL_PROCESS> _events;
+        {
+            CComCritSecLock<CComAutoCriticalSection> _lock( m_event_lock );
+            _events.swap( m_events );
+        }
+
+        std::vector<TCLIENT*> _subscribers;
+        for ( auto& c : m_clients )
+            if ( c.second->subscribed && !c.second->closing ) _subscribers.push_back( c.second );
+
+        for ( auto& e : _events ) {
+            CsySnapshotWriter _writer;
+            sy_serialize( _writer, e );
+
+            std::vector<BYTE> _message;
+            sy_ctl_message( SY_CTL_EVENT, 0, S_OK, _writer.IsBody(), _message );
+            for ( auto c : _subscribers ) {
+                if ( c->closing )
+                    continue;
+                if ( c->queue.size() >= SY_CTL_QUEUE_LIMIT ) {
+                    _SLOG( TEXT("! Control subscriber too slow. disconnected. (%d events queued)\n"),
+                            static_cast<int>( c->queue.size() ) );
+                    this->Close( c );
+                    continue;
+                }
+                this->Send( c, _message );
+            }
+        }
+        for ( auto c : _subscribers )
+            this->Reap( c );
+    }
+
+    /** 次の要求の受信を開始します */
+    void Read( _In_ TCLIENT* c ) {
+        ::ZeroMemory( &c->read.ov, sizeof( c->read.ov ) );
+        c->read.pending = TRUE;
+        if ( !::ReadFile( c->pipe, c->buffer, sizeof( c->buffer ), NULL, &c->read.ov ) ) {
+            DWORD _err = ::GetLastError();
+            if ( _err != ERROR_IO_PENDING && _err != ERROR_MORE_DATA ) {
+                c->read.pending = FALSE;
+                this->Close( c );
+            }
+        }
+    }
+
+    /** 送信待ちに積みます */
+    void Send( _In_ TCLIENT* c, _In_ const std::vector<BYTE>& message ) {
+        if ( c->closing )
+            return;
+        c->queue.push_back( message );
+        if ( !c->write.pending )
+            this->Flush( c );
+    }
+
+    /** 送信待ちの先頭を送信します */
+    void Flush( _In_ TCLIENT* c ) {
+        if ( c->queue.empty() || c->closing )
+            return;
+
+        auto& _message = c->queue.front();
+        ::ZeroMemory( &c->write.ov, sizeof( c->write.ov ) );
+        c->write.pending = TRUE;
+        if ( !::WriteFile( c->pipe, _message.data(), static_cast<DWORD>( _message.size() ), NULL, &c->write.ov ) ) {
+            if ( ::GetLastError() != ERROR_IO_PENDING ) {
+                c->write.pending = FALSE;
+                this->Close( c );
+            }
+        }
+    }
+
+    /** 接続を閉じます。（破棄は Reap で、完了待ちの I/O が全て完了してから行います） */
+    void Close( _In_ TCLIENT* c ) {
+        if ( c->closing )
+            return;
+        c->closing = TRUE;
+        if ( c->subscribed ) ::InterlockedDecrement( &m_subscribers );
+        ::CancelIoEx( c->pipe, NULL );
+    }
+
+    /** 閉じた接続の I/O が全て完了していれば破棄します */
+    void Reap( _In_ TCLIENT* c ) {
+        if ( !c->closing || c->read.pending || c->write.pending )
+            return;
+        ::CloseHandle( c->pipe );
+        m_clients.erase( c->id );
+        delete c;
+    }
+
+    /** 全ての接続を閉じます。（制御スレッドの終了後に呼ぶこと） */
+    void CloseAll( void ) {
+        for ( auto& c : m_clients ) {
+            DWORD _bytes = 0;
+            ::CancelIoEx( c.second->pipe, NULL );
+            if ( c.second->read.pending  ) ::GetOverlappedResult( c.second->pipe, &c.second->read.ov,  &_bytes, TRUE );
+            if ( c.second->write.pending ) ::GetOverlappedResult( c.second->pipe, &c.second->write.ov, &_bytes, TRUE );
+            if ( c.second->subscribed && !c.second->closing ) ::InterlockedDecrement( &m_subscribers );
+            ::CloseHandle( c.second->pipe );
+            delete c.second;
+        }
+        m_clients.clear();
+    }
+
+    CsyControlServer( const CsyControlServer& );
+    CsyControlServer& operator=( const CsyControlServer& );
+};
+
+/**
+ * @brief 制御エンドポイントのクライアント (同期 I/O)
+ */
+class CsyControlClient {
+    HANDLE  m_pipe;
+    DWORD   m_sequence;
+public:
+    CsyControlClient( void ) : m_pipe( INVALID_HANDLE_VALUE ), m_sequence( 0 ) { }
+
+    virtual ~CsyControlClient( void ) {
+        if ( m_pipe != INVALID_HANDLE_VALUE ) ::CloseHandle( m_pipe );
+    }
+
+    /**
+     * @brief 接続します。
+     * @param[in] service_name ... サービス名
+     * @param[in] timeout_ms ... 全てのインスタンスが使用中の場合の待ち時間(ms)
+     */
+    HRESULT Connect( _In_z_ LPCTSTR service_name, _In_ DWORD timeout_ms = SY_CTL_CONNECT_MS ) {
+        CAtlString _name     = sy_ctl_pipe_name( service_name );
+        ULONGLONG  _deadline = ::GetTickCount64() + timeout_ms;
+        for ( ;; ) {
+            m_pipe = ::CreateFile( _name, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL );
+            if ( m_pipe != INVALID_HANDLE_VALUE )
+                break;
+
+            DWORD     _err = ::GetLastError();
+            ULONGLONG _now = ::GetTickCount64();
+            if ( _err != ERROR_PIPE_BUSY || _now >= _deadline )
+                return HRESULT_FROM_WIN32( _err );
+            ::WaitNamedPipe( _name, static_cast<DWORD>( _deadline - _now ) );
+        }
+
+        DWORD _mode = PIPE_READMODE_MESSAGE;
+        if ( !::SetNamedPipeHandleState( m_pipe, &_mode, NULL, NULL ) )
+            return HRESULT_FROM_WIN32( ::GetLastError() );
+        return S_OK;
+    }
+
+    /**
+     * @brief 要求を送り、応答を受け取ります。
+     *
+     * @param[in] command ... SY_CTL_COMMAND
+     * @param[in] name ... entry名 (空.. 無し)
+     * @param[out] status ... 応答の結果
+     * @param[out] payload ... 応答の payload
+     */
+    HRESULT Request( _In_  WORD                 command,
+                     _In_  const CAtlString&    name,
+                     _Out_ HRESULT&             status,
+                     _Out_ std::vector<BYTE>&   payload ) {
+        status = E_FAIL;
+        payload.clear();
+
+        CsySnapshotWriter _writer;
+        if ( !name.IsEmpty() ) _writer( name );
+
+        std::vector<BYTE> _message;
+        DWORD _sequence = ++m_sequence;
+        sy_ctl_message( command, _sequence, S_OK, _writer.IsBody(), _message );
+        if ( _message.size() > SY_CTL_REQUEST_SIZE )
+            return E_INVALIDARG;
+
+        DWORD _written = 0;
+        if ( !::WriteFile( m_pipe, _message.data(), static_cast<DWORD>( _message.size() ), &_written, NULL ) )
+            return HRESULT_FROM_WIN32( ::GetLastError() );
+
+        // 応答まで（途中の event は読み捨てる）
+        for ( ;; ) {
+            TSY_CTL_HEADER _head;
+            HRESULT _hr = this->Receive( _head, payload );
+            if ( FAILED( _hr ) )
+                return _hr;
+            if ( _head.command == command && _head.sequence == _sequence ) {
+                status = _head.status;
+                return S_OK;
+            }
+        }
+    }
+
+    /**
+     * @brief メッセージを1件受信します。(SUBSCRIBE 後の event)
+     */
+    HRESULT Receive( _Out_ TSY_CTL_HEADER& head, _Out_ std::vector<BYTE>& payload ) {
+        std::vector<BYTE> _message;
+        BYTE  _buffer[ SY_CTL_REQUEST_SIZE ];
+        for ( ;; ) {
+            DWORD _read = 0;
+            BOOL  _ret  = ::ReadFile( m_pipe, _buffer, sizeof( _buffer ), &_read, NULL );
+            _message.insert( _message.end(), _buffer, _buffer + _read );
+            if ( _ret )
+                break;
+            DWORD _err = ::GetLastError();
+            if ( _err != ERROR_MORE_DATA )
+                return HRESULT_FROM_WIN32( _err );
+        }
+
+        if ( _message.size() < sizeof( head ) )
+            return HRESULT_FROM_WIN32( ERROR_INVALID_DATA );
+        ::CopyMemory( &head, _message.data(), sizeof( head ) );
+        if ( head.magic != SY_CTL_MAGIC || head.length != _message.size() - sizeof( head ) )
+            return HRESULT_FROM_WIN32( ERROR_INVALID_DATA );
+        if ( head.version != SY_CTL_VERSION )
+            return HRESULT_FROM_WIN32( ERROR_REVISION_MISMATCH );
+        payload.assign( _message.begin() + sizeof( head ), _message.end() );
+        return S_OK;
+    }
+
+private:
+    CsyControlClient( const CsyControlClient& );
+    CsyControlClient& operator=( const CsyControlClient& );
+};
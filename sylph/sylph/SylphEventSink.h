@@ -0,0 +1,327 @@
+﻿/**
+ * @file     SylphEventSink.h
+ * @brief    Asynchronous, coalescing event sink
+ * @author   M.Horigome
+ * @version  1.0.0.0000
+ * @date     2026-10-17
+ *
+ * https://github.com/horigome/sylph
+ */
+#pragma once
+#include "stdafx.h"
+
+/** Event sink 定数 */
+enum {
+    SY_EVENT_MSG_SIZE       = 31839,    ///< ReportEvent の1文字列の上限（文字数）
+    SY_EVENT_COALESCE_MS    = 10000,    ///< 同一メッセージをまとめる期間(ms)
+    SY_EVENT_FLUSH_MS       = 1000,     ///< 出力スレッドの起床間隔(ms)
+};
+
+/**
+ * @brief Event 出力先インタフェース。出力スレッドからのみ呼ばれます。
+ */
+class IsyEventBackend {
+public:
+    virtual ~IsyEventBackend( void ) { }
+
+    /** 1件出力します */
+    virtual void Report( _In_ WORD type, _In_z_ LPCTSTR text ) = 0;
+
+    /** バッチの終わりに呼ばれます */
+    virtual void Flush( void ) { }
+};
+
+/**
+ * @brief Windows イベントログ出力。イベントソースは開いたままにします。
+ */
+class CsyEventLogBackend : public IsyEventBackend {
+    HANDLE      m_source;
+    CAtlString  m_source_name;
+public:
+    /** @param[in] source_name ... イベントソース名 (Service Name) */
+    explicit CsyEventLogBackend( _In_z_ LPCTSTR source_name ) : m_source( NULL ), m_source_name( source_name ) { }
+
+    virtual ~CsyEventLogBackend( void ) {
+        if ( m_source ) ::DeregisterEventSource( m_source );
+    }
+
+    virtual void Report( _In_ WORD type, _In_z_ LPCTSTR text ) override {
+        if ( !m_source )
+            m_source = ::RegisterEventSource( NULL, m_source_name );
+        if ( m_source )
+            ::ReportEvent( m_source, type, 0, 0, NULL, 1, 0, &text, NULL );
+    }
+};
+
+/**
+ * @brief ファイル出力（UTF-8, 追記）。イベントログの代わりにローカルで確認する場合に使います。
+ */
+class CsyEventFileBackend : public IsyEventBackend {
+    HANDLE      m_file;
+    CStringA    m_buffer;
+public:
+    explicit CsyEventFileBackend( _In_z_ LPCTSTR path ) {
+        m_file = ::CreateFile( path, FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                               NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+    }
+
+    virtual ~CsyEventFileBackend( void ) {
+        if ( m_file != INVALID_HANDLE_VALUE ) ::CloseHandle( m_file );
+    }
+
+    /** ファイルが開けたか */
+    BOOL IsOpen( void ) const { return m_file != INVALID_HANDLE_VALUE; }
+
+    virtual void Report( _In_ WORD type, _In_z_ LPCTSTR text ) override {
+        SYSTEMTIME _st;
+        ::GetLocalTime( &_st );
+
+        LPCSTR _type = ( type == EVENTLOG_ERROR_TYPE   ? "ERR" :
+                         type == EVENTLOG_WARNING_TYPE ? "WAR" : "INF" );
+        m_buffer.AppendFormat( "[%04d-%02d-%02d %02d:%02d:%02d] %s %s\r\n",
+            _st.wYear, _st.wMonth, _st.wDay, _st.wHour, _st.wMinute, _st.wSecond,
+            _type, (LPCSTR) CT2A( text, CP_UTF8 ) );
+    }
+
+    virtual void Flush( void ) override {
+        if ( m_buffer.IsEmpty() ) return;
+        if ( this->IsOpen() ) {
+            DWORD _written = 0;
+            ::WriteFile( m_file, m_buffer.GetString(), m_buffer.GetLength(), &_written, NULL );
+        }
+        m_buffer.Empty();
+    }
+};
+
+/**
+ * @brief 非同期 Event sink
+ *
+ *        呼び出し側はメッセージをフォーマットしてキューへ積むだけで、
+ *        出力は出力スレッドがまとめて行います。
+ *        同じ (種別, format, entry名) のメッセージが SY_EVENT_COALESCE_MS 以内に繰り返された場合、
+ *        最初の1件だけを出力し、期間の終わりに繰り返し回数を1件にまとめて出力します。
+ *        format (呼び出し箇所) で比べるため、PID など文面の一部だけが違うものもまとめます。
+ *        entry 毎に分けるものは ReportEntry() ( EVENT_ENTRY_XXX ) で書き込みます。
+ *        出力先は SetBackend() で差し替えられます（既定は SetSourceName() の名前の Windows イベントログ）。
+ */
+class CsyEventSink : public CsyThread {
+
+    /** キューの1件 */
+    struct TEVENT {
+        WORD        type;
+        LPCTSTR     format;     ///< まとめるキー（文字列リテラル）
+        CAtlString  entry;      ///< まとめるキー（entry名。無し.. 空）
+        CAtlString  text;
+    };
+
+    /** まとめ中のメッセージ */
+    struct TCOALESCE {
+        ULONGLONG   first;      ///< 最初に出力した時刻 (GetTickCount64)
+        DWORD       repeats;    ///< 以降に抑止した件数
+        WORD        type;
+        CAtlString  text;       ///< 最初に出力した文面
+    };
+    typedef std::tuple<WORD, LPCTSTR, CAtlString>   TEVENT_KEY;
+
+    CComAutoCriticalSection             m_lock;         ///< m_pending
+    std::vector<TEVENT>                 m_pending;
+    CComAutoCriticalSection             m_backend_lock; ///< m_backend / m_source_name / m_default_backend
+    std::unique_ptr<IsyEventBackend>    m_backend;
+    CAtlString                          m_source_name;  ///< 既定の出力先のイベントソース名
+    BOOL                                m_default_backend;
+    std::map<TEVENT_KEY, TCOALESCE>     m_recent;       ///< 出力スレッドのみ
+    HANDLE                              m_wake;
+    volatile LONG                       m_closing;
+    INIT_ONCE                           m_once;
+
+public:
+    /** SERVICE_NAME と同じ翻訳単位で、SERVICE_NAME の後に定義すること */
+    CsyEventSink( void ) : m_source_name( SERVICE_NAME ), m_default_backend( FALSE ),
+                           m_wake( ::CreateEvent( NULL, FALSE, FALSE, NULL ) ), m_closing( 0 ) {
+        ::InitOnceInitialize( &m_once );
+    }
+
+    /** destructor. 残りのメッセージとまとめ中の件数を出力して終了します */
+    virtual ~CsyEventSink( void ) {
+        this->Shutdown();
+        ::CloseHandle( m_wake );
+    }
+
+    /**
+     * @brief 出力先を差し替えます
+     * @param[in] backend ... 出力先（所有権を移します）
+     */
+    void SetBackend( _In_ IsyEventBackend* backend ) {
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_backend_lock );
+        if ( m_backend ) m_backend->Flush();
+        m_backend.reset( backend );
+        m_default_backend = FALSE;
+    }
+
+    /**
+     * @brief 既定の出力先 (Windows イベントログ) のイベントソース名を設定します。
+     *        名前は出力時に使うため、設定を読む前に積まれたメッセージもこの名前で出力します。
+     * @param[in] source_name ... イベントソース名 (Service Name)
+     */
+    void SetSourceName( _In_z_ LPCTSTR source_name ) {
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_backend_lock );
+        if ( m_source_name == source_name ) return;
+        m_source_name = source_name;
+        if ( m_default_backend ) {
+            m_backend->Flush();
+            m_backend.reset();      // 次の出力で新しい名前で開き直す
+        }
+    }
+
+    /**
+     * @brief Event を書き込みます（キューへ積むだけです）
+     * @param[in] format ... 文字列リテラル（まとめるキーです）
+     */
+    void Report( _In_ WORD type, _In_z_ _Printf_format_string_ LPCTSTR format, ... ) {
+        va_list _args;
+        va_start( _args, format );
+            this->ReportV( type, NULL, format, _args );
+        va_end( _args );
+    }
+
+    /**
+     * @brief entry の Event を書き込みます（キューへ積むだけです）
+     *        同じ format でも entry が違うものはまとめません。
+     * @param[in] entry ... entry名
+     * @param[in] format ... 文字列リテラル（まとめるキーです）
+     */
+    void ReportEntry( _In_ WORD type, _In_z_ LPCTSTR entry, _In_z_ _Printf_format_string_ LPCTSTR format, ... ) {
+        va_list _args;
+        va_start( _args, format );
+            this->ReportV( type, entry, format, _args );
+        va_end( _args );
+    }
+
+    /**
+     * @brief 出力スレッドを終了します。キューの残りとまとめ中の件数は全て出力します
+     */
+    void Shutdown( void ) {
+        if ( ::InterlockedExchange( &m_closing, 1 ) ) return;
+        ::SetEvent( m_wake );
+        this->Join();
+    }
+
+protected:
+    virtual DWORD run( _In_ void* /*argment*/ = NULL ) override {
+        for ( ;; ) {
+            ::WaitForSingleObject( m_wake, SY_EVENT_FLUSH_MS );
+            BOOL _closing = m_closing;
+
+            std::vector<TEVENT> _batch;
+            {
+                CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+                _batch.swap( m_pending );
+            }
+            this->Dispatch( _batch, _closing );
+
+            if ( _closing ) break;
+        }
+        return 0;
+    }
+
+private:
+    /** フォーマットしてキューへ積みます */
+    void ReportV( _In_ WORD type, _In_opt_z_ LPCTSTR entry, _In_z_ LPCTSTR format, _In_ va_list args ) {
+        TEVENT _event;
+        _event.type   = type;
+        _event.format = format;
+        if ( entry ) _event.entry = entry;
+        _event.text.FormatV( format, args );
+        if ( _event.text.GetLength() > SY_EVENT_MSG_SIZE - 1 )
+            _event.text.Truncate( SY_EVENT_MSG_SIZE - 1 );
+
+        this->Startup();
+        {
+            CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+            m_pending.push_back( _event );
+        }
+        ::SetEvent( m_wake );
+    }
+
+    /** 出力スレッドを開始します（初回のみ） */
+    void Startup( void ) {
+        ::InitOnceExecuteOnce( &m_once, []( PINIT_ONCE, PVOID param, PVOID* ) -> BOOL {
+                auto _this = reinterpret_cast<CsyEventSink*>( param );
+                if ( !_this->m_closing ) _this->Begin();
+                return TRUE;
+            }, this, NULL );
+    }
+
+    /**
+     * @brief 1バッチ分を出力します
+     * @param[in] batch   ... 新しいメッセージ
+     * @param[in] closing ... TRUE:まとめ中の件数を期間を待たずに全て出力する
+     */
+    void Dispatch( _In_ const std::vector<TEVENT>& batch, _In_ BOOL closing ) {
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_backend_lock );
+        if ( !m_backend ) {
+            m_backend.reset( new CsyEventLogBackend( m_source_name ) );
+            m_default_backend = TRUE;
+        }
+
+        ULONGLONG _now = ::GetTickCount64();
+        for ( auto& _event : batch ) {
+            TEVENT_KEY _key( _event.type, _event.format, _event.entry );
+            auto _it = m_recent.find( _key );
+            if ( _it != m_recent.end() && _now - _it->second.first < SY_EVENT_COALESCE_MS ) {
+                _it->second.repeats++;
+                continue;
+            }
+            if ( _it != m_recent.end() ) {
+                this->ReportRepeats( _it->second, _now );
+                _it->second.first   = _now;
+                _it->second.repeats = 0;
+                _it->second.text    = _event.text;
+            } else {
+                TCOALESCE _coalesce = { _now, 0, _event.type, _event.text };
+                m_recent.insert( std::make_pair( _key, _coalesce ) );
+            }
+            m_backend->Report( _event.type, _event.text );
+        }
+
+        // 期間が終わったものは繰り返し回数を出して破棄
+        for ( auto _it = m_recent.begin(); _it != m_recent.end(); ) {
+            if ( closing || _now - _it->second.first >= SY_EVENT_COALESCE_MS ) {
+                this->ReportRepeats( _it->second, _now );
+                _it = m_recent.erase( _it );
+            } else {
+                ++_it;
+            }
+        }
+        m_backend->Flush();
+    }
+
+    /** 抑止した件数を1件にまとめて出力します */
+    void ReportRepeats( _In_ const TCOALESCE& coalesce, _In_ ULONGLONG now ) {
+        if ( !coalesce.repeats ) return;
+
+        CAtlString _text;
+        _text.Format( TEXT("%s (repeated %d times in %ds)"), coalesce.text.GetString(),
+            static_cast<int>( coalesce.repeats ), static_cast<int>( ( now - coalesce.first ) / 1000 ) );
+        m_backend->Report( coalesce.type, _text );
+    }
+
+    CsyEventSink( const CsyEventSink& );
+    CsyEventSink& operator=( const CsyEventSink& );
+};
+
+extern CsyEventSink SY_EVENTS;
+
+
+// Event Out (async)
+#define EVENT_INF(...) SY_EVENTS.Report( EVENTLOG_INFORMATION_TYPE, __VA_ARGS__ )
+#define EVENT_ERR(...) SY_EVENTS.Report( EVENTLOG_ERROR_TYPE,       __VA_ARGS__ )
+#define EVENT_WAR(...) SY_EVENTS.Report( EVENTLOG_WARNING_TYPE,     __VA_ARGS__ )
+#define EVENT_ENTRY_INF(entry, ...) SY_EVENTS.ReportEntry( EVENTLOG_INFORMATION_TYPE, entry, __VA_ARGS__ )
+#define EVENT_ENTRY_ERR(entry, ...) SY_EVENTS.ReportEntry( EVENTLOG_ERROR_TYPE,       entry, __VA_ARGS__ )
+#define EVENT_ENTRY_WAR(entry, ...) SY_EVENTS.ReportEntry( EVENTLOG_WARNING_TYPE,     entry, __VA_ARGS__ )
+#ifdef _DEBUG
+#define EVENT_DBG(...) SY_EVENTS.Report( EVENTLOG_INFORMATION_TYPE, __VA_ARGS__ )
+#else
+#define EVENT_DBG(...) __noop
+#endif
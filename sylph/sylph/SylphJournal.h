@@ -0,0 +1,501 @@
+﻿/**
+ * @file     SylphJournal.h
+ * @brief    Crash-safe journal of running children (re-adoption after a supervisor restart)
+ * @author   M.Horigome
+ * @version  1.0.0.0000
+ * @date     2026-10-17
+ *
+ * https://github.com/horigome/sylph
+ */
+#pragma once
+#include "stdafx.h"
+#include "SylphProcessManager.h"
+#include "SylphConfigSnapshot.h"
+
+/** Journal 定数 */
+enum {
+    SY_JOURNAL_MAGIC        = 0x4c4a5953,   ///< 'SYJL'
+    SY_JOURNAL_VERSION      = 1,
+    SY_JOURNAL_FLUSH_MS     = 100,          ///< 書き込み + FlushFileBuffers の間隔(ms)
+    SY_JOURNAL_COMPACT      = 4096,         ///< ファイル内の記録数がこれを超えたら生存分だけに書き直す
+};
+
+/** 記録の種類 */
+enum SY_JOURNAL_RECORD {
+    SY_JOURNAL_SPAWN        = 1,    ///< 起動（または引き継ぎ）
+    SY_JOURNAL_EXIT         = 2,    ///< 終了
+};
+
+/** ファイルヘッダ */
+struct TSY_JOURNAL_HEADER {
+    DWORD   magic;
+    DWORD   version;
+};
+
+/** 記録ヘッダ（直後に size バイトの本体） */
+struct TSY_JOURNAL_RECORD_HEADER {
+    DWORD       type;               ///< SY_JOURNAL_RECORD
+    DWORD       size;               ///< 本体のバイト数
+    ULONGLONG   hash;               ///< 本体の FNV-1a（途中まで書かれた記録の検出）
+};
+
+/** 子プロセス1つ分の記録 */
+struct TSY_JOURNAL_ENTRY {
+    CAtlString  name;               ///< entry名
+    UINT        replica;
+    DWORD       pid;
+    ULONGLONG   create_time;        ///< プロセスの作成時刻 (FILETIME)。pid の再利用と区別する
+    ULONGLONG   config_hash;        ///< 起動時の設定の FNV-1a
+
+    TSY_JOURNAL_ENTRY( void ) : replica( 0 ), pid( 0 ), create_time( 0 ), config_hash( 0 ) { }
+};
+
+template <typename A>
+inline void
+sy_serialize( _Inout_ A& ar, _Inout_ TSY_JOURNAL_ENTRY& e ) {
+    ar( e.name        );
+    ar( e.replica     );
+    ar( e.pid         );
+    ar( e.create_time );
+    ar( e.config_hash );
+}
+
+/**
+ * @brief プロセス設定の FNV-1a（設定が変わったプロセスは引き継がない）
+ */
+inline ULONGLONG
+sy_config_hash( _In_ const CsyProcConfig& config ) {
+    CsyProcConfig     _copy( config );
+    CsySnapshotWriter _writer;
+    sy_serialize( _writer, _copy );
+    return sy_hash64( _writer.IsBody().data(), _writer.IsBody().size() );
+}
+
+/**
+ * @brief プロセスの作成時刻 (FILETIME)。取得できない場合は 0
+ */
+inline ULONGLONG
+sy_process_create_time( _In_ HANDLE process ) {
+    FILETIME _create, _exit, _kernel, _user;
+    if ( !process || !::GetProcessTimes( process, &_create, &_exit, &_kernel, &_user ) )
+        return 0;
+    return ( static_cast<ULONGLONG>( _create.dwHighDateTime ) << 32 ) | _create.dwLowDateTime;
+}
+
+/**
+ * @brief 実行中の子プロセスの journal
+ *
+ *        子プロセスの起動/終了を追記のみのファイルへ記録します。記録はメモリに溜めて
+ *        SY_JOURNAL_FLUSH_MS 毎にまとめて書き込み、FlushFileBuffers します。
+ *        supervisor が異常終了/更新された後に Open() すると、記録が残っていて
+ *        作成時刻が一致する（pid が再利用されていない）子プロセスを引き継ぎ候補にします。
+ *        StartEntries() の起動時に entry名 / replica / 設定が一致する候補があれば、
+ *        新しく起動せずに引き継ぎます。
+ *
+ *        引き継げないもの：
+ *          stdout/stderr の取り込みと <listen> のある entry（パイプ/ソケットは前の supervisor と共に閉じている）
+ *          → Recover() で停止し、通常通り起動します。
+ *          引き継いだプロセスの通知チャネル / heartbeat（前の supervisor の名前を持っているため）
+ *          → 次に再起動するまで READY 済みとして扱い、watchdog の対象にしません。
+ */
+class CsyJournal : public CsyThread, public IsyProcessJournal {
+
+    /** 引き継ぎ候補 */
+    struct TCANDIDATE {
+        TSY_JOURNAL_ENTRY   entry;
+        HANDLE              process;
+    };
+
+    CComAutoCriticalSection             m_lock;
+    CAtlString                          m_path;
+    HANDLE                              m_file;
+    HANDLE                              m_quit;
+    std::vector<BYTE>                   m_pending;      ///< 未書き込みの記録 (m_lock)
+    std::map<DWORD, TSY_JOURNAL_ENTRY>  m_live;         ///< pid -> 実行中の記録 (m_lock)
+    std::map<DWORD, TCANDIDATE>         m_candidates;   ///< pid -> 引き継ぎ候補 (m_lock)
+    size_t                              m_records;      ///< ファイル内の記録数 (flush thread)
+    size_t                              m_compact_at;   ///< 記録数がこれを超えたら書き直す (flush thread)
+public:
+    CsyJournal( void ) : m_file( INVALID_HANDLE_VALUE ), m_quit( NULL ), m_records( 0 ), m_compact_at( SY_JOURNAL_COMPACT ) { }
+
+    /** destructor. 未書き込みの記録を書き込んで閉じます */
+    virtual ~CsyJournal( void ) {
+        this->Close();
+    }
+
+    /** 開いているか？ */
+    BOOL IsOpen( void ) const { return m_file != INVALID_HANDLE_VALUE; }
+
+    /**
+     * @brief journal を開き、残っている記録から引き継ぎ候補を作ります。
+     *        ファイルは生存している分だけに書き直します。
+     * @param[in] path ... journal のファイルパス
+     */
+    HRESULT Open( _In_z_ LPCTSTR path ) {
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        if ( this->IsOpen() )
+            return S_FALSE;
+        m_path = path;
+
+        // 1. 記録を再生（途中まで書かれた末尾の記録は捨てる）
+        std::map<DWORD, TSY_JOURNAL_ENTRY> _live;
+        this->Replay( _live );
+
+        // 2. 作成時刻が一致し、まだ動いているものだけを候補にする
+        for ( auto& r : _live ) {
+            HANDLE _process = ::OpenProcess( PROCESS_QUERY_LIMITED_INFORMATION | SYNCHRONIZE |
+                                             PROCESS_TERMINATE | PROCESS_SET_QUOTA, FALSE, r.first );
+            if ( !_process )
+                continue;
+            DWORD _exit_code = 0;
+            if ( sy_process_create_time( _process ) != r.second.create_time ||
+                 !::GetExitCodeProcess( _process, &_exit_code ) || _exit_code != STILL_ACTIVE ) {
+                ::CloseHandle( _process );
+                continue;
+            }
+            TCANDIDATE _c = { r.second, _process };
+            m_candidates[ r.first ] = _c;
+            m_live[ r.first ]       = r.second;
+        }
+
+        // 3. 生存分だけで書き直して追記を始める
+        HRESULT _hr = this->Compact();
+        if ( FAILED( _hr ) ) {
+            _SLOG( TEXT("! Journal open failed. in %08x [%s]\n"), _hr, m_path.GetString() );
+            return _hr;
+        }
+
+        m_quit = ::CreateEvent( NULL, TRUE, FALSE, NULL );
+        if ( !m_quit || FAILED( _hr = this->Begin() ) ) {
+            _hr = m_quit ? _hr : HRESULT_FROM_WIN32( ::GetLastError() );
+            ::CloseHandle( m_file );
+            m_file = INVALID_HANDLE_VALUE;
+            return _hr;
+        }
+        _SLOG( TEXT("==> Journal opened. %d live children to adopt : %s\n"),
+                static_cast<int>( m_candidates.size() ), m_path.GetString() );
+        return S_OK;
+    }
+
+    /**
+     * @brief 未書き込みの記録を書き込んで閉じます。（実行中の子プロセスの記録は残します）
+     *        引き継がなかった候補は停止せずにハンドルだけを閉じます。
+     */
+    void Close( void ) {
+        if ( m_quit ) {
+            ::SetEvent( m_quit );
+            this->Join();
+            ::CloseHandle( m_quit );
+            m_quit = NULL;
+        }
+        this->Flush();
+
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        for ( auto& c : m_candidates )
+            ::CloseHandle( c.second.process );
+        m_candidates.clear();
+        if ( this->IsOpen() ) ::CloseHandle( m_file );
+        m_file = INVALID_HANDLE_VALUE;
+    }
+
+    /**
+     * @brief 引き継げない候補を停止します。StartEntries() の前に呼ぶこと。
+     *        （設定が変わった / entry が削除された / 取り込みや <listen> がある / min 個を超える replica）
+     * @param[in] configs ... これから起動する設定リスト
+     */
+    void Recover( _In_ const SYCONFIGS& configs ) {
+        std::map<CAtlString, const CsyProcConfig*> _configs;
+        for ( auto& c : configs )
+            _configs[ c.m_name ] = &c;
+
+        this->DiscardIf( [&]( const TSY_JOURNAL_ENTRY& e ) {
+            auto _it = _configs.find( e.name );
+            return _it == _configs.end() || !IsAdoptable( *_it->second ) ||
+                   e.replica >= _it->second->m_instances_min ||
+                   e.config_hash != sy_config_hash( *_it->second );
+        } );
+    }
+
+    /**
+     * @brief 残っている候補（引き継がれなかったもの）を全て停止します。StartEntries() の後に呼ぶこと。
+     */
+    void Discard( void ) {
+        this->DiscardIf( []( const TSY_JOURNAL_ENTRY& ) { return TRUE; } );
+    }
+
+    /**
+     * @brief 起動の代わりに引き継ぐプロセスを探します。（CsylphProcessManager から呼ばれます）
+     * @param[in] config ... 起動する entry の設定
+     * @param[in] replica ... 起動する replica 番号
+     * @param[out] info ... 引き継ぐプロセス (hProcess / dwProcessId)。ハンドルは呼び出し側が所有します
+     * @retval TRUE ... 引き継ぐプロセスがある
+     */
+    virtual BOOL Adopt( _In_ const CsyProcConfig& config, _In_ UINT replica, _Out_ PROCESS_INFORMATION& info ) override {
+        ::ZeroMemory( &info, sizeof( info ) );
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        if ( m_candidates.empty() || !IsAdoptable( config ) )
+            return FALSE;
+
+        ULONGLONG _hash = sy_config_hash( config );
+        for ( auto it = m_candidates.begin(); it != m_candidates.end(); ++it ) {
+            const TSY_JOURNAL_ENTRY& _e = it->second.entry;
+            if ( _e.name != config.m_name || _e.replica != replica || _e.config_hash != _hash )
+                continue;
+            info.hProcess    = it->second.process;
+            info.dwProcessId = it->first;
+            m_candidates.erase( it );
+            return TRUE;
+        }
+        return FALSE;
+    }
+
+    /**
+     * @brief 状態変化を記録します。（supervisor のロックを保持したまま呼ばれることがあります）
+     *        RUNNING になった時は起動、それ以外は終了として記録します。
+     */
+    virtual void OnProcessEvent( _In_ const CsyProcess& process ) override {
+        DWORD _pid = process.IsProcessID();
+        if ( !_pid )
+            return;
+
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        if ( !this->IsOpen() )
+            return;
+
+        if ( process.IsState() == SY_PROC_RUNNING ) {
+            ULONGLONG _create_time = sy_process_create_time( process.IsProcessHandle() );
+            auto _it = m_live.find( _pid );
+            if ( _it != m_live.end() && _it->second.create_time == _create_time )
+                return;     // 引き継いだプロセス（記録済み）
+            TSY_JOURNAL_ENTRY _e;
+            _e.name        = process.IsConfig().m_name;
+            _e.replica     = process.IsReplica();
+            _e.pid         = _pid;
+            _e.create_time = _create_time;
+            _e.config_hash = sy_config_hash( process.IsConfig() );
+            m_live[ _pid ] = _e;
+            this->Append( SY_JOURNAL_SPAWN, _e );
+        } else {
+            auto _it = m_live.find( _pid );
+            if ( _it == m_live.end() )
+                return;
+            this->Append( SY_JOURNAL_EXIT, _it->second );
+            m_live.erase( _it );
+        }
+    }
+
+protected:
+    /** 書き込みスレッド */
+    virtual DWORD run( _In_ void* /*argment*/ = NULL ) override {
+        SY_TRACE.SetThreadName( "journal" );
+        while ( ::WaitForSingleObject( m_quit, SY_JOURNAL_FLUSH_MS ) == WAIT_TIMEOUT )
+            this->Flush();
+        return 0;
+    }
+
+private:
+    /** 引き継げる entry か（取り込みのパイプと <listen> のソケットは引き継げない） */
+    static BOOL IsAdoptable( _In_ const CsyProcConfig& config ) {
+        return config.m_stdout.IsEmpty() && config.m_stderr.IsEmpty() && config.m_listen.empty();
+    }
+
+    /**
+     * @brief pred に一致する候補を子孫（孫プロセスを含む）ごと停止します。
+     *        journal では kill-on-close を使わないため、候補と子孫を一時的な Job に入れて終了させます。
+     *        終了はロック外でまとめて待ちます。
+     */
+    void DiscardIf( _In_ std::function<BOOL(const TSY_JOURNAL_ENTRY&)> pred ) {
+        std::vector<TCANDIDATE> _discards;
+        {
+            CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+            for ( auto it = m_candidates.begin(); it != m_candidates.end(); ) {
+                if ( !pred( it->second.entry ) ) {
+                    ++it;
+                    continue;
+                }
+                auto _live = m_live.find( it->first );
+                if ( _live != m_live.end() ) {
+                    this->Append( SY_JOURNAL_EXIT, _live->second );
+                    m_live.erase( _live );
+                }
+                _discards.push_back( it->second );
+                it = m_candidates.erase( it );
+            }
+        }
+
+        std::vector<HANDLE> _processes;
+        for ( auto& d : _discards ) {
+            DWORD  _pid         = ::GetProcessId( d.process );
+            DWORD  _descendants = 0;
+            HANDLE _job         = ::CreateJobObject( NULL, NULL );
+            if ( _job && ::AssignProcessToJobObject( _job, d.process ) ) {
+                _descendants = sy_assign_descendants( _job, d.process );
+                if ( FAILED( sy_terminate_job( _job, 0L ) ) ) 
+                    ::TerminateProcess( d.process, 0L );
+            } else {
+                ::TerminateProcess( d.process, 0L );     // Job に入れられない場合は本体だけ
+            }
+            if ( _job ) ::CloseHandle( _job );
+
+            _SLOG( TEXT("==> [PID:%d] Not adopted. KILL Process (%d descendants) : %s\n"), 
+                    _pid, _descendants, d.entry.name.GetString() );
+            EVENT_ENTRY_WAR( d.entry.name, TEXT("Journal : child not adopted and stopped. [PID:%d] %s"),
+                       _pid, d.entry.name.GetString() );
+            _processes.push_back( d.process );
+        }
+        sy_wait_all_until( _processes, ::GetTickCount64() + SY_KILL_WAIT_MS );
+        for ( auto h : _processes ) 
+            ::CloseHandle( h );
+    }
+
+    /** 記録を m_pending へ追加します (m_lock) */
+    void Append( _In_ SY_JOURNAL_RECORD type, _In_ const TSY_JOURNAL_ENTRY& entry ) {
+        TSY_JOURNAL_ENTRY _e( entry );
+        CsySnapshotWriter _writer;
+        sy_serialize( _writer, _e );
+
+        TSY_JOURNAL_RECORD_HEADER _head;
+        _head.type = type;
+        _head.size = static_cast<DWORD>( _writer.IsBody().size() );
+        _head.hash = sy_hash64( _writer.IsBody().data(), _writer.IsBody().size() );
+
+        const BYTE* _p = reinterpret_cast<const BYTE*>( &_head );
+        m_pending.insert( m_pending.end(), _p, _p + sizeof( _head ) );
+        m_pending.insert( m_pending.end(), _writer.IsBody().begin(), _writer.IsBody().end() );
+    }
+
+    /**
+     * @brief 溜まった記録を書き込み、FlushFileBuffers します。
+     *        記録が増えすぎた場合は生存分だけに書き直します。
+     */
+    void Flush( void ) {
+        std::vector<BYTE> _pending;
+        {
+            CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+            if ( m_pending.empty() || !this->IsOpen() )
+                return;
+            if ( m_records > m_compact_at && m_records > m_live.size() * 4 ) {
+                HRESULT _hr = this->Compact();
+                if ( SUCCEEDED( _hr ) ) {
+                    m_compact_at = SY_JOURNAL_COMPACT;
+                    return;
+                }
+                // 前のファイルへの追記を続ける（記録数が倍になるまで書き直さない）
+                m_compact_at = m_records * 2;
+                _SLOG( TEXT("! Journal compaction failed. in %08x [%s]\n"), _hr, m_path.GetString() );
+                EVENT_WAR( TEXT("Journal compaction failed. in %08x : %s"), _hr, m_path.GetString() );
+            }
+            _pending.swap( m_pending );
+        }
+
+        // 書き込みは m_file を差し替える Compact() と同じスレッドのみ
+        DWORD _written = 0;
+        if ( !::WriteFile( m_file, _pending.data(), static_cast<DWORD>( _pending.size() ), &_written, NULL ) ||
+             !::FlushFileBuffers( m_file ) )
+            _SLOG( TEXT("! Journal write failed. in %d\n"), ::GetLastError() );
+        m_records += CountRecords( _pending );
+    }
+
+    /** 記録数 */
+    static size_t CountRecords( _In_ const std::vector<BYTE>& data ) {
+        size_t _count = 0;
+        for ( size_t _pos = 0; _pos + sizeof( TSY_JOURNAL_RECORD_HEADER ) <= data.size(); _count++ ) {
+            const TSY_JOURNAL_RECORD_HEADER* _head = reinterpret_cast<const TSY_JOURNAL_RECORD_HEADER*>( &data[ _pos ] );
+            _pos += sizeof( TSY_JOURNAL_RECORD_HEADER ) + _head->size;
+        }
+        return _count;
+    }
+
+    /** ファイルの記録を再生します */
+    void Replay( _Out_ std::map<DWORD, TSY_JOURNAL_ENTRY>& live ) {
+        live.clear();
+
+        std::vector<BYTE> _data;
+        HANDLE _file = ::CreateFile( m_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+        if ( _file == INVALID_HANDLE_VALUE )
+            return;
+        LARGE_INTEGER _size;
+        if ( ::GetFileSizeEx( _file, &_size ) && _size.QuadPart > 0 && _size.QuadPart < 0x40000000 ) {
+            DWORD _read = 0;
+            _data.resize( static_cast<size_t>( _size.QuadPart ) );
+            if ( !::ReadFile( _file, _data.data(), static_cast<DWORD>( _data.size() ), &_read, NULL ) )
+                _read = 0;
+            _data.resize( _read );
+        }
+        ::CloseHandle( _file );
+
+        const TSY_JOURNAL_HEADER* _file_head = reinterpret_cast<const TSY_JOURNAL_HEADER*>( _data.data() );
+        if ( _data.size() < sizeof( TSY_JOURNAL_HEADER ) ||
+             _file_head->magic != SY_JOURNAL_MAGIC || _file_head->version != SY_JOURNAL_VERSION ) {
+            if ( !_data.empty() )
+                _SLOG( TEXT("[WAR] journal format mismatch. ignored. [%s]\n"), m_path.GetString() );
+            return;
+        }
+
+        size_t _pos = sizeof( TSY_JOURNAL_HEADER );
+        while ( _pos + sizeof( TSY_JOURNAL_RECORD_HEADER ) <= _data.size() ) {
+            const TSY_JOURNAL_RECORD_HEADER* _head = reinterpret_cast<const TSY_JOURNAL_RECORD_HEADER*>( &_data[ _pos ] );
+            const BYTE* _body = &_data[ _pos ] + sizeof( TSY_JOURNAL_RECORD_HEADER );
+            if ( _head->size > _data.size() - _pos - sizeof( TSY_JOURNAL_RECORD_HEADER ) ||
+                 sy_hash64( _body, _head->size ) != _head->hash )
+                break;      // 途中まで書かれた記録
+
+            TSY_JOURNAL_ENTRY _e;
+            CsySnapshotReader _reader( _body, _head->size );
+            sy_serialize( _reader, _e );
+            if ( !_reader.IsValid() )
+                break;
+
+            if ( _head->type == SY_JOURNAL_SPAWN ) {
+                live[ _e.pid ] = _e;
+            } else if ( _head->type == SY_JOURNAL_EXIT ) {
+                auto _it = live.find( _e.pid );
+                if ( _it != live.end() && _it->second.create_time == _e.create_time )
+                    live.erase( _it );
+            }
+            _pos += sizeof( TSY_JOURNAL_RECORD_HEADER ) + _head->size;
+        }
+    }
+
+    /**
+     * @brief 生存分 (m_live) だけの journal を一時ファイルに書き、置き換えます。以降は一時ファイルのハンドルで追記します。(m_lock)
+     *        置き換えるまで前のファイルは開いたままにし、失敗した場合は前のファイルへの追記を続けます。
+     *        （開いたまま置き換え / 名前を変えられるよう FILE_SHARE_DELETE で開きます）
+     */
+    HRESULT Compact( void ) {
+        CAtlString _temp = m_path + TEXT(".tmp");
+        HANDLE _file = ::CreateFile( _temp, GENERIC_WRITE | SYNCHRONIZE, FILE_SHARE_READ | FILE_SHARE_DELETE, 
+                                     NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+        if ( _file == INVALID_HANDLE_VALUE )
+            return HRESULT_FROM_WIN32( ::GetLastError() );
+
+        std::vector<BYTE> _pending;     // 失敗した場合は戻す
+        _pending.swap( m_pending );
+        for ( auto& r : m_live )
+            this->Append( SY_JOURNAL_SPAWN, r.second );
+
+        TSY_JOURNAL_HEADER _head = { SY_JOURNAL_MAGIC, SY_JOURNAL_VERSION };
+        DWORD _written = 0;
+        BOOL  _ok = ::WriteFile( _file, &_head, sizeof( _head ), &_written, NULL ) &&
+                    ( m_pending.empty() ||
+                      ::WriteFile( _file, m_pending.data(), static_cast<DWORD>( m_pending.size() ), &_written, NULL ) ) &&
+                    ::FlushFileBuffers( _file ) &&
+                    ::MoveFileEx( _temp, m_path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH );
+        HRESULT _hr = _ok ? S_OK : HRESULT_FROM_WIN32( ::GetLastError() );
+        if ( FAILED( _hr ) ) {
+            ::CloseHandle( _file );
+            ::DeleteFile( _temp );
+            m_pending.swap( _pending );
+            return _hr;
+        }
+
+        m_pending.clear();
+        if ( this->IsOpen() ) ::CloseHandle( m_file );
+        m_file    = _file;
+        m_records = m_live.size();
+        return S_OK;
+    }
+
+    CsyJournal( const CsyJournal& );
+    CsyJournal& operator=( const CsyJournal& );
+};
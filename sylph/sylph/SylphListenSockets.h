@@ -0,0 +1,174 @@
+﻿﻿/**
+ * @file     SylphListenSockets.h
+ * @brief    Supervisor-owned listening sockets (socket activation)
+ * @author   M.Horigome
+ * @version  1.0.0.0000
+ * @date     2026-10-17
+ *
+ * https://github.com/horigome/sylph
+ */
+#pragma once
+#include "stdafx.h"
+#pragma comment (lib,"ws2_32.lib")
+
+/**
+ * @brief 待ち受けアドレスを分解します。("host:port" / "[v6addr]:port" / ":port" / "port")
+ *
+ * @param[in] address ... 待ち受けアドレス
+ * @param[out] host ... ホスト（空.. 全てのアドレス）
+ * @param[out] port ... ポート
+ * @retval FALSE ... 書式が正しくない
+ */
+inline BOOL
+sy_split_address( _In_  const CAtlString& address,
+                  _Out_ CAtlString&       host,
+                  _Out_ CAtlString&       port ) {
+    CAtlString _addr( address );
+    _addr.Trim();
+
+    int _colon = _addr.ReverseFind( TEXT(':') );
+    if ( _addr.Left( 1 ) == TEXT("[") ) {
+        int _close = _addr.Find( TEXT("]:") );
+        if ( _close < 0 ) return FALSE;
+        host  = _addr.Mid( 1, _close - 1 );
+        port  = _addr.Mid( _close + 2 );
+    } else if ( _colon >= 0 ) {
+        host  = _addr.Left( _colon );
+        port  = _addr.Mid( _colon + 1 );
+    } else {
+        host  = TEXT("");
+        port  = _addr;
+    }
+    return !port.IsEmpty() && port.SpanIncluding( TEXT("0123456789") ) == port;
+}
+
+/**
+ * @brief 待ち受けソケットの管理（socket activation）
+ *
+ *        <listen> のアドレス毎に supervisor が1度だけ bind/listen し、
+ *        同じ entry の全ての replica と再起動後のプロセスへ同じソケットを継承させます。
+ *        子プロセスの再起動中に届いた接続は、閉じられずにカーネルの backlog で待ちます。
+ *        どの entry からも参照されなくなったアドレスは Retain() で閉じます。
+ */
+class CsyListenSockets {
+    CComAutoCriticalSection         m_lock;
+    std::map<CAtlString, SOCKET>    m_sockets;      ///< address -> listening socket
+    BOOL                            m_wsa_started;
+public:
+    CsyListenSockets( void ) : m_wsa_started( FALSE ) { }
+
+    /** destructor. 全てのソケットを閉じます */
+    virtual ~CsyListenSockets( void ) {
+        this->Close();
+        if ( m_wsa_started ) ::WSACleanup();
+    }
+
+    /**
+     * @brief アドレスのソケットを取得します。まだ無いアドレスは bind/listen します。
+     *
+     * @param[in] addresses ... 待ち受けアドレスのリスト
+     * @param[out] sockets ... addresses と同じ順のソケット（継承可能）
+     */
+    HRESULT Acquire( _In_  const std::vector<CAtlString>& addresses,
+                     _Out_ std::vector<SOCKET>&           sockets ) {
+        sockets.clear();
+        if ( addresses.empty() )
+            return S_OK;
+
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        if ( !m_wsa_started ) {
+            WSADATA _wsa;
+            int _err = ::WSAStartup( MAKEWORD( 2, 2 ), &_wsa );
+            if ( _err )
+                return HRESULT_FROM_WIN32( _err );
+            m_wsa_started = TRUE;
+        }
+
+        for ( auto& a : addresses ) {
+            auto _it = m_sockets.find( a );
+            if ( _it == m_sockets.end() ) {
+                SOCKET  _s  = INVALID_SOCKET;
+                HRESULT _hr = this->Listen( a, _s );
+                if ( FAILED( _hr ) ) {
+                    _SLOG( TEXT("! Listen failed. in %08x [%s]\n"), _hr, a );
+                    EVENT_ERR( TEXT("Listen failed. [%s]"), a.GetString() );
+                    return _hr;
+                }
+                _SLOG( TEXT("==> Listening on %s\n"), a );
+                _it = m_sockets.insert( std::make_pair( a, _s ) ).first;
+            }
+            sockets.push_back( _it->second );
+        }
+        return S_OK;
+    }
+
+    /**
+     * @brief used に無いアドレスのソケットを閉じます。
+     * @param[in] used ... 参照されているアドレス
+     */
+    void Retain( _In_ const std::set<CAtlString>& used ) {
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        for ( auto _it = m_sockets.begin(); _it != m_sockets.end(); ) {
+            if ( used.count( _it->first ) ) {
+                ++_it;
+                continue;
+            }
+            _SLOG( TEXT("==> Listen closed. %s\n"), _it->first );
+            ::closesocket( _it->second );
+            _it = m_sockets.erase( _it );
+        }
+    }
+
+    /** 全てのソケットを閉じます */
+    void Close( void ) {
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        for ( auto& s : m_sockets )
+            ::closesocket( s.second );
+        m_sockets.clear();
+    }
+
+private:
+    /**
+     * @brief TCP ソケットを作成して bind/listen します。
+     */
+    HRESULT Listen( _In_ const CAtlString& address, _Out_ SOCKET& s ) {
+        s = INVALID_SOCKET;
+
+        CAtlString _host, _port;
+        if ( !sy_split_address( address, _host, _port ) )
+            return E_INVALIDARG;
+
+        ADDRINFOT  _hints;
+        ADDRINFOT* _info = NULL;
+        ::ZeroMemory( &_hints, sizeof( _hints ) );
+        _hints.ai_flags    = AI_PASSIVE;
+        _hints.ai_family   = AF_UNSPEC;
+        _hints.ai_socktype = SOCK_STREAM;
+        _hints.ai_protocol = IPPROTO_TCP;
+        int _err = ::GetAddrInfo( _host.IsEmpty() ? NULL : _host.GetString(), _port, &_hints, &_info );
+        if ( _err )
+            return HRESULT_FROM_WIN32( _err );
+
+        // 他のプロセスに同じポートを奪われないように排他で bind する
+        BOOL  _exclusive = TRUE;
+        SOCKET _s = ::WSASocket( _info->ai_family, _info->ai_socktype, _info->ai_protocol, NULL, 0, 0 );
+        if ( _s == INVALID_SOCKET ||
+             ::setsockopt( _s, SOL_SOCKET, SO_EXCLUSIVEADDRUSE,
+                           reinterpret_cast<const char*>( &_exclusive ), sizeof( _exclusive ) ) ||
+             ::bind  ( _s, _info->ai_addr, static_cast<int>( _info->ai_addrlen ) ) ||
+             ::listen( _s, SOMAXCONN ) ||
+             !::SetHandleInformation( reinterpret_cast<HANDLE>( _s ), HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT ) ) {
+            HRESULT _hr = HRESULT_FROM_WIN32( ::WSAGetLastError() );
+            if ( _s != INVALID_SOCKET ) ::closesocket( _s );
+            ::FreeAddrInfo( _info );
+            return _hr;
+        }
+
+        ::FreeAddrInfo( _info );
+        s = _s;
+        return S_OK;
+    }
+
+    CsyListenSockets( const CsyListenSockets& );
+    CsyListenSockets& operator=( const CsyListenSockets& );
+};
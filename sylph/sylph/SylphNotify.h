@@ -0,0 +1,216 @@
+﻿/**
+ * @file     SylphNotify.h
+ * @brief    Readiness notification channel (sd_notify compatible messages)
+ * @author   M.Horigome
+ * @version  1.0.0.0000
+ * @date     2026-10-17
+ *
+ * https://github.com/horigome/sylph
+ */
+#pragma once
+#include "stdafx.h"
+
+/** Notify 定数 */
+enum {
+    SY_NOTIFY_MSG_SIZE      = 4096,     ///< 1メッセージの上限(bytes)
+};
+
+/**
+ * @brief 通知用パイプ名 (\\.\pipe\sylph-notify-<supervisor pid>)
+ *        子プロセスには環境変数 NOTIFY_SOCKET で渡します。
+ */
+inline CAtlString
+sy_notify_pipe_name( void ) {
+    CAtlString _name;
+    _name.Format( TEXT("\\\\.\\pipe\\sylph-notify-%d"), ::GetCurrentProcessId() );
+    return _name;
+}
+
+/**
+ * @brief 通知メッセージを "KEY=VALUE" 毎に分解します。(改行区切り, UTF-8)
+ *
+ * @param[in] message ... 受信したメッセージ
+ * @param[out] fields ... (KEY, VALUE) のリスト
+ */
+inline void
+sy_notify_parse( _In_  const std::string& message,
+                 _Out_ std::vector< std::pair<CAtlString, CAtlString> >& fields ) {
+    fields.clear();
+    size_t _pos = 0;
+    while ( _pos < message.size() ) {
+        size_t _eol = message.find( '\n', _pos );
+        if ( _eol == std::string::npos ) _eol = message.size();
+
+        std::string _line( message, _pos, _eol - _pos );
+        size_t _eq = _line.find( '=' );
+        if ( _eq != std::string::npos && _eq > 0 )
+            fields.push_back( std::make_pair( CAtlString( CA2T( _line.substr( 0, _eq ).c_str(),  CP_UTF8 ) ),
+                                              CAtlString( CA2T( _line.substr( _eq + 1 ).c_str(), CP_UTF8 ) ) ) );
+        _pos = _eol + 1;
+    }
+}
+
+/**
+ * @brief 通知チャネル（名前付きパイプ サーバ）
+ *
+ *        子プロセスは NOTIFY_SOCKET のパイプへ接続し、sd_notify と同じ書式のメッセージ
+ *        ("READY=1\nSTATUS=...") を1回の WriteFile で1件書き込みます。（接続は使い回して構いません）
+ *        パイプは supervisor の完了ポートに関連付け、受信も supervisor loop で処理します。
+ *        送信元はパイプのクライアント プロセスID（カーネルが保証する値）で判別します。
+ */
+class CsyNotifyServer {
+
+    /** パイプ インスタンス */
+    struct TPIPE {
+        OVERLAPPED  ov;                     ///< 先頭に置くこと
+        HANDLE      pipe;
+        BOOL        connected;              ///< FALSE.. 接続待ち  TRUE.. 受信中
+        DWORD       pid;                    ///< クライアント プロセスID
+        BOOL        discard;                ///< 長すぎるメッセージの残りを読み捨て中
+        char        buffer[ SY_NOTIFY_MSG_SIZE ];
+    };
+
+    HANDLE              m_iocp;
+    ULONG_PTR           m_key;
+    CAtlString          m_name;
+    std::set<TPIPE*>    m_pipes;            ///< supervisor loop のみ
+public:
+    CsyNotifyServer( void ) : m_iocp( NULL ), m_key( 0 ) { }
+
+    /** destructor. 全てのパイプを閉じます */
+    virtual ~CsyNotifyServer( void ) {
+        this->Shutdown();
+    }
+
+    /** パイプ名 (NOTIFY_SOCKET) */
+    const CAtlString& IsName( void ) const { return m_name; }
+
+    /**
+     * @brief 待ち受けを開始します。
+     * @param[in] iocp ... 受信完了を通知する完了ポート
+     * @param[in] key ... completion key
+     */
+    HRESULT Startup( _In_ HANDLE iocp, _In_ ULONG_PTR key ) {
+        m_iocp = iocp;
+        m_key  = key;
+        m_name = sy_notify_pipe_name();
+        return this->Listen( TRUE );
+    }
+
+    /** 全てのパイプを閉じます。（supervisor loop の終了後に呼ぶこと） */
+    void Shutdown( void ) {
+        for ( auto p : m_pipes ) {
+            DWORD _bytes = 0;
+            ::CancelIoEx( p->pipe, &p->ov );
+            ::GetOverlappedResult( p->pipe, &p->ov, &_bytes, TRUE );
+            ::CloseHandle( p->pipe );
+            delete p;
+        }
+        m_pipes.clear();
+    }
+
+    /**
+     * @brief 完了通知を処理します。supervisor loop から呼ばれます。
+     *
+     * @param[in] ov ... 完了した OVERLAPPED
+     * @param[in] bytes ... 受信バイト数
+     * @param[in] error ... 完了状態 (ERROR_SUCCESS / GetQueuedCompletionStatus 失敗時の GetLastError)
+     * @param[out] pid ... 送信元のプロセスID
+     * @param[out] message ... 受信したメッセージ
+     * @retval TRUE ... メッセージを受信した
+     */
+    BOOL OnCompletion( _In_  LPOVERLAPPED ov, _In_ DWORD bytes, _In_ DWORD error,
+                       _Out_ DWORD& pid, _Out_ std::string& message ) {
+        pid = 0;
+        message.clear();
+
+        TPIPE* _p = reinterpret_cast<TPIPE*>( ov );
+        if ( !m_pipes.count( _p ) )
+            return FALSE;
+
+        DWORD _err = error;
+        if ( !_p->connected ) {
+            // 接続完了。次の接続の待ち受けを作ってから受信を始める
+            this->Listen( FALSE );
+            if ( _err != ERROR_SUCCESS && _err != ERROR_PIPE_CONNECTED ) {
+                this->Close( _p );
+                return FALSE;
+            }
+            _p->connected = TRUE;
+            ::GetNamedPipeClientProcessId( _p->pipe, &_p->pid );
+            this->Read( _p );
+            return FALSE;
+        }
+
+        if ( _err == ERROR_SUCCESS && !_p->discard ) {
+            pid = _p->pid;
+            message.assign( _p->buffer, bytes );
+        } else if ( _err == ERROR_SUCCESS ) {
+            _p->discard = FALSE;
+        } else if ( _err == ERROR_MORE_DATA ) {
+            if ( !_p->discard ) 
+                _SLOG( TEXT("! [PID:%d] notify message too long. discarded.\n"), _p->pid );
+            _p->discard = TRUE;
+        } else {
+            this->Close( _p );     // 切断
+            return FALSE;
+        }
+        this->Read( _p );
+        return !message.empty();
+    }
+
+private:
+    /** 接続待ちのインスタンスを1つ作ります */
+    HRESULT Listen( _In_ BOOL first ) {
+        TPIPE* _p = new TPIPE;
+        ::ZeroMemory( _p, sizeof( TPIPE ) );
+        _p->pipe = ::CreateNamedPipe( m_name,
+                        PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED | ( first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0 ),
+                        PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                        PIPE_UNLIMITED_INSTANCES, 0, SY_NOTIFY_MSG_SIZE, 0, NULL );
+        if ( _p->pipe == INVALID_HANDLE_VALUE ) {
+            HRESULT _hr = HRESULT_FROM_WIN32( ::GetLastError() );
+            _SLOG( TEXT("! Notify pipe create failed. in %08x\n"), _hr );
+            delete _p;
+            return _hr;
+        }
+        if ( !::CreateIoCompletionPort( _p->pipe, m_iocp, m_key, 0 ) ) {
+            HRESULT _hr = HRESULT_FROM_WIN32( ::GetLastError() );
+            ::CloseHandle( _p->pipe );
+            delete _p;
+            return _hr;
+        }
+        m_pipes.insert( _p );
+
+        if ( !::ConnectNamedPipe( _p->pipe, &_p->ov ) ) {
+            DWORD _err = ::GetLastError();
+            if ( _err == ERROR_PIPE_CONNECTED )         // 既に接続済み（完了通知は来ない）
+                ::PostQueuedCompletionStatus( m_iocp, 0, m_key, &_p->ov );
+            else if ( _err != ERROR_IO_PENDING ) {
+                this->Close( _p );
+                return HRESULT_FROM_WIN32( _err );
+            }
+        }
+        return S_OK;
+    }
+
+    /** 次のメッセージの受信を開始します */
+    void Read( _In_ TPIPE* p ) {
+        ::ZeroMemory( &p->ov, sizeof( p->ov ) );
+        if ( !::ReadFile( p->pipe, p->buffer, sizeof( p->buffer ), NULL, &p->ov ) ) {
+            DWORD _err = ::GetLastError();
+            if ( _err != ERROR_IO_PENDING && _err != ERROR_MORE_DATA )
+                this->Close( p );
+        }
+    }
+
+    /** インスタンスを閉じます */
+    void Close( _In_ TPIPE* p ) {
+        ::CloseHandle( p->pipe );
+        m_pipes.erase( p );
+        delete p;
+    }
+
+    CsyNotifyServer( const CsyNotifyServer& );
+    CsyNotifyServer& operator=( const CsyNotifyServer& );
+};
@@ -0,0 +1,482 @@
+﻿/**
+ * @file     SylphOutputCapture.h
+ * @brief    Child process stdout/stderr capture
+ * @author   M.Horigome
+ * @version  1.0.0.0000
+ * @date     2026-10-17
+ *
+ * https://github.com/horigome/sylph
+ */
+#pragma once
+#include "stdafx.h"
+
+/** Capture 定数 */
+enum {
+    SY_CAPTURE_PIPE_SIZE    = 64 * 1024,    ///< パイプのバッファサイズ
+    SY_CAPTURE_READ_SIZE    = 16 * 1024,    ///< 1回の読み込みサイズ
+    SY_CAPTURE_RING_SIZE    = 256 * 1024,   ///< ログファイル毎のリングバッファサイズ
+    SY_CAPTURE_FLUSH_MS     = 50,           ///< 書き込みスレッドの起床間隔(ms)
+    SY_CAPTURE_REPORT_MS    = 10000,        ///< 捨てた出力をログに出す間隔(ms)
+};
+
+/**
+ * @brief Lock-free リングバッファ（Single Producer / Single Consumer）
+ *        書き込み側は空きが足りない分を捨て、決してブロックしません。
+ */
+class CsyRingBuffer {
+    std::vector<BYTE>       m_buffer;
+    size_t                  m_mask;
+    std::atomic<size_t>     m_head;     ///< 書き込み位置 (producer)
+    std::atomic<size_t>     m_tail;     ///< 読み出し位置 (consumer)
+    std::atomic<size_t>     m_dropped;  ///< 空き不足で捨てたバイト数
+public:
+    /** constructor. capacity は2のべき乗に切り上げます */
+    explicit CsyRingBuffer( _In_ size_t capacity )
+        : m_head( 0 ), m_tail( 0 ), m_dropped( 0 ) {
+        size_t _size = 4096;
+        while ( _size < capacity ) _size <<= 1;
+        m_buffer.resize( _size );
+        m_mask = _size - 1;
+    }
+
+    /** 容量 */
+    size_t Capacity( void ) const { return m_buffer.size(); }
+
+    /** 読み出し可能なバイト数 */
+    size_t Size( void ) const {
+        return m_head.load( std::memory_order_acquire ) - m_tail.load( std::memory_order_acquire );
+    }
+
+    /** 空き不足で捨てたバイト数 */
+    size_t Dropped( void ) const { return m_dropped.load( std::memory_order_relaxed ); }
+
+    /**
+     * @brief 書き込み (producer)
+     * @retval 書き込んだバイト数（空きが足りない分は捨てる）
+     */
+    size_t Write( _In_reads_bytes_( size ) const BYTE* data, _In_ size_t size ) {
+        size_t _head = m_head.load( std::memory_order_relaxed );
+        size_t _free = m_buffer.size() - ( _head - m_tail.load( std::memory_order_acquire ) );
+        size_t _len  = size < _free ? size : _free;
+
+        size_t _pos   = _head & m_mask;
+        size_t _first = ( std::min )( _len, m_buffer.size() - _pos );
+        ::CopyMemory( &m_buffer[ _pos ], data, _first );
+        if ( _len > _first )
+            ::CopyMemory( &m_buffer[ 0 ], data + _first, _len - _first );
+
+        m_head.store( _head + _len, std::memory_order_release );
+        if ( _len < size )
+            m_dropped.fetch_add( size - _len, std::memory_order_relaxed );
+        return _len;
+    }
+
+    /**
+     * @brief 読み出し可能な領域を連続した最大2つのブロックで得ます (consumer)
+     * @retval 読み出し可能なバイト数
+     */
+    size_t Peek( _Out_ const BYTE** data1_p, _Out_ size_t* size1_p,
+                 _Out_ const BYTE** data2_p, _Out_ size_t* size2_p ) const {
+        size_t _tail = m_tail.load( std::memory_order_relaxed );
+        size_t _len  = m_head.load( std::memory_order_acquire ) - _tail;
+        size_t _pos  = _tail & m_mask;
+
+        *size1_p = ( std::min )( _len, m_buffer.size() - _pos );
+        *data1_p = &m_buffer[ _pos ];
+        *size2_p = _len - *size1_p;
+        *data2_p = &m_buffer[ 0 ];
+        return _len;
+    }
+
+    /** 読み出し位置を進めます (consumer) */
+    void Consume( _In_ size_t size ) {
+        m_tail.store( m_tail.load( std::memory_order_relaxed ) + size, std::memory_order_release );
+    }
+};
+
+/**
+ * @brief ログファイル１つ分の出力先。
+ *        パイプ読み込み側がリングバッファへ積み、書き込みスレッドがファイルへ書き出します。
+ */
+class CsyCaptureSink {
+    CAtlString      m_path;
+    HANDLE          m_file;
+    CsyRingBuffer   m_ring;
+    ULONGLONG       m_written;      ///< ファイルへ書いたバイト数
+    ULONGLONG       m_failed;       ///< 書き込みに失敗して捨てたバイト数
+    ULONGLONG       m_reported;     ///< ログに出した捨てたバイト数 (書き込みスレッド)
+public:
+    CsyCaptureSink( _In_ LPCTSTR path, _In_ size_t ring_size = SY_CAPTURE_RING_SIZE )
+        : m_path( path ), m_file( INVALID_HANDLE_VALUE ), m_ring( ring_size ), m_written( 0 ), m_failed( 0 ), m_reported( 0 ) { }
+
+    ~CsyCaptureSink( void ) {
+        this->Flush();
+        if ( m_file != INVALID_HANDLE_VALUE ) ::CloseHandle( m_file );
+    }
+
+    /** ログファイルを開きます（追記） */
+    HRESULT Open( void ) {
+        m_file = ::CreateFile( m_path, FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                               NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+        if ( m_file == INVALID_HANDLE_VALUE )
+            return HRESULT_FROM_WIN32( ::GetLastError() );
+        return S_OK;
+    }
+
+    const CAtlString&   IsPath   ( void ) const { return m_path; }
+    ULONGLONG           IsWritten( void ) const { return m_written; }
+    size_t              IsDropped( void ) const { return m_ring.Dropped(); }
+    ULONGLONG           IsFailed ( void ) const { return m_failed; }
+
+    /**
+     * @brief 前回の呼び出しから捨てた出力（バッファ不足 + 書き込み失敗）のバイト数を得ます (書き込みスレッド)
+     */
+    ULONGLONG TakeLost( void ) {
+        ULONGLONG _lost = m_ring.Dropped() + m_failed;
+        ULONGLONG _diff = _lost - m_reported;
+        m_reported = _lost;
+        return _diff;
+    }
+
+    /**
+     * @brief 出力を積みます (パイプ読み込み側)
+     * @retval TRUE ... バッファが半分を超えた（書き込みスレッドを起こす）
+     */
+    BOOL Push( _In_reads_bytes_( size ) const BYTE* data, _In_ size_t size ) {
+        m_ring.Write( data, size );
+        return m_ring.Size() * 2 >= m_ring.Capacity();
+    }
+
+    /**
+     * @brief 溜まった出力をまとめてファイルへ書き出します (書き込みスレッド)
+     *        全て書き終わるまで WriteFile を繰り返し、失敗した場合は残りを捨てて m_failed に数えます。
+     */
+    void Flush( void ) {
+        const BYTE* _data[ 2 ];
+        size_t      _size[ 2 ];
+        if ( !m_ring.Peek( &_data[ 0 ], &_size[ 0 ], &_data[ 1 ], &_size[ 1 ] ) )
+            return;
+
+        for ( int i = 0; i < 2; i++ ) {
+            if ( !_size[ i ] )
+                continue;
+            size_t _done = 0;
+            while ( _done < _size[ i ] && m_file != INVALID_HANDLE_VALUE ) {
+                DWORD _written = 0;
+                if ( !::WriteFile( m_file, _data[ i ] + _done, static_cast<DWORD>( _size[ i ] - _done ), &_written, NULL ) || !_written )
+                    break;
+                _done += _written;
+            }
+            m_written += _done;
+            m_failed  += _size[ i ] - _done;
+        }
+        m_ring.Consume( _size[ 0 ] + _size[ 1 ] );
+    }
+};
+
+typedef std::shared_ptr<CsyCaptureSink> SYCAPTURESINK;
+
+/**
+ * @brief 子プロセスの stdout/stderr を取り込むクラス。
+ *
+ *        子プロセス毎に名前付きパイプを作成し、読み込みは完了ポート１つで
+ *        まとめて行います（スレッド１本）。読んだデータはログファイル毎の
+ *        リングバッファへ積み、書き込みスレッド１本がまとめてファイルへ書き出します。
+ *        ディスクが遅くてもパイプの読み込みは止まらず、子プロセスはブロックされません。
+ *        （リングバッファが一杯の場合、その分の出力は捨てられます）
+ */
+class CsyOutputCapture : public CsyThread {
+
+    /** パイプ１本分の読み込み状態 */
+    struct TPIPE_READER {
+        OVERLAPPED      ov;                             ///< 先頭に置くこと
+        HANDLE          pipe;
+        SYCAPTURESINK   sink;
+        BYTE            buffer[ SY_CAPTURE_READ_SIZE ];
+    };
+
+    /** 書き込みスレッド */
+    class CsyCaptureWriter : public CsyThread {
+        CsyOutputCapture*   m_owner;
+    public:
+        explicit CsyCaptureWriter( _In_ CsyOutputCapture* owner ) : m_owner( owner ) { }
+    protected:
+        virtual DWORD run( _In_ void* argment = NULL ) override {
+            return m_owner->WriterLoop();
+        }
+    };
+
+    HANDLE                              m_iocp;
+    HANDLE                              m_wake;         ///< 書き込みスレッドの起床
+    volatile LONG                       m_closing;
+    volatile LONG                       m_serial;       ///< パイプ名の連番
+    std::set<TPIPE_READER*>             m_readers;
+    std::map<CAtlString, SYCAPTURESINK> m_sinks;        ///< path(小文字) -> sink
+    CComAutoCriticalSection             m_lock;
+    CsyCaptureWriter                    m_writer;
+
+public:
+    CsyOutputCapture( void )
+        : m_iocp( NULL ), m_wake( NULL ), m_closing( 0 ), m_serial( 0 ), m_writer( this ) { }
+
+    virtual ~CsyOutputCapture( void ) {
+        this->Shutdown();
+    }
+
+    /**
+     * @brief 読み込みスレッドと書き込みスレッドを開始します。
+     */
+    HRESULT Startup( void ) {
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        if ( m_iocp )
+            return S_OK;
+
+        m_iocp = ::CreateIoCompletionPort( INVALID_HANDLE_VALUE, NULL, 0, 1 );
+        m_wake = ::CreateEvent( NULL, FALSE, FALSE, NULL );
+        if ( !m_iocp || !m_wake )
+            return HRESULT_FROM_WIN32( ::GetLastError() );
+
+        m_closing = 0;
+        HRESULT _hr = CsyThread::Begin( NULL );
+        if ( SUCCEEDED( _hr ) )
+            _hr = m_writer.Begin( NULL );
+        return _hr;
+    }
+
+    /**
+     * @brief 全てのパイプを閉じ、残りの出力を書き出してスレッドを終了します。
+     */
+    void Shutdown( void ) {
+        {
+            CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+            if ( !m_iocp )
+                return;
+
+            ::InterlockedExchange( &m_closing, 1 );
+            for ( auto r : m_readers )
+                ::CancelIoEx( r->pipe, &r->ov );
+            ::PostQueuedCompletionStatus( m_iocp, 0, 0, NULL );
+        }
+        CsyThread::Join();
+
+        ::SetEvent( m_wake );
+        m_writer.Join();
+
+        ::CloseHandle( m_iocp );
+        ::CloseHandle( m_wake );
+        m_iocp = NULL;
+        m_wake = NULL;
+        m_sinks.clear();
+    }
+
+    /**
+     * @brief ログファイルの出力先を得ます。同じパスは同じ出力先を共有します。
+     *
+     * @param[in] path ... ログファイルパス（相対パスは実行ディレクトリ基準）
+     * @param[out] sink ... 出力先
+     */
+    HRESULT OpenSink( _In_ const CAtlString& path, _Out_ SYCAPTURESINK& sink ) {
+        CAtlString _path = ::PathIsRelative( path ) ? sy_get_running_dir() + TEXT("\\") + path : path;
+        CAtlString _key  = _path;
+        _key.MakeLower();
+
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        auto _it = m_sinks.find( _key );
+        if ( _it != m_sinks.end() ) {
+            sink = _it->second;
+            return S_OK;
+        }
+
+        sink = std::make_shared<CsyCaptureSink>( _path );
+        HRESULT _hr = sink->Open();
+        if ( FAILED( _hr ) ) {
+            _SLOG( TEXT("! Capture file open failed. %08x : %s\n"), _hr, _path );
+            sink.reset();
+            return _hr;
+        }
+        m_sinks[ _key ] = sink;
+        return S_OK;
+    }
+
+    /**
+     * @brief 出力先に繋がるパイプを作成し、読み込みを開始します。
+     *
+     * @param[in] sink ... 出力先
+     * @param[out] child_handle ... 子プロセスへ渡す書き込み側ハンドル（継承可能）
+     *                              CreateProcess後に呼び出し側で閉じること
+     */
+    HRESULT CreatePipe( _In_ const SYCAPTURESINK& sink, _Out_ HANDLE& child_handle ) {
+        child_handle = NULL;
+        if ( !m_iocp )
+            return E_UNEXPECTED;
+
+        CAtlString _name;
+        _name.Format( TEXT("\\\\.\\pipe\\sylph-out-%d-%d"),
+                ::GetCurrentProcessId(), ::InterlockedIncrement( &m_serial ) );
+
+        auto _r = new TPIPE_READER;
+        ::ZeroMemory( &_r->ov, sizeof( _r->ov ) );
+        _r->sink = sink;
+        _r->pipe = ::CreateNamedPipe( _name,
+                        PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+                        PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                        1, 0, SY_CAPTURE_PIPE_SIZE, 0, NULL );
+        if ( _r->pipe == INVALID_HANDLE_VALUE ) {
+            HRESULT _hr = HRESULT_FROM_WIN32( ::GetLastError() );
+            delete _r;
+            return _hr;
+        }
+
+        SECURITY_ATTRIBUTES _sa = { sizeof( _sa ), NULL, TRUE };
+        child_handle = ::CreateFile( _name, GENERIC_WRITE, 0, &_sa, OPEN_EXISTING, 0, NULL );
+        if ( child_handle == INVALID_HANDLE_VALUE ||
+             !::CreateIoCompletionPort( _r->pipe, m_iocp, 0, 0 ) ) {
+            HRESULT _hr = HRESULT_FROM_WIN32( ::GetLastError() );
+            if ( child_handle != INVALID_HANDLE_VALUE ) ::CloseHandle( child_handle );
+            child_handle = NULL;
+            ::CloseHandle( _r->pipe );
+            delete _r;
+            return _hr;
+        }
+
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        m_readers.insert( _r );
+        if ( !this->Read( _r ) )
+            this->CloseReader( _r );
+        return S_OK;
+    }
+
+    /**
+     * @brief 出力先の一覧を列挙します（統計用）
+     */
+    void ForEachSink( _In_ std::function<void(const CsyCaptureSink&)> func ) {
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        for ( auto& s : m_sinks )
+            func( *s.second );
+    }
+
+protected:
+    /**
+     * @brief 読み込みスレッド。全パイプの読み込み完了を１か所で待ちます。
+     */
+    virtual DWORD run( _In_ void* argment = NULL ) override {
+        for ( ;; ) {
+            DWORD        _bytes = 0;
+            ULONG_PTR    _key   = 0;
+            LPOVERLAPPED _ov_p  = NULL;
+
+            BOOL _ret = ::GetQueuedCompletionStatus( m_iocp, &_bytes, &_key, &_ov_p, INFINITE );
+            if ( !_ov_p ) {
+                if ( !_ret )
+                    return 1;   // port closed.
+
+                // 終了要求 : 残りの読み込みがキャンセルされるのを待つ
+                CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+                if ( m_closing && m_readers.empty() )
+                    break;
+                continue;
+            }
+
+            auto _r = CONTAINING_RECORD( _ov_p, TPIPE_READER, ov );
+
+            CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+            if ( _ret && _bytes ) {
+                if ( _r->sink->Push( _r->buffer, _bytes ) )
+                    ::SetEvent( m_wake );
+            }
+
+            // 子プロセス終了(ERROR_BROKEN_PIPE) / キャンセル / 次の読み込み
+            if ( !_ret || m_closing || !this->Read( _r ) )
+                this->CloseReader( _r );
+
+            if ( m_closing && m_readers.empty() )
+                break;
+        }
+        return 0;
+    }
+
+private:
+    /** 次の読み込みを開始します（m_lock 取得済みで呼ぶ） */
+    BOOL Read( _In_ TPIPE_READER* r ) {
+        ::ZeroMemory( &r->ov, sizeof( r->ov ) );
+        if ( ::ReadFile( r->pipe, r->buffer, sizeof( r->buffer ), NULL, &r->ov ) )
+            return TRUE;
+        return ::GetLastError() == ERROR_IO_PENDING;
+    }
+
+    /** パイプを閉じます（m_lock 取得済みで呼ぶ） */
+    void CloseReader( _In_ TPIPE_READER* r ) {
+        ::CloseHandle( r->pipe );
+        m_readers.erase( r );
+        delete r;
+    }
+
+    /**
+     * @brief 書き込みスレッド。一定間隔（またはバッファが半分を超えた時）に
+     *        全ての出力先をまとめて書き出します。
+     *        捨てた出力は SY_CAPTURE_REPORT_MS 毎にログへ出し、
+     *        どのパイプからも使われなくなった出力先（reload で削除した entry など）は閉じます。
+     */
+    DWORD WriterLoop( void ) {
+        ULONGLONG _report = ::GetTickCount64() + SY_CAPTURE_REPORT_MS;
+        for ( ;; ) {
+            ::WaitForSingleObject( m_wake, SY_CAPTURE_FLUSH_MS );
+
+            std::vector<SYCAPTURESINK> _sinks;
+            {
+                CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+                for ( auto& s : m_sinks )
+                    _sinks.push_back( s.second );
+            }
+            for ( auto& s : _sinks )
+                s->Flush();
+
+            ULONGLONG _now = ::GetTickCount64();
+            if ( _now >= _report || m_closing ) {
+                _report = _now + SY_CAPTURE_REPORT_MS;
+                for ( auto& s : _sinks )
+                    this->ReportLost( *s );
+            }
+            _sinks.clear();
+            this->CloseUnused();
+
+            if ( m_closing && !CsyThread::IsAlive() )
+                break;
+        }
+        return 0;
+    }
+
+    /** 前回から捨てた出力があればログに出します (書き込みスレッド) */
+    void ReportLost( _In_ CsyCaptureSink& sink ) {
+        ULONGLONG _lost = sink.TakeLost();
+        if ( !_lost )
+            return;
+        _SLOG( TEXT("! Capture output lost. %I64u bytes : %s (total dropped %I64u, write failed %I64u)\n"),
+                _lost, sink.IsPath(), static_cast<ULONGLONG>( sink.IsDropped() ), sink.IsFailed() );
+        EVENT_WAR( TEXT("Capture output lost. %I64u bytes : %s"), _lost, sink.IsPath().GetString() );
+    }
+
+    /**
+     * @brief どのパイプからも参照されていない出力先を閉じます (書き込みスレッド)
+     *        参照は m_lock の中でしか増えないため、m_sinks だけが持っていれば使われていません。
+     */
+    void CloseUnused( void ) {
+        std::vector<SYCAPTURESINK> _closing;
+        {
+            CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+            for ( auto _it = m_sinks.begin(); _it != m_sinks.end(); ) {
+                if ( _it->second.use_count() > 1 ) {
+                    ++_it;
+                    continue;
+                }
+                _closing.push_back( _it->second );
+                _it = m_sinks.erase( _it );
+            }
+        }
+        // 最後の参照 (_closing) が外れた時に残りを書き出してファイルを閉じる
+        for ( auto& s : _closing ) {
+            s->Flush();
+            this->ReportLost( *s );
+        }
+    }
+};
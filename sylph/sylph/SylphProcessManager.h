@@ -9,47 +9,657 @@
  */
 #pragma once
 #include "stdafx.h"
+#include "SylphOutputCapture.h"
+#include "SylphResourceSampler.h"
+#include "SylphListenSockets.h"
+#include "SylphNotify.h"
+#include "SylphWatchdog.h"
+
+/** Supervisor 定数 */
+enum {
+    SY_KEY_QUIT             = 0,        ///< CompletionKey : supervisor loop 終了
+    SY_KEY_WAKE             = 1,        ///< CompletionKey : タイマーの再計算のみ
+    SY_KEY_NOTIFY           = 2,        ///< CompletionKey : 通知チャネル (READY/STATUS/WATCHDOG)
+    SY_KEY_FIRST            = 3,        ///< CompletionKey : プロセス毎のキーの開始値
+    SY_SUPERVISOR_SWEEP_MS  = 5000,     ///< 取りこぼし確認の間隔(ms)
+    SY_KILL_WAIT_MS         = 5000,     ///< TerminateProcess後の終了待ち(ms)
+    SY_STOP_TIMEOUT_MS      = 5000,     ///< 停止要求からKillまでの猶予(ms) Default
+    SY_STOP_PROGRESS_MS     = 1000,     ///< 停止を待つ間に進捗を報告する間隔(ms)
+    SY_RETRY_DELAY_MS       = 1000,     ///< 再起動待ちの初期値(ms) Default
+    SY_RETRY_DELAY_MAX_MS   = 60000,    ///< 再起動待ちの上限(ms) Default
+    SY_CRASH_LOOP_WINDOW_S  = 60,       ///< crash loop 判定期間(sec) Default
+    SY_CRASH_LOOP_LIMIT     = 5,        ///< crash loop 判定回数 Default
+    SY_INSTANCES_LIMIT      = 64,       ///< entry毎の replica 数の上限
+    SY_SCALE_UP_PERCENT     = 75,       ///< scale up する CPU 使用率(%, 1コア = 100) Default
+    SY_SCALE_DOWN_PERCENT   = 25,       ///< scale down する CPU 使用率(%, 1コア = 100) Default
+    SY_SCALE_COOLDOWN_S     = 60,       ///< scale 後に次の scale を待つ時間(sec) Default
+    SY_SCALE_SUSTAIN        = 3,        ///< scale するまでに閾値を超え続ける採取回数
+    SY_ROLLING_SURGE        = 1,        ///< rolling restart で replica 数を超えて起動する数 Default
+    SY_ROLLING_UNAVAILABLE  = 0,        ///< rolling restart で replica 数を下回ってよい数 Default
+    SY_READY_WAIT_MS        = 1000,     ///< 起動後この時間動き続けたら ready とみなす(ms) Default
+    SY_READY_TIMEOUT_MS     = 60000,    ///< rolling restart で ready を待つ上限(ms) Default
+    SY_READY_POLL_MS        = 50,       ///< ready を待つ間に終了を確認する間隔(ms)
+    SY_NOTIFY_ORPHAN_MS     = 5000,     ///< 管理リストへの追加前に届いた通知を保持する時間(ms)
+    SY_RECYCLE_MEMORY_FOR_S = 60,       ///< recycle : memory を超え続けたら再起動する時間(sec) Default
+    SY_RECYCLE_PARALLEL     = 1,        ///< recycle : entry 毎に同時に再起動する数 Default
+};
+
+/** <numa_node>auto : 起動順に node を割り当てる */
+const int SY_NUMA_AUTO = -2;
+
+/** CsyProcess::Stop() : 設定(stop_timeout)の猶予時間を使う */
+const DWORD SY_STOP_BY_CONFIG = static_cast<DWORD>( -2 );
+
+/**
+ * @brief 停止要求の種類 (<stop_signal>)
+ */
+enum SY_STOP_SIGNAL {
+    SY_STOP_CTRL_C = 0,     ///< ctrl_c     : Ctrl-C を送る (Default)
+    SY_STOP_CTRL_BREAK,     ///< ctrl_break : Ctrl-Break を送る
+    SY_STOP_CLOSE,          ///< close      : WM_CLOSE を送る
+    SY_STOP_KILL,           ///< kill       : 停止要求を送らず即Kill
+};
+
+
 
 /**
  * @brief プロセス毎の設定情報クラス。
  */
 class CsyProcConfig {
 public:
-    CAtlString m_commandline;
-    UINT       m_max_retry;      // not impl.
+    CAtlString              m_commandline;
+    UINT                    m_max_retry;      ///< 連続再起動の上限 (0.. 再起動しない)
+    CAtlString              m_name;           ///< entry名（depends_onで参照）
+    std::vector<CAtlString> m_depends_on;     ///< 先に起動するentry名
+    UINT                    m_group;          ///< 起動グループ（小さい順に起動）
+    SY_STOP_SIGNAL          m_stop_signal;    ///< 停止要求の種類
+    DWORD                   m_stop_timeout;   ///< 停止要求からKillまでの猶予(ms)
+    DWORD                   m_retry_delay;    ///< 再起動待ちの初期値(ms) 失敗毎に倍
+    DWORD                   m_retry_delay_max;///< 再起動待ちの上限(ms)
+    DWORD                   m_crash_window;   ///< crash loop 判定期間(sec)
+    UINT                    m_crash_limit;    ///< 判定期間内の異常終了がこの回数を超えたら停止(park)
+    CAtlString              m_stdout;         ///< 標準出力のログファイル（空.. 取り込まない）
+    CAtlString              m_stderr;         ///< 標準エラー出力のログファイル（空.. m_stdout）
+    UINT                    m_cpu_rate;       ///< CPU使用率の上限(%, 全CPU = 100) 0.. 制限しない
+    DWORD                   m_memory_limit;   ///< コミットメモリの上限(MB, 子孫プロセスを含む) 0.. 制限しない
+    DWORD                   m_priority;       ///< 優先度クラス 0.. 変更しない
+    ULONGLONG               m_cpu_set;        ///< CPU affinity mask 0.. 指定しない
+    BOOL                    m_cpu_auto;       ///< cpu_set auto : 起動順に1コアずつ割り当てる
+    int                     m_numa_node;      ///< NUMA node -1.. 指定しない  SY_NUMA_AUTO.. 起動順に割り当てる
+    UINT                    m_instances_min;  ///< replica 数の下限（起動時の数）
+    UINT                    m_instances_max;  ///< replica 数の上限（min より大きい場合は autoscale）
+    UINT                    m_scale_up;       ///< replica 平均の CPU 使用率がこれ以上なら増やす(%, 1コア = 100)
+    UINT                    m_scale_down;     ///< replica 平均の CPU 使用率がこれ以下なら減らす(%, 1コア = 100)
+    DWORD                   m_scale_cooldown; ///< scale 後に次の scale を待つ時間(sec)
+    std::vector<CAtlString> m_listen;         ///< supervisor が待ち受けて子へ継承するアドレス ("host:port")
+    UINT                    m_surge;          ///< rolling restart で replica 数を超えて起動する数
+    UINT                    m_unavailable;    ///< rolling restart で replica 数を下回ってよい数
+    DWORD                   m_ready_wait;     ///< 起動後この時間(ms)動き続けたら ready とみなす
+    DWORD                   m_ready_timeout;  ///< ready を待つ上限(ms) (rolling restart / notify)
+    BOOL                    m_notify;         ///< 通知チャネル (NOTIFY_SOCKET) の READY で ready とする
+    DWORD                   m_watchdog;       ///< この時間(ms)生存通知が無ければ強制終了する (0.. 無効)
+    DWORD                   m_recycle_memory;     ///< Working set がこれ(MB)を超え続けたら再起動する (0.. 無効)
+    DWORD                   m_recycle_memory_for; ///< memory を超え続ける時間(sec)
+    DWORD                   m_recycle_uptime;     ///< 起動からこの時間(hour)経ったら再起動する (0.. 無効)
+    UINT                    m_recycle_parallel;   ///< entry 毎に同時に再起動する数
 public:
     CsyProcConfig( _In_ LPCTSTR commandline = NULL,
                    _In_ UINT    max_retry   = 0 ) 
         : m_commandline( commandline ),
-          m_max_retry  ( max_retry   ) { }
+          m_max_retry  ( max_retry   ),
+          m_group      ( 0 ),
+          m_stop_signal ( SY_STOP_CTRL_C ),
+          m_stop_timeout( SY_STOP_TIMEOUT_MS ),
+          m_retry_delay    ( SY_RETRY_DELAY_MS ),
+          m_retry_delay_max( SY_RETRY_DELAY_MAX_MS ),
+          m_crash_window   ( SY_CRASH_LOOP_WINDOW_S ),
+          m_crash_limit    ( SY_CRASH_LOOP_LIMIT ),
+          m_cpu_rate       ( 0 ),
+          m_memory_limit   ( 0 ),
+          m_priority       ( 0 ),
+          m_cpu_set        ( 0 ),
+          m_cpu_auto       ( FALSE ),
+          m_numa_node      ( -1 ),
+          m_instances_min  ( 1 ),
+          m_instances_max  ( 1 ),
+          m_scale_up       ( SY_SCALE_UP_PERCENT ),
+          m_scale_down     ( SY_SCALE_DOWN_PERCENT ),
+          m_scale_cooldown ( SY_SCALE_COOLDOWN_S ),
+          m_surge          ( SY_ROLLING_SURGE ),
+          m_unavailable    ( SY_ROLLING_UNAVAILABLE ),
+          m_ready_wait     ( SY_READY_WAIT_MS ),
+          m_ready_timeout  ( SY_READY_TIMEOUT_MS ),
+          m_notify         ( FALSE ),
+          m_watchdog       ( 0 ),
+          m_recycle_memory     ( 0 ),
+          m_recycle_memory_for ( SY_RECYCLE_MEMORY_FOR_S ),
+          m_recycle_uptime     ( 0 ),
+          m_recycle_parallel   ( SY_RECYCLE_PARALLEL ) { }
 
     ~CsyProcConfig( void ) = default;
-        
+
+    /** 全項目が同じか（reload で変更の有無を判定します） */
+    bool operator==( _In_ const CsyProcConfig& r ) const {
+        return m_commandline     == r.m_commandline     &&
+               m_max_retry       == r.m_max_retry       &&
+               m_name            == r.m_name            &&
+               m_depends_on      == r.m_depends_on      &&
+               m_group           == r.m_group           &&
+               m_stop_signal     == r.m_stop_signal     &&
+               m_stop_timeout    == r.m_stop_timeout    &&
+               m_retry_delay     == r.m_retry_delay     &&
+               m_retry_delay_max == r.m_retry_delay_max &&
+               m_crash_window    == r.m_crash_window    &&
+               m_crash_limit     == r.m_crash_limit     &&
+               m_stdout          == r.m_stdout          &&
+               m_stderr          == r.m_stderr          &&
+               m_cpu_rate        == r.m_cpu_rate        &&
+               m_memory_limit    == r.m_memory_limit    &&
+               m_priority        == r.m_priority        &&
+               m_cpu_set         == r.m_cpu_set         &&
+               m_cpu_auto        == r.m_cpu_auto        &&
+               m_numa_node       == r.m_numa_node       &&
+               m_instances_min   == r.m_instances_min   &&
+               m_instances_max   == r.m_instances_max   &&
+               m_scale_up        == r.m_scale_up        &&
+               m_scale_down      == r.m_scale_down      &&
+               m_scale_cooldown  == r.m_scale_cooldown  &&
+               m_listen          == r.m_listen          &&
+               m_surge           == r.m_surge           &&
+               m_unavailable     == r.m_unavailable     &&
+               m_ready_wait      == r.m_ready_wait      &&
+               m_ready_timeout   == r.m_ready_timeout   &&
+               m_notify          == r.m_notify          &&
+               m_watchdog        == r.m_watchdog        &&
+               m_recycle_memory     == r.m_recycle_memory     &&
+               m_recycle_memory_for == r.m_recycle_memory_for &&
+               m_recycle_uptime     == r.m_recycle_uptime     &&
+               m_recycle_parallel   == r.m_recycle_parallel;
+    }
+    bool operator!=( _In_ const CsyProcConfig& r ) const { return !( *this == r ); }
+
     void Clear( void ) {
         m_commandline = TEXT("");
+        m_name        = TEXT("");
+        m_depends_on.clear();
+        m_group       = 0;
+        m_stop_signal  = SY_STOP_CTRL_C;
+        m_stop_timeout = SY_STOP_TIMEOUT_MS;
+        m_max_retry       = 0;
+        m_retry_delay     = SY_RETRY_DELAY_MS;
+        m_retry_delay_max = SY_RETRY_DELAY_MAX_MS;
+        m_crash_window    = SY_CRASH_LOOP_WINDOW_S;
+        m_crash_limit     = SY_CRASH_LOOP_LIMIT;
+        m_stdout          = TEXT("");
+        m_stderr          = TEXT("");
+        m_cpu_rate        = 0;
+        m_memory_limit    = 0;
+        m_priority        = 0;
+        m_cpu_set         = 0;
+        m_cpu_auto        = FALSE;
+        m_numa_node       = -1;
+        m_instances_min   = 1;
+        m_instances_max   = 1;
+        m_scale_up        = SY_SCALE_UP_PERCENT;
+        m_scale_down      = SY_SCALE_DOWN_PERCENT;
+        m_scale_cooldown  = SY_SCALE_COOLDOWN_S;
+        m_listen.clear();
+        m_surge           = SY_ROLLING_SURGE;
+        m_unavailable     = SY_ROLLING_UNAVAILABLE;
+        m_ready_wait      = SY_READY_WAIT_MS;
+        m_ready_timeout   = SY_READY_TIMEOUT_MS;
+        m_notify          = FALSE;
+        m_watchdog        = 0;
+        m_recycle_memory     = 0;
+        m_recycle_memory_for = SY_RECYCLE_MEMORY_FOR_S;
+        m_recycle_uptime     = 0;
+        m_recycle_parallel   = SY_RECYCLE_PARALLEL;
+    }
+
+    /** メモリ使用量 / 起動からの時間で再起動 (recycle) するか */
+    BOOL IsRecycle( void ) const {
+        return m_recycle_memory || m_recycle_uptime;
+    }
+
+    /** replica 数を負荷に合わせて増減するか */
+    BOOL IsAutoscale( void ) const {
+        return m_instances_max > m_instances_min;
+    }
+
+    /**
+     * @brief 設定値の組み合わせを補正します。（全項目を設定した後に呼ぶ）
+     */
+    void Normalize( void ) {
+        if ( m_instances_min < 1 )                  m_instances_min = 1;
+        if ( m_instances_min > SY_INSTANCES_LIMIT ) m_instances_min = SY_INSTANCES_LIMIT;
+        if ( m_instances_max < m_instances_min )    m_instances_max = m_instances_min;
+        if ( m_instances_max > SY_INSTANCES_LIMIT ) m_instances_max = SY_INSTANCES_LIMIT;
+        if ( m_recycle_parallel < 1 )               m_recycle_parallel = 1;
+        if ( m_scale_down >= m_scale_up ) {
+            if ( this->IsAutoscale() )      // autoscale しない entry の既定値は報告しない
+                _SLOG( TEXT("[WAR] instances scale_down(%d) >= scale_up(%d). use %d. [%s]\n"), 
+                        m_scale_down, m_scale_up, m_scale_up / 2, m_name );
+            m_scale_down = m_scale_up / 2;
+        }
+    }
+
+    /** entry の配置に起動順の割り当て (auto) を使うか */
+    BOOL IsAutoPlacement( void ) const {
+        return m_cpu_auto || m_numa_node == SY_NUMA_AUTO;
+    }
+
+    /**
+     * @brief stop_signal を設定します。(ctrl_c / ctrl_break / close / kill)
+     * @retval FALSE ... 不明な値（変更しない）
+     */
+    BOOL SetStopSignal( _In_ const CAtlString& signal ) {
+        static const struct { LPCTSTR name; SY_STOP_SIGNAL value; } _TABLE[] = {
+            { TEXT("ctrl_c"),     SY_STOP_CTRL_C     },
+            { TEXT("ctrl_break"), SY_STOP_CTRL_BREAK },
+            { TEXT("close"),      SY_STOP_CLOSE      },
+            { TEXT("kill"),       SY_STOP_KILL       },
+        };
+        for ( auto& t : _TABLE ) 
+            if ( signal.CompareNoCase( t.name ) == 0 ) {
+                m_stop_signal = t.value;
+                return TRUE;
+            }
+        return FALSE;
+    }
+
+    /**
+     * @brief priority を設定します。(idle / below_normal / normal / above_normal / high)
+     * @retval FALSE ... 不明な値（変更しない）
+     */
+    BOOL SetPriority( _In_ const CAtlString& priority ) {
+        static const struct { LPCTSTR name; DWORD value; } _TABLE[] = {
+            { TEXT("idle"),         IDLE_PRIORITY_CLASS         },
+            { TEXT("below_normal"), BELOW_NORMAL_PRIORITY_CLASS },
+            { TEXT("normal"),       NORMAL_PRIORITY_CLASS       },
+            { TEXT("above_normal"), ABOVE_NORMAL_PRIORITY_CLASS },
+            { TEXT("high"),         HIGH_PRIORITY_CLASS         },
+        };
+        for ( auto& t : _TABLE ) 
+            if ( priority.CompareNoCase( t.name ) == 0 ) {
+                m_priority = t.value;
+                return TRUE;
+            }
+        return FALSE;
+    }
+
+    /**
+     * @brief cpu_set を設定します。("0-3,8" のような CPU 番号のリスト、または auto)
+     * @retval FALSE ... 不明な値（変更しない）
+     */
+    BOOL SetCpuSet( _In_ const CAtlString& cpu_set ) {
+        if ( cpu_set.CompareNoCase( TEXT("auto") ) == 0 ) {
+            m_cpu_set  = 0;
+            m_cpu_auto = TRUE;
+            return TRUE;
+        }
+
+        ULONGLONG _mask = 0;
+        int       _pos  = 0;
+        for ( CAtlString _tok = cpu_set.Tokenize( TEXT(", \t"), _pos ); 
+              _pos >= 0; _tok = cpu_set.Tokenize( TEXT(", \t"), _pos ) ) {
+            LPTSTR _end  = NULL;
+            ULONG  _from = ::_tcstoul( _tok, &_end, 10 );
+            ULONG  _to   = ( *_end == TEXT('-') ) ? ::_tcstoul( _end + 1, &_end, 10 ) : _from;
+            if ( *_end || _from > _to || _to >= 64 ) 
+                return FALSE;
+            for ( ULONG i = _from; i <= _to; i++ ) 
+                _mask |= 1ULL << i;
+        }
+        m_cpu_set  = _mask;
+        m_cpu_auto = FALSE;
+        return TRUE;
+    }
+
+    /**
+     * @brief numa_node を設定します。(node 番号、または auto)
+     * @retval FALSE ... 不明な値（変更しない）
+     */
+    BOOL SetNumaNode( _In_ const CAtlString& numa_node ) {
+        if ( numa_node.CompareNoCase( TEXT("auto") ) == 0 ) {
+            m_numa_node = SY_NUMA_AUTO;
+            return TRUE;
+        }
+        LPTSTR _end  = NULL;
+        ULONG  _node = ::_tcstoul( numa_node, &_end, 10 );
+        if ( *_end || _node > 0xFFFF ) 
+            return FALSE;
+        m_numa_node = static_cast<int>( _node );
+        return TRUE;
+    }
+
+    /**
+     * @brief depends_on を設定します。（カンマ/空白区切り）
+     */
+    void SetDependsOn( _In_ const CAtlString& depends_on ) {
+        m_depends_on.clear();
+        int _pos = 0;
+        for ( CAtlString _tok = depends_on.Tokenize( TEXT(", \t"), _pos ); 
+              _pos >= 0; _tok = depends_on.Tokenize( TEXT(", \t"), _pos ) )
+            m_depends_on.push_back( _tok );
+    }
+
+    /**
+     * @brief <process> 直下の要素を1つ設定します。
+     *
+     * @param[in] name ... 要素名 (command, name, group, ...)
+     * @param[in] value ... 要素のテキスト
+     * @retval FALSE ... 不明な要素名、または不明な値
+     */
+    BOOL SetElement( _In_ const CAtlString& name, _In_ const CAtlString& value ) {
+        CAtlString _value( value );
+        _value.Trim();
+
+        if ( name == TEXT("command")    ) { m_commandline = value;  return TRUE; }
+        if ( name == TEXT("name")       ) { m_name        = _value; return TRUE; }
+        if ( name == TEXT("depends_on") ) { this->SetDependsOn( _value ); return TRUE; }
+        if ( name == TEXT("stdout")     ) { m_stdout      = _value; return TRUE; }
+        if ( name == TEXT("stderr")     ) { m_stderr      = _value; return TRUE; }
+        if ( name == TEXT("stop_signal") )
+            return _value.IsEmpty() || this->SetStopSignal( _value );
+        if ( name == TEXT("priority") )
+            return _value.IsEmpty() || this->SetPriority( _value );
+        if ( name == TEXT("cpu_set") )
+            return _value.IsEmpty() || this->SetCpuSet( _value );
+        if ( name == TEXT("numa_node") )
+            return _value.IsEmpty() || this->SetNumaNode( _value );
+
+        if ( name == TEXT("group")             ) { sy_parse_number( _value, m_group );           return TRUE; }
+        if ( name == TEXT("stop_timeout")      ) { sy_parse_number( _value, m_stop_timeout );    return TRUE; }
+        if ( name == TEXT("max_retry")         ) { sy_parse_number( _value, m_max_retry );       return TRUE; }
+        if ( name == TEXT("retry_delay")       ) { sy_parse_number( _value, m_retry_delay );     return TRUE; }
+        if ( name == TEXT("retry_delay_max")   ) { sy_parse_number( _value, m_retry_delay_max ); return TRUE; }
+        if ( name == TEXT("crash_loop_window") ) { sy_parse_number( _value, m_crash_window );    return TRUE; }
+        if ( name == TEXT("crash_loop_limit")  ) { sy_parse_number( _value, m_crash_limit );     return TRUE; }
+        if ( name == TEXT("cpu_rate")          ) { sy_parse_number( _value, m_cpu_rate );        return TRUE; }
+        if ( name == TEXT("memory_limit")      ) { sy_parse_number( _value, m_memory_limit );    return TRUE; }
+        if ( name == TEXT("watchdog")          ) { sy_parse_number( _value, m_watchdog );        return TRUE; }
+        if ( name == TEXT("rolling") || name == TEXT("recycle") ) 
+            return TRUE;    // 属性のみ
+        if ( name == TEXT("notify") ) {
+            m_notify = ( _value == TEXT("1") || _value.CompareNoCase( TEXT("true") ) == 0 ||
+                         _value.CompareNoCase( TEXT("yes") ) == 0 );
+            return TRUE;
+        }
+        if ( name == TEXT("listen") ) {
+            // 複数の <listen> またはカンマ/空白区切り
+            int _pos = 0;
+            for ( CAtlString _tok = _value.Tokenize( TEXT(", \t"), _pos ); 
+                  _pos >= 0; _tok = _value.Tokenize( TEXT(", \t"), _pos ) )
+                m_listen.push_back( _tok );
+            return TRUE;
+        }
+        if ( name == TEXT("instances") ) {
+            // <instances>N</instances> .. 固定数
+            if ( !_value.IsEmpty() ) {
+                sy_parse_number( _value, m_instances_min );
+                m_instances_max = m_instances_min;
+            }
+            return TRUE;
+        }
+        return FALSE;
+    }
+
+    /**
+     * @brief <process> 直下の要素の属性を1つ設定します。
+     *        <instances min="1" max="4" scale_up="75" scale_down="25" cooldown="60"/>
+     *        <rolling surge="1" unavailable="0" ready_wait="1000" ready_timeout="60000"/>
+     *        <recycle memory="512" memory_for="60" uptime="24" parallel="1"/>
+     *
+     * @param[in] element ... 要素名
+     * @param[in] name ... 属性名
+     * @param[in] value ... 属性値
+     * @retval FALSE ... 不明な属性名
+     */
+    BOOL SetAttribute( _In_ const CAtlString& element, _In_ const CAtlString& name, _In_ const CAtlString& value ) {
+        CAtlString _value( value );
+        _value.Trim();
+
+        if ( element == TEXT("instances") ) {
+            if ( name == TEXT("min")        ) { sy_parse_number( _value, m_instances_min );  return TRUE; }
+            if ( name == TEXT("max")        ) { sy_parse_number( _value, m_instances_max );  return TRUE; }
+            if ( name == TEXT("scale_up")   ) { sy_parse_number( _value, m_scale_up );       return TRUE; }
+            if ( name == TEXT("scale_down") ) { sy_parse_number( _value, m_scale_down );     return TRUE; }
+            if ( name == TEXT("cooldown")   ) { sy_parse_number( _value, m_scale_cooldown ); return TRUE; }
+        }
+        if ( element == TEXT("rolling") ) {
+            if ( name == TEXT("surge")         ) { sy_parse_number( _value, m_surge );         return TRUE; }
+            if ( name == TEXT("unavailable")   ) { sy_parse_number( _value, m_unavailable );   return TRUE; }
+            if ( name == TEXT("ready_wait")    ) { sy_parse_number( _value, m_ready_wait );    return TRUE; }
+            if ( name == TEXT("ready_timeout") ) { sy_parse_number( _value, m_ready_timeout ); return TRUE; }
+        }
+        if ( element == TEXT("recycle") ) {
+            if ( name == TEXT("memory")     ) { sy_parse_number( _value, m_recycle_memory );     return TRUE; }
+            if ( name == TEXT("memory_for") ) { sy_parse_number( _value, m_recycle_memory_for ); return TRUE; }
+            if ( name == TEXT("uptime")     ) { sy_parse_number( _value, m_recycle_uptime );     return TRUE; }
+            if ( name == TEXT("parallel")   ) { sy_parse_number( _value, m_recycle_parallel );   return TRUE; }
+        }
+        return FALSE;
     }
 };
 
 typedef std::vector<CsyProcConfig> SYCONFIGS;
 
+/**
+ * @brief プロセス状態
+ */
+enum SY_PROC_STATE {
+    SY_PROC_STOPPED = 0,    ///< 停止（未起動）
+    SY_PROC_RUNNING,        ///< 実行中
+    SY_PROC_EXITED,         ///< プロセスが自ら終了した（再起動しない）
+    SY_PROC_BACKOFF,        ///< 再起動待ち
+    SY_PROC_PARKED,         ///< crash loop のため再起動を停止した
+};
+
+/**
+ * @brief 再起動の待ち時間(ms)を求めます。
+ *        retry_delay * 2^retry (上限 retry_delay_max) の後半50%をランダムにしたものです。
+ *
+ * @param[in] retry_delay ... 初回の待ち時間(ms)
+ * @param[in] retry_delay_max ... 待ち時間の上限(ms)
+ * @param[in] retry ... これまでの連続回数 (0.. 初回)
+ * @param[in] random ... ジッタ用の乱数
+ */
+inline ULONGLONG
+sy_backoff_delay( _In_ DWORD retry_delay,
+                  _In_ DWORD retry_delay_max,
+                  _In_ UINT  retry,
+                  _In_ UINT  random ) {
+    ULONGLONG _delay = retry_delay;
+    for ( UINT i = 0; i < retry && _delay < retry_delay_max; i++ ) 
+        _delay *= 2;
+    if ( _delay > retry_delay_max ) 
+        _delay = retry_delay_max;
+    return _delay / 2 + ( _delay / 2 ? random % ( _delay / 2 + 1 ) : 0 );
+}
+
+/**
+ * @brief entry の配置 (cpu_set / numa_node) を決めます。
+ *
+ *        numa_node を指定し cpu_set を指定しない場合は、その node の CPU に限定します。
+ *        auto の場合は slot（起動順の通し番号）で node / コアを順番に割り当て、
+ *        同じ entry の複数のプロセスを node / コアに分散させます。
+ *
+ * @param[in] config ... プロセス設定
+ * @param[in] slot ... 起動順の通し番号 (auto で使う)
+ * @param[in,out] option ... m_affinity / m_numa_node を設定します
+ */
+inline void
+sy_resolve_placement( _In_    const CsyProcConfig&  config,
+                      _In_    UINT                  slot,
+                      _Inout_ CsySpawnOption&       option ) {
+
+    KAFFINITY _mask = static_cast<KAFFINITY>( config.m_cpu_set );
+    int       _node = config.m_numa_node;
+
+    if ( _node == SY_NUMA_AUTO ) {
+        ULONG _highest = 0;
+        ::GetNumaHighestNodeNumber( &_highest );
+        _node = static_cast<int>( slot % ( _highest + 1 ) );
+    }
+
+    // 候補の CPU（node の CPU / 全 CPU）
+    KAFFINITY _candidates = 0;
+    ULONGLONG _node_mask  = 0;
+    if ( _node >= 0 && ::GetNumaNodeProcessorMask( static_cast<UCHAR>( _node ), &_node_mask ) ) 
+        _candidates = static_cast<KAFFINITY>( _node_mask );
+    if ( !_candidates ) {
+        DWORD_PTR _process_mask = 0, _system_mask = 0;
+        ::GetProcessAffinityMask( ::GetCurrentProcess(), &_process_mask, &_system_mask );
+        _candidates = _system_mask;
+    }
+
+    if ( config.m_cpu_auto ) {
+        // 候補のうち (slot % 候補数) 番目のコア
+        UINT _count = 0;
+        for ( KAFFINITY m = _candidates; m; m &= m - 1 ) _count++;
+        UINT _nth = _count ? slot % _count : 0;
+        for ( KAFFINITY m = _candidates; m; m &= m - 1 ) {
+            if ( _nth-- == 0 ) { _mask = m & ( ~m + 1 ); break; }
+        }
+    } else if ( !_mask && _node >= 0 && _node_mask ) {
+        _mask = _candidates;
+    }
+
+    option.m_affinity  = _mask;
+    option.m_numa_node = _node;
+}
+
+class CsyProcess;
+
+/**
+ * @brief プロセスの状態変化の通知先（control の event 購読）
+ */
+class IsyProcessObserver {
+public:
+    virtual ~IsyProcessObserver( void ) { }
+
+    /**
+     * @brief 状態が変わった時、READY になった時に呼ばれます。
+     *        supervisor のロックを保持したまま呼ばれることがあるため、内容を複写してすぐに戻ること。
+     */
+    virtual void OnProcessEvent( _In_ const CsyProcess& process ) = 0;
+};
+
+/**
+ * @brief 実行中の子プロセスの記録先（supervisor の再起動後に子プロセスを引き継ぐ）
+ *        状態変化は OnProcessEvent() で受け取ります。
+ */
+class IsyProcessJournal : public IsyProcessObserver {
+public:
+    /**
+     * @brief 起動の代わりに引き継ぐプロセスを探します。
+     * @param[in] config ... 起動する entry の設定
+     * @param[in] replica ... 起動する replica 番号
+     * @param[out] info ... 引き継ぐプロセス (hProcess / dwProcessId)。ハンドルの所有権は呼び出し側へ移ります
+     * @retval TRUE ... 引き継ぐプロセスがある
+     */
+    virtual BOOL Adopt( _In_ const CsyProcConfig& config, _In_ UINT replica, _Out_ PROCESS_INFORMATION& info ) = 0;
+};
+
 /**
  * @brief プロセスクラス。
- *        プロセス毎にスレッドで終了待ちを行うクラス
+ *        スレッドは持たず、終了通知は Job Object 経由で
+ *        CsylphProcessManager の完了ポートに届きます。
  */
-class CsyProcess : public CsyThread {
-    HANDLE              m_event;        ///< end trigger
+class CsyProcess {
+    ULONG_PTR           m_key;          ///< completion key
+    HANDLE              m_job;          ///< job object (exit notification)
+    HANDLE              m_drain_job;    ///< Kill した子孫プロセスの終了 (ACTIVE_PROCESS_ZERO) を待っている job
+    ULONGLONG           m_drain_until;  ///< m_drain_job を待つ期限 (GetTickCount64)
+    BOOL                m_kill_sent;    ///< Kill() で終了させた（Stop で Kill として記録する）
     PROCESS_INFORMATION m_proc_info;    ///< process information
     CsyProcConfig       m_config;
-    HRESULT             m_status;
+    SY_PROC_STATE       m_state;
+    DWORD               m_exit_code;
+    FILETIME            m_signal_time;      ///< 停止要求を送った時刻 (0.. 未送信)
+    double              m_stop_latency_ms;  ///< 最後の停止に要した時間(ms)
+    BOOL                m_stop_killed;      ///< 最後の停止でKillしたか
+    HANDLE              m_iocp;             ///< 終了通知先（再起動で使う）
+    ULONGLONG           m_start_tick;       ///< 起動時刻 (GetTickCount64)
+    LONGLONG            m_exit_counter;     ///< 異常終了を検知した時刻 (sy_perf_counter)
+    ULONGLONG           m_restart_at;       ///< 再起動予定時刻 (GetTickCount64)
+    UINT                m_retry;            ///< 連続再起動回数
+    UINT                m_restart_count;    ///< 再起動の累計
+    double              m_recovery_ms;      ///< 最後の異常終了から再起動完了までの時間(ms)
+    std::vector<ULONGLONG> m_failures;      ///< crash loop 判定期間内の異常終了時刻
+    CsyOutputCapture*   m_capture;          ///< stdout/stderr の取り込み先
+    UINT                m_limit_hits;       ///< リソース制限に達した回数
+    BOOL                m_cpu_throttled;    ///< CPU使用率が上限に張り付いているか
+    UINT                m_slot;             ///< 配置 (auto) の通し番号
+    UINT                m_replica;          ///< entry 内の replica 番号 (0..)
+    std::vector<SOCKET> m_listen;           ///< 継承させる待ち受けソケット (<listen> の順)
+    LONGLONG            m_spawn_counter;    ///< 起動を開始した時刻 (sy_perf_counter)
+    BOOL                m_ready;            ///< READY を受信した (notify)
+    double              m_ready_ms;         ///< 起動から READY までの時間(ms)
+    CAtlString          m_status;           ///< 最後に受信した STATUS
+    ULONGLONG           m_watchdog_tick;    ///< 最後に WATCHDOG を受信した時刻 (GetTickCount64)
+    CsyHeartbeatTable*  m_heartbeat;        ///< heartbeat の共有メモリ (watchdog)
+    int                 m_heartbeat_slot;   ///< heartbeat の slot (-1.. 未割り当て)
+    LONG64              m_beat_value;       ///< 最後に読んだ heartbeat の値
+    ULONGLONG           m_beat_tick;        ///< 最後に生存を確認した時刻 (GetTickCount64)
+    IsyProcessObserver* m_observer;         ///< 状態変化の通知先 (NULL.. 通知しない)
+    IsyProcessJournal*  m_journal;          ///< 実行中の子プロセスの記録先 (NULL.. 記録しない)
+    BOOL                m_adopted;          ///< 前の supervisor から引き継いだプロセスか
+    BOOL                m_recycling;        ///< recycle の停止要求を送った（終了後すぐに起動し直す）
+    ULONGLONG           m_memory_over_tick; ///< Working set が recycle memory を超え始めた時刻 (0.. 超えていない)
+    UINT                m_recycle_count;    ///< recycle の累計
 public:
     /** constructor */
-    CsyProcess( void ) : m_event( INVALID_HANDLE_VALUE ) {
-        ::ZeroMemory( &m_proc_info, sizeof(m_proc_info) ); 
+    CsyProcess( _In_ ULONG_PTR              key, 
+                _In_ const CsyProcConfig&   config, 
+                _In_ CsyOutputCapture*      capture = NULL,
+                _In_ UINT                   slot    = 0,
+                _In_ UINT                   replica = 0 )
+        : m_key      ( key ),
+          m_job      ( NULL ),
+          m_drain_job  ( NULL ),
+          m_drain_until( 0 ),
+          m_kill_sent  ( FALSE ),
+          m_config   ( config ),
+          m_state    ( SY_PROC_STOPPED ),
+          m_exit_code( 0 ),
+          m_stop_latency_ms( 0.0 ),
+          m_stop_killed    ( FALSE ),
+          m_iocp           ( NULL ),
+          m_start_tick     ( 0 ),
+          m_exit_counter   ( 0 ),
+          m_restart_at     ( 0 ),
+          m_retry          ( 0 ),
+          m_restart_count  ( 0 ),
+          m_recovery_ms    ( 0.0 ),
+          m_capture        ( capture ),
+          m_limit_hits     ( 0 ),
+          m_cpu_throttled  ( FALSE ),
+          m_slot           ( slot ),
+          m_replica        ( replica ),
+          m_spawn_counter  ( 0 ),
+          m_ready          ( FALSE ),
+          m_ready_ms       ( 0.0 ),
+          m_watchdog_tick  ( 0 ),
+          m_heartbeat      ( NULL ),
+          m_heartbeat_slot ( -1 ),
+          m_beat_value     ( 0 ),
+          m_beat_tick      ( 0 ),
+          m_observer       ( NULL ),
+          m_journal        ( NULL ),
+          m_adopted        ( FALSE ),
+          m_recycling      ( FALSE ),
+          m_memory_over_tick( 0 ),
+          m_recycle_count  ( 0 ) {
+        ::ZeroMemory( &m_proc_info,   sizeof(m_proc_info) ); 
+        ::ZeroMemory( &m_signal_time, sizeof(m_signal_time) ); 
     }
 
     /** destructor. 実行中のプロセスはKillされる。*/
     virtual ~CsyProcess( void ) {
         this->Stop( );
+        this->ReleaseDrain( );
+        if ( m_heartbeat ) m_heartbeat->Free( m_heartbeat_slot );
     }
 
     /**
@@ -66,6 +676,103 @@ public:
         return m_proc_info.dwThreadId;
     }
 
+    /** Completion Keyを取得 */
+    ULONG_PTR IsKey( void ) const { return m_key; }
+
+    /** 状態を取得 */
+    SY_PROC_STATE IsState( void ) const { return m_state; }
+
+    /** 最後の終了コードを取得 */
+    DWORD IsExitCode( void ) const { return m_exit_code; }
+
+    /** 最後の停止に要した時間(ms)を取得 */
+    double IsStopLatency( void ) const { return m_stop_latency_ms; }
+
+    /** 最後の停止でKillしたか */
+    BOOL IsStopKilled( void ) const { return m_stop_killed; }
+
+    /** 再起動の累計を取得 */
+    UINT IsRestartCount( void ) const { return m_restart_count; }
+
+    /** 最後の異常終了から再起動完了までの時間(ms)を取得 */
+    double IsRecoveryLatency( void ) const { return m_recovery_ms; }
+
+    /** 再起動予定時刻を取得 (GetTickCount64) */
+    ULONGLONG IsRestartAt( void ) const { return m_restart_at; }
+
+    /** プロセスハンドルを取得 */
+    HANDLE IsProcessHandle( void ) const { return m_proc_info.hProcess; }
+
+    /** 設定を取得 */
+    const CsyProcConfig& IsConfig( void ) const { return m_config; }
+
+    /** リソース制限に達した回数を取得 */
+    UINT IsLimitHits( void ) const { return m_limit_hits; }
+
+    /** entry 内の replica 番号を取得 */
+    UINT IsReplica( void ) const { return m_replica; }
+
+    /**
+     * @brief 継承させる待ち受けソケットを設定します。（ソケットは CsyListenSockets が所有します）
+     */
+    void SetListenSockets( _In_ const std::vector<SOCKET>& sockets ) { m_listen = sockets; }
+
+    /** 起動から READY までの時間(ms)を取得 (notify) */
+    double IsReadyLatency( void ) const { return m_ready_ms; }
+
+    /** 最後に受信した STATUS を取得 (notify) */
+    const CAtlString& IsStatus( void ) const { return m_status; }
+
+    /** 起動時刻を取得 (GetTickCount64) */
+    ULONGLONG IsStartTick( void ) const { return m_start_tick; }
+
+    /** READY を受信したか (notify) */
+    BOOL IsNotifiedReady( void ) const { return m_ready; }
+
+    /** 状態変化の通知先を設定します */
+    void SetObserver( _In_opt_ IsyProcessObserver* observer ) { m_observer = observer; }
+
+    /** 実行中の子プロセスの記録先を設定します */
+    void SetJournal( _In_opt_ IsyProcessJournal* journal ) { m_journal = journal; }
+
+    /** 前の supervisor から引き継いだプロセスか */
+    BOOL IsAdopted( void ) const { return m_adopted; }
+
+    /**
+     * @brief watchdog の対象から外しているか。
+     *        引き継いだプロセスの heartbeat は前の supervisor の共有メモリに書かれ、
+     *        こちらからは読めないため、次に再起動するまで対象にしません。
+     */
+    BOOL IsWatchdogExempt( void ) const { return m_adopted && m_config.m_watchdog; }
+
+    /** recycle の停止要求を送った後か */
+    BOOL IsRecycling( void ) const { return m_recycling; }
+
+    /** recycle の累計を取得 */
+    UINT IsRecycleCount( void ) const { return m_recycle_count; }
+
+    /** 最後に WATCHDOG を受信した時刻を取得 (notify, 0.. 未受信) */
+    ULONGLONG IsWatchdogTick( void ) const { return m_watchdog_tick; }
+
+    /**
+     * @brief heartbeat の共有メモリを設定します。（テーブルは CsylphProcessManager が所有します）
+     */
+    void SetHeartbeat( _In_ CsyHeartbeatTable* table ) { m_heartbeat = table; }
+
+    /**
+     * @brief 起動したプロセスが処理を受け付けられる状態か確認します。
+     *        notify の場合は READY を受信していれば、
+     *        それ以外は起動後 ready_wait の間、終了せずに動き続けていれば ready とみなします。
+     * @param[in] now ... 現在時刻 (GetTickCount64)
+     */
+    BOOL IsReady( _In_ ULONGLONG now ) const {
+        if ( m_state != SY_PROC_RUNNING || !this->IsRunning() ) 
+            return FALSE;
+        if ( m_config.m_notify ) 
+            return m_ready;
+        return now - m_start_tick >= m_config.m_ready_wait;
+    }
+
     /**
      * @brief プロセスが実行中か確認
      * @retval TRUE ... Process is Running.
@@ -81,176 +788,2392 @@ public:
 
     /**
      * @brief Start Process
+     *
+     * @param[in] iocp ... 終了通知を受け取る完了ポート
      */
-    HRESULT Start( _In_ const CsyProcConfig& config ) { 
+    HRESULT Start( _In_ HANDLE iocp ) { 
 
-        HRESULT _hr           = S_OK;
-        HANDLE  _idle_trigger = INVALID_HANDLE_VALUE;
         this->Stop();
-
-        // Thread StopEvent
-        m_config = config;
-        m_event  = ::CreateEvent( NULL, TRUE, FALSE, NULL );
-        if ( m_event == INVALID_HANDLE_VALUE )  {
-            _hr = HRESULT_FROM_WIN32( ::GetLastError() );
-            goto START_EXIT;
+        if ( m_drain_job ) {
+            _SLOG( TEXT("! descendants of the previous process did not exit in %d ms : %s\n"), 
+                    SY_KILL_WAIT_MS, m_config.m_name );
+            this->ReleaseDrain();
         }
+        m_iocp             = iocp;
+        m_adopted          = FALSE;
+        m_recycling        = FALSE;
+        m_memory_over_tick = 0;
 
-        // スレッド起動先で、プロセス起動が完了するまで待ち合わせる
-        // ※同期しないと、スレッド関数内でプロセスが正常に起動したか分からない
-        _idle_trigger = ::CreateEvent( NULL, TRUE, FALSE, NULL );
-        if ( _idle_trigger == INVALID_HANDLE_VALUE ) {
-            _hr = HRESULT_FROM_WIN32( ::GetLastError() );
-            goto START_EXIT;
+        CsyTraceScope _trace( "spawn", m_config.m_name );
+        _trace.SetValue( static_cast<LONG>( m_replica ) );
+
+        HRESULT _hr = sy_create_job( iocp, m_key, m_job );
+        if ( FAILED( _hr ) ) {
+            _SLOG( TEXT("! Job Create Failed. in %08x\n"), _hr );
+            return _hr;
         }
 
-        if ( FAILED((_hr = CsyThread::Begin( &_idle_trigger ) )) ) {
-            goto START_EXIT;
+        // <cpu_rate> <memory_limit> <priority>
+        _hr = sy_set_job_limits( m_job, m_config.m_cpu_rate, m_config.m_memory_limit, m_config.m_priority );
+        if ( SUCCEEDED( _hr ) ) 
+            _hr = this->SetContainment();
+        if ( FAILED( _hr ) ) {
+            _SLOG( TEXT("! Job Limit Failed. in %08x\n"), _hr );
+            this->Release();
+            return _hr;
         }
+        m_cpu_throttled = FALSE;
 
-        sy_single_join( _idle_trigger );
-        if ( FAILED( m_status ) ) goto START_EXIT;
+        CsySpawnOption _option;
+        _option.m_job = m_job;
+        sy_resolve_placement( m_config, m_slot, _option );
 
-        ::CloseHandle( _idle_trigger ); 
-        return S_OK;
+        // replica 番号（port や shard の選択に使う）
+        CAtlString _env;
+        _env.Format( TEXT("SYLPH_ENTRY=%s"), m_config.m_name.GetString() );
+        _option.m_environment.push_back( _env );
+        _env.Format( TEXT("SYLPH_REPLICA=%u"), m_replica );
+        _option.m_environment.push_back( _env );
 
+        // 通知チャネル (READY / STATUS / WATCHDOG)
+        m_ready         = FALSE;
+        m_ready_ms      = 0.0;
+        m_watchdog_tick = 0;
+        m_status.Empty();
+        if ( m_config.m_notify ) 
+            _option.m_environment.push_back( TEXT("NOTIFY_SOCKET=") + sy_notify_pipe_name() );
 
-    START_EXIT:
-        if ( m_event != INVALID_HANDLE_VALUE ) 
-            ::CloseHandle( m_event ); 
-        if ( _idle_trigger != INVALID_HANDLE_VALUE ) 
-            ::CloseHandle( _idle_trigger ); 
+        // watchdog (WATCHDOG_USEC 互換。heartbeat の共有メモリと slot も渡す)
+        if ( m_config.m_watchdog ) {
+            _env.Format( TEXT("WATCHDOG_USEC=%I64u"), static_cast<ULONGLONG>( m_config.m_watchdog ) * 1000 );
+            _option.m_environment.push_back( _env );
+            if ( m_heartbeat && m_heartbeat_slot < 0 ) 
+                m_heartbeat_slot = m_heartbeat->Alloc();
+            if ( m_heartbeat_slot >= 0 ) {
+                m_heartbeat->Reset( m_heartbeat_slot );
+                _option.m_environment.push_back( TEXT("SYLPH_HEARTBEAT_MAP=") + m_heartbeat->IsName() );
+                _env.Format( TEXT("SYLPH_HEARTBEAT_SLOT=%d"), m_heartbeat_slot );
+                _option.m_environment.push_back( _env );
+            }
+        }
+        m_beat_value = 0;
 
-        m_event = INVALID_HANDLE_VALUE;
-        return _hr;
-    }
+        // 待ち受けソケット (LISTEN_FDS 互換。Windows ではソケットのハンドル値を LISTEN_SOCKETS で渡す)
+        if ( !m_listen.empty() ) {
+            CAtlString _sockets, _names;
+            for ( size_t i = 0; i < m_listen.size(); i++ ) {
+                _sockets.AppendFormat( TEXT("%s%I64u"), i ? TEXT(",") : TEXT(""), static_cast<ULONGLONG>( m_listen[ i ] ) );
+                _names  .AppendFormat( TEXT("%s%s"),    i ? TEXT(",") : TEXT(""), m_config.m_listen[ i ].GetString() );
+                _option.m_inherit.push_back( reinterpret_cast<HANDLE>( m_listen[ i ] ) );
+            }
+            _env.Format( TEXT("LISTEN_FDS=%d"), static_cast<int>( m_listen.size() ) );
+            _option.m_environment.push_back( _env );
+            _option.m_environment.push_back( TEXT("LISTEN_SOCKETS=") + _sockets );
+            _option.m_environment.push_back( TEXT("LISTEN_FDNAMES=") + _names );
+        }
 
-    /**
-     * @brief Stop Process
-     */
-    void Stop( void ) {
-        if ( m_event  != INVALID_HANDLE_VALUE ) {
-            // wait for completion..
-            ::SetEvent( m_event );
-            CsyThread::Join();
+        // stdout/stderr をパイプ経由でログファイルへ
+        if ( FAILED( _hr = this->OpenCapture( _option ) ) ) {
+            _SLOG( TEXT("! Capture Start Failed. in %08x\n"), _hr );
+            this->Release();
+            return _hr;
+        }
+
+        _SLOG( TEXT("==> Start > %s\n"), m_config.m_commandline );
+        m_spawn_counter = sy_perf_counter();
+        _hr = sy_create_process( m_config.m_commandline, m_proc_info, _option );
+
+        if ( _option.m_std_output ) ::CloseHandle( _option.m_std_output );
+        if ( _option.m_std_error  ) ::CloseHandle( _option.m_std_error  );
 
-            ::CloseHandle( m_event );
-            m_event = INVALID_HANDLE_VALUE;
+        if ( FAILED( _hr ) ) {
+            _SLOG( TEXT("! Process Start Failed. in %08x\n"), _hr );
+            this->Release();
+            return _hr;     // process create failed.
         }
+
+        m_start_tick = ::GetTickCount64();
+        m_beat_tick  = m_start_tick;
+        _trace.SetPid( m_proc_info.dwProcessId );
+        this->SetState( SY_PROC_RUNNING );
+        _SLOG( TEXT("==> [PID:%d] Process Started. (replica %d)\n"), m_proc_info.dwProcessId, m_replica );
+        if ( _option.m_affinity || _option.m_numa_node >= 0 ) 
+            _SLOG( TEXT("==> [PID:%d] placement : cpu 0x%I64x, numa node %d\n"), m_proc_info.dwProcessId, 
+                    static_cast<ULONGLONG>( _option.m_affinity ), _option.m_numa_node );
+        return S_OK;
     }
 
-protected:
-    /** 
-     * @brief Thread hundler
+    /**
+     * @brief 前の supervisor が起動した実行中のプロセスを引き継ぎます。
+     *        子孫（孫プロセスを含む）と一緒に新しい Job Object に入れて終了通知を受け取ります。
+     *        （元の Job の入れ子になるため Windows 8 以降）
+     *        NOTIFY_SOCKET と SYLPH_HEARTBEAT_MAP は前の supervisor のものを指したままのため、
+     *        次に再起動するまで READY 済みとして扱い、watchdog の対象から外します。（IsWatchdogExempt）
+     *
+     * @param[in] iocp ... 終了通知を受け取る完了ポート
+     * @param[in] info ... 引き継ぐプロセス (hProcess / dwProcessId)。失敗した場合も含めハンドルの所有権は移ります
      */
-    virtual DWORD run( _In_ void* argment = NULL ) override {
+    HRESULT Adopt( _In_ HANDLE iocp, _In_ const PROCESS_INFORMATION& info ) {
 
-        // receive event trigger from Begin()
-        HANDLE *_idle_trigger_p = (HANDLE*)argment;
-        ATLASSERT( _idle_trigger_p );
+        this->Stop();
+        m_iocp      = iocp;
+        m_proc_info = info;
 
-        _SLOG( TEXT("==> Start > %s\n"), m_config.m_commandline );
-        HRESULT _h = sy_create_process( m_config.m_commandline, m_proc_info ); 
-        if ( FAILED( _h ) ) {
-            _SLOG( TEXT("! Process Start Failed. in %08x\n"), _h );
-            m_status = _h;
-            ::SetEvent( *_idle_trigger_p ); 
-            return 1;   // process create failed.
+        HRESULT _hr = sy_create_job( iocp, m_key, m_job );
+        if ( SUCCEEDED( _hr ) ) 
+            _hr = sy_set_job_limits( m_job, m_config.m_cpu_rate, m_config.m_memory_limit, m_config.m_priority );
+        if ( SUCCEEDED( _hr ) ) 
+            _hr = this->SetContainment();
+        if ( SUCCEEDED( _hr ) && !::AssignProcessToJobObject( m_job, m_proc_info.hProcess ) ) 
+            _hr = HRESULT_FROM_WIN32( ::GetLastError() );
+        DWORD _descendants = SUCCEEDED( _hr ) ? sy_assign_descendants( m_job, m_proc_info.hProcess ) : 0;
+        if ( FAILED( _hr ) ) {
+            _SLOG( TEXT("! [PID:%d] Adopt Failed. in %08x : %s\n"), m_proc_info.dwProcessId, _hr, m_config.m_name );
+            ::TerminateProcess( m_proc_info.hProcess, 0L );
+            ::WaitForSingleObject( m_proc_info.hProcess, SY_KILL_WAIT_MS );
+            this->Release();
+            return _hr;
         }
+        m_cpu_throttled = FALSE;
 
-        _SLOG( TEXT("==> [PID:%d] Process Started.\n"), m_proc_info.dwProcessId );
-        ::SetEvent( *_idle_trigger_p ); 
+        // 起動からの経過時間はプロセスの作成時刻から求める（crash_window / ready_wait の判定に使う）
+        FILETIME _create, _exit, _kernel, _user, _now;
+        ::GetSystemTimeAsFileTime( &_now );
+        ULONGLONG _elapsed_ms = 0;
+        if ( ::GetProcessTimes( m_proc_info.hProcess, &_create, &_exit, &_kernel, &_user ) ) {
+            ULARGE_INTEGER _from, _to;
+            _from.LowPart  = _create.dwLowDateTime;
+            _from.HighPart = _create.dwHighDateTime;
+            _to.LowPart    = _now.dwLowDateTime;
+            _to.HighPart   = _now.dwHighDateTime;
+            if ( _to.QuadPart > _from.QuadPart ) 
+                _elapsed_ms = ( _to.QuadPart - _from.QuadPart ) / 10000;
+        }
+        m_start_tick    = ::GetTickCount64() - ( std::min )( _elapsed_ms, ::GetTickCount64() );
+        m_beat_tick     = ::GetTickCount64();
+        m_beat_value    = 0;
+        m_spawn_counter = sy_perf_counter();
+        m_ready         = TRUE;
+        m_ready_ms      = 0.0;
+        m_watchdog_tick = 0;
+        m_status.Empty();
+        m_adopted       = TRUE;
+        m_recycling        = FALSE;
+        m_memory_over_tick = 0;
 
-        HANDLE _events[2] = {
-            m_proc_info.hProcess,
-            m_event
-        };
+        this->SetState( SY_PROC_RUNNING );
+        _SLOG( TEXT("==> [PID:%d] Process Adopted. (replica %d, running %I64u ms, %d descendants) : %s\n"), 
+                m_proc_info.dwProcessId, m_replica, _elapsed_ms, _descendants, m_config.m_name );
+        if ( this->IsWatchdogExempt() || m_config.m_notify ) {
+            _SLOG( TEXT("! [PID:%d] Adopted without notify/watchdog until next restart. : %s\n"), 
+                    m_proc_info.dwProcessId, m_config.m_name );
+            EVENT_ENTRY_WAR( m_config.m_name, TEXT("Adopted without notify/watchdog until next restart. [PID:%d] %s"), 
+                    m_proc_info.dwProcessId, m_config.m_name.GetString() );
+        }
+        SY_TRACE.Instant( "adopt", m_proc_info.dwProcessId, m_config.m_name, static_cast<LONG>( m_replica ) );
+        return S_OK;
+    }
 
-        DWORD _exit_code = 0;
-        DWORD _result = ::WaitForMultipleObjects( 2, _events, FALSE, INFINITE );
-        switch ( _result ) {
-        // sig: exit a process
-        case WAIT_OBJECT_0 + 0:
-            ::GetExitCodeProcess( m_proc_info.hProcess, &_exit_code );
-            break;
+    /**
+     * @brief プロセスを停止せずに管理から外します。（journal に記録を残し、次の supervisor が引き継ぐ）
+     *        状態変化は通知しません。
+     */
+    void Detach( void ) {
+        if ( m_state == SY_PROC_RUNNING ) 
+            _SLOG( TEXT("==> [PID:%d] Process Detached : %s\n"), m_proc_info.dwProcessId, m_config.m_name );
+        if ( m_job ) 
+            sy_set_job_kill_on_close( m_job, FALSE );   // ハンドルを閉じても終了させない
+        this->Release();
+        this->ReleaseDrain();
+        m_state      = SY_PROC_STOPPED;
+        m_restart_at = 0;
+    }
 
-        // sig: terminate to process.
-        case WAIT_OBJECT_0 + 1: {
-        default:
-            if ( ::GetExitCodeProcess( m_proc_info.hProcess, &_exit_code ) )
-                if ( _exit_code == STILL_ACTIVE ) {
-                    _SLOG( TEXT("==> [PID:%d] KILL Process \n"), m_proc_info.dwProcessId );
-                    ::TerminateProcess( m_proc_info.hProcess, 0L );
-                }
-            }
-            break;
-        };
+    /**
+     * @brief 異常終了したプロセスの再起動を予約します。
+     *        待ち時間は retry_delay * 2^(連続回数-1) (上限 retry_delay_max) に
+     *        ジッタ（後半50%をランダム）を加えたものです。（sy_backoff_delay）
+     *
+     * @param[in] random ... ジッタ用の乱数
+     * @retval TRUE ... 予約した(BACKOFF)  FALSE ... 再起動しない(EXITED/PARKED)
+     */
+    BOOL ScheduleRestart( _In_ UINT random ) {
+        if ( m_state != SY_PROC_EXITED || m_config.m_max_retry == 0 )
+            return FALSE;
 
-        if ( m_proc_info.hProcess ) 
-            ::CloseHandle( m_proc_info.hProcess );
+        ULONGLONG _now    = ::GetTickCount64();
+        ULONGLONG _window = static_cast<ULONGLONG>( m_config.m_crash_window ) * 1000;
 
-        _SLOG( TEXT("==> [PID:%d] Process exit : code %d\n"), 
-                            m_proc_info.dwProcessId, _exit_code );
-        ::ZeroMemory( &m_proc_info, sizeof( m_proc_info ) );
+        // 判定期間より長く動いていれば、連続回数をリセット
+        if ( _now - m_start_tick >= _window ) 
+            m_retry = 0;
 
-        return _exit_code;
-    }
-};
+        m_failures.erase( std::remove_if( m_failures.begin(), m_failures.end(), 
+                [&]( ULONGLONG t ) { return _now - t >= _window; } ), m_failures.end() );
+        m_failures.push_back( _now );
 
-/**
- * @brief プロセス管理クラス。複数のプロセスクラスを管理します。
- */
-class CsylphProcessManager {
+        if ( m_config.m_crash_limit && m_failures.size() > m_config.m_crash_limit ) {
+            this->SetState( SY_PROC_PARKED );
+            _SLOG( TEXT("! Crash loop detected. %d exits in %d sec. parked : %s\n"), 
+                    static_cast<int>( m_failures.size() ), m_config.m_crash_window, m_config.m_name );
+            EVENT_ENTRY_ERR( m_config.m_name, TEXT("Crash loop detected. entry parked : %s"), m_config.m_name.GetString() );
+            return FALSE;
+        }
 
-   std::vector<CsyProcess*> m_processes;
+        if ( m_retry >= m_config.m_max_retry ) {
+            _SLOG( TEXT("! Retry limit reached (%d). : %s\n"), m_retry, m_config.m_name );
+            EVENT_ENTRY_WAR( m_config.m_name, TEXT("Retry limit reached. : %s"), m_config.m_name.GetString() );
+            return FALSE;
+        }
 
-public:
-    /** constructor (default) */
-    CsylphProcessManager         ( void ) = default;
+        ULONGLONG _delay = sy_backoff_delay( m_config.m_retry_delay, m_config.m_retry_delay_max, m_retry, random );
 
-    /** destructor. 全てのプロセスは解放される */
-    virtual ~CsylphProcessManager( void ) {
-        this->PurgeProcesses();
+        m_retry++;
+        m_restart_at = _now + _delay;
+        this->SetState( SY_PROC_BACKOFF );
+        _SLOG( TEXT("==> Restart in %I64u ms (retry %d/%d) : %s\n"), 
+                _delay, m_retry, m_config.m_max_retry, m_config.m_name );
+        return TRUE;
     }
-    
+
     /**
-     * @brief 指定プロセスを開始し、管理リストに追加します。　
+     * @brief 予約した再起動を実行します。Supervisor loopから呼ばれます。
      */
-    HRESULT AddProcessEntry( _In_ const CsyProcConfig& config ) {
-        auto _p = new CsyProcess();
-        if ( !_p )
-            return E_OUTOFMEMORY;
+    HRESULT Restart( void ) {
+        if ( m_state != SY_PROC_BACKOFF )
+            return S_FALSE;
 
-        HRESULT _hr = _p->Start( config ); 
+        HRESULT _hr = this->Start( m_iocp );
         if ( FAILED( _hr ) ) {
-            delete _p;
+            this->SetState( SY_PROC_EXITED );   // 起動失敗も異常終了として数える
             return _hr;
         }
-        
-        m_processes.push_back( _p );
-        _SLOG(TEXT("==> [PID:%d] Add ProcessEntry \n"), _p->IsProcessID( ) );
+
+        m_restart_count++;
+        m_recovery_ms = sy_perf_ms( m_exit_counter );
+        _SLOG( TEXT("==> [PID:%d] Restarted. recovered in %.1f ms : %s\n"), 
+                m_proc_info.dwProcessId, m_recovery_ms, m_config.m_name );
         return S_OK;
     }
 
     /**
-     * @brief 全てのプロセスを停止し、プロセスリストを破棄します。
+     * @brief 停止要求（stop_signal）を送ります。終了は待ちません。
+     * @param[in,out] console ... Ctrl イベントを追加する送信リスト (Option)
+     *                            指定した場合、Ctrl イベントは呼び出し元が console->Send() で送ります。
+     * @retval TRUE ... 停止要求を送信した
+     */
+    BOOL Signal( _Inout_opt_ CsyConsoleCtrlBatch* console = NULL ) {
+        if ( m_state != SY_PROC_RUNNING ) 
+            return FALSE;
+
+        ::GetSystemTimeAsFileTime( &m_signal_time );
+
+        BOOL  _sent = FALSE;
+        DWORD _pid  = m_proc_info.dwProcessId;
+        auto  _ctrl = [&]( DWORD ctrl_event ) -> BOOL {
+            if ( !console ) 
+                return sy_send_console_ctrl( _pid, ctrl_event );
+            console->Add( _pid, ctrl_event );
+            return TRUE;
+        };
+        switch ( m_config.m_stop_signal ) {
+        case SY_STOP_CTRL_C:
+            _sent  = _ctrl( CTRL_C_EVENT );
+            _sent |= sy_close_windows( _pid );
+            break;
+        case SY_STOP_CTRL_BREAK:
+            _sent  = _ctrl( CTRL_BREAK_EVENT );
+            _sent |= sy_close_windows( _pid );
+            break;
+        case SY_STOP_CLOSE:
+            _sent  = sy_close_windows    ( _pid );
+            break;
+        case SY_STOP_KILL:
+        default:
+            break;
+        }
+
+        _SLOG( TEXT("==> [PID:%d] Stop Request (%s)\n"), _pid, _sent ? TEXT("sent") : TEXT("none") );
+        return _sent;
+    }
+
+    /**
+     * @brief Stop Process
+     *        停止要求を送り、timeout_ms 以内に終了しなければKillします。
+     *        停止要求からプロセス終了までの時間を記録します。
+     *
+     * @param[in] timeout_ms ... 終了待ち時間(ms)  
+     *                           SY_STOP_BY_CONFIG.. <stop_timeout> を使う
+     *                           0.. 停止要求を送らずKill（送信済みなら経過を記録）
+     *                               Kill() 済みの場合は本体の終了を待ちません。（呼び出し元がまとめて待つ）
+     * @retval TRUE ... 強制終了(Kill)した
      */
-    void PurgeProcesses( void ) {
-        std::for_each( 
-            m_processes.begin(), m_processes.end  (), [](CsyProcess* p) {
-                if ( p ) {
-                    p->Stop();
-                    delete p;
+    BOOL Stop( _In_ DWORD timeout_ms = SY_STOP_BY_CONFIG ) {
+        BOOL _killed = FALSE;
+        if ( m_state == SY_PROC_RUNNING ) {
+            CsyTraceScope _trace( "stop", m_config.m_name );
+            _trace.SetPid( m_proc_info.dwProcessId );
+
+            if ( timeout_ms == SY_STOP_BY_CONFIG ) 
+                timeout_ms = m_config.m_stop_timeout;
+
+            if ( timeout_ms && this->Signal() )
+                ::WaitForSingleObject( m_proc_info.hProcess, timeout_ms );
+
+            if ( !m_signal_time.dwLowDateTime && !m_signal_time.dwHighDateTime ) 
+                ::GetSystemTimeAsFileTime( &m_signal_time );
+
+            DWORD _exit_code = 0;
+            if ( ::GetExitCodeProcess( m_proc_info.hProcess, &_exit_code ) )
+                if ( _exit_code == STILL_ACTIVE && m_kill_sent ) {
+                    _killed = TRUE;     // Kill() 済み。終了は待たずに Kill として記録する
                 }
-            });
+                else if ( _exit_code == STILL_ACTIVE ) {
+                    _SLOG( TEXT("==> [PID:%d] KILL Process \n"), m_proc_info.dwProcessId );
+                    SY_TRACE.Instant( "kill", m_proc_info.dwProcessId, m_config.m_name );
+                    this->KillTree( 0L );
+                    // 本体の終了だけを待つ（子孫は KillDescendants で終了通知を待つ）
+                    ::WaitForSingleObject( m_proc_info.hProcess, SY_KILL_WAIT_MS );
+                    ::GetExitCodeProcess( m_proc_info.hProcess, &_exit_code );
+                    _killed = TRUE;
+                }
+            _killed |= m_kill_sent;
 
-        m_processes.clear();
+            this->RecordStopLatency( _killed );
+            this->KillDescendants();
+            this->OnExited( _exit_code );
+            _trace.SetValue( static_cast<LONG>( _exit_code ) );
+        }
+        m_restart_at = 0;
+        m_kill_sent  = FALSE;
+        this->SetState( SY_PROC_STOPPED );
+        this->Release();
+        return _killed;
     }
 
     /**
-     * @brief process list を列挙します
+     * @brief プロセスツリーを Kill します。終了は待ちません。（Stop(0) の前にまとめて Kill する場合に使います）
+     *        後の Stop() は本体の終了を待たずに Kill として記録します。
+     * @retval TRUE ... 実行中だったため Kill した
      */
-    void ForEach( std::function<void(CsyProcess*)> func ) {
-        std::for_each( m_processes.begin(), m_processes.end  (), func );
+    BOOL Kill( void ) {
+        if ( m_state != SY_PROC_RUNNING || !this->IsRunning() ) 
+            return FALSE;
+
+        _SLOG( TEXT("==> [PID:%d] KILL Process \n"), m_proc_info.dwProcessId );
+        SY_TRACE.Instant( "kill", m_proc_info.dwProcessId, m_config.m_name );
+        this->KillTree( 0L );
+        m_kill_sent = TRUE;
+        return TRUE;
+    }
+
+    /**
+     * @brief Job の全プロセスが終了した通知 (JOB_OBJECT_MSG_ACTIVE_PROCESS_ZERO)。Supervisor loopから呼ばれます。
+     *        同じ key の新しい job の通知もあるため、Kill した job が空になったことを確かめます。
+     * @retval TRUE ... Kill した子孫プロセスが全て終了した
+     */
+    BOOL OnJobEmpty( void ) {
+        if ( !m_drain_job || sy_job_active_processes( m_drain_job ) ) 
+            return FALSE;
+        this->ReleaseDrain();
+        return TRUE;
     }
-};
\ No newline at end of file
+
+    /** 
+     * @brief Kill した子孫プロセスの終了を待っているか。
+     * @param[in] now ... 現在時刻 (GetTickCount64)。期限 (IsDrainUntil) を過ぎたら待たない
+     */
+    BOOL IsDraining( _In_ ULONGLONG now ) const {
+        return m_drain_job && now < m_drain_until;
+    }
+
+    /** 子孫プロセスの終了を待つ期限 (GetTickCount64) */
+    ULONGLONG IsDrainUntil( void ) const { return m_drain_until; }
+
+    /**
+     * @brief プロセス終了通知。Supervisor loopから呼ばれます。
+     *
+     * @param[in] pid ... 終了したプロセスID（Job内の子孫プロセスを含む）
+     * @retval TRUE ... 管理対象のプロセスが終了した
+     */
+    BOOL OnExitNotify( _In_ DWORD pid ) {
+        if ( m_state != SY_PROC_RUNNING || pid != m_proc_info.dwProcessId )
+            return FALSE;
+
+        DWORD _exit_code = 0;
+        ::GetExitCodeProcess( m_proc_info.hProcess, &_exit_code );
+        SY_TRACE.Instant( "exit", pid, m_config.m_name, static_cast<LONG>( _exit_code ) );
+        this->OnExited( _exit_code );
+        this->KillDescendants();    // 再起動したプロセスとポート等を取り合わないように
+        m_exit_counter = sy_perf_counter();
+        this->SetState( SY_PROC_EXITED );
+        this->Release();
+        return TRUE;
+    }
+
+    /**
+     * @brief Job のメモリ上限に達した通知。Supervisor loopから呼ばれます。
+     */
+    void OnMemoryLimit( void ) {
+        if ( m_state != SY_PROC_RUNNING ) 
+            return;
+
+        m_limit_hits++;
+        _SLOG( TEXT("! [PID:%d] Memory limit reached (%d MB) : %s\n"), 
+                m_proc_info.dwProcessId, m_config.m_memory_limit, m_config.m_name );
+        EVENT_ENTRY_WAR( m_config.m_name, TEXT("Memory limit reached (%d MB) : %s"), 
+                m_config.m_memory_limit, m_config.m_name.GetString() );
+    }
+
+    /**
+     * @brief 通知チャネルのメッセージを処理します。Supervisor loopから呼ばれます。
+     * @param[in] message ... "READY=1\nSTATUS=..." (sd_notify 互換)
+     * @retval TRUE ... READY になった
+     */
+    BOOL OnNotify( _In_ const std::string& message ) {
+        if ( m_state != SY_PROC_RUNNING ) 
+            return FALSE;
+
+        std::vector< std::pair<CAtlString, CAtlString> > _fields;
+        sy_notify_parse( message, _fields );
+
+        BOOL _ready = FALSE;
+        for ( auto& f : _fields ) {
+            if ( f.first == TEXT("READY") && f.second == TEXT("1") ) {
+                if ( m_ready ) 
+                    continue;
+                m_ready    = TRUE;
+                m_ready_ms = sy_perf_ms( m_spawn_counter );
+                _ready     = TRUE;
+                _SLOG( TEXT("==> [PID:%d] Ready in %.1f ms : %s\n"), 
+                        m_proc_info.dwProcessId, m_ready_ms, m_config.m_name );
+                SY_TRACE.Instant( "ready", m_proc_info.dwProcessId, m_config.m_name );
+                if ( m_observer ) m_observer->OnProcessEvent( *this );
+            }
+            else if ( f.first == TEXT("STATUS") ) {
+                m_status = f.second;
+                _SLOG( TEXT("==> [PID:%d] Status : %s\n"), m_proc_info.dwProcessId, m_status );
+            }
+            else if ( f.first == TEXT("WATCHDOG") && f.second == TEXT("1") ) {
+                m_watchdog_tick = ::GetTickCount64();
+            }
+            else if ( f.first == TEXT("STOPPING") && f.second == TEXT("1") ) {
+                _SLOG( TEXT("==> [PID:%d] Stopping : %s\n"), m_proc_info.dwProcessId, m_config.m_name );
+            }
+        }
+        return _ready;
+    }
+
+    /**
+     * @brief watchdog の期限を確認します。Supervisor loopから呼ばれます。
+     *        heartbeat のカウンタが増えた時刻、または WATCHDOG を受信した時刻から
+     *        watchdog(ms) 以上経過していれば応答なしとして強制終了します。
+     *        終了は通常の異常終了と同じく終了通知から再起動されます。
+     * @param[in] now ... 現在時刻 (GetTickCount64)
+     * @retval TRUE ... 期限切れで強制終了した
+     */
+    BOOL CheckWatchdog( _In_ ULONGLONG now ) {
+        if ( m_state != SY_PROC_RUNNING || !m_config.m_watchdog || this->IsWatchdogExempt() ) 
+            return FALSE;
+
+        if ( m_heartbeat_slot >= 0 ) {
+            LONG64 _value = m_heartbeat->Read( m_heartbeat_slot );
+            if ( _value != m_beat_value ) {
+                m_beat_value = _value;
+                m_beat_tick  = now;
+            }
+        }
+        if ( m_watchdog_tick > m_beat_tick ) 
+            m_beat_tick = m_watchdog_tick;
+        if ( now - m_beat_tick < m_config.m_watchdog ) 
+            return FALSE;
+
+        _SLOG( TEXT("! [PID:%d] Watchdog timeout. no heartbeat in %I64u ms : %s\n"), 
+                m_proc_info.dwProcessId, now - m_beat_tick, m_config.m_name );
+        EVENT_ENTRY_ERR( m_config.m_name, TEXT("Watchdog timeout (%d ms) : %s"), m_config.m_watchdog, m_config.m_name.GetString() );
+        SY_TRACE.Instant( "kill", m_proc_info.dwProcessId, m_config.m_name, SY_WATCHDOG_EXIT_CODE );
+        this->KillTree( SY_WATCHDOG_EXIT_CODE );
+        m_beat_tick = now;      // 終了通知が届くまで再判定しない
+        return TRUE;
+    }
+
+    /**
+     * @brief recycle の条件を確認します。Supervisor loop（リソース採取）から呼ばれます。
+     *        Working set が memory を memory_for 秒以上超え続けた場合と、
+     *        起動から uptime 時間経った場合に recycle の対象とします。
+     * @param[in] now ... 現在時刻 (GetTickCount64)
+     * @param[in] working_set ... 採取した Working set (bytes, 0.. 採取できなかった)
+     * @param[out] reason ... 対象とした理由
+     * @retval TRUE ... recycle の対象
+     */
+    BOOL CheckRecycle( _In_ ULONGLONG now, _In_ SIZE_T working_set, _Out_ CAtlString& reason ) {
+        reason.Empty();
+        if ( m_state != SY_PROC_RUNNING || m_recycling ) 
+            return FALSE;
+
+        if ( m_config.m_recycle_memory && working_set ) {
+            ULONGLONG _limit = static_cast<ULONGLONG>( m_config.m_recycle_memory ) * 1024 * 1024;
+            if ( working_set < _limit ) {
+                m_memory_over_tick = 0;
+            } else if ( !m_memory_over_tick ) {
+                m_memory_over_tick = now;
+            } else if ( now - m_memory_over_tick >= static_cast<ULONGLONG>( m_config.m_recycle_memory_for ) * 1000 ) {
+                reason.Format( TEXT("memory %I64u MB > %u MB for %I64u sec"), 
+                        static_cast<ULONGLONG>( working_set / 1048576 ), m_config.m_recycle_memory, 
+                        ( now - m_memory_over_tick ) / 1000 );
+                return TRUE;
+            }
+        }
+
+        if ( m_config.m_recycle_uptime && 
+             now - m_start_tick >= static_cast<ULONGLONG>( m_config.m_recycle_uptime ) * 3600 * 1000 ) {
+            reason.Format( TEXT("uptime %I64u min >= %u hours"), ( now - m_start_tick ) / 60000, m_config.m_recycle_uptime );
+            return TRUE;
+        }
+        return FALSE;
+    }
+
+    /**
+     * @brief recycle を開始します。停止要求 (stop_signal) を送り、終了後に Respawn() で起動し直します。
+     * @param[in] reason ... 理由（ログ / イベントに記録します）
+     * @retval TRUE ... 停止要求を送信した（FALSE でも recycle 中になり、猶予後に Kill されます）
+     */
+    BOOL Recycle( _In_ const CAtlString& reason ) {
+        m_recycling = TRUE;
+        m_recycle_count++;
+        _SLOG( TEXT("==> [PID:%d] Recycle (replica %d) : %s : %s\n"), 
+                m_proc_info.dwProcessId, m_replica, reason, m_config.m_name );
+        EVENT_ENTRY_INF( m_config.m_name, TEXT("Recycle (replica %d) : %s : %s"), 
+                m_replica, reason.GetString(), m_config.m_name.GetString() );
+        SY_TRACE.Instant( "recycle", m_proc_info.dwProcessId, m_config.m_name, static_cast<LONG>( m_replica ) );
+        return this->Signal();
+    }
+
+    /**
+     * @brief recycle 中のプロセスを起動し直します。（終了していなければ Kill します）
+     *        起動に失敗した場合は異常終了として扱います。(EXITED)
+     */
+    HRESULT Respawn( void ) {
+        if ( !m_recycling ) 
+            return S_FALSE;
+        if ( m_state == SY_PROC_RUNNING ) 
+            this->Stop( 0 );
+
+        HRESULT _hr = this->Start( m_iocp );
+        if ( FAILED( _hr ) ) {
+            this->SetState( SY_PROC_EXITED );
+            return _hr;
+        }
+        _SLOG( TEXT("==> [PID:%d] Recycled. (replica %d) : %s\n"), m_proc_info.dwProcessId, m_replica, m_config.m_name );
+        return S_OK;
+    }
+
+    /**
+     * @brief CPU使用率の採取結果。上限 (cpu_rate) に張り付いた時に報告します。
+     * @param[in] cpu_percent ... 前回の採取からの CPU 使用率 (全CPU = 100%)
+     */
+    void OnCpuSample( _In_ double cpu_percent ) {
+        if ( m_state != SY_PROC_RUNNING || !m_config.m_cpu_rate ) 
+            return;
+
+        BOOL _throttled = cpu_percent >= m_config.m_cpu_rate * 0.95;
+        if ( _throttled && !m_cpu_throttled ) {
+            m_limit_hits++;
+            _SLOG( TEXT("! [PID:%d] CPU limit reached (%.1f%% / %d%%) : %s\n"), 
+                    m_proc_info.dwProcessId, cpu_percent, m_config.m_cpu_rate, m_config.m_name );
+            EVENT_ENTRY_WAR( m_config.m_name, TEXT("CPU limit reached (%d%%) : %s"), 
+                    m_config.m_cpu_rate, m_config.m_name.GetString() );
+        }
+        m_cpu_throttled = _throttled;
+    }
+
+private:
+    /**
+     * @brief stdout/stderr の取り込み用パイプを作成します。
+     *        作成したハンドルは CreateProcess 後に閉じること。
+     */
+    HRESULT OpenCapture( _Inout_ CsySpawnOption& option ) {
+        if ( !m_capture || m_config.m_stdout.IsEmpty() )
+            return S_OK;
+
+        SYCAPTURESINK _out, _err;
+        HRESULT _hr = m_capture->OpenSink( m_config.m_stdout, _out );
+        if ( SUCCEEDED( _hr ) && !m_config.m_stderr.IsEmpty() )
+            _hr = m_capture->OpenSink( m_config.m_stderr, _err );
+        if ( FAILED( _hr ) )
+            return _hr;
+
+        if ( FAILED( _hr = m_capture->CreatePipe( _out, option.m_std_output ) ) )
+            return _hr;
+
+        if ( _err && FAILED( _hr = m_capture->CreatePipe( _err, option.m_std_error ) ) ) {
+            ::CloseHandle( option.m_std_output );
+            option.m_std_output = NULL;
+            return _hr;
+        }
+        return S_OK;
+    }
+
+    /** 状態を変更し、変わった場合は通知します */
+    void SetState( _In_ SY_PROC_STATE state ) {
+        if ( m_state == state ) 
+            return;
+        m_state = state;
+        if ( m_journal  ) m_journal ->OnProcessEvent( *this );
+        if ( m_observer ) m_observer->OnProcessEvent( *this );
+    }
+
+    /**
+     * @brief Job の kill-on-close を設定します。（supervisor が異常終了しても孫プロセスまで残さない）
+     *        journal がある場合は、次の supervisor が引き継ぐため設定しません。
+     */
+    HRESULT SetContainment( void ) {
+        if ( m_journal ) 
+            return S_OK;
+        return sy_set_job_kill_on_close( m_job, TRUE );
+    }
+
+    /**
+     * @brief プロセスツリー全体（Job 内の全プロセス）を一度に終了します。終了は待ちません。
+     * @param[in] exit_code ... 終了コード
+     */
+    void KillTree( _In_ UINT exit_code ) {
+        if ( m_job && SUCCEEDED( sy_terminate_job( m_job, exit_code ) ) ) 
+            return;
+        // 引き継いだプロセスを Job に入れられなかった場合など
+        ::TerminateProcess( m_proc_info.hProcess, exit_code );
+    }
+
+    /**
+     * @brief 本体の終了後に残った子孫プロセスを終了します。終了は待ちません。
+     *        job は終了通知 (ACTIVE_PROCESS_ZERO) まで m_drain_job に残し、再起動はその後に行います。
+     */
+    void KillDescendants( void ) {
+        DWORD _remaining = sy_job_active_processes( m_job );
+        if ( !_remaining ) 
+            return;
+        _SLOG( TEXT("==> [PID:%d] KILL %d remaining descendants : %s\n"), 
+                m_proc_info.dwProcessId, _remaining, m_config.m_name );
+        SY_TRACE.Instant( "kill", m_proc_info.dwProcessId, m_config.m_name, static_cast<LONG>( _remaining ) );
+        if ( FAILED( sy_terminate_job( m_job, 0L ) ) ) 
+            return;
+
+        this->ReleaseDrain();
+        m_drain_job   = m_job;
+        m_drain_until = ::GetTickCount64() + SY_KILL_WAIT_MS;
+        m_job         = NULL;
+    }
+
+    /** 子孫プロセスの終了を待っている job を閉じます */
+    void ReleaseDrain( void ) {
+        if ( m_drain_job ) ::CloseHandle( m_drain_job );
+        m_drain_job = NULL;
+    }
+
+    /** 終了コードの記録 */
+    void OnExited( _In_ DWORD exit_code ) {
+        m_exit_code = exit_code;
+        _SLOG( TEXT("==> [PID:%d] Process exit : code %d\n"), 
+                            m_proc_info.dwProcessId, exit_code );
+    }
+
+    /** 
+     * @brief 停止要求からプロセス終了までの時間を記録します。
+     *        終了時刻はプロセスの ExitTime を使います。（待ち合わせの粒度に依存しない）
+     */
+    void RecordStopLatency( _In_ BOOL killed ) {
+        FILETIME _create, _exit, _kernel, _user;
+        ULARGE_INTEGER _from, _to;
+        _from.LowPart  = m_signal_time.dwLowDateTime;
+        _from.HighPart = m_signal_time.dwHighDateTime;
+
+        if ( ::GetProcessTimes( m_proc_info.hProcess, &_create, &_exit, &_kernel, &_user ) ) {
+            _to.LowPart  = _exit.dwLowDateTime;
+            _to.HighPart = _exit.dwHighDateTime;
+        } else {
+            ::GetSystemTimeAsFileTime( &_exit );
+            _to.LowPart  = _exit.dwLowDateTime;
+            _to.HighPart = _exit.dwHighDateTime;
+        }
+
+        m_stop_latency_ms = _to.QuadPart > _from.QuadPart 
+                          ? ( _to.QuadPart - _from.QuadPart ) / 10000.0 : 0.0;
+        m_stop_killed     = killed;
+        ::ZeroMemory( &m_signal_time, sizeof( m_signal_time ) );
+
+        _SLOG( TEXT("==> [PID:%d] Stopped in %.1f ms (%s) : %s\n"), m_proc_info.dwProcessId, 
+                m_stop_latency_ms, killed ? TEXT("killed") : TEXT("graceful"), m_config.m_name );
+    }
+
+    /** ハンドル解放 */
+    void Release( void ) {
+        if ( m_proc_info.hThread  ) ::CloseHandle( m_proc_info.hThread  );
+        if ( m_proc_info.hProcess ) ::CloseHandle( m_proc_info.hProcess );
+        if ( m_job                ) ::CloseHandle( m_job );
+
+        ::ZeroMemory( &m_proc_info, sizeof( m_proc_info ) );
+        m_job = NULL;
+    }
+};
+
+/**
+ * @brief entry名を確定します。name未指定のentryはコマンドラインを名前とし、
+ *        重複する名前には "#2", "#3" ... を付けます。
+ *
+ * @param[in,out] configs ... プロセス設定リスト
+ */
+inline void
+sy_assign_entry_names( _Inout_ SYCONFIGS& configs ) {
+    std::map<CAtlString, UINT> _count;
+    for ( auto& c : configs ) {
+        if ( c.m_name.IsEmpty() ) 
+            c.m_name = c.m_commandline;
+
+        UINT _n = ++_count[ c.m_name ];
+        if ( _n > 1 ) 
+            c.m_name.AppendFormat( TEXT("#%d"), _n );
+    }
+}
+
+/** 設定の反映 (reload) の差分。entry名毎に数えます */
+struct TSY_RELOAD_DIFF {
+    UINT    added;          ///< 新しく起動する（反映前にプロセスが無かった）
+    UINT    modified;       ///< 設定が変わったため起動し直す
+    UINT    removed;        ///< 設定から無くなったため停止する
+    UINT    unchanged;      ///< そのまま動かし続ける
+};
+
+/**
+ * @brief 設定の反映 (reload) の差分を entry名毎に数えます。（replica の数には依りません）
+ *
+ * @param[in] configs ... 新しいプロセス設定リスト
+ * @param[in] current ... 反映前にプロセスがあった entry名
+ * @param[in] kept ... プロセスをそのまま動かし続ける entry名
+ */
+inline TSY_RELOAD_DIFF
+sy_reload_diff( _In_ const SYCONFIGS&            configs,
+                _In_ const std::set<CAtlString>& current,
+                _In_ const std::set<CAtlString>& kept ) {
+
+    TSY_RELOAD_DIFF      _diff = { 0, 0, 0, 0 };
+    std::set<CAtlString> _names;
+    for ( auto& c : configs ) {
+        _names.insert( c.m_name );
+        if ( !current.count( c.m_name ) ) 
+            _diff.added++;
+        else if ( kept.count( c.m_name ) ) 
+            _diff.unchanged++;
+        else
+            _diff.modified++;
+    }
+    for ( auto& name : current ) 
+        if ( !_names.count( name ) ) 
+            _diff.removed++;
+    return _diff;
+}
+
+/**
+ * @brief 依存関係から各entryの起動段(level)を求めます。
+ *        level = 依存先の最大level + 1 (依存なし.. 0)
+ *
+ * @param[in] configs ... プロセス設定リスト
+ * @param[out] levels ... entry毎の起動段
+ * @retval E_INVALIDARG ... 未定義のentry名/循環依存/後のgroupへの依存
+ */
+inline HRESULT
+sy_resolve_start_levels( _In_  const SYCONFIGS&   configs,
+                         _Out_ std::vector<UINT>& levels ) {
+
+    const UINT _UNRESOLVED = static_cast<UINT>( -1 );
+    const UINT _VISITING   = static_cast<UINT>( -2 );
+
+    std::map<CAtlString, size_t> _index;
+    for ( size_t i = 0; i < configs.size(); i++ ) 
+        _index[ configs[ i ].m_name ] = i;
+
+    levels.assign( configs.size(), _UNRESOLVED );
+
+    std::function<HRESULT(size_t)> _resolve = [&]( size_t i ) -> HRESULT {
+        if ( levels[ i ] == _VISITING ) {
+            _SLOG( TEXT("! depends_on cycle detected. [%s]\n"), configs[ i ].m_name );
+            return E_INVALIDARG;
+        }
+        if ( levels[ i ] != _UNRESOLVED ) 
+            return S_OK;
+
+        levels[ i ] = _VISITING;
+        UINT _level = 0;
+        for ( auto& d : configs[ i ].m_depends_on ) {
+            auto _it = _index.find( d );
+            if ( _it == _index.end() ) {
+                _SLOG( TEXT("! depends_on unknown entry. [%s] -> [%s]\n"), configs[ i ].m_name, d );
+                return E_INVALIDARG;
+            }
+            if ( configs[ _it->second ].m_group > configs[ i ].m_group ) {
+                _SLOG( TEXT("! depends_on later group. [%s] -> [%s]\n"), configs[ i ].m_name, d );
+                return E_INVALIDARG;
+            }
+
+            HRESULT _hr = _resolve( _it->second );
+            if ( FAILED( _hr ) ) 
+                return _hr;
+
+            if ( configs[ _it->second ].m_group == configs[ i ].m_group ) 
+                _level = ( std::max )( _level, levels[ _it->second ] + 1 );
+        }
+        levels[ i ] = _level;
+        return S_OK;
+    };
+
+    for ( size_t i = 0; i < configs.size(); i++ ) {
+        HRESULT _hr = _resolve( i );
+        if ( FAILED( _hr ) ) 
+            return _hr;
+    }
+    return S_OK;
+}
+
+/**
+ * @brief プロセス管理クラス。複数のプロセスクラスを管理します。
+ *
+ *        全プロセスの終了待ちは１つの完了ポート(IOCP)で行います。
+ *        プロセス毎に Job Object を作成して完了ポートに関連付け、
+ *        supervisor loop スレッド１本で全ての終了通知を受け取ります。
+ *        （子プロセス数に関わらずスレッドは１本です）
+ */
+class CsylphProcessManager : public CsyThread {
+
+    typedef std::map<ULONG_PTR, CsyProcess*> SYPROCESSES;
+
+public:
+    /** 停止を待つ間の進捗通知。引数は待ちの残り時間(ms) */
+    typedef std::function<void(DWORD)>       SYSTOP_PROGRESS;
+
+private:
+
+    /** autoscale の entry 毎の状態 */
+    struct TSCALE_STATE {
+        UINT        up;         ///< scale_up 以上が続いた採取回数
+        UINT        down;       ///< scale_down 以下が続いた採取回数
+        ULONGLONG   last;       ///< 最後に replica 数を変えた時刻 (GetTickCount64)
+    };
+
+    /** scale up で起動する replica（ロック外で起動する） */
+    struct TSCALE_UP {
+        CsyProcConfig   config;
+        UINT            replica;
+        UINT            purge;      ///< 決定時の m_purge_count（起動までに Purge されたら停止する）
+    };
+
+    /** ロック外で起動し直すプロセス（再起動 / recycle） */
+    struct TRESPAWN {
+        CsyProcess* process;
+        BOOL        recycle;    ///< TRUE.. Respawn()  FALSE.. Restart()
+        BOOL        cancel;     ///< 起動中に停止 / reload / Purge された（起動後に停止する）
+    };
+
+    /** scale down で停止中のプロセス */
+    struct TRETIRE {
+        CsyProcess* process;
+        ULONGLONG   deadline;   ///< Killする時刻 (GetTickCount64)
+    };
+
+    HANDLE                      m_iocp;         ///< supervisor completion port
+    SYPROCESSES                 m_processes;    ///< key -> process
+    volatile LONG               m_next_key;     ///< last completion key
+    volatile LONG               m_next_slot;    ///< 配置 (auto) の通し番号
+    CComAutoCriticalSection     m_lock;         ///< m_processes lock
+    CComAutoCriticalSection     m_control_lock; ///< start/reload/purge を直列化
+    std::multimap<ULONGLONG, ULONG_PTR> m_restarts; ///< 再起動予定 (時刻 -> key)
+    std::minstd_rand            m_random;       ///< 再起動ジッタ
+    ULONGLONG                   m_last_sweep;   ///< 最後に取りこぼし確認をした時刻
+    CsyOutputCapture            m_capture;      ///< stdout/stderr の取り込み
+    CsyResourceSampler          m_sampler;      ///< CPU/メモリ等の採取 (m_lock)
+    std::map<CAtlString, TSCALE_STATE>  m_scale;    ///< entry名 -> autoscale の状態 (m_lock)
+    std::vector<TSCALE_UP>              m_scale_ups;    ///< scale up で起動を待つ replica (m_lock)
+    UINT                                m_purge_count;  ///< PurgeProcesses の回数 (m_lock)
+    std::map<ULONG_PTR, TRETIRE>        m_retiring; ///< scale down で停止中 (m_lock)
+    SYPROCESSES                         m_retired;  ///< scale down の停止を終えた（ロック外で Kill / 破棄する） (m_lock)
+    std::map<ULONG_PTR, TRESPAWN>       m_respawning;   ///< ロック外で起動し直す（管理リストから外したもの） (m_lock)
+    CsyListenSockets            m_listen;       ///< <listen> の待ち受けソケット
+    std::set<CAtlString>        m_rolling;      ///< rolling restart 中のentry名（autoscale しない） (m_lock)
+    volatile LONG               m_cancel;       ///< ready 待ちの中断要求 (Cancel / PurgeProcesses)
+    CsyNotifyServer             m_notify;       ///< 通知チャネル (supervisor loop)
+    HANDLE                      m_ready_event;  ///< READY を受信した (WaitReady の起床)
+    std::map<DWORD, std::pair<ULONGLONG, std::string> > m_orphan_notify; ///< 管理リスト追加前の通知 pid -> (時刻, メッセージ) (m_lock)
+    std::set<ULONG_PTR>                 m_starting;     ///< 起動中（管理リスト追加前）の key (m_lock)
+    std::multimap<ULONG_PTR, DWORD>     m_early_exits;  ///< 管理リスト追加前に届いた終了通知 key -> pid (m_lock)
+    CsyHeartbeatTable           m_heartbeat;    ///< watchdog の heartbeat
+    BOOL                        m_watchdog;     ///< watchdog の entry がある (m_lock)
+    ULONGLONG                   m_last_watchdog;///< 最後に heartbeat を確認した時刻 (m_lock)
+    SYCONFIGS                   m_configs;      ///< 最後に起動/反映した設定リスト (m_lock)
+    IsyProcessObserver*         m_observer;     ///< 状態変化の通知先 (m_lock)
+    IsyProcessJournal*          m_journal;      ///< 実行中の子プロセスの記録先 (起動前に設定)
+    volatile LONG               m_detached;     ///< PurgeProcesses で停止せずに管理から外す (Detach)
+    std::map<ULONG_PTR, ULONGLONG>      m_recycling;    ///< recycle 中 (key -> Killする時刻) (m_lock)
+    std::map<ULONG_PTR, ULONGLONG>      m_draining;     ///< 子孫プロセスの終了待ち (key -> 期限)。終了後に再起動する (m_lock)
+
+public:
+    /** constructor */
+    CsylphProcessManager( void ) 
+        : m_iocp    ( NULL ),
+          m_next_key( SY_KEY_FIRST - 1 ),
+          m_next_slot( -1 ),
+          m_cancel  ( 0 ),
+          m_ready_event( ::CreateEvent( NULL, FALSE, FALSE, NULL ) ),
+          m_random  ( static_cast<unsigned long>( ::GetTickCount64() ^ ::GetCurrentProcessId() ) ),
+          m_last_sweep( 0 ),
+          m_watchdog( FALSE ),
+          m_last_watchdog( 0 ),
+          m_observer( NULL ),
+          m_journal ( NULL ),
+          m_detached( 0 ),
+          m_purge_count( 0 ) { }
+
+    /** destructor. 全てのプロセスは解放される */
+    virtual ~CsylphProcessManager( void ) {
+        this->PurgeProcesses();
+        this->Shutdown();
+        ::CloseHandle( m_ready_event );
+    }
+    
+    /**
+     * @brief 指定プロセスを開始し、管理リストに追加します。　
+     *
+     * @param[in] config ... プロセス設定
+     * @param[in] replica ... entry 内の replica 番号 (SYLPH_REPLICA)
+     * @param[out] key ... 追加したプロセスの completion key (NULL.. 不要)
+     */
+    HRESULT AddProcessEntry( _In_      const CsyProcConfig& config, 
+                             _In_      UINT                 replica = 0,
+                             _Out_opt_ ULONG_PTR*           key     = NULL ) {
+        CsyTraceScope _trace( "add_process_entry", config.m_name );
+
+        HRESULT _hr = this->Startup();
+        if ( FAILED( _hr ) )
+            return _hr;
+
+        UINT _slot = config.IsAutoPlacement() ? static_cast<UINT>( ::InterlockedIncrement( &m_next_slot ) ) : 0;
+        auto _p = new CsyProcess( 
+                static_cast<ULONG_PTR>( ::InterlockedIncrement( &m_next_key ) ), config, &m_capture, _slot, replica );
+        if ( !_p )
+            return E_OUTOFMEMORY;
+
+        // <listen> は最初の起動時に bind し、以降は同じソケットを渡す
+        std::vector<SOCKET> _sockets;
+        if ( FAILED( _hr = m_listen.Acquire( config.m_listen, _sockets ) ) ) {
+            delete _p;
+            return _hr;
+        }
+        _p->SetListenSockets( _sockets );
+        _p->SetHeartbeat( &m_heartbeat );
+        _p->SetJournal( m_journal );
+
+        // 起動中の終了通知を取りこぼさないよう、起動前に key を登録する
+        {
+            CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+            m_starting.insert( _p->IsKey() );
+        }
+
+        // 起動は並列に行うため、ロック外で実行する
+        // （前の supervisor が起動したプロセスが journal に残っていれば引き継ぐ）
+        PROCESS_INFORMATION _adopt;
+        if ( m_journal && m_journal->Adopt( config, replica, _adopt ) && SUCCEEDED( _p->Adopt( m_iocp, _adopt ) ) ) 
+            _hr = S_OK;
+        else
+            _hr = _p->Start( m_iocp ); 
+
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        m_starting.erase( _p->IsKey() );
+        auto _exits = m_early_exits.equal_range( _p->IsKey() );
+        std::vector<DWORD> _exited_pids;
+        for ( auto it = _exits.first; it != _exits.second; ++it ) 
+            _exited_pids.push_back( it->second );
+        m_early_exits.erase( _exits.first, _exits.second );
+
+        if ( FAILED( _hr ) ) {
+            delete _p;
+            return _hr;
+        }
+
+        _trace.SetPid( _p->IsProcessID() );
+
+        m_processes[ _p->IsKey() ] = _p;
+        if ( key ) *key = _p->IsKey();
+        _p->SetObserver( m_observer );
+
+        // 追加前に届いていた終了通知（再起動の予約があれば supervisor loop の待ち時間を再計算）
+        for ( auto pid : _exited_pids ) {
+            if ( !_p->OnExitNotify( pid ) ) 
+                continue;
+            this->OnProcessExited( _p );
+            ::PostQueuedCompletionStatus( m_iocp, 0, SY_KEY_WAKE, NULL );
+        }
+
+        // 追加前に届いていた通知
+        auto _orphan = m_orphan_notify.find( _p->IsProcessID() );
+        if ( _orphan != m_orphan_notify.end() ) {
+            if ( _p->OnNotify( _orphan->second.second ) ) 
+                ::SetEvent( m_ready_event );
+            m_orphan_notify.erase( _orphan );
+        }
+
+        // watchdog の確認を始める（supervisor loop の待ち時間を再計算）
+        if ( config.m_watchdog && !m_watchdog ) {
+            m_watchdog = TRUE;
+            ::PostQueuedCompletionStatus( m_iocp, 0, SY_KEY_WAKE, NULL );
+        }
+        _SLOG(TEXT("==> [PID:%d] Add ProcessEntry \n"), _p->IsProcessID( ) );
+        return S_OK;
+    }
+
+    /**
+     * @brief 設定リストのプロセスを依存関係の順に起動します。
+     *        (group, 依存の深さ) が同じentryは並列に起動し、
+     *        前の段の起動が全て完了してから次の段を起動します。
+     *        entry毎に instances の min 個の replica を起動します。
+     *        notify の entry は、READY を受信してから次の段を起動します。
+     *
+     * @param[in] configs ... プロセス設定リスト
+     */
+    HRESULT StartEntries( _In_ const SYCONFIGS& configs ) {
+        CComCritSecLock<CComAutoCriticalSection> _control( m_control_lock );
+        CsyTraceScope _trace( "start_entries" );
+
+        std::vector<UINT> _levels;
+        HRESULT _hr = sy_resolve_start_levels( configs, _levels );
+        if ( FAILED( _hr ) )
+            return _hr;
+        {
+            CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+            m_configs = configs;
+        }
+
+        std::vector<size_t> _indices( configs.size() );
+        for ( size_t i = 0; i < configs.size(); i++ ) 
+            _indices[ i ] = i;
+        return this->StartWaves( configs, _levels, _indices );
+    }
+
+    /**
+     * @brief 設定リストを読み直した結果を反映します。
+     *        entry名で現在のプロセスと突き合わせ、
+     *        追加されたentryは起動、削除されたentryは停止、変更されたentryは再起動します。
+     *        変更の無いentryのプロセスはそのまま動かし続けます。（autoscale で増減した replica 数も維持します）
+     *
+     * @param[in] configs ... 新しいプロセス設定リスト
+     */
+    HRESULT ReloadEntries( _In_ const SYCONFIGS& configs ) {
+        CComCritSecLock<CComAutoCriticalSection> _control( m_control_lock );
+        CsyTraceScope _trace( "reload_entries" );
+
+        std::vector<UINT> _levels;
+        HRESULT _hr = sy_resolve_start_levels( configs, _levels );
+        if ( FAILED( _hr ) )
+            return _hr;
+
+        std::map<CAtlString, size_t> _index;
+        for ( size_t i = 0; i < configs.size(); i++ ) 
+            _index[ configs[ i ].m_name ] = i;
+
+        // 1. 突き合わせ。削除/変更されたものは管理リストから外す
+        std::vector<BOOL>    _start( configs.size(), TRUE );
+        SYPROCESSES          _stopping;
+        std::set<CAtlString> _current, _kept;
+        {
+            CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+            m_configs = configs;
+            for ( auto _it = m_processes.begin(); _it != m_processes.end(); ) {
+                auto _found = _index.find( _it->second->IsConfig().m_name );
+                _current.insert( _it->second->IsConfig().m_name );
+                if ( _found != _index.end() && _it->second->IsConfig() == configs[ _found->second ] ) {
+                    _start[ _found->second ] = FALSE;
+                    _kept.insert( _found->first );
+                    ++_it;
+                    continue;
+                }
+                m_scale.erase( _it->second->IsConfig().m_name );
+                _stopping.insert( *_it );
+                _it = m_processes.erase( _it );
+            }
+            // supervisor loop が起動し直している最中のもの（削除/変更されたものは起動後に停止される）
+            for ( auto& r : m_respawning ) {
+                const CsyProcConfig& _c = r.second.process->IsConfig();
+                auto _found = _index.find( _c.m_name );
+                _current.insert( _c.m_name );
+                if ( _found != _index.end() && _c == configs[ _found->second ] ) {
+                    _start[ _found->second ] = FALSE;
+                    _kept.insert( _found->first );
+                    continue;
+                }
+                m_scale.erase( _c.m_name );
+                r.second.cancel = TRUE;
+            }
+        }
+
+        std::vector<size_t> _indices;
+        for ( size_t i = 0; i < configs.size(); i++ ) 
+            if ( _start[ i ] ) _indices.push_back( i );
+
+        TSY_RELOAD_DIFF _diff = sy_reload_diff( configs, _current, _kept );
+        _SLOG( TEXT("==> Reload : %d added, %d modified, %d removed, %d unchanged.\n"),
+                _diff.added, _diff.modified, _diff.removed, _diff.unchanged );
+
+        // 2. 一斉に停止してから、3. 依存関係の順に起動
+        //    (変更されたentryも <listen> が同じならソケットは開いたまま)
+        this->StopProcesses( _stopping, INFINITE );
+
+        std::set<CAtlString> _listen;
+        for ( auto& c : configs ) 
+            _listen.insert( c.m_listen.begin(), c.m_listen.end() );
+        m_listen.Retain( _listen );
+
+        if ( _indices.empty() )
+            return S_OK;
+        return this->StartWaves( configs, _levels, _indices );
+    }
+
+    /**
+     * @brief 全てのプロセスを停止し、プロセスリストを破棄します。
+     *        全プロセスへ一斉に停止要求を送り、まとめて終了を待ちます。
+     *        entry毎の猶予(stop_timeout)までに終了しなかったプロセスはKillし、
+     *        ログに報告します。
+     *
+     * @param[in] max_timeout_ms ... 全体の終了待ちの上限(ms)。entry毎の猶予もこれを超えません。
+     * @param[in] progress       ... 終了を待つ間 SY_STOP_PROGRESS_MS 毎に呼ばれます (Option)
+     */
+    void PurgeProcesses( _In_     DWORD                  max_timeout_ms = INFINITE,
+                         _In_opt_ const SYSTOP_PROGRESS& progress       = nullptr ) {
+        ::InterlockedExchange( &m_cancel, 1 );     // rolling restart 中なら中断させる
+        CComCritSecLock<CComAutoCriticalSection> _control( m_control_lock );
+        ::InterlockedExchange( &m_cancel, 0 );
+
+        SYPROCESSES _processes;
+        {
+            CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+            _processes.swap( m_processes );
+            for ( auto& r : m_retiring ) 
+                _processes[ r.first ] = r.second.process;
+            _processes.insert( m_retired.begin(), m_retired.end() );
+            for ( auto& r : m_respawning ) 
+                r.second.cancel = TRUE;     // 起動を終えた後に supervisor loop が停止する
+            m_retiring.clear();
+            m_retired.clear();
+            m_scale.clear();
+            m_recycling.clear();
+            m_draining.clear();
+            m_scale_ups.clear();
+            m_purge_count++;
+        }
+
+        // Detach 後は実行中のプロセスを停止しない（scale down で停止中のものは停止する）
+        if ( ::InterlockedExchange( &m_detached, 0 ) ) {
+            for ( auto it = _processes.begin(); it != _processes.end(); ) {
+                if ( it->second->IsState() != SY_PROC_RUNNING ) {
+                    ++it;
+                    continue;
+                }
+                it->second->Detach();
+                delete it->second;
+                it = _processes.erase( it );
+            }
+        }
+        this->StopProcesses( _processes, max_timeout_ms, progress );
+        m_listen.Close();
+    }
+
+    /**
+     * @brief 実行中の StartEntries() / ReloadEntries() / RollingRestart() の ready 待ちを中断させます。
+     *        （中断要求は次の PurgeProcesses() まで有効です）
+     */
+    void Cancel( void ) {
+        ::InterlockedExchange( &m_cancel, 1 );
+    }
+
+    /**
+     * @brief 実行中の子プロセスの記録先を設定します。StartEntries() の前に呼ぶこと。
+     * @param[in] journal ... 記録先 (NULL.. 記録しない)
+     */
+    void SetJournal( _In_opt_ IsyProcessJournal* journal ) {
+        m_journal = journal;
+    }
+
+    /**
+     * @brief 次の PurgeProcesses() で実行中のプロセスを停止せずに管理から外します。
+     *        journal の記録は残り、次に起動した supervisor が引き継ぎます。（supervisor の更新用）
+     * @retval HRESULT_FROM_WIN32( ERROR_INVALID_STATE ) ... journal が無い
+     */
+    HRESULT Detach( void ) {
+        if ( !m_journal ) 
+            return HRESULT_FROM_WIN32( ERROR_INVALID_STATE );
+        ::InterlockedExchange( &m_detached, 1 );
+        _SLOG( TEXT("==> Detach requested. running children are kept on stop.\n") );
+        EVENT_INF( TEXT("Detach requested. running children are kept on stop.") );
+        return S_OK;
+    }
+
+    /**
+     * @brief entry のプロセスを順番に入れ替えます。（rolling restart）
+     *
+     *        replica を (surge + unavailable) 個ずつ処理します。
+     *        unavailable 個の旧プロセスを先に停止し、新プロセスを起動して
+     *        全て ready になってから、残りの旧プロセスを停止します。
+     *        先に停止した旧プロセスの代わりは同じ replica 番号で、旧プロセスと同時に動く surge 分は
+     *        空いている最小の replica 番号で起動します。（同じ SYLPH_REPLICA の port / path が重ならないように）
+     *        稼働数は replica 数 - unavailable を下回らず、replica 数 + surge を超えません。
+     *        新プロセスが ready_timeout までに ready にならない場合は新プロセスを停止して中断します。
+     *        （まだ入れ替えていない旧プロセスはそのまま動かし続けます）
+     *
+     * @param[in] name ... entry名
+     */
+    HRESULT RollingRestart( _In_ const CAtlString& name ) {
+        CComCritSecLock<CComAutoCriticalSection> _control( m_control_lock );
+        CsyTraceScope _trace( "rolling_restart", name );
+
+        // 旧プロセス (replica 番号, key) の replica 番号順
+        std::vector< std::pair<UINT, ULONG_PTR> > _olds;
+        CsyProcConfig _config;
+        {
+            CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+            for ( auto& p : m_processes ) 
+                if ( p.second->IsConfig().m_name == name ) {
+                    _olds.push_back( std::make_pair( p.second->IsReplica(), p.first ) );
+                    _config = p.second->IsConfig();
+                }
+            if ( _olds.empty() ) {
+                _SLOG( TEXT("! Rolling restart : unknown entry. [%s]\n"), name );
+                return E_INVALIDARG;
+            }
+            m_rolling.insert( name );
+        }
+        std::sort( _olds.begin(), _olds.end() );
+
+        UINT _surge       = _config.m_surge;
+        UINT _unavailable = _config.m_unavailable;
+        if ( !_surge && !_unavailable ) 
+            _surge = 1;
+        size_t _chunk = _surge + _unavailable;
+
+        _SLOG( TEXT("==> Rolling restart : %s (%d processes, surge %d, unavailable %d)\n"), 
+                name, static_cast<int>( _olds.size() ), _surge, _unavailable );
+
+        LONGLONG _begin    = sy_perf_counter();
+        HRESULT  _hr       = S_OK;
+        size_t   _replaced = 0;
+        for ( size_t i = 0; i < _olds.size(); i += _chunk ) {
+            size_t _end  = ( std::min )( i + _chunk, _olds.size() );
+            size_t _down = ( std::min )( i + _unavailable, _end );
+
+            // 1. unavailable 分の旧プロセスを先に停止
+            std::vector<ULONG_PTR> _keys;
+            for ( size_t n = i; n < _down; n++ ) 
+                _keys.push_back( _olds[ n ].second );
+            this->StopKeys( _keys );
+
+            // 2. 新プロセスを起動し、全て ready になるまで待つ
+            std::vector<ULONG_PTR> _news;
+            std::set<UINT>         _assigned;
+            for ( size_t n = i; n < _end && SUCCEEDED( _hr ); n++ ) {
+                UINT _replica = _olds[ n ].first;
+                if ( n >= _down ) {
+                    CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+                    _replica = this->FreeReplica( name, _assigned );
+                }
+                _assigned.insert( _replica );
+
+                ULONG_PTR _key = 0;
+                _hr = this->AddProcessEntry( _config, _replica, &_key );
+                if ( SUCCEEDED( _hr ) ) 
+                    _news.push_back( _key );
+            }
+            if ( SUCCEEDED( _hr ) ) 
+                _hr = this->WaitReady( _news, _config.m_ready_timeout );
+            if ( FAILED( _hr ) ) {
+                this->StopKeys( _news );
+                break;
+            }
+
+            // 3. 残りの旧プロセスを停止
+            _keys.clear();
+            for ( size_t n = _down; n < _end; n++ ) 
+                _keys.push_back( _olds[ n ].second );
+            this->StopKeys( _keys );
+            _replaced = _end;
+        }
+
+        {
+            CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+            m_rolling.erase( name );
+            m_scale.erase( name );      // 入れ替え直後は autoscale の cooldown から始める
+        }
+
+        if ( FAILED( _hr ) ) {
+            _SLOG( TEXT("! Rolling restart aborted. in %08x : %s (%d/%d replaced)\n"), 
+                    _hr, name, static_cast<int>( _replaced ), static_cast<int>( _olds.size() ) );
+            EVENT_ENTRY_ERR( name, TEXT("Rolling restart aborted. : %s (%d/%d replaced)"), 
+                    name.GetString(), static_cast<int>( _replaced ), static_cast<int>( _olds.size() ) );
+            return _hr;
+        }
+        _SLOG( TEXT("==> Rolling restart completed in %.1f ms : %s\n"), sy_perf_ms( _begin ), name );
+        EVENT_ENTRY_INF( name, TEXT("Rolling restart completed. : %s"), name.GetString() );
+        return S_OK;
+    }
+
+    /**
+     * @brief 停止中の entry を起動します。（StopEntry で停止した / crash loop で停止した entry）
+     *        終了したままのプロセスは破棄し、instances の min 個の replica を起動します。
+     *        depends_on の entry は起動しません。実行中のプロセスが無い場合は起動しません。
+     *
+     * @param[in] name ... entry名
+     * @retval S_FALSE ... 既に実行中
+     * @retval HRESULT_FROM_WIN32( ERROR_SERVICE_DEPENDENCY_FAIL ) ... depends_on の entry が実行中でない
+     */
+    HRESULT StartEntry( _In_ const CAtlString& name ) {
+        CComCritSecLock<CComAutoCriticalSection> _control( m_control_lock );
+
+        SYCONFIGS           _configs;
+        SYPROCESSES         _stopping;
+        std::vector<size_t> _indices;
+        {
+            CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+            for ( size_t i = 0; i < m_configs.size(); i++ ) 
+                if ( m_configs[ i ].m_name == name ) _indices.push_back( i );
+            if ( _indices.empty() ) {
+                _SLOG( TEXT("! Start : unknown entry. [%s]\n"), name );
+                return E_INVALIDARG;
+            }
+            for ( auto& p : m_processes ) 
+                if ( p.second->IsConfig().m_name == name && p.second->IsState() == SY_PROC_RUNNING ) 
+                    return S_FALSE;
+            for ( auto& r : m_respawning ) 
+                if ( r.second.process->IsConfig().m_name == name && !r.second.cancel ) 
+                    return S_FALSE;     // supervisor loop が起動し直している
+
+            // depends_on の entry が先に動いていること（StartEntries の起動順と同じ条件）
+            for ( auto i : _indices ) {
+                for ( auto& d : m_configs[ i ].m_depends_on ) {
+                    BOOL _running = FALSE;
+                    for ( auto& p : m_processes ) 
+                        if ( p.second->IsConfig().m_name == d && p.second->IsState() == SY_PROC_RUNNING ) { _running = TRUE; break; }
+                    if ( !_running ) {
+                        _SLOG( TEXT("! Start : depends_on entry is not running. [%s] -> [%s]\n"), name, d );
+                        EVENT_ENTRY_WAR( name, TEXT("Start entry refused. depends_on entry is not running. : %s -> %s"), name.GetString(), d.GetString() );
+                        return HRESULT_FROM_WIN32( ERROR_SERVICE_DEPENDENCY_FAIL );
+                    }
+                }
+            }
+
+            for ( auto _it = m_processes.begin(); _it != m_processes.end(); ) {
+                if ( _it->second->IsConfig().m_name != name ) {
+                    ++_it;
+                    continue;
+                }
+                _stopping.insert( *_it );
+                _it = m_processes.erase( _it );
+            }
+            m_scale.erase( name );
+            _configs = m_configs;
+        }
+        this->StopProcesses( _stopping, INFINITE );
+
+        _SLOG( TEXT("==> Start entry : %s\n"), name );
+        std::vector<UINT> _levels( _configs.size(), 0 );
+        return this->StartWaves( _configs, _levels, _indices );
+    }
+
+    /**
+     * @brief entry の全てのプロセスを停止します。
+     *        停止した entry は StartEntry または設定の反映 (reload) まで起動しません。
+     *
+     * @param[in] name ... entry名
+     * @retval S_FALSE ... 実行中のプロセスが無い
+     */
+    HRESULT StopEntry( _In_ const CAtlString& name ) {
+        CComCritSecLock<CComAutoCriticalSection> _control( m_control_lock );
+
+        SYPROCESSES _stopping;
+        BOOL        _cancelled = FALSE;
+        {
+            CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+            BOOL _known = FALSE;
+            for ( auto& c : m_configs ) 
+                if ( c.m_name == name ) _known = TRUE;
+            if ( !_known ) {
+                _SLOG( TEXT("! Stop : unknown entry. [%s]\n"), name );
+                return E_INVALIDARG;
+            }
+
+            for ( auto _it = m_processes.begin(); _it != m_processes.end(); ) {
+                if ( _it->second->IsConfig().m_name != name ) {
+                    ++_it;
+                    continue;
+                }
+                _stopping.insert( *_it );
+                _it = m_processes.erase( _it );
+            }
+            for ( auto& r : m_respawning ) {
+                if ( r.second.process->IsConfig().m_name != name || r.second.cancel ) 
+                    continue;
+                r.second.cancel = TRUE;     // 起動し直している最中のものは、起動後に supervisor loop が停止する
+                _cancelled = TRUE;
+            }
+            m_scale.erase( name );
+        }
+        if ( _stopping.empty() && !_cancelled ) 
+            return S_FALSE;
+
+        _SLOG( TEXT("==> Stop entry : %s\n"), name );
+        this->StopProcesses( _stopping, INFINITE );
+        EVENT_ENTRY_INF( name, TEXT("Entry stopped. : %s"), name.GetString() );
+        return S_OK;
+    }
+
+    /**
+     * @brief 状態変化の通知先を設定します。（実行中のプロセスにも設定します）
+     * @param[in] observer ... 通知先 (NULL.. 通知しない)
+     */
+    void SetObserver( _In_opt_ IsyProcessObserver* observer ) {
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        m_observer = observer;
+        for ( auto& p : m_processes ) 
+            p.second->SetObserver( observer );
+        for ( auto& r : m_retiring ) 
+            r.second.process->SetObserver( observer );
+        for ( auto& r : m_retired ) 
+            r.second->SetObserver( observer );
+    }
+
+    /**
+     * @brief 最後に起動/反映した設定リストを列挙します
+     */
+    void ForEachConfig( std::function<void(const CsyProcConfig&)> func ) {
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        for ( auto& c : m_configs ) 
+            func( c );
+    }
+
+    /**
+     * @brief process list を列挙します
+     */
+    void ForEach( std::function<void(CsyProcess*)> func ) {
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        for ( auto& p : m_processes ) 
+            func( p.second );
+    }
+
+    /**
+     * @brief リソース採取の間隔を設定します
+     * @param[in] interval_ms ... 採取間隔(ms) 0.. 採取しない
+     */
+    void SetSampleInterval( _In_ DWORD interval_ms ) {
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        m_sampler.SetInterval( interval_ms );
+        if ( m_iocp ) ::PostQueuedCompletionStatus( m_iocp, 0, SY_KEY_WAKE, NULL );  // 待ち時間を再計算
+    }
+
+    /**
+     * @brief 最新のリソース採取結果を取得します。（supervisor のロックは取りません）
+     */
+    SYRESOURCESNAPSHOT GetResourceSnapshot( void ) const {
+        return m_sampler.IsSnapshot();
+    }
+
+protected:
+    /**
+     * @brief Supervisor loop. 全プロセスの終了通知を１か所で待ちます。
+     */
+    virtual DWORD run( _In_ void* argment = NULL ) override {
+
+        SY_TRACE.SetThreadName( "supervisor" );
+        for ( ;; ) {
+            this->SpawnRestarts();      // 前回の処理で予約した起動 / Kill（ロック外）
+
+            DWORD        _msg  = 0;
+            ULONG_PTR    _key  = 0;
+            LPOVERLAPPED _ov_p = NULL;
+
+            BOOL _ret = ::GetQueuedCompletionStatus( 
+                            m_iocp, &_msg, &_key, &_ov_p, this->NextTimeout() );
+            DWORD _err = _ret ? ERROR_SUCCESS : ::GetLastError();
+
+            if ( !_ret && !_ov_p ) {
+                if ( _err != WAIT_TIMEOUT ) 
+                    return 1;   // port closed.
+
+                this->OnTimer();
+                this->SpawnScaled();
+                continue;
+            }
+
+            if ( _key == SY_KEY_QUIT )
+                break;
+            if ( _key == SY_KEY_WAKE )
+                continue;
+            if ( _key == SY_KEY_NOTIFY ) {
+                this->OnNotify( _ov_p, _msg, _err );
+                continue;
+            }
+
+            switch ( _msg ) {
+            // sig: exit a process (job member)
+            case JOB_OBJECT_MSG_EXIT_PROCESS:
+            case JOB_OBJECT_MSG_ABNORMAL_EXIT_PROCESS: {
+                CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+                auto _it = m_processes.find( _key );
+                if ( _it != m_processes.end() ) {
+                    if ( _it->second->OnExitNotify( static_cast<DWORD>( reinterpret_cast<ULONG_PTR>( _ov_p ) ) ) )
+                        this->OnProcessExited( _it->second );
+                } else if ( m_retiring.count( _key ) ) {
+                    this->FinishRetire( ::GetTickCount64() );
+                } else if ( m_starting.count( _key ) ) {
+                    // 起動直後に終了した (AddProcessEntry が管理リストへ追加した後に処理する)
+                    m_early_exits.insert( std::make_pair( _key, static_cast<DWORD>( reinterpret_cast<ULONG_PTR>( _ov_p ) ) ) );
+                }
+                }
+                break;
+
+            // sig: all processes in a job exited (Kill した子孫プロセスの終了)
+            case JOB_OBJECT_MSG_ACTIVE_PROCESS_ZERO: {
+                CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+                auto _it = m_processes.find( _key );
+                if ( _it != m_processes.end() && _it->second->OnJobEmpty() && m_draining.erase( _key ) ) 
+                    this->OnProcessExited( _it->second );
+                }
+                break;
+
+            // sig: job memory limit
+            case JOB_OBJECT_MSG_JOB_MEMORY_LIMIT: {
+                CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+                auto _it = m_processes.find( _key );
+                if ( _it != m_processes.end() ) 
+                    _it->second->OnMemoryLimit();
+                }
+                break;
+
+            default:
+                break;
+            }
+        }
+        return 0;
+    }
+
+private:
+    /** 完了ポートを作成し、supervisor loopを開始します */
+    HRESULT Startup( void ) {
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        if ( m_iocp ) 
+            return S_OK;
+
+        HRESULT _hr = m_capture.Startup();
+        if ( FAILED( _hr ) )
+            return _hr;
+
+        m_iocp = ::CreateIoCompletionPort( INVALID_HANDLE_VALUE, NULL, 0, 1 );
+        if ( !m_iocp )
+            return HRESULT_FROM_WIN32( ::GetLastError() );
+
+        _hr = m_notify.Startup( m_iocp, SY_KEY_NOTIFY );
+        if ( SUCCEEDED( _hr ) ) 
+            _hr = CsyThread::Begin( NULL );
+        if ( FAILED( _hr ) ) {
+            m_notify.Shutdown();
+            ::CloseHandle( m_iocp );
+            m_iocp = NULL;
+        }
+        return _hr;
+    }
+
+    /** supervisor loopを終了し、完了ポートを閉じます */
+    void Shutdown( void ) {
+        if ( !m_iocp ) 
+            return;
+
+        ::PostQueuedCompletionStatus( m_iocp, 0, SY_KEY_QUIT, NULL );
+        CsyThread::Join();
+        m_notify.Shutdown();
+
+        ::CloseHandle( m_iocp );
+        m_iocp = NULL;
+
+        m_capture.Shutdown();
+    }
+
+    /**
+     * @brief 設定リストのうち indices のentryを、段 (group, 依存の深さ) 毎に起動します。
+     *
+     * @param[in] configs ... プロセス設定リスト
+     * @param[in] levels ... entry毎の依存の深さ (sy_resolve_start_levels)
+     * @param[in] indices ... 起動するentry
+     */
+    HRESULT StartWaves( _In_ const SYCONFIGS&           configs,
+                        _In_ const std::vector<UINT>&   levels,
+                        _In_ const std::vector<size_t>& indices ) {
+
+        HRESULT _hr = this->Startup();
+        if ( FAILED( _hr ) )
+            return _hr;
+
+        // 段 (group, level) 毎にまとめる
+        typedef std::pair<UINT, UINT> TWAVE_KEY;
+        std::map< TWAVE_KEY, std::vector<size_t> > _waves;
+        for ( auto i : indices ) 
+            _waves[ TWAVE_KEY( configs[ i ].m_group, levels[ i ] ) ].push_back( i );
+
+        LONGLONG              _begin = sy_perf_counter();
+        std::vector<double>   _spawn_ms ( configs.size(), 0.0 );
+        std::vector<double>   _finish_ms( configs.size(), 0.0 );
+        std::vector<HRESULT>  _results  ( configs.size(), S_OK );
+
+        for ( auto& w : _waves ) {
+            auto& _entries = w.second;
+
+            // (entry, replica) 毎に並列に起動
+            std::vector< std::pair<size_t, UINT> > _tasks;
+            for ( auto i : _entries ) 
+                for ( UINT r = 0; r < configs[ i ].m_instances_min; r++ ) 
+                    _tasks.push_back( std::make_pair( i, r ) );
+
+            std::vector<double>   _task_spawn ( _tasks.size(), 0.0 );
+            std::vector<double>   _task_finish( _tasks.size(), 0.0 );
+            std::vector<HRESULT>  _task_result( _tasks.size(), S_OK );
+            std::vector<ULONG_PTR> _task_key  ( _tasks.size(), 0 );
+            sy_parallel_for( _tasks.size(), [&]( size_t n ) {
+                LONGLONG _spawn = sy_perf_counter();
+                _task_result[ n ] = this->AddProcessEntry( configs[ _tasks[ n ].first ], _tasks[ n ].second, &_task_key[ n ] );
+                _task_spawn [ n ] = sy_perf_ms( _spawn );
+                _task_finish[ n ] = sy_perf_ms( _begin );
+            } );
+
+            // notify の entry は READY まで待つ（次の段を起動しない）
+            this->WaitWaveReady( configs, _tasks, _task_key, _task_result, _task_spawn, _task_finish );
+
+            // entry 毎に最も遅い replica
+            for ( size_t n = 0; n < _tasks.size(); n++ ) {
+                size_t _idx = _tasks[ n ].first;
+                _spawn_ms [ _idx ] = ( std::max )( _spawn_ms [ _idx ], _task_spawn [ n ] );
+                _finish_ms[ _idx ] = ( std::max )( _finish_ms[ _idx ], _task_finish[ n ] );
+                if ( FAILED( _task_result[ n ] ) ) _results[ _idx ] = _task_result[ n ];
+            }
+
+            // 段の報告（最も遅いentry）
+            size_t _slowest = _entries[ 0 ];
+            for ( auto i : _entries ) {
+                if ( _spawn_ms[ i ] > _spawn_ms[ _slowest ] ) _slowest = i;
+                if ( FAILED( _results[ i ] ) ) _hr = _results[ i ];
+            }
+            _SLOG( TEXT("==> [group:%d level:%d] %d entries (%d processes) started. slowest : %s (%.1f ms)\n"),
+                    w.first.first, w.first.second, static_cast<int>( _entries.size() ), 
+                    static_cast<int>( _tasks.size() ), configs[ _slowest ].m_name, _spawn_ms[ _slowest ] );
+
+            if ( FAILED( _hr ) ) 
+                return _hr;
+        }
+
+        this->ReportCriticalPath( configs, _spawn_ms, _finish_ms );
+        return S_OK;
+    }
+
+    /**
+     * @brief 段で起動した notify の entry が READY になるまで待ちます。
+     *        起動時間 (spawn / finish) は READY までの時間に置き換え、
+     *        READY にならなかったものは task_result を失敗にします。
+     */
+    void WaitWaveReady( _In_    const SYCONFIGS&                              configs,
+                        _In_    const std::vector< std::pair<size_t, UINT> >& tasks,
+                        _In_    const std::vector<ULONG_PTR>&                 task_key,
+                        _Inout_ std::vector<HRESULT>&                         task_result,
+                        _Inout_ std::vector<double>&                          task_spawn,
+                        _Inout_ std::vector<double>&                          task_finish ) {
+        std::vector<ULONG_PTR> _keys;
+        DWORD                  _timeout = 0;
+        for ( size_t n = 0; n < tasks.size(); n++ ) {
+            const CsyProcConfig& _c = configs[ tasks[ n ].first ];
+            if ( !_c.m_notify || FAILED( task_result[ n ] ) ) 
+                continue;
+            _keys.push_back( task_key[ n ] );
+            _timeout = ( std::max )( _timeout, _c.m_ready_timeout );
+        }
+        if ( _keys.empty() ) 
+            return;
+
+        HRESULT _hr = this->WaitReady( _keys, _timeout );
+
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        for ( size_t n = 0; n < tasks.size(); n++ ) {
+            const CsyProcConfig& _c = configs[ tasks[ n ].first ];
+            if ( !_c.m_notify || FAILED( task_result[ n ] ) ) 
+                continue;
+
+            auto _it = m_processes.find( task_key[ n ] );
+            if ( _it != m_processes.end() && _it->second->IsReady( ::GetTickCount64() ) ) {
+                double _ready_ms = _it->second->IsReadyLatency();
+                task_finish[ n ] += _ready_ms - task_spawn[ n ];
+                task_spawn [ n ]  = _ready_ms;
+            } else {
+                task_result[ n ] = FAILED( _hr ) ? _hr : E_FAIL;
+                _SLOG( TEXT("! Not ready in %d ms. in %08x : %s\n"), _c.m_ready_timeout, task_result[ n ], _c.m_name );
+                EVENT_ENTRY_ERR( _c.m_name, TEXT("Not ready. : %s"), _c.m_name.GetString() );
+            }
+        }
+    }
+
+    /**
+     * @brief プロセスを停止し、破棄します。（管理リストから外したものを渡すこと）
+     *        全プロセスへ一斉に停止要求を送り、まとめて終了を待ちます。
+     *        entry毎の猶予(stop_timeout)までに終了しなかったプロセスはKillし、
+     *        ログに報告します。
+     *
+     * @param[in] max_timeout_ms ... 全体の終了待ちの上限(ms)
+     * @param[in] progress       ... 終了を待つ間 SY_STOP_PROGRESS_MS 毎に呼ばれます (Option)
+     */
+    void StopProcesses( _Inout_  SYPROCESSES&           processes, 
+                        _In_     DWORD                  max_timeout_ms,
+                        _In_opt_ const SYSTOP_PROGRESS& progress = nullptr ) {
+        if ( processes.empty() )
+            return;
+
+        // 1. 一斉に停止要求 (期限毎にまとめる。Ctrl イベントはまとめて送る)
+        ULONGLONG _begin = ::GetTickCount64();
+        std::map< ULONGLONG, std::vector<HANDLE> > _deadlines;
+        CsyConsoleCtrlBatch _console;
+        for ( auto& p : processes ) {
+            if ( p.second->IsState() != SY_PROC_RUNNING ) 
+                continue;
+            if ( p.second->Signal( &_console ) ) {
+                DWORD _grace = ( std::min )( p.second->IsConfig().m_stop_timeout, max_timeout_ms );
+                _deadlines[ _begin + _grace ].push_back( p.second->IsProcessHandle() );
+            }
+        }
+        _console.Send();
+
+        // 2. 期限の早い順に待ち合わせ（その間も他のプロセスは終了処理を続ける）
+        for ( auto& d : _deadlines ) {
+            for ( ;; ) {
+                ULONGLONG _now   = ::GetTickCount64();
+                ULONGLONG _until = progress ? ( std::min )( d.first, _now + SY_STOP_PROGRESS_MS ) : d.first;
+                if ( sy_wait_all_until( d.second, _until ) || _until >= d.first ) 
+                    break;
+                _now = ::GetTickCount64();
+                ULONGLONG _last = _deadlines.rbegin()->first;
+                progress( _now < _last ? static_cast<DWORD>( ( std::min )( _last - _now, 0xFFFFFFFEULL ) ) : 0 );
+            }
+        }
+
+        // 3. 残ったプロセスはまとめてKillし、本体の終了をまとめて待つ（子孫の終了は待たない）
+        //    待っても終了しなかったものも、プロセス毎には待たずに Kill として記録する
+        std::vector<HANDLE> _killing;
+        for ( auto& p : processes ) 
+            if ( p.second->Kill() ) 
+                _killing.push_back( p.second->IsProcessHandle() );
+        if ( !_killing.empty() ) 
+            sy_wait_all_until( _killing, ::GetTickCount64() + SY_KILL_WAIT_MS );
+
+        CAtlString _killed;
+        UINT       _num_killed = 0;
+        double     _max_ms     = 0.0;
+        for ( auto& p : processes ) {
+            DWORD _pid = p.second->IsProcessID();
+            if ( p.second->Stop( 0 ) ) {
+                _killed.AppendFormat( TEXT(" %d"), _pid );
+                _num_killed++;
+            }
+            _max_ms = ( std::max )( _max_ms, p.second->IsStopLatency() );
+            delete p.second;
+        }
+
+        _SLOG( TEXT("==> %d processes stopped in %I64u ms. (slowest : %.1f ms, force killed : %d)\n"),
+                static_cast<int>( processes.size() ), ::GetTickCount64() - _begin, 
+                _max_ms, _num_killed );
+        if ( _num_killed ) {
+            _SLOG( TEXT("==> force killed PID :%s\n"), _killed );
+            EVENT_WAR( TEXT("Stop timeout. force killed PID :%s"), _killed.GetString() );
+        }
+    }
+
+    /**
+     * @brief key のプロセスを管理リストから外して停止します。（既に無いものは無視します）
+     */
+    void StopKeys( _In_ const std::vector<ULONG_PTR>& keys ) {
+        SYPROCESSES _stopping;
+        {
+            CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+            for ( auto k : keys ) {
+                auto _it = m_processes.find( k );
+                if ( _it == m_processes.end() ) 
+                    continue;
+                _stopping.insert( *_it );
+                m_processes.erase( _it );
+            }
+        }
+        this->StopProcesses( _stopping, INFINITE );
+    }
+
+    /**
+     * @brief key のプロセスが全て ready になるまで待ちます。（READY の受信で起床します）
+     * @retval E_ABORT ... 中断要求 (PurgeProcesses)
+     * @retval HRESULT_FROM_WIN32(ERROR_PROCESS_ABORTED) ... 待っている間に終了した
+     * @retval HRESULT_FROM_WIN32(ERROR_TIMEOUT) ... timeout_ms までに ready にならなかった
+     */
+    HRESULT WaitReady( _In_ const std::vector<ULONG_PTR>& keys, _In_ DWORD timeout_ms ) {
+        ULONGLONG _deadline = ::GetTickCount64() + timeout_ms;
+        for ( ;; ) {
+            {
+                CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+                ULONGLONG _now   = ::GetTickCount64();
+                size_t    _ready = 0;
+                for ( auto k : keys ) {
+                    auto _it = m_processes.find( k );
+                    if ( _it == m_processes.end() || _it->second->IsState() != SY_PROC_RUNNING || 
+                         _it->second->IsRestartCount() ) 
+                        return HRESULT_FROM_WIN32( ERROR_PROCESS_ABORTED );
+                    if ( _it->second->IsReady( _now ) ) 
+                        _ready++;
+                }
+                if ( _ready == keys.size() ) 
+                    return S_OK;
+                if ( _now >= _deadline ) 
+                    return HRESULT_FROM_WIN32( ERROR_TIMEOUT );
+            }
+            if ( m_cancel ) 
+                return E_ABORT;
+            ::WaitForSingleObject( m_ready_event, SY_READY_POLL_MS );
+        }
+    }
+
+    /**
+     * @brief 起動時間のクリティカルパスを報告します。
+     *        最後に起動完了したentryから、最も遅く完了した依存先を辿ります。
+     */
+    void ReportCriticalPath( _In_ const SYCONFIGS&           configs,
+                             _In_ const std::vector<double>& spawn_ms,
+                             _In_ const std::vector<double>& finish_ms ) {
+        if ( configs.empty() ) 
+            return;
+
+        std::map<CAtlString, size_t> _index;
+        size_t _last = 0;
+        for ( size_t i = 0; i < configs.size(); i++ ) {
+            _index[ configs[ i ].m_name ] = i;
+            if ( finish_ms[ i ] > finish_ms[ _last ] ) _last = i;
+        }
+
+        CAtlString _path;
+        for ( size_t i = _last; ; ) {
+            CAtlString _s;
+            _s.Format( TEXT("%s%s (%.1f ms)"), 
+                    _path.IsEmpty() ? TEXT("") : TEXT(" <- "), configs[ i ].m_name, spawn_ms[ i ] );
+            _path += _s;
+
+            if ( configs[ i ].m_depends_on.empty() ) 
+                break;
+
+            size_t _next = _index[ configs[ i ].m_depends_on[ 0 ] ];
+            for ( auto& d : configs[ i ].m_depends_on ) 
+                if ( finish_ms[ _index[ d ] ] > finish_ms[ _next ] ) _next = _index[ d ];
+            i = _next;
+        }
+
+        _SLOG( TEXT("==> Startup %.1f ms. critical path : %s\n"), finish_ms[ _last ], _path );
+    }
+
+    /**
+     * @brief 通知チャネルの完了通知を処理します。（supervisor loop）
+     */
+    void OnNotify( _In_ LPOVERLAPPED ov, _In_ DWORD bytes, _In_ DWORD error ) {
+        DWORD       _pid = 0;
+        std::string _message;
+        if ( !m_notify.OnCompletion( ov, bytes, error, _pid, _message ) ) 
+            return;
+
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        for ( auto& p : m_processes ) {
+            if ( p.second->IsProcessID() != _pid || p.second->IsState() != SY_PROC_RUNNING ) 
+                continue;
+            if ( p.second->OnNotify( _message ) ) 
+                ::SetEvent( m_ready_event );
+            return;
+        }
+
+        // 起動直後で管理リストへの追加前（AddProcessEntry で処理する）
+        auto& _orphan = m_orphan_notify[ _pid ];
+        _orphan.first   = ::GetTickCount64();
+        _orphan.second += _message;
+        _orphan.second += '\n';
+    }
+
+    /** 
+     * @brief Job通知は取りこぼす可能性があるため、定期的に状態を確認します
+     */
+    void Sweep( void ) {
+        ULONGLONG _now = ::GetTickCount64();
+        for ( auto _it = m_orphan_notify.begin(); _it != m_orphan_notify.end(); ) {
+            if ( _now - _it->second.first >= SY_NOTIFY_ORPHAN_MS ) 
+                _it = m_orphan_notify.erase( _it );
+            else
+                ++_it;
+        }
+
+        for ( auto& p : m_processes ) 
+            if ( p.second->IsState() == SY_PROC_RUNNING && !p.second->IsRunning() ) 
+                if ( p.second->OnExitNotify( p.second->IsProcessID() ) )
+                    this->OnProcessExited( p.second );
+    }
+
+    /**
+     * @brief 全プロセスの heartbeat を確認します。（m_lock 取得済みで呼ぶ）
+     *        期限切れのプロセスは強制終了され、終了通知から再起動されます。
+     *        watchdog の entry が無くなったら確認を止めます。
+     */
+    void ScanWatchdog( _In_ ULONGLONG now ) {
+        BOOL _watchdog = FALSE;
+        for ( auto& p : m_processes ) {
+            if ( !p.second->IsConfig().m_watchdog ) 
+                continue;
+            _watchdog = TRUE;
+            p.second->CheckWatchdog( now );
+        }
+        m_watchdog = _watchdog;
+    }
+
+    /**
+     * @brief プロセスの異常終了を処理します。（m_lock 取得済みで呼ぶ）
+     */
+    void OnProcessExited( _In_ CsyProcess* p ) {
+        if ( p->IsDraining( ::GetTickCount64() ) ) {
+            m_draining[ p->IsKey() ] = p->IsDrainUntil();   // 子孫プロセスが終了してから再起動する
+            return;
+        }
+        if ( m_recycling.erase( p->IsKey() ) && p->IsRecycling() ) {
+            this->QueueRespawn( p, TRUE );      // recycle は待たずに起動し直す（連続再起動回数に数えない）
+            return;
+        }
+        if ( p->ScheduleRestart( static_cast<UINT>( m_random() ) ) )
+            m_restarts.insert( std::make_pair( p->IsRestartAt(), p->IsKey() ) );
+    }
+
+    /**
+     * @brief 次のタイマー処理までの待ち時間(ms)
+     */
+    DWORD NextTimeout( void ) {
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        ULONGLONG _now     = ::GetTickCount64();
+        DWORD     _timeout = ( std::min )( static_cast<DWORD>( SY_SUPERVISOR_SWEEP_MS ), 
+                                           m_sampler.Remaining( _now ) );
+        for ( auto& r : m_retiring ) 
+            _timeout = ( std::min )( _timeout, r.second.deadline <= _now ? 0 
+                                             : static_cast<DWORD>( r.second.deadline - _now ) );
+        for ( auto& r : m_recycling ) 
+            _timeout = ( std::min )( _timeout, r.second <= _now ? 0 
+                                             : static_cast<DWORD>( ( std::min )( r.second - _now, static_cast<ULONGLONG>( _timeout ) ) ) );
+        for ( auto& r : m_draining ) 
+            _timeout = ( std::min )( _timeout, r.second <= _now ? 0 
+                                             : static_cast<DWORD>( ( std::min )( r.second - _now, static_cast<ULONGLONG>( _timeout ) ) ) );
+        if ( m_watchdog ) {
+            ULONGLONG _elapsed = _now - m_last_watchdog;
+            _timeout = ( std::min )( _timeout, _elapsed >= SY_WATCHDOG_SCAN_MS ? 0 
+                                             : static_cast<DWORD>( SY_WATCHDOG_SCAN_MS - _elapsed ) );
+        }
+        if ( m_restarts.empty() ) 
+            return _timeout;
+
+        ULONGLONG _at  = m_restarts.begin()->first;
+        if ( _at <= _now ) 
+            return 0;
+        return static_cast<DWORD>( ( std::min )( _at - _now, static_cast<ULONGLONG>( _timeout ) ) );
+    }
+
+    /**
+     * @brief タイマー処理。期限の来た再起動の実行と、取りこぼしの確認、
+     *        watchdog の確認、リソース採取 (autoscale / recycle) を行います。
+     */
+    void OnTimer( void ) {
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        ULONGLONG _now = ::GetTickCount64();
+
+        while ( !m_restarts.empty() && m_restarts.begin()->first <= _now ) {
+            ULONG_PTR _key = m_restarts.begin()->second;
+            m_restarts.erase( m_restarts.begin() );
+
+            auto _it = m_processes.find( _key );
+            if ( _it == m_processes.end() || _it->second->IsState() != SY_PROC_BACKOFF ) 
+                continue;
+            this->QueueRespawn( _it->second, FALSE );   // 起動はロック外で (SpawnRestarts)
+        }
+
+        if ( !m_retiring.empty() ) 
+            this->FinishRetire( _now );
+
+        if ( !m_draining.empty() ) 
+            this->FinishDrain( _now );
+
+        if ( !m_recycling.empty() ) 
+            this->FinishRecycle( _now );
+
+        if ( _now - m_last_sweep >= SY_SUPERVISOR_SWEEP_MS ) {
+            m_last_sweep = _now;
+            this->Sweep();
+        }
+
+        if ( m_watchdog && _now - m_last_watchdog >= SY_WATCHDOG_SCAN_MS ) {
+            m_last_watchdog = _now;
+            this->ScanWatchdog( _now );
+        }
+
+        if ( m_sampler.Remaining( _now ) == 0 ) 
+            this->Sample( _now );
+    }
+
+    /**
+     * @brief 実行中の全プロセスのリソースを採取します。（m_lock 取得済みで呼ぶ）
+     */
+    void Sample( _In_ ULONGLONG now ) {
+        std::vector<TSY_SAMPLE_TARGET> _targets;
+        _targets.reserve( m_processes.size() );
+        for ( auto& p : m_processes ) {
+            if ( p.second->IsState() != SY_PROC_RUNNING ) 
+                continue;
+            TSY_SAMPLE_TARGET _t = { p.first, p.second->IsProcessID(), p.second->IsProcessHandle() };
+            _targets.push_back( _t );
+        }
+        m_sampler.Sample( _targets, now );
+
+        SYRESOURCESNAPSHOT _snap = m_sampler.IsSnapshot();
+        for ( auto& s : _snap->m_samples ) 
+            m_processes[ s.key ]->OnCpuSample( s.cpu_percent );
+
+        _SDBG( TEXT("==> %d processes sampled in %.2f ms.\n"), 
+                static_cast<int>( _targets.size() ), _snap->m_cost_ms );
+
+        this->Autoscale( now, *_snap );
+        this->Recycle( now, *_snap );
+    }
+
+    /**
+     * @brief recycle の条件に達したプロセスを起動し直します。（m_lock 取得済みで呼ぶ）
+     *
+     *        entry 毎に同時に recycle するのは parallel 個までとし、起動が古い順に行います。
+     *        停止要求を送り、終了したら（stop_timeout を過ぎたら Kill して）同じ replica 番号で起動します。
+     *        rolling restart 中の entry は対象にしません。
+     */
+    void Recycle( _In_ ULONGLONG now, _In_ const CsyResourceSnapshot& snap ) {
+        struct TCANDIDATE {
+            CsyProcess* process;
+            CAtlString  reason;
+        };
+        std::map<CAtlString, std::vector<TCANDIDATE> > _candidates;
+        std::map<CAtlString, UINT>                     _recycling;
+        for ( auto& p : m_processes ) {
+            const CsyProcConfig& _c = p.second->IsConfig();
+            if ( !_c.IsRecycle() || m_rolling.count( _c.m_name ) ) 
+                continue;
+            if ( p.second->IsRecycling() ) {
+                _recycling[ _c.m_name ]++;
+                continue;
+            }
+            const TSY_PROC_SAMPLE* _s = snap.Find( p.first );
+            TCANDIDATE _t = { p.second };
+            if ( p.second->CheckRecycle( now, _s ? _s->working_set : 0, _t.reason ) ) 
+                _candidates[ _c.m_name ].push_back( _t );
+        }
+
+        for ( auto& g : _candidates ) {
+            std::sort( g.second.begin(), g.second.end(), []( const TCANDIDATE& a, const TCANDIDATE& b ) {
+                return a.process->IsStartTick() < b.process->IsStartTick(); } );
+
+            UINT _parallel = g.second.front().process->IsConfig().m_recycle_parallel;
+            UINT _busy     = _recycling[ g.first ];
+            for ( auto& t : g.second ) {
+                if ( _busy >= _parallel ) 
+                    break;
+                CsyProcess* _p = t.process;
+                m_recycling[ _p->IsKey() ] = _p->Recycle( t.reason ) ? now + _p->IsConfig().m_stop_timeout : now;
+                _busy++;
+            }
+        }
+    }
+
+    /**
+     * @brief recycle 中で stop_timeout を過ぎたプロセスを Kill して起動し直します。（m_lock 取得済みで呼ぶ）
+     *        終了通知で起動し直したもの / 停止されたものは外します。起動はロック外で行います。 (SpawnRestarts)
+     */
+    void FinishRecycle( _In_ ULONGLONG now ) {
+        for ( auto _it = m_recycling.begin(); _it != m_recycling.end(); ) {
+            auto _p = m_processes.find( _it->first );
+            if ( _p == m_processes.end() || !_p->second->IsRecycling() ) {
+                _it = m_recycling.erase( _it );
+                continue;
+            }
+            if ( now < _it->second || m_draining.count( _it->first ) ) {
+                ++_it;
+                continue;
+            }
+            if ( _p->second->Kill() ) {     // 終了通知 (OnProcessExited) で起動し直す
+                _it->second = static_cast<ULONGLONG>( -1 );
+                ++_it;
+                continue;
+            }
+            _it = m_recycling.erase( _it );
+            this->QueueRespawn( _p->second, TRUE );
+        }
+    }
+
+    /**
+     * @brief 子孫プロセスの終了待ちが期限を過ぎたプロセスの再起動を判断します。（m_lock 取得済みで呼ぶ）
+     *        （通常は終了通知 ACTIVE_PROCESS_ZERO で判断済み）
+     */
+    void FinishDrain( _In_ ULONGLONG now ) {
+        for ( auto _it = m_draining.begin(); _it != m_draining.end(); ) {
+            if ( now < _it->second ) {
+                ++_it;
+                continue;
+            }
+            auto _p = m_processes.find( _it->first );
+            _it = m_draining.erase( _it );
+            if ( _p == m_processes.end() || _p->second->IsState() != SY_PROC_EXITED ) 
+                continue;
+            _SLOG( TEXT("! descendants did not exit in %d ms. restart anyway : %s\n"), 
+                    SY_KILL_WAIT_MS, _p->second->IsConfig().m_name );
+            this->OnProcessExited( _p->second );
+        }
+    }
+
+    /**
+     * @brief replica 数を CPU 使用率に合わせて増減します。（m_lock 取得済みで呼ぶ）
+     *
+     *        entry の replica の平均 CPU 使用率 (1コア = 100%) が scale_up 以上、
+     *        または scale_down 以下の状態が SY_SCALE_SUSTAIN 回の採取で続き、
+     *        前回の増減（初回は起動）から cooldown 秒経っていれば、instances の範囲で1つ増減します。
+     *        数えるのは実行中 (RUNNING) の replica だけです。再起動を待つ (BACKOFF) replica は
+     *        戻った時に instances の max を超えないよう scale up の上限にだけ含め、PARKED は含めません。
+     */
+    void Autoscale( _In_ ULONGLONG now, _In_ const CsyResourceSnapshot& snap ) {
+        struct TGROUP {
+            const CsyProcConfig*        config;
+            std::vector<CsyProcess*>    replicas;   ///< 実行中の replica
+            UINT                        restarting; ///< 再起動を待つ / 起動し直している replica
+            double                      cpu;        ///< 採取できた replica の合計 (1コア = 100%)
+            UINT                        sampled;
+        };
+        std::map<CAtlString, TGROUP> _groups;
+        for ( auto& p : m_processes ) {
+            const CsyProcConfig& _c = p.second->IsConfig();
+            if ( !_c.IsAutoscale() || m_rolling.count( _c.m_name ) ) 
+                continue;
+
+            TGROUP& _g = _groups[ _c.m_name ];
+            _g.config = &_c;
+            if ( p.second->IsState() == SY_PROC_BACKOFF ) 
+                _g.restarting++;
+            if ( p.second->IsState() != SY_PROC_RUNNING ) 
+                continue;
+            _g.replicas.push_back( p.second );
+            const TSY_PROC_SAMPLE* _s = snap.Find( p.first );
+            if ( _s ) {
+                _g.cpu += _s->cpu_percent * m_sampler.IsNumCpu();
+                _g.sampled++;
+            }
+        }
+        for ( auto& r : m_respawning ) {
+            auto _g = _groups.find( r.second.process->IsConfig().m_name );
+            if ( _g != _groups.end() ) 
+                _g->second.restarting++;
+        }
+
+        for ( auto& g : _groups ) {
+            const CsyProcConfig& _c = *g.second.config;
+            if ( !g.second.sampled ) 
+                continue;
+
+            auto _inserted = m_scale.insert( std::make_pair( g.first, TSCALE_STATE() ) );
+            TSCALE_STATE& _st = _inserted.first->second;
+            if ( _inserted.second ) 
+                _st.last = now;     // 起動直後も cooldown を待つ
+
+            double _avg = g.second.cpu / g.second.sampled;
+            _st.up   = _avg >= _c.m_scale_up   ? _st.up   + 1 : 0;
+            _st.down = _avg <= _c.m_scale_down ? _st.down + 1 : 0;
+            if ( now - _st.last < static_cast<ULONGLONG>( _c.m_scale_cooldown ) * 1000 ) 
+                continue;
+
+            UINT _count = static_cast<UINT>( g.second.replicas.size() );
+            if ( _st.up >= SY_SCALE_SUSTAIN && _count + g.second.restarting < _c.m_instances_max ) {
+                // 空いている最小の replica 番号で起動（実行中でない replica の番号も避ける）
+                UINT _replica = this->FreeReplica( g.first, std::set<UINT>() );
+
+                _SLOG( TEXT("==> Scale up : %s (%d -> %d) cpu %.1f%%\n"), _c.m_name, _count, _count + 1, _avg );
+                EVENT_ENTRY_INF( _c.m_name, TEXT("Scale up : %s (%d -> %d)"), _c.m_name.GetString(), _count, _count + 1 );
+                TSCALE_UP _up = { _c, _replica, m_purge_count };
+                m_scale_ups.push_back( _up );     // 起動は OnTimer の後、ロック外で (SpawnScaled)
+            }
+            else if ( _st.down >= SY_SCALE_SUSTAIN && _count > _c.m_instances_min ) {
+                // 実行中で最大の replica 番号を停止
+                CsyProcess* _p = *std::max_element( g.second.replicas.begin(), g.second.replicas.end(),
+                        []( const CsyProcess* a, const CsyProcess* b ) { return a->IsReplica() < b->IsReplica(); } );
+
+                _SLOG( TEXT("==> Scale down : %s (%d -> %d) cpu %.1f%%\n"), _c.m_name, _count, _count - 1, _avg );
+                EVENT_ENTRY_INF( _c.m_name, TEXT("Scale down : %s (%d -> %d)"), _c.m_name.GetString(), _count, _count - 1 );
+                this->Retire( _p, now );
+            }
+            else {
+                continue;
+            }
+            _st.up   = 0;
+            _st.down = 0;
+            _st.last = now;
+        }
+    }
+
+    /**
+     * @brief entry のプロセス（起動し直している最中のものを含む）と reserved のどちらも使っていない
+     *        最小の replica 番号を返します。（m_lock 取得済みで呼ぶ）
+     */
+    UINT FreeReplica( _In_ const CAtlString& name, _In_ const std::set<UINT>& reserved ) const {
+        std::set<UINT> _used( reserved );
+        for ( auto& p : m_processes ) 
+            if ( p.second->IsConfig().m_name == name ) 
+                _used.insert( p.second->IsReplica() );
+        for ( auto& r : m_respawning ) 
+            if ( r.second.process->IsConfig().m_name == name ) 
+                _used.insert( r.second.process->IsReplica() );
+        UINT _replica = 0;
+        while ( _used.count( _replica ) ) 
+            _replica++;
+        return _replica;
+    }
+
+    /**
+     * @brief Autoscale() で決めた replica を並列に起動します。（supervisor loop から m_lock を持たずに呼ぶ）
+     *        起動中に PurgeProcesses() が実行された場合は、起動したプロセスを停止します。
+     */
+    void SpawnScaled( void ) {
+        std::vector<TSCALE_UP> _ups;
+        {
+            CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+            _ups.swap( m_scale_ups );
+        }
+        if ( _ups.empty() ) 
+            return;
+
+        std::vector<ULONG_PTR> _keys( _ups.size(), 0 );
+        sy_parallel_for( _ups.size(), [&]( size_t n ) {
+            HRESULT _hr = this->AddProcessEntry( _ups[ n ].config, _ups[ n ].replica, &_keys[ n ] );
+            if ( FAILED( _hr ) ) 
+                _SLOG( TEXT("! Scale up failed. in %08x : %s\n"), _hr, _ups[ n ].config.m_name );
+        } );
+
+        SYPROCESSES _stopping;
+        {
+            CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+            for ( size_t n = 0; n < _ups.size(); n++ ) {
+                auto _it = m_processes.find( _keys[ n ] );
+                if ( _ups[ n ].purge == m_purge_count || _it == m_processes.end() ) 
+                    continue;
+                _stopping.insert( *_it );
+                m_processes.erase( _it );
+            }
+        }
+        this->StopProcesses( _stopping, INFINITE );
+    }
+
+    /**
+     * @brief プロセスを管理リストから外し、停止要求を送ります。（m_lock 取得済みで呼ぶ）
+     *        終了待ちは行わず、終了通知または猶予(stop_timeout)の経過後に FinishRetire() で破棄します。
+     */
+    void Retire( _In_ CsyProcess* p, _In_ ULONGLONG now ) {
+        m_processes.erase( p->IsKey() );
+
+        TRETIRE _r = { p, now };
+        if ( p->Signal() ) 
+            _r.deadline = now + p->IsConfig().m_stop_timeout;
+        m_retiring[ p->IsKey() ] = _r;
+    }
+
+    /**
+     * @brief 停止中のプロセスのうち、終了したもの/猶予を過ぎたもの(Kill)を m_retired に移します。（m_lock 取得済みで呼ぶ）
+     *        Kill と破棄はロック外で行います。 (SpawnRestarts)
+     */
+    void FinishRetire( _In_ ULONGLONG now ) {
+        for ( auto _it = m_retiring.begin(); _it != m_retiring.end(); ) {
+            CsyProcess* _p = _it->second.process;
+            if ( _p->IsRunning() && now < _it->second.deadline ) {
+                ++_it;
+                continue;
+            }
+            m_retired[ _it->first ] = _p;
+            _it = m_retiring.erase( _it );
+        }
+    }
+
+    /**
+     * @brief プロセスを管理リストから外し、ロック外での起動を予約します。（m_lock 取得済みで呼ぶ）
+     * @param[in] recycle ... TRUE.. Respawn()  FALSE.. Restart()
+     */
+    void QueueRespawn( _In_ CsyProcess* p, _In_ BOOL recycle ) {
+        m_processes.erase( p->IsKey() );
+        p->SetObserver( NULL );     // 起動中の状態変化は、管理リストに戻す時に通知する
+        TRESPAWN _r = { p, recycle, FALSE };
+        m_respawning[ p->IsKey() ] = _r;
+    }
+
+    /**
+     * @brief 予約した再起動 / recycle の起動と、scale down を終えたプロセスの Kill / 破棄を行います。
+     *        （supervisor loop から m_lock を持たずに呼ぶ）
+     *
+     *        起動したプロセスは管理リストに戻し、起動に失敗したものは異常終了として扱います。
+     *        起動中に停止 / reload / Purge された entry のプロセスは、管理リストに戻さずに停止します。
+     */
+    void SpawnRestarts( void ) {
+        std::vector<TRESPAWN> _respawns;
+        SYPROCESSES           _retired;
+        SYPROCESSES           _stopping;
+        {
+            CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+            for ( auto _it = m_respawning.begin(); _it != m_respawning.end(); ) {
+                if ( !_it->second.cancel ) {
+                    _respawns.push_back( _it->second );     // 起動後まで m_respawning に残す（停止 / reload の対象）
+                    ++_it;
+                    continue;
+                }
+                _stopping[ _it->first ] = _it->second.process;
+                _it = m_respawning.erase( _it );
+            }
+            _retired.swap( m_retired );
+        }
+
+        // scale down : 猶予を過ぎたものはまとめて Kill し、終了は待たずに破棄する
+        for ( auto& p : _retired ) 
+            p.second->Kill();
+        for ( auto& p : _retired ) {
+            p.second->Stop( 0 );
+            delete p.second;
+        }
+
+        std::vector<HRESULT> _results( _respawns.size(), S_OK );
+        sy_parallel_for( _respawns.size(), [&]( size_t n ) {
+            CsyProcess* _p = _respawns[ n ].process;
+            _results[ n ] = _respawns[ n ].recycle ? _p->Respawn() : _p->Restart();
+        } );
+
+        if ( !_respawns.empty() ) {
+            CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+            for ( size_t n = 0; n < _respawns.size(); n++ ) {
+                CsyProcess* _p   = _respawns[ n ].process;
+                auto        _it  = m_respawning.find( _p->IsKey() );
+                BOOL        _cancel = _it == m_respawning.end() || _it->second.cancel;
+                if ( _it != m_respawning.end() ) 
+                    m_respawning.erase( _it );
+                if ( _cancel ) {
+                    _stopping[ _p->IsKey() ] = _p;
+                    continue;
+                }
+                m_processes[ _p->IsKey() ] = _p;
+                _p->SetObserver( m_observer );
+                if ( m_observer ) 
+                    m_observer->OnProcessEvent( *_p );
+                if ( FAILED( _results[ n ] ) ) 
+                    this->OnProcessExited( _p );
+            }
+        }
+        this->StopProcesses( _stopping, INFINITE );
+    }
+};
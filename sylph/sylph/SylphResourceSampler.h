@@ -0,0 +1,167 @@
+﻿/**
+ * @file     SylphResourceSampler.h
+ * @brief    Per-child resource sampler (CPU, memory, handles, I/O)
+ * @author   M.Horigome
+ * @version  1.0.0.0000
+ * @date     2026-10-17
+ *
+ * https://github.com/horigome/sylph
+ */
+#pragma once
+#include "stdafx.h"
+#include <psapi.h>
+#pragma comment (lib,"psapi.lib")
+
+/** Sampler 定数 */
+enum {
+    SY_SAMPLE_INTERVAL_MS   = 5000,     ///< 採取間隔(ms) Default (0.. 採取しない)
+    SY_SAMPLE_INTERVAL_MIN  = 100,      ///< 採取間隔の下限(ms)
+};
+
+/**
+ * @brief 採取対象（supervisor が管理リストから作ります）
+ */
+struct TSY_SAMPLE_TARGET {
+    ULONG_PTR   key;        ///< completion key
+    DWORD       pid;
+    HANDLE      process;    ///< 採取中は有効であること
+};
+
+/**
+ * @brief プロセス1つ分の採取結果
+ */
+struct TSY_PROC_SAMPLE {
+    ULONG_PTR   key;            ///< completion key
+    DWORD       pid;
+    ULONGLONG   cpu_time;       ///< CPU時間の累計 (kernel + user, 100ns)
+    double      cpu_percent;    ///< 前回の採取からの CPU 使用率 (全CPU = 100%)
+    SIZE_T      working_set;    ///< Working set (bytes)
+    SIZE_T      private_bytes;  ///< Private bytes (commit)
+    DWORD       handles;        ///< ハンドル数
+    ULONGLONG   read_bytes;     ///< 読み込みバイト数の累計
+    ULONGLONG   write_bytes;    ///< 書き込みバイト数の累計
+};
+
+/**
+ * @brief 1回の採取結果（全プロセス）。公開後は変更されません。
+ */
+class CsyResourceSnapshot {
+public:
+    ULONGLONG                       m_tick;     ///< 採取時刻 (GetTickCount64)
+    double                          m_cost_ms;  ///< 採取に要した時間(ms)
+    std::vector<TSY_PROC_SAMPLE>    m_samples;  ///< key の昇順
+public:
+    CsyResourceSnapshot( void ) : m_tick( 0 ), m_cost_ms( 0.0 ) { }
+
+    /** key で検索します（無い場合は NULL） */
+    const TSY_PROC_SAMPLE* Find( _In_ ULONG_PTR key ) const {
+        auto _it = std::lower_bound( m_samples.begin(), m_samples.end(), key,
+                []( const TSY_PROC_SAMPLE& s, ULONG_PTR k ) { return s.key < k; } );
+        return ( _it != m_samples.end() && _it->key == key ) ? &*_it : NULL;
+    }
+};
+
+typedef std::shared_ptr<const CsyResourceSnapshot> SYRESOURCESNAPSHOT;
+
+/**
+ * @brief リソース採取
+ *
+ *        supervisor loop のタイマーから1回の呼び出しで全プロセス分をまとめて採取し、
+ *        結果を新しい snapshot として差し替えます。
+ *        読み込み側は IsSnapshot() で取得した snapshot を参照するだけで、
+ *        supervisor のロックを取りません。
+ */
+class CsyResourceSampler {
+    SYRESOURCESNAPSHOT  m_snapshot;     ///< 最新の結果 (atomic_load/atomic_store)
+    DWORD               m_interval;     ///< 採取間隔(ms) 0.. 採取しない
+    ULONGLONG           m_next;         ///< 次の採取時刻 (GetTickCount64)
+    DWORD               m_num_cpu;
+public:
+    CsyResourceSampler( void )
+        : m_snapshot( std::make_shared<CsyResourceSnapshot>() ),
+          m_interval( SY_SAMPLE_INTERVAL_MS ),
+          m_next    ( 0 ) {
+        SYSTEM_INFO _si;
+        ::GetSystemInfo( &_si );
+        m_num_cpu = _si.dwNumberOfProcessors ? _si.dwNumberOfProcessors : 1;
+    }
+
+    /** 採取間隔(ms)を設定します（0.. 採取しない） */
+    void SetInterval( _In_ DWORD interval_ms ) {
+        m_interval = ( interval_ms && interval_ms < SY_SAMPLE_INTERVAL_MIN ) ? SY_SAMPLE_INTERVAL_MIN : interval_ms;
+        m_next     = 0;
+    }
+
+    /** 採取間隔(ms) */
+    DWORD IsInterval( void ) const { return m_interval; }
+
+    /** CPU 数（cpu_percent の 100% に相当） */
+    DWORD IsNumCpu( void ) const { return m_num_cpu; }
+
+    /** 次の採取までの待ち時間(ms) (採取しない場合は INFINITE) */
+    DWORD Remaining( _In_ ULONGLONG now ) const {
+        if ( !m_interval ) return INFINITE;
+        return m_next <= now ? 0 : static_cast<DWORD>( m_next - now );
+    }
+
+    /** 最新の採取結果 */
+    SYRESOURCESNAPSHOT IsSnapshot( void ) const {
+        return std::atomic_load( &m_snapshot );
+    }
+
+    /**
+     * @brief 全プロセスを採取して snapshot を差し替えます。
+     * @param[in] targets ... 採取対象（key の昇順）
+     * @param[in] now ... 現在時刻 (GetTickCount64)
+     */
+    void Sample( _In_ const std::vector<TSY_SAMPLE_TARGET>& targets, _In_ ULONGLONG now ) {
+        LONGLONG _begin = sy_perf_counter();
+        m_next = now + m_interval;
+
+        SYRESOURCESNAPSHOT _prev = this->IsSnapshot();
+        auto _snap = std::make_shared<CsyResourceSnapshot>();
+        _snap->m_tick = now;
+        _snap->m_samples.reserve( targets.size() );
+
+        double _elapsed = static_cast<double>( now - _prev->m_tick ) * 10000.0 * m_num_cpu;  // 100ns
+        for ( auto& t : targets ) {
+            TSY_PROC_SAMPLE _s;
+            ::ZeroMemory( &_s, sizeof( _s ) );
+            _s.key = t.key;
+            _s.pid = t.pid;
+
+            FILETIME _create, _exit, _kernel, _user;
+            if ( ::GetProcessTimes( t.process, &_create, &_exit, &_kernel, &_user ) ) {
+                ULARGE_INTEGER _k, _u;
+                _k.LowPart = _kernel.dwLowDateTime;  _k.HighPart = _kernel.dwHighDateTime;
+                _u.LowPart = _user.dwLowDateTime;    _u.HighPart = _user.dwHighDateTime;
+                _s.cpu_time = _k.QuadPart + _u.QuadPart;
+            }
+
+            PROCESS_MEMORY_COUNTERS_EX _mem;
+            if ( ::GetProcessMemoryInfo( t.process,
+                        reinterpret_cast<PPROCESS_MEMORY_COUNTERS>( &_mem ), sizeof( _mem ) ) ) {
+                _s.working_set   = _mem.WorkingSetSize;
+                _s.private_bytes = _mem.PrivateUsage;
+            }
+
+            ::GetProcessHandleCount( t.process, &_s.handles );
+
+            IO_COUNTERS _io;
+            if ( ::GetProcessIoCounters( t.process, &_io ) ) {
+                _s.read_bytes  = _io.ReadTransferCount;
+                _s.write_bytes = _io.WriteTransferCount;
+            }
+
+            // 前回と同じプロセスなら使用率を計算
+            const TSY_PROC_SAMPLE* _last = _prev->Find( t.key );
+            if ( _last && _last->pid == _s.pid && _elapsed > 0.0 && _s.cpu_time >= _last->cpu_time )
+                _s.cpu_percent = ( _s.cpu_time - _last->cpu_time ) * 100.0 / _elapsed;
+
+            _snap->m_samples.push_back( _s );
+        }
+
+        _snap->m_cost_ms = sy_perf_ms( _begin );
+        std::atomic_store( &m_snapshot, SYRESOURCESNAPSHOT( _snap ) );
+    }
+};
@@ -10,6 +10,11 @@
 #pragma once
 #include "stdafx.h"
 
+/** Service 定数 */
+enum {
+    SY_SERVICE_STOP_WAIT_MS = 15000,    ///< 停止時に子プロセスの終了を待つ上限(ms)。Kill の待ちを加えても SCM の停止待ち(20秒)に収まる値
+};
+
 /**
  * @brief Windows Service Contol class
  */
@@ -19,6 +24,7 @@ class CsyServiceControl : public CsyThread{
     SERVICE_STATUS        m_ServiceStatus;
     SERVICE_STATUS_HANDLE m_StatusHandle     = NULL;
     HANDLE                m_ServiceStopEvent = INVALID_HANDLE_VALUE; 
+    HANDLE                m_ParamChangeEvent = NULL;    ///< PARAMCHANGE を受けた (auto reset)
 
 protected:
     /**
@@ -28,11 +34,51 @@ protected:
 
     /**
      * @brief サービス停止時に呼ばれます。（派生クラスはOverrideできます）　
+     *        サービススレッドで実行されます。（制御ハンドラはブロックしません）
      */
     virtual void OnStop( void ) {
         if ( m_ServiceStopEvent ) ::SetEvent( m_ServiceStopEvent ); 
     }
 
+    /**
+     * @brief STOP を受け付けた時に制御ハンドラから呼ばれます。（派生クラスはOverrideできます）
+     *        実行中の OnParamChange() の中断要求などに使います。すぐに戻ること。
+     */
+    virtual void OnStopPending( void ) { }
+
+    /**
+     * @brief 設定変更の通知 (SERVICE_CONTROL_PARAMCHANGE) で呼ばれます。（派生クラスはOverrideできます）
+     *        サービススレッドで実行されます。（制御ハンドラはブロックしません。実行中の通知はまとめられます）
+     */
+    virtual void OnParamChange( void ) { }
+
+    /**
+     * @brief OnStart() に要する時間の見込み(ms)。START_PENDING の dwWaitHint に使います。
+     *        （派生クラスはOverrideできます）
+     */
+    virtual DWORD GetStartWaitHint( void ) const { return 30000; }
+
+    /**
+     * @brief OnStop() に要する時間の見込み(ms)。STOP_PENDING の dwWaitHint に使います。
+     *        （派生クラスはOverrideできます）
+     */
+    virtual DWORD GetStopWaitHint( void ) const { return 20000; }
+
+    /**
+     * @brief STOP_PENDING の進捗を報告します。（OnStop() の間、待ちが長くなる場合に呼ぶこと）
+     * @param[in] wait_hint ... 次の報告までの見込み時間(ms)
+     */
+    void ReportStopPending( _In_ DWORD wait_hint ) {
+        if ( m_ServiceStatus.dwCurrentState != SERVICE_STOP_PENDING ) 
+            return;
+        m_ServiceStatus.dwCheckPoint++;
+        m_ServiceStatus.dwWaitHint = wait_hint;
+        if ( !SetStatus( m_StatusHandle, &m_ServiceStatus ) ) {
+            EVENT_WAR( TEXT("[STOP_PENDING] SetServiceStatus Failed. %d"), 
+                ::GetLastError() );
+        }
+    }
+
 public:
     CsyServiceControl         ( void ) {
         ::ZeroMemory( &m_ServiceStatus, sizeof( m_ServiceStatus ) );
@@ -71,36 +117,45 @@ public:
         m_ServiceStatus.dwCurrentState              = SERVICE_START_PENDING;
         m_ServiceStatus.dwWin32ExitCode             = 0;
         m_ServiceStatus.dwServiceSpecificExitCode   = 0;
-        m_ServiceStatus.dwCheckPoint                = 0;
+        m_ServiceStatus.dwCheckPoint                = 1;
+        m_ServiceStatus.dwWaitHint                  = this->GetStartWaitHint();
 
-        if ( !::SetServiceStatus ( m_StatusHandle, &m_ServiceStatus )) {
+        if ( !SetStatus( m_StatusHandle, &m_ServiceStatus )) {
             EVENT_WAR( TEXT("[START_PENDING] SetServiceStatus Failed. %d"), 
                 ::GetLastError() );
         }
 
-        //
-        // ==> サービス開始（Event objectを使い、Threadを待機します）
-        //
-        m_ServiceStatus.dwControlsAccepted  = SERVICE_ACCEPT_STOP;
-        m_ServiceStatus.dwCurrentState      = SERVICE_RUNNING; // RUNNING
-        m_ServiceStatus.dwWin32ExitCode     = 0;
-        m_ServiceStatus.dwCheckPoint        = 0;
-
-        if ( !::SetServiceStatus ( m_StatusHandle, &m_ServiceStatus ) ) {
-            EVENT_WAR( TEXT("[RUNNING] SetServiceStatus Failed. %d"), 
-                ::GetLastError() );
-        }
-
         m_ServiceStopEvent = ::CreateEvent ( NULL, TRUE, FALSE, NULL );
+        m_ParamChangeEvent = ::CreateEvent ( NULL, FALSE, FALSE, NULL );
         ATLASSERT( m_ServiceStopEvent != INVALID_HANDLE_VALUE ); 
 
         try {
-            ATLENSURE_SUCCEEDED( this->OnStart( )     ); // Call Start Handler
+            {
+                CsyTraceScope _trace( "service_start" );
+                ATLENSURE_SUCCEEDED( this->OnStart( )     ); // Call Start Handler
+            }
+
+            //
+            // ==> サービス開始（OnStart 完了 = 子プロセスが ready になってから RUNNING を報告します）
+            //
+            m_ServiceStatus.dwControlsAccepted  = SERVICE_ACCEPT_STOP | SERVICE_ACCEPT_PARAMCHANGE;
+            m_ServiceStatus.dwCurrentState      = SERVICE_RUNNING; // RUNNING
+            m_ServiceStatus.dwWin32ExitCode     = 0;
+            m_ServiceStatus.dwCheckPoint        = 0;
+            m_ServiceStatus.dwWaitHint          = 0;
+
+            if ( !SetStatus( m_StatusHandle, &m_ServiceStatus ) ) {
+                EVENT_WAR( TEXT("[RUNNING] SetServiceStatus Failed. %d"), 
+                    ::GetLastError() );
+            }
+
             ATLENSURE_SUCCEEDED( this->Begin  ( NULL )); // Start ServiceThread
             this->Join   (  );
 
             if ( m_ServiceStopEvent ) ::CloseHandle ( m_ServiceStopEvent );
+            if ( m_ParamChangeEvent ) ::CloseHandle ( m_ParamChangeEvent );
             m_ServiceStopEvent = NULL;
+            m_ParamChangeEvent = NULL;
 
         } catch ( CAtlException& e ) {
 
@@ -110,7 +165,7 @@ public:
             m_ServiceStatus.dwWin32ExitCode    = 0;
             m_ServiceStatus.dwCheckPoint       = 4;
 
-            if ( !::SetServiceStatus ( m_StatusHandle, &m_ServiceStatus ) ) {
+            if ( !SetStatus( m_StatusHandle, &m_ServiceStatus ) ) {
                 EVENT_WAR( TEXT("[STOP_PENDING] SetServiceStatus Failed. %d"), 
                     ::GetLastError() );
             }
@@ -122,7 +177,7 @@ public:
         m_ServiceStatus.dwWin32ExitCode     = 0;
         m_ServiceStatus.dwCheckPoint        = 3;
 
-        if ( !::SetServiceStatus ( m_StatusHandle, &m_ServiceStatus ) ) {
+        if ( !SetStatus( m_StatusHandle, &m_ServiceStatus ) ) {
             EVENT_WAR( TEXT("[STOPED] SetServiceStatus Failed. %d"), 
                 ::GetLastError() );
         }
@@ -133,16 +188,33 @@ public:
 
 private:
 
-    /** Service Wait Thread */
+    /** SetServiceStatus（trace に状態を記録します） */
+    static BOOL SetStatus( _In_ SERVICE_STATUS_HANDLE handle, _In_ LPSERVICE_STATUS status ) {
+        CsyTraceScope _trace( "set_service_status" );
+        _trace.SetValue( static_cast<LONG>( status->dwCurrentState ) );
+        return ::SetServiceStatus( handle, status );
+    }
+
+    /** 
+     * @brief Service Wait Thread 
+     *        制御ハンドラから通知された停止・設定変更をここで実行します。（停止を優先）
+     */
     virtual DWORD run( _In_ void* argment  ) override {
-        switch( ::WaitForSingleObject( this->m_ServiceStopEvent, INFINITE ) ) {
-        case WAIT_OBJECT_0 + 0:
-            _SDBG( TEXT("Service Thread break.\n") );
-            return 0;
-        default:
-            break;
+        HANDLE _events[] = { this->m_ServiceStopEvent, this->m_ParamChangeEvent };
+        for ( ;; ) {
+            switch( ::WaitForMultipleObjects( _countof( _events ), _events, FALSE, INFINITE ) ) {
+            case WAIT_OBJECT_0 + 0:
+                this->OnStop( );
+                _SDBG( TEXT("Service Thread break.\n") );
+                return 0;
+            case WAIT_OBJECT_0 + 1:
+                this->OnParamChange( );
+                continue;
+            default:
+                break;
+            }
+            return 1;
         }
-        return 1;
     }
 
     /**
@@ -174,16 +246,28 @@ private:
                 _s->dwCurrentState      = SERVICE_STOP_PENDING;     // B-1 STOP_PENDING
                 _s->dwWin32ExitCode     = 0;
                 _s->dwCheckPoint        = 4;                        // 4?
+                _s->dwWaitHint          = _service_p->GetStopWaitHint();
 
-                if ( !::SetServiceStatus ( _service_p->m_StatusHandle, _s ) ) {
+                if ( !SetStatus( _service_p->m_StatusHandle, _s ) ) {
                     EVENT_WAR( TEXT("[STOP_PENDING] SetServiceStatus Failed. %d"), 
                         ::GetLastError() );
                 }
             }
 
-            // ==> Stop Event Signal.　
-            _service_p->OnStop( );
+            // ==> Stop Event Signal. (停止処理はサービススレッドで実行)
+            _service_p->OnStopPending( );
+            ::SetEvent( _service_p->m_ServiceStopEvent );
+
+            return NO_ERROR;
+
+        // * Config Reload (sc control <service> paramchange) (サービススレッドで実行)
+        case SERVICE_CONTROL_PARAMCHANGE :
+            if ( _service_p->m_ServiceStatus.dwCurrentState == SERVICE_RUNNING )
+                ::SetEvent( _service_p->m_ParamChangeEvent );
+            return NO_ERROR;
 
+        // * Status query
+        case SERVICE_CONTROL_INTERROGATE :
             return NO_ERROR;
 
         default:
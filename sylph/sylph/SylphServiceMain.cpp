@@ -12,15 +12,27 @@
 #include "SylphServiceSetup.h"
 #include "SylphServiceControl.h"
 #include "SylphProcessManager.h"
+#include "SylphConfigSnapshot.h"
+#include "SylphControl.h"
+#include "SylphJournal.h"
 
 // Globals
+CsyAsyncLogger SY_LOGGER;
+CsyTracer      SY_TRACE;
 LPTSTR      SYCONFIG_XML        = TEXT("syconfig.xml");
+LPTSTR      SYCONFIG_BIN        = TEXT("syconfig.bin");
 CAtlString  SERVICE_NAME        = TEXT("Sylph");
-SYCONFIGS   SYLPH_PROC_CONFIG;
+CsyServiceConfig SYLPH_CONFIG;
+CsyEventSink SY_EVENTS;
 
 // Prototype ---
 int         run_console ( void ); 
-HRESULT     load_config ( SYCONFIGS&, CAtlString&  service_name, DWORD& start_type );
+int         run_compile ( void ); 
+int         run_control ( int argc, _TCHAR* argv[] ); 
+HRESULT     load_config ( CsyServiceConfig& );
+HRESULT     read_config ( CsyServiceConfig& );
+HRESULT     reload_config( CsylphProcessManager& );
+HRESULT     open_journal( CsyJournal&, CsylphProcessManager& );
 VOID WINAPI ServiceMain ( DWORD argc, LPTSTR *argv );
 
 /**
@@ -28,18 +40,25 @@ VOID WINAPI ServiceMain ( DWORD argc, LPTSTR *argv );
  */
 class CsySylphService : public CsyServiceControl {
     
-    CsylphProcessManager    m_proc; ///< Process Management 
+    CsyJournal              m_journal;  ///< 実行中の子プロセスの journal (m_proc より後に破棄する)
+    CsylphProcessManager    m_proc;     ///< Process Management 
+    CsyControlServer        m_control;  ///< 制御エンドポイント (/ctl)
 protected:
     
     /** サービス開始時に呼ばれます。 */
     virtual HRESULT OnStart( void ) override { 
 
-        HRESULT _hr = S_OK;
-        for ( auto& conf : SYLPH_PROC_CONFIG ) 
-            if( FAILED(_hr = m_proc.AddProcessEntry( conf )) ) break;
+        if ( FAILED( m_control.Startup( SERVICE_NAME ) ) ) 
+            EVENT_WAR(TEXT("Control endpoint start failed."));
 
+        if ( FAILED( open_journal( m_journal, m_proc ) ) ) 
+            EVENT_WAR(TEXT("Journal open failed. children are not adopted on restart."));
+
+        m_proc.SetSampleInterval( SYLPH_CONFIG.m_sample_interval );
+        HRESULT _hr = m_proc.StartEntries( SYLPH_CONFIG.m_processes );
+        m_journal.Discard( );
         if ( FAILED( _hr ) ) {
-            EVENT_ERR(TEXT("Service AddProcessEntry failed. 0x%08d"), _hr);
+            EVENT_ERR(TEXT("Service StartEntries failed. 0x%08x"), _hr);
             return _hr;
         }
 
@@ -47,15 +66,51 @@ protected:
         return S_OK; 
     }
 
-    /** サービス停止時に呼ばれます。 */
+    /** OnStart の見込み時間。notify の entry は READY を待つため ready_timeout を加えます */
+    virtual DWORD GetStartWaitHint( void ) const override {
+        DWORD _hint = __super::GetStartWaitHint();
+        for ( auto& p : SYLPH_CONFIG.m_processes ) 
+            if ( p.m_notify ) _hint += p.m_ready_timeout;
+        return _hint;
+    }
+
+    /** OnStop の見込み時間。終了待ちの上限と Kill 後の待ちの合計 */
+    virtual DWORD GetStopWaitHint( void ) const override {
+        return SY_SERVICE_STOP_WAIT_MS + SY_KILL_WAIT_MS;
+    }
+
+    /** 停止要求を受けた時に呼ばれます。実行中の reload の ready 待ちを中断させます */
+    virtual void OnStopPending( void ) override {
+        m_proc.Cancel( );
+    }
+
+    /** 設定変更の通知で呼ばれます。変更されたentryだけを反映します */
+    virtual void OnParamChange( void ) override {
+        HRESULT _hr = reload_config( m_proc );
+        if ( FAILED( _hr ) ) 
+            EVENT_ERR(TEXT("Service config reload failed. 0x%08x"), _hr);
+        else
+            EVENT_INF(TEXT("Service config reloaded."));
+    }
+
+    /** 
+     * サービス停止時に呼ばれます。
+     * 子プロセスの終了は SY_SERVICE_STOP_WAIT_MS まで待ち（entry毎の stop_timeout もこれで打ち切る）、
+     * 待つ間は STOP_PENDING の checkpoint を進めます。
+     */
     virtual void OnStop( void ) override {
         EVENT_INF(TEXT("Service  Stoped."));
-        m_proc.PurgeProcesses( );
+        m_control.Shutdown( );
+        m_proc.PurgeProcesses( SY_SERVICE_STOP_WAIT_MS, [this]( DWORD remaining_ms ) {
+            this->ReportStopPending( remaining_ms + SY_KILL_WAIT_MS );
+        } );
+        m_journal.Close( );
+        SY_TRACE.Dump( );
         __super::OnStop( );
     }
 
 public:
-    CsySylphService         ( void ) = default;
+    CsySylphService         ( void ) : m_control( m_proc ) { }
     virtual ~CsySylphService( void ) = default;
 
     /** サービス名取得。XMLより名前を取得します 
@@ -75,17 +130,36 @@ public:
  *   /uninstall ... UnInstall a service
  *   /console   ... console test mode(for debug)
  *   /version   ... version information
+ *   /compile   ... validate syconfig.xml and write syconfig.bin
+ *   /ctl       ... control a running service (list, status, start, stop, restart, watch, trace, detach)
+ *   /ctrl      ... (internal) send Ctrl-C/Ctrl-Break to child consoles. started by the supervisor
  *
  */
 extern "C"
 int _tmain( _In_ int        argc, 
             _In_ _TCHAR*    argv[] ) {
 
-    CsyCoInitializer _USE_COM;
+    // Ctrl イベント送信の補助プロセス ( /ctrl )
+    int _ctrl = sy_console_ctrl_main( argc, argv );
+    if ( _ctrl >= 0 ) 
+        return _ctrl;
 
+    //
+    // Commandline Option (without config)
+    //
+    if ( argc >= 2 ) {
+        if ( ::_tcscmp( TEXT("/version"), argv[1] ) == 0 ) {
+            CAtlString _ver;
+            _ver.LoadString( IDS_VERSION );
+            _tprintf_s( TEXT("Sylph service wrapper. Ver %s\n"),_ver );
+            return 0;
+        }
+        else if ( ::_tcscmp( TEXT("/compile"), argv[1] ) == 0 ) {
+            return run_compile( );
+        }
+    }
 
-    DWORD _start_type = SERVICE_DEMAND_START;
-    HRESULT _hr = load_config( SYLPH_PROC_CONFIG, SERVICE_NAME, _start_type );
+    HRESULT _hr = load_config( SYLPH_CONFIG );
     if ( FAILED( _hr ) ) {
         _SLOG( TEXT("[ERR] Load configfile failed. in %08x\n"),_hr );
         return _hr;
@@ -96,7 +170,7 @@ int _tmain( _In_ int        argc,
     //
     if ( argc >= 2 ) {
         if ( ::_tcscmp( TEXT("/install"), argv[1] ) == 0 ) {
-            BOOL _ret = sy_sv_install( SERVICE_NAME, _start_type )  ;
+            BOOL _ret = sy_sv_install( SERVICE_NAME, SYLPH_CONFIG.m_start_type )  ;
             _SLOG( TEXT("Service Install. %d.\n"), _ret );
             return _ret;
         }
@@ -108,11 +182,8 @@ int _tmain( _In_ int        argc,
         else if ( ::_tcscmp( TEXT("/console"), argv[1] ) == 0 ) {
             return run_console( );
         }
-        else if ( ::_tcscmp( TEXT("/version"), argv[1] ) == 0 ) {
-            CAtlString _ver;
-            _ver.LoadString( IDS_VERSION );
-            _tprintf_s( TEXT("Sylph service wrapper. Ver %s\n"),_ver );
-            return 0;
+        else if ( ::_tcscmp( TEXT("/ctl"), argv[1] ) == 0 ) {
+            return run_control( argc - 2, argv + 2 );
         }
     }
 
@@ -150,73 +221,117 @@ VOID WINAPI ServiceMain ( _In_ DWORD   argc,
 
 /**
  * @brief syconfig.xmlを読み込む（プロセス起動定義）
+ *        syconfig.bin が XML と一致していれば、そちらを使います（XML を解析しない）
  *
- * @brief[out] configs ... プロセス毎の設定リスト
- * @brief[out] service_name ... Service Name
- * @brief[out] start_type ... Service StartType(use Install)
+ * @brief[out] config ... サービス設定とプロセス毎の設定リスト
+ *                         (Service Name は SERVICE_NAME にも設定します)
  */
-HRESULT load_config( _Out_ SYCONFIGS&   configs, 
-                     _Out_ CAtlString&  service_name,
-                     _Out_ DWORD&       start_type ) {
+HRESULT load_config( _Out_ CsyServiceConfig& config ) {
 
-    HRESULT _hr = S_OK;
-    ::CoInitialize( NULL );
-    { 
-        CComPtr< IXMLDOMDocument2 > _xml;
-        _hr = sy_xml_open( sy_get_running_dir() + TEXT("\\") + SYCONFIG_XML, &_xml );
-
-        if ( _hr == S_OK ) {
-
-            // parse.
-
-            // ==> <sylph><service><config> ... </config>
-            {
-                // <service_name>
-                CComPtr<IXMLDOMNode> _sv_name_p;
-                if ( _xml->get_lastChild( &_sv_name_p ) == S_OK ) {
-                    service_name = sy_xml_get_nodetext( 
-                        _sv_name_p, TEXT("/sylph/service/config/service_name") );
-                }
-                if ( service_name.IsEmpty() ) service_name = TEXT("SylphService");
-
-                // <start_type>
-                CComPtr<IXMLDOMNode> _start_type_p;
-                if ( _xml->get_lastChild( &_start_type_p ) == S_OK ) {
-
-                    CAtlString _st_type_str = sy_xml_get_nodetext( 
-                        _sv_name_p, TEXT("/sylph/service/config/start_type") );
-
-                    start_type = ::_ttoi( _st_type_str );
-                    switch ( start_type ) {
-                    case SERVICE_AUTO_START:
-                    case SERVICE_DEMAND_START:
-                    case SERVICE_DISABLED:
-                        break;
-                    default:
-                        start_type = SERVICE_DEMAND_START;  // Unknown value.
-                    }
-                } else {
-                    start_type = SERVICE_DEMAND_START;      // no tag
-                }
-            }
+    CsyTraceScope _trace( "load_config" );
+    HRESULT _hr = read_config( config );
+    if ( FAILED( _hr ) ) 
+        return _hr;
 
-            // ==> <sylph><service><entry>...</entry></service></service>
-            _hr = sy_xml_foreach_nodes( _xml, TEXT("/sylph/service/entry/process"), 
-                [&configs](IXMLDOMNode* node_p, long /*idx*/) -> HRESULT {
+    SERVICE_NAME = config.m_service_name;
+    SY_EVENTS.SetSourceName( SERVICE_NAME );
 
-                // .. <command>xxxx</command>
-                    auto _cmd = sy_xml_get_nodetext( node_p, TEXT("command") );
-                    if ( _cmd.GetLength() ) 
-                        configs.push_back( CsyProcConfig( _cmd ) );
+    // <event_log> (省略時は Windows イベントログ)
+    if ( !config.m_event_log.IsEmpty() ) {
+        CAtlString _event_log = config.m_event_log;
+        if ( ::PathIsRelative( _event_log ) )
+            _event_log = sy_get_running_dir() + TEXT("\\") + _event_log;
 
-                    return S_OK;
-            } );
-        }
+        auto _backend = new CsyEventFileBackend( _event_log );
+        if ( !_backend->IsOpen() ) 
+            _SLOG( TEXT("[WAR] event_log open failed. [%s]\n"), _event_log );
+        SY_EVENTS.SetBackend( _backend );
+    }
+
+    // <trace> (省略時は記録しない。この読み込みから記録します)
+    if ( !config.m_trace.IsEmpty() ) {
+        CAtlString _trace_path = config.m_trace;
+        if ( ::PathIsRelative( _trace_path ) )
+            _trace_path = sy_get_running_dir() + TEXT("\\") + _trace_path;
+        SY_TRACE.Enable( _trace_path );
+        SY_TRACE.SetThreadName( "main" );
     }
-    ::CoUninitialize();
+    return S_OK;
+}
+
+/**
+ * @brief syconfig.bin（XML と一致する場合）または syconfig.xml を読み込みます。
+ */
+HRESULT read_config( _Out_ CsyServiceConfig& config ) {
+
+    CAtlString _xml_path = sy_get_running_dir() + TEXT("\\") + SYCONFIG_XML;
+    CAtlString _bin_path = sy_get_running_dir() + TEXT("\\") + SYCONFIG_BIN;
+
+    HRESULT _hr = sy_snapshot_load( _xml_path, _bin_path, config );
+    if ( _hr != S_OK ) 
+        _hr = sy_config_load( _xml_path, config );
     return _hr;
 }
 
+/**
+ * @brief 設定を読み直し、変更されたentryだけを反映します。
+ *        （service_name / start_type / event_log の変更は再起動まで反映されません）
+ */
+HRESULT reload_config( _Inout_ CsylphProcessManager& proc ) {
+
+    CsyServiceConfig _config;
+    HRESULT _hr = read_config( _config );
+    if ( FAILED( _hr ) ) 
+        return _hr;
+
+    proc.SetSampleInterval( _config.m_sample_interval );
+    return proc.ReloadEntries( _config.m_processes );
+}
+
+/**
+ * @brief <journal> を開き、StartEntries() で前の supervisor の子プロセスを引き継げるようにします。
+ *        引き継げない子プロセスはここで停止します。（引き継がれずに残ったものは StartEntries() の後に Discard() で停止）
+ * @retval S_FALSE ... <journal> の指定なし
+ */
+HRESULT open_journal( _Inout_ CsyJournal& journal, _Inout_ CsylphProcessManager& proc ) {
+
+    if ( SYLPH_CONFIG.m_journal.IsEmpty() ) 
+        return S_FALSE;
+
+    CAtlString _journal_path = SYLPH_CONFIG.m_journal;
+    if ( ::PathIsRelative( _journal_path ) )
+        _journal_path = sy_get_running_dir() + TEXT("\\") + _journal_path;
+
+    HRESULT _hr = journal.Open( _journal_path );
+    if ( FAILED( _hr ) ) 
+        return _hr;
+
+    proc.SetJournal( &journal );
+    journal.Recover( SYLPH_CONFIG.m_processes );
+    return S_OK;
+}
+
+/**
+ * @brief syconfig.xml を検証して syconfig.bin を書き込みます。
+ *        for "/compile"  commandline option
+ */
+int run_compile( void ) {
+
+    CAtlString _xml_path = sy_get_running_dir() + TEXT("\\") + SYCONFIG_XML;
+    CAtlString _bin_path = sy_get_running_dir() + TEXT("\\") + SYCONFIG_BIN;
+
+    CsyServiceConfig _config;
+    HRESULT _hr = sy_snapshot_compile( _xml_path, _bin_path, _config );
+    if ( FAILED( _hr ) ) {
+        _SLOG( TEXT("[ERR] Compile configfile failed. in %08x\n"), _hr );
+        return _hr;
+    }
+
+    _SLOG( TEXT("* Compiled %s -> %s (%d entries)\n"), 
+        SYCONFIG_XML, SYCONFIG_BIN, static_cast<int>( _config.m_processes.size() ) );
+    return 0;
+}
+
 /**
  * @brief Console run. (for debug)
  *        for "/console"  commandline option
@@ -232,22 +347,156 @@ int run_console( void ) {
     HRESULT _hr = S_OK;
     _SLOG( TEXT("* Service name > %s\n"), SERVICE_NAME);
     _SLOG( TEXT("* Start Pricesses.\n"));
+    CsyJournal              _journal;
     CsylphProcessManager    _proc;
-    for ( auto& conf : SYLPH_PROC_CONFIG )
-        if( FAILED(_hr = _proc.AddProcessEntry( conf )) ) break;
-
-    if ( FAILED( _hr ) ) {
-        _SLOG( TEXT("[ERR] AddProcessEntry failed. %08x\n") ); 
+    CsyControlServer        _control( _proc );
+    _control.Startup( SERVICE_NAME );
+    if ( FAILED( _hr = open_journal( _journal, _proc ) ) ) 
+        _SLOG( TEXT("[WAR] Journal open failed. %08x\n"), _hr ); 
+    _proc.SetSampleInterval( SYLPH_CONFIG.m_sample_interval );
+    if ( FAILED( _hr = _proc.StartEntries( SYLPH_CONFIG.m_processes ) ) ) {
+        _SLOG( TEXT("[ERR] StartEntries failed. %08x\n"), _hr ); 
     }
+    _journal.Discard();
+
+    // [r] .. reload,  [s] .. resource usage,  [u] .. rolling restart,  [t] .. trace dump,  other .. stop
+    for ( ;; ) {
+        _SLOG( TEXT("\n\n| please type any key. ([r] reload syconfig.xml, [s] resource usage, [u] rolling restart, [t] trace dump)\n\n\n") );
+        int _key = ::_getch();
+        if ( _key == 't' || _key == 'T' ) {
+            if ( SY_TRACE.Dump() == S_FALSE ) 
+                _SLOG( TEXT("[WAR] trace is disabled. (set <trace> in syconfig.xml)\n") );
+            continue;
+        }
+        if ( _key == 'u' || _key == 'U' ) {
+            TCHAR _name[ 1024 ] = { 0 };
+            _tprintf_s( TEXT("entry name> ") );
+            if ( ::_fgetts( _name, _countof( _name ), stdin ) ) {
+                CAtlString _entry( _name );
+                if ( FAILED( _hr = _proc.RollingRestart( _entry.Trim() ) ) ) 
+                    _SLOG( TEXT("[ERR] Rolling restart failed. %08x\n"), _hr ); 
+            }
+            continue;
+        }
+        if ( _key == 's' || _key == 'S' ) {
+            auto _snap = _proc.GetResourceSnapshot();
+            _SLOG( TEXT("* %d processes. (sampled in %.2f ms)\n"), 
+                    static_cast<int>( _snap->m_samples.size() ), _snap->m_cost_ms );
+            for ( auto& r : _snap->m_samples ) 
+                _SLOG( TEXT("  [PID:%d] cpu %5.1f%%  ws %I64u KB  private %I64u KB  handles %d  read %I64u KB  write %I64u KB\n"),
+                        r.pid, r.cpu_percent, 
+                        static_cast<ULONGLONG>( r.working_set / 1024 ), static_cast<ULONGLONG>( r.private_bytes / 1024 ),
+                        r.handles, r.read_bytes / 1024, r.write_bytes / 1024 );
+            continue;
+        }
+        if ( _key != 'r' && _key != 'R' ) 
+            break;
 
-    _SLOG( TEXT("\n\n| please type any key.\n\n\n") );
-    ::_getch();
+        if ( FAILED( _hr = reload_config( _proc ) ) ) 
+            _SLOG( TEXT("[ERR] Reload failed. %08x\n"), _hr ); 
+    }
 
     // Stop processes.
+    _control.Shutdown();
     _proc.PurgeProcesses();
+    _journal.Close();
+    SY_TRACE.Dump();
 
     return 0;
 }
 
 
 
+
+/**
+ * @brief プロセスの状態を1行出力します。
+ */
+static void
+print_process( _In_ const TSY_CTL_PROCESS& r ) {
+    _tprintf_s( TEXT("%-24s %3u %6u  %-8s %-5s %8I64u %5u %6.1f%% %8I64u KB  %s\n"),
+        r.name.GetString(), r.replica, r.pid, sy_proc_state_name( r.state ), r.ready ? TEXT("yes") : TEXT("no"),
+        r.uptime_ms / 1000, r.restart_count, r.cpu_percent, r.working_set / 1024, r.status.GetString() );
+}
+
+/**
+ * @brief 実行中のサービスを制御します。（制御エンドポイントへ接続します）
+ *        for "/ctl"  commandline option
+ *
+ *   /ctl list              ... 全 entry の状態
+ *   /ctl status  <entry>   ... entry の状態
+ *   /ctl start   <entry>   ... entry を起動
+ *   /ctl stop    <entry>   ... entry を停止
+ *   /ctl restart <entry>   ... entry を rolling restart
+ *   /ctl watch             ... 状態変化を表示し続ける
+ *   /ctl trace             ... trace を書き出す
+ *   /ctl detach            ... 次の停止で子プロセスを停止せずに残す（<journal> が必要。supervisor の更新用）
+ */
+int run_control( _In_ int argc, _In_ _TCHAR* argv[] ) {
+
+    static const struct { LPCTSTR name; WORD command; BOOL entry; } COMMANDS[] = {
+        { TEXT("list"),    SY_CTL_LIST,      FALSE },
+        { TEXT("status"),  SY_CTL_STATUS,    TRUE  },
+        { TEXT("start"),   SY_CTL_START,     TRUE  },
+        { TEXT("stop"),    SY_CTL_STOP,      TRUE  },
+        { TEXT("restart"), SY_CTL_RESTART,   TRUE  },
+        { TEXT("watch"),   SY_CTL_SUBSCRIBE, FALSE },
+        { TEXT("trace"),   SY_CTL_TRACE,     FALSE },
+        { TEXT("detach"),  SY_CTL_DETACH,    FALSE },
+    };
+
+    int _index = -1;
+    for ( size_t i = 0; argc >= 1 && i < _countof( COMMANDS ); i++ ) 
+        if ( ::_tcsicmp( COMMANDS[ i ].name, argv[0] ) == 0 ) _index = static_cast<int>( i );
+    if ( _index < 0 || ( COMMANDS[ _index ].entry && argc < 2 ) ) {
+        _tprintf_s( TEXT("usage: sylph /ctl list | watch | trace | detach | status <entry> | start <entry> | stop <entry> | restart <entry>\n") );
+        return E_INVALIDARG;
+    }
+
+    CsyControlClient _client;
+    HRESULT _hr = _client.Connect( SERVICE_NAME );
+    if ( FAILED( _hr ) ) {
+        _SLOG( TEXT("[ERR] Connect failed. in %08x [%s]\n"), _hr, sy_ctl_pipe_name( SERVICE_NAME ) );
+        return _hr;
+    }
+
+    HRESULT           _status = S_OK;
+    std::vector<BYTE> _payload;
+    CAtlString        _entry( COMMANDS[ _index ].entry ? argv[1] : TEXT("") );
+    _hr = _client.Request( COMMANDS[ _index ].command, _entry, _status, _payload );
+    if ( FAILED( _hr ) || FAILED( _status ) ) {
+        _SLOG( TEXT("[ERR] %s failed. in %08x\n"), COMMANDS[ _index ].name, FAILED( _hr ) ? _hr : _status );
+        return FAILED( _hr ) ? _hr : _status;
+    }
+
+    std::vector<TSY_CTL_PROCESS> _processes;
+    if ( sy_ctl_read_processes( _payload, _processes ) ) {
+        _tprintf_s( TEXT("%-24s %3s %6s  %-8s %-5s %8s %5s %7s %11s  %s\n"),
+            TEXT("ENTRY"), TEXT("#"), TEXT("PID"), TEXT("STATE"), TEXT("READY"),
+            TEXT("UP(s)"), TEXT("RST"), TEXT("CPU"), TEXT("WS"), TEXT("STATUS") );
+        for ( auto& r : _processes ) 
+            print_process( r );
+    } else if ( COMMANDS[ _index ].command == SY_CTL_DETACH ) {
+        _tprintf_s( TEXT("detach : ok (children keep running after the service stops)\n") );
+    } else if ( COMMANDS[ _index ].command == SY_CTL_TRACE ) {
+        _tprintf_s( TEXT("trace : %s\n"), _status == S_FALSE ? TEXT("disabled (set <trace> in syconfig.xml)") : TEXT("ok") );
+    } else {
+        _tprintf_s( TEXT("%s %s : %s\n"), COMMANDS[ _index ].name, _entry, 
+                    _status == S_FALSE ? TEXT("no change") : TEXT("ok") );
+    }
+
+    // watch : 状態変化を表示し続ける（切断まで）
+    while ( COMMANDS[ _index ].command == SY_CTL_SUBSCRIBE ) {
+        TSY_CTL_HEADER _head;
+        if ( FAILED( _hr = _client.Receive( _head, _payload ) ) ) 
+            break;
+        if ( _head.command != SY_CTL_EVENT ) 
+            continue;
+
+        TSY_CTL_PROCESS   _r;
+        CsySnapshotReader _reader( _payload.data(), _payload.size() );
+        sy_serialize( _reader, _r );
+        if ( _reader.IsValid() ) 
+            print_process( _r );
+    }
+    return 0;
+}
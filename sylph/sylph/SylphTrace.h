@@ -0,0 +1,302 @@
+﻿/**
+ * @file     SylphTrace.h
+ * @brief    Lifecycle tracing (Chrome / Perfetto trace-event JSON)
+ * @author   M.Horigome
+ * @version  1.0.0.0000
+ * @date     2026-10-17
+ *
+ * https://github.com/horigome/sylph
+ */
+#pragma once
+#include "stdafx.h"
+
+/** Trace 定数 */
+enum {
+    SY_TRACE_EVENTS         = 4096,     ///< スレッド毎のバッファに記録できるイベント数
+    SY_TRACE_THREADS        = 256,      ///< バッファを割り当てるスレッド数の上限
+    SY_TRACE_DETAIL_SIZE    = 32,       ///< detail (entry名など) の最大長 (UTF-8, 終端を含む)
+};
+
+/**
+ * @brief 1イベント
+ *        end が 0 の場合は instant ("ph":"i")、それ以外は complete ("ph":"X") として出力します。
+ */
+struct TSY_TRACE_EVENT {
+    LONGLONG    begin;                          ///< QueryPerformanceCounter
+    LONGLONG    end;                            ///< QueryPerformanceCounter (0.. instant)
+    const char* name;                           ///< イベント名（文字列リテラルであること）
+    DWORD       pid;                            ///< 対象の子プロセスID (0.. なし)
+    LONG        value;                          ///< 終了コードなど
+    char        detail[ SY_TRACE_DETAIL_SIZE ]; ///< entry名など
+};
+
+/**
+ * @brief ライフサイクルのトレース
+ *
+ *        イベントはスレッド毎に事前に確保したバッファ（SY_TRACE_EVENTS 件）へ、ロックを取らずに記録します。
+ *        タイムスタンプは QueryPerformanceCounter（単調増加）です。バッファが一杯になった後のイベントは捨てます。
+ *        Dump() で Chrome / Perfetto の trace-event 形式 (JSON) へ書き出します。
+ *        Enable() を呼ぶまでは何も記録しません。
+ */
+class CsyTracer {
+
+    /** スレッド毎のバッファ（書き込みは所有スレッドのみ） */
+    struct TBUFFER {
+        DWORD               tid;
+        const char*         thread_name;
+        std::atomic<LONG>   count;              ///< 書き込み済みの件数（読み込み側は count 未満のみ読む）
+        LONG                dropped;
+        TSY_TRACE_EVENT     events[ SY_TRACE_EVENTS ];
+    };
+
+    CComAutoCriticalSection m_lock;             ///< m_buffers / m_path
+    std::atomic<BOOL>       m_enabled;
+    DWORD                   m_tls;
+    DWORD                   m_tls_name;         ///< SetThreadName の名前（記録前に設定されたもの）
+    LONGLONG                m_origin;           ///< 時刻の基準（このオブジェクトの作成時）
+    LONGLONG                m_frequency;
+    CAtlString              m_path;             ///< 出力先
+    std::vector<TBUFFER*>   m_buffers;
+public:
+    CsyTracer( void ) : m_enabled( FALSE ), m_tls( ::TlsAlloc() ), m_tls_name( ::TlsAlloc() ) {
+        LARGE_INTEGER _value;
+        ::QueryPerformanceFrequency( &_value );
+        m_frequency = _value.QuadPart;
+        ::QueryPerformanceCounter( &_value );
+        m_origin = _value.QuadPart;
+    }
+
+    /** destructor */
+    virtual ~CsyTracer( void ) {
+        for ( auto b : m_buffers )
+            delete b;
+        if ( m_tls      != TLS_OUT_OF_INDEXES ) ::TlsFree( m_tls );
+        if ( m_tls_name != TLS_OUT_OF_INDEXES ) ::TlsFree( m_tls_name );
+    }
+
+    /**
+     * @brief 記録を開始します。
+     * @param[in] path ... Dump() の出力先 (JSON)
+     */
+    void Enable( _In_z_ LPCTSTR path ) {
+        {
+            CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+            m_path = path;
+        }
+        if ( m_tls != TLS_OUT_OF_INDEXES )
+            m_enabled = TRUE;
+    }
+
+    /** 記録中か？ */
+    BOOL IsEnabled( void ) const { return m_enabled; }
+
+    /** 現在時刻 (QueryPerformanceCounter) */
+    static LONGLONG Now( void ) {
+        LARGE_INTEGER _now;
+        ::QueryPerformanceCounter( &_now );
+        return _now.QuadPart;
+    }
+
+    /**
+     * @brief 区間を記録します。("ph":"X")
+     * @param[in] name ... イベント名（文字列リテラル）
+     * @param[in] begin ... 開始時刻 (Now)
+     * @param[in] end ... 終了時刻 (Now)
+     * @param[in] pid ... 対象の子プロセスID (0.. なし)
+     * @param[in] detail ... entry名など (NULL.. なし)
+     * @param[in] value ... 終了コードなど
+     */
+    void Complete( _In_z_ const char* name, _In_ LONGLONG begin, _In_ LONGLONG end,
+                   _In_ DWORD pid = 0, _In_opt_z_ LPCTSTR detail = NULL, _In_ LONG value = 0 ) {
+        if ( m_enabled )
+            this->Record( name, begin, ( std::max )( end, begin + 1 ), pid, detail, value );
+    }
+
+    /**
+     * @brief 時点を記録します。("ph":"i")
+     */
+    void Instant( _In_z_ const char* name, _In_ DWORD pid = 0, _In_opt_z_ LPCTSTR detail = NULL, _In_ LONG value = 0 ) {
+        if ( m_enabled )
+            this->Record( name, Now(), 0, pid, detail, value );
+    }
+
+    /**
+     * @brief 呼び出しスレッドの名前を設定します。（trace の thread_name。文字列リテラル）
+     *        記録の開始前に呼んでも名前は残り、バッファを割り当てる時に使います。
+     */
+    void SetThreadName( _In_z_ const char* name ) {
+        if ( m_tls_name != TLS_OUT_OF_INDEXES )
+            ::TlsSetValue( m_tls_name, const_cast<char*>( name ) );
+        if ( !m_enabled )
+            return;
+        if ( TBUFFER* _b = this->GetBuffer() )
+            _b->thread_name = name;
+    }
+
+    /**
+     * @brief 記録したイベントを trace-event 形式 (JSON) で書き出します。
+     *        記録は続けたまま書き出すため、何度でも呼べます。（記録中のスレッドは止めません）
+     * @param[in] path ... 出力先 (NULL.. Enable() で指定したファイル)
+     * @retval S_FALSE ... 記録していない
+     */
+    HRESULT Dump( _In_opt_z_ LPCTSTR path = NULL ) {
+        if ( !m_enabled )
+            return S_FALSE;
+
+        std::vector<TBUFFER*> _buffers;
+        CAtlString            _path;
+        {
+            CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+            _buffers = m_buffers;
+            _path    = path ? CAtlString( path ) : m_path;
+        }
+
+        DWORD     _self  = ::GetCurrentProcessId();
+        ULONGLONG _total = 0, _dropped = 0;
+        std::string _json;
+        _json.reserve( 1024 * 1024 );
+        _json += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+        char _line[ 512 ];
+        ::sprintf_s( _line, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":0,\"args\":{\"name\":\"sylph\"}}", _self );
+        _json += _line;
+
+        for ( auto b : _buffers ) {
+            LONG _count = b->count.load( std::memory_order_acquire );
+            _total   += _count;
+            _dropped += b->dropped;
+            if ( b->thread_name ) {
+                ::sprintf_s( _line, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":%lu,\"args\":{\"name\":\"%s\"}}",
+                             _self, b->tid, b->thread_name );
+                _json += _line;
+            }
+            for ( LONG i = 0; i < _count; i++ ) {
+                const TSY_TRACE_EVENT& _e = b->events[ i ];
+                if ( _e.end )
+                    ::sprintf_s( _line, ",\n{\"name\":\"%s\",\"cat\":\"sylph\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%lu,\"tid\":%lu,\"args\":{",
+                                 _e.name, this->ToMicro( _e.begin - m_origin ), this->ToMicro( _e.end - _e.begin ), _self, b->tid );
+                else
+                    ::sprintf_s( _line, ",\n{\"name\":\"%s\",\"cat\":\"sylph\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%lu,\"tid\":%lu,\"args\":{",
+                                 _e.name, this->ToMicro( _e.begin - m_origin ), _self, b->tid );
+                _json += _line;
+
+                ::sprintf_s( _line, "\"child\":%lu,\"value\":%ld,\"detail\":\"", _e.pid, _e.value );
+                _json += _line;
+                for ( const char* c = _e.detail; *c; c++ ) {
+                    if ( *c == '"' || *c == '\\' ) _json += '\\';
+                    if ( static_cast<unsigned char>( *c ) >= 0x20 ) _json += *c;
+                }
+                _json += "\"}}";
+            }
+        }
+        ::sprintf_s( _line, "\n],\"otherData\":{\"events\":%I64u,\"dropped\":%I64u}}\n", _total, _dropped );
+        _json += _line;
+
+        HANDLE _file = ::CreateFile( _path, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+        if ( _file == INVALID_HANDLE_VALUE ) {
+            HRESULT _hr = HRESULT_FROM_WIN32( ::GetLastError() );
+            _SLOG( TEXT("! Trace dump failed. in %08x [%s]\n"), _hr, _path.GetString() );
+            return _hr;
+        }
+        DWORD _written = 0;
+        BOOL  _ok      = ::WriteFile( _file, _json.data(), static_cast<DWORD>( _json.size() ), &_written, NULL );
+        HRESULT _hr    = _ok ? S_OK : HRESULT_FROM_WIN32( ::GetLastError() );
+        ::CloseHandle( _file );
+
+        _SLOG( TEXT("==> Trace dumped. %I64u events (dropped %I64u) : %s\n"), _total, _dropped, _path.GetString() );
+        return _hr;
+    }
+
+private:
+    /** カウンタ値をマイクロ秒へ */
+    double ToMicro( _In_ LONGLONG counter ) const {
+        return static_cast<double>( counter ) * 1000000.0 / m_frequency;
+    }
+
+    /** 呼び出しスレッドのバッファ（初回に割り当てます） */
+    TBUFFER* GetBuffer( void ) {
+        TBUFFER* _b = reinterpret_cast<TBUFFER*>( ::TlsGetValue( m_tls ) );
+        if ( _b )
+            return _b;
+
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        if ( m_buffers.size() >= SY_TRACE_THREADS )
+            return NULL;
+        _b = new TBUFFER;
+        _b->tid         = ::GetCurrentThreadId();
+        _b->thread_name = ( m_tls_name != TLS_OUT_OF_INDEXES ) ? static_cast<const char*>( ::TlsGetValue( m_tls_name ) ) : NULL;
+        _b->count       = 0;
+        _b->dropped     = 0;
+        m_buffers.push_back( _b );
+        ::TlsSetValue( m_tls, _b );
+        return _b;
+    }
+
+    void Record( _In_z_ const char* name, _In_ LONGLONG begin, _In_ LONGLONG end,
+                 _In_ DWORD pid, _In_opt_z_ LPCTSTR detail, _In_ LONG value ) {
+        TBUFFER* _b = this->GetBuffer();
+        if ( !_b )
+            return;
+
+        LONG _count = _b->count.load( std::memory_order_relaxed );
+        if ( _count >= SY_TRACE_EVENTS ) {
+            _b->dropped++;
+            return;
+        }
+
+        TSY_TRACE_EVENT& _e = _b->events[ _count ];
+        _e.begin     = begin;
+        _e.end       = end;
+        _e.name      = name;
+        _e.pid       = pid;
+        _e.value     = value;
+        _e.detail[0] = '\0';
+        if ( detail && *detail ) {
+            // 長すぎる場合は UTF-8 の文字の境界で切り詰める
+            CT2A   _utf8( detail, CP_UTF8 );
+            size_t _len = ::strlen( _utf8 );
+            if ( _len >= SY_TRACE_DETAIL_SIZE ) {
+                _len = SY_TRACE_DETAIL_SIZE - 1;
+                while ( _len && ( static_cast<unsigned char>( _utf8[ _len ] ) & 0xC0 ) == 0x80 )
+                    _len--;
+            }
+            ::memcpy( _e.detail, static_cast<LPSTR>( _utf8 ), _len );
+            _e.detail[ _len ] = '\0';
+        }
+        _b->count.store( _count + 1, std::memory_order_release );
+    }
+
+    CsyTracer( const CsyTracer& );
+    CsyTracer& operator=( const CsyTracer& );
+};
+
+extern CsyTracer SY_TRACE;
+
+/**
+ * @brief スコープの区間を記録します。（スコープを抜けた時点で記録中なら記録します）
+ *
+ *        開始時は記録の有無を問わず時刻だけ取るため、Enable() より前に始まった区間
+ *        （設定の読み込みなど）も記録できます。
+ */
+class CsyTraceScope {
+    const char* m_name;
+    LONGLONG    m_begin;
+    DWORD       m_pid;
+    LPCTSTR     m_detail;
+    LONG        m_value;
+public:
+    explicit CsyTraceScope( _In_z_ const char* name, _In_opt_z_ LPCTSTR detail = NULL )
+        : m_name( name ), m_begin( CsyTracer::Now() ), m_pid( 0 ), m_detail( detail ), m_value( 0 ) { }
+
+    ~CsyTraceScope( void ) {
+        SY_TRACE.Complete( m_name, m_begin, CsyTracer::Now(), m_pid, m_detail, m_value );
+    }
+
+    /** 対象の子プロセスID（区間の途中で決まる場合） */
+    void SetPid  ( _In_ DWORD pid  ) { m_pid   = pid;   }
+    void SetValue( _In_ LONG value ) { m_value = value; }
+
+private:
+    CsyTraceScope( const CsyTraceScope& );
+    CsyTraceScope& operator=( const CsyTraceScope& );
+};
@@ -0,0 +1,109 @@
+﻿/**
+ * @file     SylphWatchdog.h
+ * @brief    Shared-memory heartbeat table for the child watchdog
+ * @author   M.Horigome
+ * @version  1.0.0.0000
+ * @date     2026-10-17
+ *
+ * https://github.com/horigome/sylph
+ */
+#pragma once
+#include "stdafx.h"
+
+/** Watchdog 定数 */
+enum {
+    SY_HEARTBEAT_SLOTS      = 8192,     ///< heartbeat の slot 数（同時に監視できるプロセス数）
+    SY_WATCHDOG_SCAN_MS     = 250,      ///< heartbeat を確認する間隔(ms)
+};
+
+/** watchdog で強制終了したプロセスの終了コード */
+const DWORD SY_WATCHDOG_EXIT_CODE = ERROR_TIMEOUT;
+
+/**
+ * @brief heartbeat テーブル（名前付き共有メモリ）
+ *
+ *        プロセス毎に 64bit のカウンタ (slot) を1つ割り当てます。
+ *        子プロセスは SYLPH_HEARTBEAT_MAP を OpenFileMapping/MapViewOfFile で開き、
+ *        SYLPH_HEARTBEAT_SLOT 番目のカウンタを InterlockedIncrement64 で増やします。
+ *        supervisor はタイマーで全 slot を読むだけなので、プロセス数に関わらずスレッド/タイマーは増えません。
+ */
+class CsyHeartbeatTable {
+    CComAutoCriticalSection m_lock;         ///< m_free / 作成
+    HANDLE                  m_mapping;
+    volatile LONG64*        m_slots;
+    CAtlString              m_name;
+    std::vector<int>        m_free;         ///< 空き slot
+public:
+    CsyHeartbeatTable( void ) : m_mapping( NULL ), m_slots( NULL ) { }
+
+    /** destructor */
+    virtual ~CsyHeartbeatTable( void ) {
+        if ( m_slots   ) ::UnmapViewOfFile( const_cast<LONG64*>( m_slots ) );
+        if ( m_mapping ) ::CloseHandle( m_mapping );
+    }
+
+    /** 共有メモリ名 (SYLPH_HEARTBEAT_MAP) */
+    const CAtlString& IsName( void ) const { return m_name; }
+
+    /**
+     * @brief slot を1つ割り当て、カウンタを 0 にします。（初回は共有メモリを作成します）
+     * @retval -1 ... 割り当てられない（共有メモリの作成失敗 / slot 不足）
+     */
+    int Alloc( void ) {
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        if ( !m_slots && FAILED( this->Create() ) )
+            return -1;
+        if ( m_free.empty() ) {
+            _SLOG( TEXT("! Heartbeat slots exhausted. (%d)\n"), SY_HEARTBEAT_SLOTS );
+            return -1;
+        }
+        int _slot = m_free.back();
+        m_free.pop_back();
+        this->Reset( _slot );
+        return _slot;
+    }
+
+    /** slot を解放します */
+    void Free( _In_ int slot ) {
+        if ( slot < 0 ) return;
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        m_free.push_back( slot );
+    }
+
+    /** カウンタを 0 にします（再起動時） */
+    void Reset( _In_ int slot ) {
+        ::InterlockedExchange64( &m_slots[ slot ], 0 );
+    }
+
+    /** カウンタを読みます */
+    LONG64 Read( _In_ int slot ) const {
+        return ::InterlockedCompareExchange64( &m_slots[ slot ], 0, 0 );
+    }
+
+private:
+    HRESULT Create( void ) {
+        m_name.Format( TEXT("Local\\sylph-heartbeat-%d"), ::GetCurrentProcessId() );
+        m_mapping = ::CreateFileMapping( INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                         0, SY_HEARTBEAT_SLOTS * sizeof( LONG64 ), m_name );
+        if ( !m_mapping ) {
+            HRESULT _hr = HRESULT_FROM_WIN32( ::GetLastError() );
+            _SLOG( TEXT("! Heartbeat table create failed. in %08x\n"), _hr );
+            return _hr;
+        }
+        m_slots = static_cast<volatile LONG64*>( ::MapViewOfFile( m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0 ) );
+        if ( !m_slots ) {
+            HRESULT _hr = HRESULT_FROM_WIN32( ::GetLastError() );
+            ::CloseHandle( m_mapping );
+            m_mapping = NULL;
+            return _hr;
+        }
+
+        m_free.reserve( SY_HEARTBEAT_SLOTS );
+        for ( int i = SY_HEARTBEAT_SLOTS - 1; i >= 0; i-- )
+            m_free.push_back( i );
+        return S_OK;
+    }
+
+    CsyHeartbeatTable( const CsyHeartbeatTable& );
+    CsyHeartbeatTable& operator=( const CsyHeartbeatTable& );
+};
@@ -15,6 +15,10 @@
 #include <tchar.h>
 #include <conio.h>
 
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <tlhelp32.h>
+
 #define _ATL_CSTRING_EXPLICIT_CONSTRUCTORS
 #include <atlbase.h>
 #include <atlcom.h>
@@ -25,7 +29,15 @@ using namespace ATL;
 
 #include <algorithm>
 #include <vector>
+#include <map>
+#include <tuple>
+#include <set>
+#include <memory>
+#include <atomic>
 #include <functional>
+#include <random>
 
 #include "SylphCommonLog.h"
-#include "SylphCommon.h"
\ No newline at end of file
+#include "SylphTrace.h"
+#include "SylphCommon.h"
+#include "SylphEventSink.h"
\ No newline at end of file
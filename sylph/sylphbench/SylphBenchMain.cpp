@@ -0,0 +1,772 @@
+﻿/**
+ * @file     SylphBenchMain.cpp
+ * @brief    Supervisor benchmark (spawn / startup / stop / restart / tree / capture / logger / config)
+ * @author   M.Horigome
+ * @version  1.0.0.0000
+ * @date     2026-10-17
+ *
+ * https://github.com/horigome/sylph
+ */
+#include "stdafx.h"
+#include <cmath>
+#include "SylphProcessManager.h"
+#include "SylphConfigSnapshot.h"
+
+// Globals
+CsyAsyncLogger  SY_LOGGER;
+CsyTracer       SY_TRACE;
+CAtlString      SERVICE_NAME    = TEXT("SylphBench");
+CsyEventSink    SY_EVENTS;
+
+/** Benchmark 定数 */
+enum {
+    SY_BENCH_WAIT_MS        = 120000,               ///< 1項目の待ち時間の上限(ms)
+    SY_BENCH_POLL_MS        = 10,                   ///< ファイルサイズの確認間隔(ms)
+    SY_BENCH_CAPTURE_TOTAL  = 64 * 1024 * 1024,     ///< capture の総出力(bytes)。N で割る
+    SY_BENCH_CAPTURE_MIN    = 64 * 1024,            ///< capture の1プロセスあたりの下限(bytes)
+    SY_BENCH_LOG_CALLS      = 100000,               ///< logger の呼び出し回数
+    SY_BENCH_PARSE_ENTRIES  = 10000,                ///< config の最大 entry 数
+    SY_BENCH_TREE_DEPTH     = 2,                    ///< tree の子孫の段数（entry 本体を含めて3段）
+};
+
+/**
+ * @brief 1項目の結果。サンプルから min / p50 / p99 / max / mean を出します。
+ */
+struct TBENCH_RESULT {
+    CStringA            name;
+    UINT                n;          ///< 子プロセス数 / entry 数
+    CStringA            unit;
+    std::vector<double> samples;
+};
+
+// Prototype ---
+int     run_child   ( int argc, _TCHAR* argv[] );
+int     run_bench   ( const std::vector<UINT>& counts, const CAtlString& out );
+
+/**
+ * @brief main function
+ *
+ * options:
+ * ----------------------------------------------------------------------
+ *   /n 1,10,100,1000 ... 子プロセス数 (Default: 1,10,100,1000,5000)
+ *   /out <file>      ... 結果の JSON (Default: sylphbench.json)
+ *   /child <mode>    ... stub child (idle | notify | write <bytes> | tree <depth>)
+ *
+ */
+extern "C"
+int _tmain( _In_ int        argc,
+            _In_ _TCHAR*    argv[] ) {
+
+    int _ctrl = sy_console_ctrl_main( argc, argv );     // 停止要求の補助プロセス ( /ctrl )
+    if ( _ctrl >= 0 ) 
+        return _ctrl;
+
+    if ( argc >= 2 && ::_tcscmp( TEXT("/child"), argv[1] ) == 0 )
+        return run_child( argc - 2, argv + 2 );
+
+    std::vector<UINT> _counts;
+    CAtlString        _out( TEXT("sylphbench.json") );
+    for ( int i = 1; i + 1 < argc; i += 2 ) {
+        if ( ::_tcscmp( TEXT("/n"), argv[i] ) == 0 ) {
+            CAtlString _list( argv[i + 1] );
+            int _pos = 0;
+            for ( CAtlString _tok = _list.Tokenize( TEXT(","), _pos ); _pos >= 0; _tok = _list.Tokenize( TEXT(","), _pos ) )
+                if ( ::_ttoi( _tok ) > 0 ) _counts.push_back( static_cast<UINT>( ::_ttoi( _tok ) ) );
+        }
+        else if ( ::_tcscmp( TEXT("/out"), argv[i] ) == 0 ) {
+            _out = argv[i + 1];
+        }
+    }
+    if ( _counts.empty() )
+        _counts = { 1, 10, 100, 1000, 5000 };
+
+    return run_bench( _counts, _out );
+}
+
+//
+// stub child
+//
+
+/**
+ * @brief 通知チャネル (NOTIFY_SOCKET) へ1件書き込みます。
+ */
+static void
+child_notify( _In_z_ LPCSTR message ) {
+    TCHAR _name[ MAX_PATH ] = { 0 };
+    if ( !::GetEnvironmentVariable( TEXT("NOTIFY_SOCKET"), _name, _countof( _name ) ) )
+        return;
+
+    ULONGLONG _deadline = ::GetTickCount64() + SY_BENCH_WAIT_MS;
+    while ( ::GetTickCount64() < _deadline ) {
+        HANDLE _pipe = ::CreateFile( _name, GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL );
+        if ( _pipe != INVALID_HANDLE_VALUE ) {
+            DWORD _written = 0;
+            ::WriteFile( _pipe, message, static_cast<DWORD>( ::strlen( message ) ), &_written, NULL );
+            ::CloseHandle( _pipe );
+            return;
+        }
+        if ( ::GetLastError() != ERROR_PIPE_BUSY )
+            return;
+        ::WaitNamedPipe( _name, 1000 );
+    }
+}
+
+/**
+ * @brief stub child. 何もせずに停止要求（Ctrl+C / WM_CLOSE / Kill）を待ちます。
+ *
+ *   idle          ... 起動後すぐに待つ
+ *   notify        ... READY=1 を送ってから待つ
+ *   write <bytes> ... 標準出力へ bytes 分の行を書いて終了する
+ *   tree <depth>  ... "tree <depth - 1>" の子を起動してから待つ（0.. 起動しない）
+ */
+int run_child( _In_ int argc, _In_ _TCHAR* argv[] ) {
+
+    if ( argc >= 2 && ::_tcscmp( TEXT("tree"), argv[0] ) == 0 ) {
+        int _depth = ::_ttoi( argv[1] );
+        if ( _depth > 0 ) {
+            TCHAR _self[ MAX_PATH ] = { 0 };
+            ::GetModuleFileName( NULL, _self, _countof( _self ) );
+
+            CAtlString _command;
+            _command.Format( TEXT("\"%s\" /child tree %d"), _self, _depth - 1 );
+            PROCESS_INFORMATION _pi;
+            if ( SUCCEEDED( sy_create_process( _command, _pi ) ) ) {
+                ::CloseHandle( _pi.hThread );
+                ::CloseHandle( _pi.hProcess );
+            }
+        }
+        ::Sleep( INFINITE );
+        return 0;
+    }
+
+    if ( argc >= 2 && ::_tcscmp( TEXT("write"), argv[0] ) == 0 ) {
+        ULONGLONG _remain = static_cast<ULONGLONG>( ::_ttoi64( argv[1] ) );
+
+        std::vector<char> _buffer( 64 * 1024, 'x' );
+        for ( size_t i = 99; i < _buffer.size(); i += 100 )
+            _buffer[ i ] = '\n';
+
+        HANDLE _out = ::GetStdHandle( STD_OUTPUT_HANDLE );
+        while ( _remain ) {
+            DWORD _size    = static_cast<DWORD>( ( std::min )( _remain, static_cast<ULONGLONG>( _buffer.size() ) ) );
+            DWORD _written = 0;
+            if ( !::WriteFile( _out, _buffer.data(), _size, &_written, NULL ) || !_written )
+                return 1;
+            _remain -= _written;
+        }
+        return 0;
+    }
+
+    if ( argc >= 1 && ::_tcscmp( TEXT("notify"), argv[0] ) == 0 )
+        child_notify( "READY=1" );
+
+    ::Sleep( INFINITE );
+    return 0;
+}
+
+//
+// benchmark
+//
+
+/**
+ * @brief 状態変化を集計します。（supervisor loop / 停止処理から呼ばれます）
+ */
+class CsyBenchObserver : public IsyProcessObserver {
+    CComAutoCriticalSection m_lock;
+    HANDLE                  m_event;
+    LONGLONG                m_since;        ///< 計測の開始 (sy_perf_counter)
+    std::vector<double>     m_stop_ms;      ///< 停止要求から終了まで(ms)
+    std::vector<double>     m_ready_ms;     ///< m_since から READY まで(ms)
+    UINT                    m_exited;       ///< 自ら終了した数
+public:
+    CsyBenchObserver( void ) : m_event( ::CreateEvent( NULL, FALSE, FALSE, NULL ) ), m_since( 0 ), m_exited( 0 ) { }
+
+    virtual ~CsyBenchObserver( void ) {
+        ::CloseHandle( m_event );
+    }
+
+    /** 集計をやり直します */
+    void Reset( void ) {
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        m_since  = sy_perf_counter();
+        m_exited = 0;
+        m_stop_ms.clear();
+        m_ready_ms.clear();
+    }
+
+    std::vector<double> IsStopLatency( void ) {
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        return m_stop_ms;
+    }
+
+    std::vector<double> IsReadyLatency( void ) {
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        return m_ready_ms;
+    }
+
+    /**
+     * @brief READY / 終了の数が count になるまで待ちます。
+     * @retval FALSE ... timeout
+     */
+    BOOL WaitReady ( _In_ size_t count ) { return this->Wait( [&]{ return m_ready_ms.size() >= count; } ); }
+    BOOL WaitExited( _In_ size_t count ) { return this->Wait( [&]{ return m_exited          >= count; } ); }
+
+    virtual void OnProcessEvent( _In_ const CsyProcess& process ) override {
+        CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+        switch ( process.IsState() ) {
+        case SY_PROC_STOPPED:
+            m_stop_ms.push_back( process.IsStopLatency() );
+            break;
+        case SY_PROC_EXITED:
+        case SY_PROC_BACKOFF:
+            m_exited++;
+            break;
+        case SY_PROC_RUNNING:
+            if ( process.IsNotifiedReady() )
+                m_ready_ms.push_back( sy_perf_ms( m_since ) );
+            break;
+        default:
+            break;
+        }
+        ::SetEvent( m_event );
+    }
+
+private:
+    BOOL Wait( _In_ std::function<BOOL()> done ) {
+        ULONGLONG _deadline = ::GetTickCount64() + SY_BENCH_WAIT_MS;
+        for ( ;; ) {
+            {
+                CComCritSecLock<CComAutoCriticalSection> _lock( m_lock );
+                if ( done() )
+                    return TRUE;
+            }
+            ULONGLONG _now = ::GetTickCount64();
+            if ( _now >= _deadline )
+                return FALSE;
+            ::WaitForSingleObject( m_event, static_cast<DWORD>( _deadline - _now ) );
+        }
+    }
+
+    CsyBenchObserver( const CsyBenchObserver& );
+    CsyBenchObserver& operator=( const CsyBenchObserver& );
+};
+
+/**
+ * @brief stub child の entry を作ります。
+ * @param[in] name ... entry名
+ * @param[in] args ... stub child の引数 (idle | notify | write <bytes>)
+ */
+static CsyProcConfig
+bench_config( _In_ const CAtlString& name, _In_ const CAtlString& args ) {
+    TCHAR _self[ MAX_PATH ] = { 0 };
+    ::GetModuleFileName( NULL, _self, _countof( _self ) );
+
+    CAtlString _command;
+    _command.Format( TEXT("\"%s\" /child %s"), _self, args.GetString() );
+
+    CsyProcConfig _c( _command, 0 );
+    _c.m_name = name;
+    _c.Normalize();
+    return _c;
+}
+
+/** N 個の entry */
+static SYCONFIGS
+bench_configs( _In_ UINT n, _In_ const CAtlString& args ) {
+    SYCONFIGS _configs;
+    for ( UINT i = 0; i < n; i++ ) {
+        CAtlString _name;
+        _name.Format( TEXT("stub%04u"), i );
+        _configs.push_back( bench_config( _name, args ) );
+    }
+    return _configs;
+}
+
+/** 結果を追加します */
+static void
+bench_add( _Inout_ std::vector<TBENCH_RESULT>& results, _In_z_ LPCSTR name, _In_ UINT n,
+           _In_z_ LPCSTR unit, _In_ const std::vector<double>& samples ) {
+    TBENCH_RESULT _r;
+    _r.name    = name;
+    _r.n       = n;
+    _r.unit    = unit;
+    _r.samples = samples;
+    results.push_back( _r );
+}
+
+/**
+ * @brief supervisor（このプロセス）のスレッド数と private bytes / working set (RSS)
+ */
+static void
+bench_self_usage( _Out_ DWORD& threads, _Out_ SIZE_T& private_bytes, _Out_ SIZE_T& working_set ) {
+    threads       = 0;
+    private_bytes = 0;
+    working_set   = 0;
+
+    HANDLE _snap = ::CreateToolhelp32Snapshot( TH32CS_SNAPTHREAD, 0 );
+    if ( _snap != INVALID_HANDLE_VALUE ) {
+        THREADENTRY32 _te = { sizeof( _te ) };
+        for ( BOOL _ok = ::Thread32First( _snap, &_te ); _ok; _ok = ::Thread32Next( _snap, &_te ) )
+            if ( _te.th32OwnerProcessID == ::GetCurrentProcessId() ) threads++;
+        ::CloseHandle( _snap );
+    }
+
+    PROCESS_MEMORY_COUNTERS_EX _pmc = { sizeof( _pmc ) };
+    if ( ::GetProcessMemoryInfo( ::GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS*>( &_pmc ), sizeof( _pmc ) ) ) {
+        private_bytes = _pmc.PrivateUsage;
+        working_set   = _pmc.WorkingSetSize;
+    }
+}
+
+/**
+ * @brief 1つずつ起動した時の起動時間、起動中の supervisor の使用量、一斉停止の停止時間
+ */
+static void
+bench_spawn_stop( _In_ UINT n, _Inout_ std::vector<TBENCH_RESULT>& results ) {
+    CsyBenchObserver     _observer;
+    CsylphProcessManager _proc;
+    _proc.SetSampleInterval( 0 );
+    _proc.SetObserver( &_observer );
+
+    std::vector<double> _spawn_ms;
+    SYCONFIGS _configs = bench_configs( n, TEXT("idle") );
+    for ( auto& c : _configs ) {
+        LONGLONG _begin = sy_perf_counter();
+        HRESULT  _hr    = _proc.AddProcessEntry( c );
+        if ( FAILED( _hr ) ) {
+            _SLOG( TEXT("[ERR] spawn failed. in %08x\n"), _hr );
+            break;
+        }
+        _spawn_ms.push_back( sy_perf_ms( _begin ) );
+    }
+    bench_add( results, "spawn_latency", n, "ms", _spawn_ms );
+
+    DWORD  _threads = 0;
+    SIZE_T _private = 0;
+    SIZE_T _rss     = 0;
+    bench_self_usage( _threads, _private, _rss );
+    bench_add( results, "supervisor_threads",    n, "count", std::vector<double>( 1, _threads ) );
+    bench_add( results, "supervisor_private_kb", n, "KB",    std::vector<double>( 1, static_cast<double>( _private / 1024 ) ) );
+    bench_add( results, "supervisor_rss_kb",     n, "KB",    std::vector<double>( 1, static_cast<double>( _rss / 1024 ) ) );
+
+    _observer.Reset();
+    LONGLONG _begin = sy_perf_counter();
+    _proc.PurgeProcesses();
+    bench_add( results, "fleet_stop",   n, "ms", std::vector<double>( 1, sy_perf_ms( _begin ) ) );
+    bench_add( results, "stop_latency", n, "ms", _observer.IsStopLatency() );
+    _proc.SetObserver( NULL );
+}
+
+/**
+ * @brief N 個の entry を StartEntries で一斉に起動する時間
+ */
+static void
+bench_fleet_startup( _In_ UINT n, _Inout_ std::vector<TBENCH_RESULT>& results ) {
+    CsylphProcessManager _proc;
+    _proc.SetSampleInterval( 0 );
+
+    SYCONFIGS _configs = bench_configs( n, TEXT("idle") );
+    LONGLONG  _begin   = sy_perf_counter();
+    HRESULT   _hr      = _proc.StartEntries( _configs );
+    double    _ms      = sy_perf_ms( _begin );
+    if ( FAILED( _hr ) )
+        _SLOG( TEXT("[ERR] StartEntries failed. in %08x\n"), _hr );
+    else
+        bench_add( results, "fleet_startup", n, "ms", std::vector<double>( 1, _ms ) );
+    _proc.PurgeProcesses();
+}
+
+/**
+ * @brief notify の entry を一斉に Kill し、再起動して READY になるまでの時間
+ */
+static void
+bench_restart( _In_ UINT n, _Inout_ std::vector<TBENCH_RESULT>& results ) {
+    CsyBenchObserver     _observer;
+    CsylphProcessManager _proc;
+    _proc.SetSampleInterval( 0 );
+    _proc.SetObserver( &_observer );
+
+    SYCONFIGS _configs = bench_configs( n, TEXT("notify") );
+    for ( auto& c : _configs ) {
+        c.m_notify          = TRUE;
+        c.m_max_retry       = 1000;
+        c.m_retry_delay     = 0;
+        c.m_retry_delay_max = 0;
+        c.m_crash_limit     = 0;
+    }
+
+    HRESULT _hr = _proc.StartEntries( _configs );
+    if ( SUCCEEDED( _hr ) ) {
+        _observer.Reset();
+        _proc.ForEach( []( CsyProcess* p ) { ::TerminateProcess( p->IsProcessHandle(), 1 ); } );
+        if ( !_observer.WaitReady( n ) )
+            _SLOG( TEXT("[WAR] restart : not all processes became ready.\n") );
+        bench_add( results, "restart_to_ready", n, "ms", _observer.IsReadyLatency() );
+    } else {
+        _SLOG( TEXT("[ERR] StartEntries failed. in %08x\n"), _hr );
+    }
+
+    _proc.SetObserver( NULL );
+    _proc.PurgeProcesses();
+}
+
+/**
+ * @brief roots の子孫プロセス（孫以降を含む）を開きます。
+ */
+static void
+bench_descendants( _In_ const std::set<DWORD>& roots, _Out_ std::vector<HANDLE>& descendants ) {
+    descendants.clear();
+
+    std::multimap<DWORD, DWORD> _children;     // parent -> child
+    HANDLE _snap = ::CreateToolhelp32Snapshot( TH32CS_SNAPPROCESS, 0 );
+    if ( _snap == INVALID_HANDLE_VALUE )
+        return;
+    PROCESSENTRY32 _pe = { sizeof( _pe ) };
+    for ( BOOL _ok = ::Process32First( _snap, &_pe ); _ok; _ok = ::Process32Next( _snap, &_pe ) )
+        _children.insert( std::make_pair( _pe.th32ParentProcessID, _pe.th32ProcessID ) );
+    ::CloseHandle( _snap );
+
+    std::vector<DWORD> _stack( roots.begin(), roots.end() );
+    while ( !_stack.empty() ) {
+        DWORD _pid = _stack.back();
+        _stack.pop_back();
+        auto _range = _children.equal_range( _pid );
+        for ( auto it = _range.first; it != _range.second; ++it ) {
+            if ( HANDLE _h = ::OpenProcess( SYNCHRONIZE, FALSE, it->second ) )
+                descendants.push_back( _h );
+            _stack.push_back( it->second );
+        }
+    }
+}
+
+/**
+ * @brief 3段のプロセスツリー（entry → 子 → 孫）を N 個起動し、一斉停止（Kill）した時の
+ *        停止時間と、停止後に残った子孫プロセスの数（0 であること）
+ */
+static void
+bench_tree( _In_ UINT n, _Inout_ std::vector<TBENCH_RESULT>& results ) {
+    CAtlString _args;
+    _args.Format( TEXT("tree %d"), SY_BENCH_TREE_DEPTH );
+    SYCONFIGS _configs = bench_configs( n, _args );
+    for ( auto& c : _configs )
+        c.m_stop_signal = SY_STOP_KILL;     // 停止要求を送らず、ツリーごと Kill する
+
+    CsylphProcessManager _proc;
+    _proc.SetSampleInterval( 0 );
+    HRESULT _hr = _proc.StartEntries( _configs );
+    if ( FAILED( _hr ) ) {
+        _SLOG( TEXT("[ERR] StartEntries failed. in %08x\n"), _hr );
+        _proc.PurgeProcesses();
+        return;
+    }
+
+    std::set<DWORD> _roots;
+    _proc.ForEach( [&]( CsyProcess* p ) { _roots.insert( p->IsProcessID() ); } );
+
+    // 全ての孫まで起動するまで
+    std::vector<HANDLE> _descendants;
+    ULONGLONG _deadline = ::GetTickCount64() + SY_BENCH_WAIT_MS;
+    for ( ;; ) {
+        bench_descendants( _roots, _descendants );
+        if ( _descendants.size() >= static_cast<size_t>( n ) * SY_BENCH_TREE_DEPTH || ::GetTickCount64() >= _deadline )
+            break;
+        for ( auto h : _descendants ) ::CloseHandle( h );
+        ::Sleep( SY_BENCH_POLL_MS );
+    }
+    if ( _descendants.size() < static_cast<size_t>( n ) * SY_BENCH_TREE_DEPTH )
+        _SLOG( TEXT("[WAR] tree : %d / %d descendants started.\n"), 
+                static_cast<int>( _descendants.size() ), n * SY_BENCH_TREE_DEPTH );
+
+    LONGLONG _begin = sy_perf_counter();
+    _proc.PurgeProcesses();
+    double   _ms    = sy_perf_ms( _begin );
+
+    UINT _survivors = 0;
+    for ( auto h : _descendants ) {
+        if ( ::WaitForSingleObject( h, 0 ) == WAIT_TIMEOUT ) {
+            _survivors++;
+            ::TerminateProcess( h, 1 );     // 後の項目に影響させない
+        }
+        ::CloseHandle( h );
+    }
+    if ( _survivors )
+        _SLOG( TEXT("[ERR] tree : %u descendants survived the stop.\n"), _survivors );
+
+    bench_add( results, "tree_stop",      n, "ms",    std::vector<double>( 1, _ms ) );
+    bench_add( results, "tree_survivors", n, "count", std::vector<double>( 1, static_cast<double>( _survivors ) ) );
+}
+
+/**
+ * @brief N 個の子プロセスが標準出力へ書いた量を、1つのログファイルへ取り込む速度
+ */
+static void
+bench_capture( _In_ UINT n, _In_ const CAtlString& work_dir, _Inout_ std::vector<TBENCH_RESULT>& results ) {
+    ULONGLONG  _per_child = ( std::max )( static_cast<ULONGLONG>( SY_BENCH_CAPTURE_TOTAL / n ),
+                                          static_cast<ULONGLONG>( SY_BENCH_CAPTURE_MIN ) );
+    ULONGLONG  _total     = _per_child * n;
+    CAtlString _log       = work_dir + TEXT("\\capture.log");
+    ::DeleteFile( _log );
+
+    CAtlString _args;
+    _args.Format( TEXT("write %I64u"), _per_child );
+    SYCONFIGS _configs = bench_configs( n, _args );
+    for ( auto& c : _configs )
+        c.m_stdout = _log;
+
+    CsylphProcessManager _proc;
+    _proc.SetSampleInterval( 0 );
+
+    LONGLONG _begin = sy_perf_counter();
+    HRESULT  _hr    = _proc.StartEntries( _configs );
+    if ( FAILED( _hr ) ) {
+        _SLOG( TEXT("[ERR] StartEntries failed. in %08x\n"), _hr );
+        _proc.PurgeProcesses();
+        return;
+    }
+
+    // ファイルに全て書き込まれるまで
+    ULONGLONG _deadline = ::GetTickCount64() + SY_BENCH_WAIT_MS;
+    ULONGLONG _size     = 0;
+    while ( ::GetTickCount64() < _deadline ) {
+        WIN32_FILE_ATTRIBUTE_DATA _attr;
+        if ( ::GetFileAttributesEx( _log, GetFileExInfoStandard, &_attr ) )
+            _size = ( static_cast<ULONGLONG>( _attr.nFileSizeHigh ) << 32 ) | _attr.nFileSizeLow;
+        if ( _size >= _total )
+            break;
+        ::Sleep( SY_BENCH_POLL_MS );
+    }
+    double _ms = sy_perf_ms( _begin );
+    _proc.PurgeProcesses();
+
+    if ( _size < _total ) {
+        _SLOG( TEXT("[WAR] capture : %I64u / %I64u bytes written.\n"), _size, _total );
+        return;
+    }
+    bench_add( results, "capture_throughput", n, "MB/s",
+               std::vector<double>( 1, ( _total / 1048576.0 ) / ( _ms / 1000.0 ) ) );
+}
+
+/** 以前の _TRACE_HEAD と同じ時刻ヘッダ */
+static CAtlString
+bench_legacy_head( void ) {
+    SYSTEMTIME _st;
+    ::ZeroMemory( &_st, sizeof( _st ) );
+    ::GetLocalTime( &_st );
+    CAtlString _s;
+    _s.Format( TEXT("[%04d-%02d-%02d %02d:%02d:%02d]: "),
+        _st.wYear, _st.wMonth, _st.wDay, _st.wHour, _st.wMinute, _st.wSecond );
+    return _s;
+}
+
+/**
+ * @brief 以前の同期マクロ ( _TRACE_FT_ ) と同じ処理。logger の比較用
+ *        （_vsctprintf で長さを求めて malloc、フォーマットして呼び出し側のスレッドで f へ出力）
+ * @param[in] f ... 出力 ( _SLOG.. _tprintf_s  _SDBG.. OutputDebugString )
+ */
+template <typename TFunc>
+static void
+bench_legacy_trace( _In_ TFunc f, _In_z_ _Printf_format_string_ LPCTSTR format, ... ) {
+    va_list _args;
+    va_start( _args, format );
+    const size_t _msg_len = ::_vsctprintf( format, _args ) + 1;
+    TCHAR*       _msg_p   = static_cast<TCHAR*>( ::malloc( _msg_len * sizeof( TCHAR ) ) );
+    if ( _msg_p ) {
+        ::ZeroMemory  ( _msg_p, _msg_len * sizeof( TCHAR ) );
+        ::_vstprintf_s( _msg_p, _msg_len, format, _args );
+        f( _msg_p );
+        ::free( _msg_p );
+    }
+    va_end( _args );
+}
+
+/**
+ * @brief logger の呼び出し1回あたりの時間（呼び出し側のみ）
+ *        比較用に、以前の同期マクロが呼び出し側のスレッドで出力する時間も計測します。
+ *          logger_baseline       ... _SLOG ( _TRACE_F_ : 標準出力へ _tprintf_s )
+ *          logger_baseline_debug ... _SDBG ( _TRACE_D_ : OutputDebugString )
+ */
+static void
+bench_logger( _Inout_ std::vector<TBENCH_RESULT>& results ) {
+    SY_LOGGER.Write( SY_LOG_DEBUG, TEXT("sylphbench logger warm up\n") );
+    ::Sleep( SY_LOG_FLUSH_MS * 2 );
+
+    size_t   _dropped = SY_LOGGER.IsDropped();
+    LONGLONG _begin   = sy_perf_counter();
+    for ( int i = 0; i < SY_BENCH_LOG_CALLS; i++ )
+        SY_LOGGER.Write( SY_LOG_DEBUG, TEXT("==> [PID:%d] sylphbench logger %d : %s\n"), 1234, i, TEXT("entry") );
+    double _ms = sy_perf_ms( _begin );
+
+    bench_add( results, "logger_call", SY_BENCH_LOG_CALLS, "ns",
+               std::vector<double>( 1, _ms * 1000000.0 / SY_BENCH_LOG_CALLS ) );
+    bench_add( results, "logger_dropped", SY_BENCH_LOG_CALLS, "count",
+               std::vector<double>( 1, static_cast<double>( SY_LOGGER.IsDropped() - _dropped ) ) );
+    ::Sleep( SY_LOG_FLUSH_MS * 2 );     // 出力スレッドが baseline と重ならないように
+
+    _begin = sy_perf_counter();
+    for ( int i = 0; i < SY_BENCH_LOG_CALLS; i++ )
+        bench_legacy_trace( []( LPTSTR msg ) { ::_tprintf_s( msg ); },
+                            TEXT("%s==> [PID:%d] sylphbench logger %d : %s\n"), bench_legacy_head().GetString(), 1234, i, TEXT("entry") );
+    _ms = sy_perf_ms( _begin );
+
+    bench_add( results, "logger_baseline", SY_BENCH_LOG_CALLS, "ns",
+               std::vector<double>( 1, _ms * 1000000.0 / SY_BENCH_LOG_CALLS ) );
+
+    _begin = sy_perf_counter();
+    for ( int i = 0; i < SY_BENCH_LOG_CALLS; i++ )
+        bench_legacy_trace( []( LPTSTR msg ) { ::OutputDebugString( msg ); },
+                            TEXT("%s==> [PID:%d] sylphbench logger %d : %s\n"), bench_legacy_head().GetString(), 1234, i, TEXT("entry") );
+    _ms = sy_perf_ms( _begin );
+
+    bench_add( results, "logger_baseline_debug", SY_BENCH_LOG_CALLS, "ns",
+               std::vector<double>( 1, _ms * 1000000.0 / SY_BENCH_LOG_CALLS ) );
+}
+
+/**
+ * @brief N entry の syconfig.xml の解析時間と、syconfig.bin からの読み込み時間
+ */
+static void
+bench_config( _In_ UINT n, _In_ const CAtlString& work_dir, _Inout_ std::vector<TBENCH_RESULT>& results ) {
+    std::string _xml = "<sylph><service><config><service_name>SylphBench</service_name></config><entry>\n";
+    for ( UINT i = 0; i < n; i++ ) {
+        char _line[ 256 ];
+        ::sprintf_s( _line, "<process><name>stub%u</name><command>stub.exe /child idle</command>"
+                            "<max_retry>3</max_retry><group>%u</group></process>\n", i, i % 4 );
+        _xml += _line;
+    }
+    _xml += "</entry></service></sylph>\n";
+
+    // 解析（短い場合は繰り返して平均）
+    UINT     _repeat = ( std::max )( 1u, 1000u / n );
+    LONGLONG _begin  = sy_perf_counter();
+    for ( UINT r = 0; r < _repeat; r++ ) {
+        CsyServiceConfig _config;
+        if ( FAILED( sy_config_parse( _xml.data(), _xml.size(), _config ) ) ) {
+            _SLOG( TEXT("[ERR] config parse failed.\n") );
+            return;
+        }
+    }
+    bench_add( results, "config_parse", n, "ms", std::vector<double>( 1, sy_perf_ms( _begin ) / _repeat ) );
+
+    // snapshot
+    CAtlString _xml_path = work_dir + TEXT("\\syconfig.xml");
+    CAtlString _bin_path = work_dir + TEXT("\\syconfig.bin");
+    HANDLE _file = ::CreateFile( _xml_path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+    if ( _file == INVALID_HANDLE_VALUE )
+        return;
+    DWORD _written = 0;
+    ::WriteFile( _file, _xml.data(), static_cast<DWORD>( _xml.size() ), &_written, NULL );
+    ::CloseHandle( _file );
+
+    CsyServiceConfig _compiled;
+    if ( FAILED( sy_snapshot_compile( _xml_path, _bin_path, _compiled ) ) )
+        return;
+
+    _begin = sy_perf_counter();
+    for ( UINT r = 0; r < _repeat; r++ ) {
+        CsyServiceConfig _config;
+        if ( sy_snapshot_load( _xml_path, _bin_path, _config ) != S_OK ) {
+            _SLOG( TEXT("[ERR] snapshot load failed.\n") );
+            return;
+        }
+    }
+    bench_add( results, "config_snapshot_load", n, "ms", std::vector<double>( 1, sy_perf_ms( _begin ) / _repeat ) );
+}
+
+/** 昇順のサンプルの百分位 (nearest rank) */
+static double
+bench_percentile( _In_ const std::vector<double>& sorted, _In_ double p ) {
+    if ( sorted.empty() )
+        return 0.0;
+    size_t _rank = static_cast<size_t>( std::ceil( p * sorted.size() ) );
+    return sorted[ _rank ? _rank - 1 : 0 ];
+}
+
+/**
+ * @brief 結果を JSON で書き込み、概要を表示します。
+ */
+static HRESULT
+bench_write( _In_ const std::vector<TBENCH_RESULT>& results, _In_ const CAtlString& out ) {
+    SYSTEM_INFO _si;
+    ::GetSystemInfo( &_si );
+    SYSTEMTIME _st;
+    ::GetSystemTime( &_st );
+
+    CStringA _json;
+    _json.AppendFormat( "{\n  \"benchmark\": \"sylph\",\n  \"schema\": 1,\n"
+                        "  \"timestamp\": \"%04d-%02d-%02dT%02d:%02d:%02dZ\",\n  \"cpus\": %u,\n  \"results\": [\n",
+                        _st.wYear, _st.wMonth, _st.wDay, _st.wHour, _st.wMinute, _st.wSecond, _si.dwNumberOfProcessors );
+
+    _tprintf_s( TEXT("\n%-24s %6s %6s %12s %12s %12s %12s\n"),
+                TEXT("BENCHMARK"), TEXT("N"), TEXT("UNIT"), TEXT("P50"), TEXT("P99"), TEXT("MAX"), TEXT("MEAN") );
+    for ( size_t i = 0; i < results.size(); i++ ) {
+        const TBENCH_RESULT& _r = results[ i ];
+        std::vector<double> _sorted( _r.samples );
+        std::sort( _sorted.begin(), _sorted.end() );
+
+        double _mean = 0.0;
+        for ( auto v : _sorted ) _mean += v;
+        if ( !_sorted.empty() ) _mean /= _sorted.size();
+
+        double _min = _sorted.empty() ? 0.0 : _sorted.front();
+        double _max = _sorted.empty() ? 0.0 : _sorted.back();
+        double _p50 = bench_percentile( _sorted, 0.50 );
+        double _p99 = bench_percentile( _sorted, 0.99 );
+
+        _json.AppendFormat( "    { \"name\": \"%s\", \"n\": %u, \"unit\": \"%s\", \"count\": %u, "
+                            "\"min\": %.4f, \"p50\": %.4f, \"p99\": %.4f, \"max\": %.4f, \"mean\": %.4f }%s\n",
+                            _r.name.GetString(), _r.n, _r.unit.GetString(), static_cast<UINT>( _sorted.size() ),
+                            _min, _p50, _p99, _max, _mean, i + 1 < results.size() ? "," : "" );
+        _tprintf_s( TEXT("%-24S %6u %6S %12.3f %12.3f %12.3f %12.3f\n"),
+                    _r.name.GetString(), _r.n, _r.unit.GetString(), _p50, _p99, _max, _mean );
+    }
+    _json += "  ]\n}\n";
+
+    HANDLE _file = ::CreateFile( out, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+    if ( _file == INVALID_HANDLE_VALUE )
+        return HRESULT_FROM_WIN32( ::GetLastError() );
+    DWORD _written = 0;
+    BOOL  _ok      = ::WriteFile( _file, _json.GetString(), _json.GetLength(), &_written, NULL );
+    ::CloseHandle( _file );
+    if ( !_ok )
+        return HRESULT_FROM_WIN32( ::GetLastError() );
+
+    _tprintf_s( TEXT("\n* results : %s\n"), out.GetString() );
+    return S_OK;
+}
+
+/**
+ * @brief 全ての項目を N 毎に実行します。
+ *        作業ファイル（capture のログ, config）は %TEMP%\sylphbench-<pid> に置きます。
+ */
+int run_bench( _In_ const std::vector<UINT>& counts, _In_ const CAtlString& out ) {
+
+    TCHAR _temp[ MAX_PATH ] = { 0 };
+    ::GetTempPath( _countof( _temp ), _temp );
+    CAtlString _work_dir;
+    _work_dir.Format( TEXT("%ssylphbench-%u"), _temp, ::GetCurrentProcessId() );
+    ::CreateDirectory( _work_dir, NULL );
+
+    // Event はイベントログへ出さない
+    SY_EVENTS.SetBackend( new CsyEventFileBackend( _work_dir + TEXT("\\events.log") ) );
+
+    std::vector<TBENCH_RESULT> _results;
+    for ( auto n : counts ) {
+        _SLOG( TEXT("* N = %u\n"), n );
+        bench_spawn_stop   ( n, _results );
+        bench_fleet_startup( n, _results );
+        bench_restart      ( n, _results );
+        bench_tree         ( n, _results );
+        bench_capture      ( n, _work_dir, _results );
+    }
+
+    bench_logger( _results );
+    for ( UINT n = 1; n <= SY_BENCH_PARSE_ENTRIES; n *= 10 )
+        bench_config( n, _work_dir, _results );
+
+    HRESULT _hr = bench_write( _results, out );
+    if ( FAILED( _hr ) ) {
+        _SLOG( TEXT("[ERR] write results failed. in %08x [%s]\n"), _hr, out.GetString() );
+        return _hr;
+    }
+    return 0;
+}
@@ -0,0 +1,974 @@
+﻿/**
+ * @file     SylphTestMain.cpp
+ * @brief    Unit / integration tests
+ * @author   M.Horigome
+ * @version  1.0.0.0000
+ * @date     2026-10-17
+ *
+ * https://github.com/horigome/sylph
+ */
+#include "stdafx.h"
+#include "SylphProcessManager.h"
+#include "SylphConfigSnapshot.h"
+#include "SylphJournal.h"
+
+// Globals
+CsyAsyncLogger  SY_LOGGER;
+CsyTracer       SY_TRACE;
+CAtlString      SERVICE_NAME    = TEXT("SylphTest");
+CsyEventSink    SY_EVENTS;
+
+/** Test 定数 */
+enum {
+    SY_TEST_WAIT_MS         = 60000,    ///< 起動/終了を待つ上限(ms)
+    SY_TEST_POLL_MS         = 10,       ///< 状態の確認間隔(ms)
+    SY_TEST_COUNT           = 1000,     ///< 負荷テストの件数 (Default)
+    SY_TEST_STOP_TIMEOUT_MS = 3000,     ///< stop の stop_timeout(ms)
+    SY_TEST_TREE_DEPTH      = 2,        ///< tree の子孫の段数（entry 本体を含めて3段）
+    SY_TEST_LISTEN_MS       = 3000,     ///< listen で接続し続ける時間(ms)
+    SY_TEST_KILL_INTERVAL   = 300,      ///< listen で子プロセスを Kill する間隔(ms)
+};
+
+/**
+ * @brief 検査の結果を数えます。失敗はその場でログに出します。
+ */
+class CsyTestResult {
+    UINT    m_checks;
+    UINT    m_failures;
+public:
+    CsyTestResult( void ) : m_checks( 0 ), m_failures( 0 ) { }
+
+    UINT IsChecks  ( void ) const { return m_checks; }
+    UINT IsFailures( void ) const { return m_failures; }
+
+    void Check( _In_ BOOL ok, _In_z_ LPCSTR expr, _In_z_ LPCSTR file, _In_ int line ) {
+        m_checks++;
+        if ( ok )
+            return;
+        m_failures++;
+        _SLOG( TEXT("[ERR] %hs(%d) : %hs\n"), file, line, expr );
+    }
+};
+
+#define SY_CHECK( r, expr ) ( r ).Check( ( expr ) ? TRUE : FALSE, #expr, __FILE__, __LINE__ )
+
+/** テスト1件 */
+struct TTEST {
+    LPCTSTR     name;
+    void      ( *func )( CsyTestResult& r, UINT n );
+};
+
+// Prototype ---
+int     run_child   ( int argc, _TCHAR* argv[] );
+int     run_tests   ( const std::set<CAtlString>& names, UINT n );
+
+/**
+ * @brief main function
+ *
+ * options:
+ * ----------------------------------------------------------------------
+ *   /t backoff,notify ... 実行するテスト (Default: 全て)
+ *   /n 1000           ... 負荷テストの件数 (stop の子プロセス数) (Default: 1000)
+ *   /child <mode>     ... stub child (idle | stubborn | tree <depth> | serve)
+ *
+ * 戻り値は失敗した検査の数です。（0.. 全て成功）
+ */
+extern "C"
+int _tmain( _In_ int        argc,
+            _In_ _TCHAR*    argv[] ) {
+
+    int _ctrl = sy_console_ctrl_main( argc, argv );     // 停止要求の補助プロセス ( /ctrl )
+    if ( _ctrl >= 0 )
+        return _ctrl;
+
+    if ( argc >= 2 && ::_tcscmp( TEXT("/child"), argv[1] ) == 0 )
+        return run_child( argc - 2, argv + 2 );
+
+    std::set<CAtlString> _names;
+    UINT                 _n = SY_TEST_COUNT;
+    for ( int i = 1; i + 1 < argc; i += 2 ) {
+        if ( ::_tcscmp( TEXT("/t"), argv[i] ) == 0 ) {
+            CAtlString _list( argv[i + 1] );
+            int _pos = 0;
+            for ( CAtlString _tok = _list.Tokenize( TEXT(","), _pos ); _pos >= 0; _tok = _list.Tokenize( TEXT(","), _pos ) )
+                _names.insert( _tok );
+        }
+        else if ( ::_tcscmp( TEXT("/n"), argv[i] ) == 0 ) {
+            if ( ::_ttoi( argv[i + 1] ) > 0 ) _n = static_cast<UINT>( ::_ttoi( argv[i + 1] ) );
+        }
+    }
+    return run_tests( _names, _n );
+}
+
+//
+// stub child
+//
+
+/**
+ * @brief stub child.
+ *
+ *   idle          ... 停止要求（Ctrl+C / Kill）を待つ
+ *   stubborn      ... Ctrl+C / Ctrl+Break を無視して待つ（Kill まで終了しない）
+ *   tree <depth>  ... "tree <depth - 1>" の子を起動してから待つ（0.. 起動しない）
+ *   serve         ... LISTEN_SOCKETS の最初のソケットで accept して、すぐに閉じ続ける
+ */
+int run_child( _In_ int argc, _In_ _TCHAR* argv[] ) {
+
+    if ( argc >= 1 && ::_tcscmp( TEXT("stubborn"), argv[0] ) == 0 ) {
+        ::SetConsoleCtrlHandler( sy_ignore_console_ctrl, TRUE );
+        ::Sleep( INFINITE );
+        return 0;
+    }
+
+    if ( argc >= 2 && ::_tcscmp( TEXT("tree"), argv[0] ) == 0 ) {
+        int _depth = ::_ttoi( argv[1] );
+        if ( _depth > 0 ) {
+            TCHAR _self[ MAX_PATH ] = { 0 };
+            ::GetModuleFileName( NULL, _self, _countof( _self ) );
+
+            CAtlString _command;
+            _command.Format( TEXT("\"%s\" /child tree %d"), _self, _depth - 1 );
+            PROCESS_INFORMATION _pi;
+            if ( SUCCEEDED( sy_create_process( _command, _pi ) ) ) {
+                ::CloseHandle( _pi.hThread );
+                ::CloseHandle( _pi.hProcess );
+            }
+        }
+        ::Sleep( INFINITE );
+        return 0;
+    }
+
+    if ( argc >= 1 && ::_tcscmp( TEXT("serve"), argv[0] ) == 0 ) {
+        TCHAR _sockets[ 256 ] = { 0 };
+        if ( !::GetEnvironmentVariable( TEXT("LISTEN_SOCKETS"), _sockets, _countof( _sockets ) ) )
+            return 1;
+
+        WSADATA _wsa;
+        if ( ::WSAStartup( MAKEWORD( 2, 2 ), &_wsa ) != 0 )
+            return 1;
+        SOCKET _listen = static_cast<SOCKET>( ::_ttoi64( _sockets ) );
+        for ( ;; ) {
+            SOCKET _s = ::accept( _listen, NULL, NULL );
+            if ( _s == INVALID_SOCKET )
+                return 1;
+            ::closesocket( _s );
+        }
+    }
+
+    ::Sleep( INFINITE );
+    return 0;
+}
+
+//
+// helper
+//
+
+/**
+ * @brief stub child の entry を作ります。
+ * @param[in] name ... entry名
+ * @param[in] args ... stub child の引数
+ */
+static CsyProcConfig
+test_config( _In_ const CAtlString& name, _In_ const CAtlString& args ) {
+    TCHAR _self[ MAX_PATH ] = { 0 };
+    ::GetModuleFileName( NULL, _self, _countof( _self ) );
+
+    CAtlString _command;
+    _command.Format( TEXT("\"%s\" /child %s"), _self, args.GetString() );
+
+    CsyProcConfig _c( _command, 0 );
+    _c.m_name = name;
+    _c.Normalize();
+    return _c;
+}
+
+/**
+ * @brief 管理中のプロセスを開きます。（終了の確認用。呼び出し側で閉じること）
+ */
+static std::vector<HANDLE>
+test_open_processes( _In_ CsylphProcessManager& proc ) {
+    std::vector<HANDLE> _handles;
+    proc.ForEach( [&]( CsyProcess* p ) {
+        if ( HANDLE _h = ::OpenProcess( SYNCHRONIZE | PROCESS_TERMINATE, FALSE, p->IsProcessID() ) )
+            _handles.push_back( _h );
+    } );
+    return _handles;
+}
+
+/**
+ * @brief roots の子孫プロセス（孫以降を含む）を開きます。
+ */
+static void
+test_descendants( _In_ const std::set<DWORD>& roots, _Out_ std::vector<HANDLE>& descendants ) {
+    descendants.clear();
+
+    std::multimap<DWORD, DWORD> _children;     // parent -> child
+    HANDLE _snap = ::CreateToolhelp32Snapshot( TH32CS_SNAPPROCESS, 0 );
+    if ( _snap == INVALID_HANDLE_VALUE )
+        return;
+    PROCESSENTRY32 _pe = { sizeof( _pe ) };
+    for ( BOOL _ok = ::Process32First( _snap, &_pe ); _ok; _ok = ::Process32Next( _snap, &_pe ) )
+        _children.insert( std::make_pair( _pe.th32ParentProcessID, _pe.th32ProcessID ) );
+    ::CloseHandle( _snap );
+
+    std::vector<DWORD> _stack( roots.begin(), roots.end() );
+    while ( !_stack.empty() ) {
+        DWORD _pid = _stack.back();
+        _stack.pop_back();
+        auto _range = _children.equal_range( _pid );
+        for ( auto it = _range.first; it != _range.second; ++it ) {
+            if ( HANDLE _h = ::OpenProcess( SYNCHRONIZE | PROCESS_TERMINATE, FALSE, it->second ) )
+                descendants.push_back( _h );
+            _stack.push_back( it->second );
+        }
+    }
+}
+
+/**
+ * @brief roots の子孫プロセスが expected 個になるまで（最大 SY_TEST_WAIT_MS）待ってから開きます。
+ */
+static void
+test_wait_descendants( _In_ const std::set<DWORD>& roots, _In_ size_t expected, _Out_ std::vector<HANDLE>& descendants ) {
+    ULONGLONG _deadline = ::GetTickCount64() + SY_TEST_WAIT_MS;
+    for ( ;; ) {
+        test_descendants( roots, descendants );
+        if ( descendants.size() >= expected || ::GetTickCount64() >= _deadline )
+            return;
+        for ( auto h : descendants ) ::CloseHandle( h );
+        ::Sleep( SY_TEST_POLL_MS );
+    }
+}
+
+/**
+ * @brief handles のうち、timeout_ms 待っても終了しなかった数を返します。（残ったものは Kill して閉じます）
+ */
+static UINT
+test_survivors( _In_ const std::vector<HANDLE>& handles, _In_ DWORD timeout_ms ) {
+    ULONGLONG _deadline  = ::GetTickCount64() + timeout_ms;
+    UINT      _survivors = 0;
+    for ( auto h : handles ) {
+        ULONGLONG _now = ::GetTickCount64();
+        DWORD     _wait = _now < _deadline ? static_cast<DWORD>( _deadline - _now ) : 0;
+        if ( ::WaitForSingleObject( h, _wait ) == WAIT_TIMEOUT ) {
+            _survivors++;
+            ::TerminateProcess( h, 1 );     // 後のテストに影響させない
+        }
+        ::CloseHandle( h );
+    }
+    return _survivors;
+}
+
+/**
+ * @brief 出力を記録する Event 出力先
+ */
+class CsyTestEventBackend : public IsyEventBackend {
+    std::vector< std::pair<WORD, CAtlString> >&  m_records;
+public:
+    explicit CsyTestEventBackend( _Out_ std::vector< std::pair<WORD, CAtlString> >& records ) : m_records( records ) { }
+
+    virtual void Report( _In_ WORD type, _In_z_ LPCTSTR text ) override {
+        m_records.push_back( std::make_pair( type, CAtlString( text ) ) );
+    }
+private:
+    CsyTestEventBackend& operator=( const CsyTestEventBackend& );
+};
+
+//
+// unit tests
+//
+
+/**
+ * @brief 再起動の待ち時間 (sy_backoff_delay)
+ *        retry_delay * 2^retry を retry_delay_max で止め、後半50%をジッタにします。
+ */
+static void
+test_backoff( _Inout_ CsyTestResult& r, _In_ UINT /*n*/ ) {
+    // 初回 : [500, 1000]
+    SY_CHECK( r, sy_backoff_delay( 1000, 60000, 0, 0 )   == 500 );
+    SY_CHECK( r, sy_backoff_delay( 1000, 60000, 0, 500 ) == 1000 );
+    SY_CHECK( r, sy_backoff_delay( 1000, 60000, 0, 501 ) == 500 );
+
+    // 倍々 : retry 3 -> 8000
+    SY_CHECK( r, sy_backoff_delay( 1000, 60000, 3, 0 )    == 4000 );
+    SY_CHECK( r, sy_backoff_delay( 1000, 60000, 3, 4000 ) == 8000 );
+
+    // 上限 : retry 20 -> 60000
+    SY_CHECK( r, sy_backoff_delay( 1000, 60000, 20, 0 )     == 30000 );
+    SY_CHECK( r, sy_backoff_delay( 1000, 60000, 20, 30000 ) == 60000 );
+    SY_CHECK( r, sy_backoff_delay( 1000, 0xFFFFFFFF, 1000, 0 ) <= 0xFFFFFFFFULL );
+
+    // 0 / 1 ms は待たない（ジッタも無し）
+    SY_CHECK( r, sy_backoff_delay( 0, 0, 5, 12345 ) == 0 );
+    SY_CHECK( r, sy_backoff_delay( 1, 1, 0, 12345 ) == 0 );
+
+    // max < delay の場合は max
+    SY_CHECK( r, sy_backoff_delay( 5000, 2000, 0, 1000 ) == 2000 );
+
+    // ジッタは範囲内で散らばる
+    std::minstd_rand _random( 1 );
+    std::set<ULONGLONG> _values;
+    BOOL _in_range = TRUE;
+    for ( int i = 0; i < 1000; i++ ) {
+        ULONGLONG _d = sy_backoff_delay( 1000, 60000, 2, static_cast<UINT>( _random() ) );
+        _in_range = _in_range && _d >= 2000 && _d <= 4000;
+        _values.insert( _d );
+    }
+    SY_CHECK( r, _in_range );
+    SY_CHECK( r, _values.size() > 100 );
+}
+
+/**
+ * @brief 通知メッセージの分解 (sy_notify_parse)
+ */
+static void
+test_notify_parse( _Inout_ CsyTestResult& r, _In_ UINT /*n*/ ) {
+    std::vector< std::pair<CAtlString, CAtlString> > _f;
+
+    sy_notify_parse( "READY=1\nSTATUS=listening on 8080", _f );
+    SY_CHECK( r, _f.size() == 2 );
+    SY_CHECK( r, _f.size() == 2 && _f[ 0 ].first == TEXT("READY")  && _f[ 0 ].second == TEXT("1") );
+    SY_CHECK( r, _f.size() == 2 && _f[ 1 ].first == TEXT("STATUS") && _f[ 1 ].second == TEXT("listening on 8080") );
+
+    // 空行 / '=' の無い行 / 名前の無い行は無視。値の '=' はそのまま
+    sy_notify_parse( "\nWATCHDOG=1\n\ngarbage\n=x\nA=b=c\n", _f );
+    SY_CHECK( r, _f.size() == 2 );
+    SY_CHECK( r, _f.size() == 2 && _f[ 0 ].first == TEXT("WATCHDOG") && _f[ 0 ].second == TEXT("1") );
+    SY_CHECK( r, _f.size() == 2 && _f[ 1 ].first == TEXT("A")        && _f[ 1 ].second == TEXT("b=c") );
+
+    // 空の値
+    sy_notify_parse( "STATUS=", _f );
+    SY_CHECK( r, _f.size() == 1 && _f[ 0 ].first == TEXT("STATUS") && _f[ 0 ].second.IsEmpty() );
+
+    // UTF-8 (起動)
+    sy_notify_parse( "STATUS=\xE8\xB5\xB7\xE5\x8B\x95", _f );
+    SY_CHECK( r, _f.size() == 1 && _f[ 0 ].second == CAtlString( L"\x8D77\x52D5" ) );
+
+    // 空のメッセージ / 前の結果は消える
+    sy_notify_parse( "", _f );
+    SY_CHECK( r, _f.empty() );
+}
+
+/** config / snapshot のテストに使う設定 */
+static const char SY_TEST_XML[] =
+    "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+    "<sylph>\n"
+    "  <service>\n"
+    "    <config>\n"
+    "      <service_name> TestService </service_name>\n"
+    "      <start_type>2</start_type>\n"
+    "      <sample_interval>500</sample_interval>\n"
+    "      <journal>journal.bin</journal>\n"
+    "    </config>\n"
+    "    <entry>\n"
+    "      <process>\n"
+    "        <command>db.exe --port 5432</command>\n"
+    "        <name>db</name>\n"
+    "        <stop_signal>ctrl_break</stop_signal>\n"
+    "        <stop_timeout>7000</stop_timeout>\n"
+    "        <max_retry>3</max_retry>\n"
+    "        <retry_delay>250</retry_delay>\n"
+    "        <notify>true</notify>\n"
+    "        <watchdog>10000</watchdog>\n"
+    "        <cpu_set>0-1,3</cpu_set>\n"
+    "      </process>\n"
+    "      <process>\n"
+    "        <command>web.exe</command>\n"
+    "        <name>web</name>\n"
+    "        <depends_on>db</depends_on>\n"
+    "        <group>1</group>\n"
+    "        <instances min=\"2\" max=\"4\" scale_up=\"80\" scale_down=\"20\" cooldown=\"30\"/>\n"
+    "        <rolling surge=\"2\" unavailable=\"1\" ready_wait=\"500\" ready_timeout=\"9000\"/>\n"
+    "        <recycle memory=\"512\" memory_for=\"90\" uptime=\"24\" parallel=\"2\"/>\n"
+    "        <listen>127.0.0.1:8080, :8081</listen>\n"
+    "        <stdout>web.log</stdout>\n"
+    "      </process>\n"
+    "      <process>\n"
+    "        <command>worker.exe</command>\n"
+    "      </process>\n"
+    "      <process>\n"
+    "        <command>worker.exe</command>\n"
+    "      </process>\n"
+    "    </entry>\n"
+    "  </service>\n"
+    "</sylph>\n";
+
+/**
+ * @brief syconfig.xml の読み込み (sy_config_parse)
+ */
+static void
+test_config_parse( _Inout_ CsyTestResult& r, _In_ UINT /*n*/ ) {
+    CsyServiceConfig _config;
+    HRESULT _hr = sy_config_parse( SY_TEST_XML, sizeof( SY_TEST_XML ) - 1, _config );
+    SY_CHECK( r, SUCCEEDED( _hr ) );
+    SY_CHECK( r, _config.m_service_name    == TEXT("TestService") );
+    SY_CHECK( r, _config.m_start_type      == SERVICE_AUTO_START );
+    SY_CHECK( r, _config.m_sample_interval == 500 );
+    SY_CHECK( r, _config.m_journal         == TEXT("journal.bin") );
+    SY_CHECK( r, _config.m_processes.size() == 4 );
+    if ( _config.m_processes.size() != 4 )
+        return;
+
+    const CsyProcConfig& _db = _config.m_processes[ 0 ];
+    SY_CHECK( r, _db.m_commandline  == TEXT("db.exe --port 5432") );
+    SY_CHECK( r, _db.m_name         == TEXT("db") );
+    SY_CHECK( r, _db.m_stop_signal  == SY_STOP_CTRL_BREAK );
+    SY_CHECK( r, _db.m_stop_timeout == 7000 );
+    SY_CHECK( r, _db.m_max_retry    == 3 );
+    SY_CHECK( r, _db.m_retry_delay  == 250 );
+    SY_CHECK( r, _db.m_notify       == TRUE );
+    SY_CHECK( r, _db.m_watchdog     == 10000 );
+    SY_CHECK( r, _db.m_cpu_set      == 0xB );
+    SY_CHECK( r, !_db.m_cpu_auto );
+
+    const CsyProcConfig& _web = _config.m_processes[ 1 ];
+    SY_CHECK( r, _web.m_depends_on.size() == 1 && _web.m_depends_on[ 0 ] == TEXT("db") );
+    SY_CHECK( r, _web.m_group              == 1 );
+    SY_CHECK( r, _web.m_instances_min      == 2 );
+    SY_CHECK( r, _web.m_instances_max      == 4 );
+    SY_CHECK( r, _web.m_scale_up           == 80 );
+    SY_CHECK( r, _web.m_scale_down         == 20 );
+    SY_CHECK( r, _web.m_scale_cooldown     == 30 );
+    SY_CHECK( r, _web.m_surge              == 2 );
+    SY_CHECK( r, _web.m_unavailable        == 1 );
+    SY_CHECK( r, _web.m_ready_wait         == 500 );
+    SY_CHECK( r, _web.m_ready_timeout      == 9000 );
+    SY_CHECK( r, _web.m_recycle_memory     == 512 );
+    SY_CHECK( r, _web.m_recycle_memory_for == 90 );
+    SY_CHECK( r, _web.m_recycle_uptime     == 24 );
+    SY_CHECK( r, _web.m_recycle_parallel   == 2 );
+    SY_CHECK( r, _web.m_listen.size() == 2 && _web.m_listen[ 0 ] == TEXT("127.0.0.1:8080") && _web.m_listen[ 1 ] == TEXT(":8081") );
+    SY_CHECK( r, _web.m_stdout == TEXT("web.log") );
+
+    // 名前の無い entry はコマンドライン（重複は #n）
+    SY_CHECK( r, _config.m_processes[ 2 ].m_name == TEXT("worker.exe") );
+    SY_CHECK( r, _config.m_processes[ 3 ].m_name == TEXT("worker.exe#2") );
+
+    // 不明な start_type は DEMAND_START
+    static const char _UNKNOWN[] = "<sylph><service><config><start_type>9</start_type></config></service></sylph>";
+    SY_CHECK( r, SUCCEEDED( sy_config_parse( _UNKNOWN, sizeof( _UNKNOWN ) - 1, _config ) ) );
+    SY_CHECK( r, _config.m_start_type   == SERVICE_DEMAND_START );
+    SY_CHECK( r, _config.m_service_name == TEXT("SylphService") );
+    SY_CHECK( r, _config.m_processes.empty() );
+
+    // 壊れた XML
+    static const char _BROKEN[] = "<sylph><service><entry><process><command>a.exe</command></entry></sylph>";
+    SY_CHECK( r, FAILED( sy_config_parse( _BROKEN, sizeof( _BROKEN ) - 1, _config ) ) );
+}
+
+/**
+ * @brief snapshot の書き込み → 読み込みで設定が変わらないこと
+ */
+static void
+test_snapshot_roundtrip( _Inout_ CsyTestResult& r, _In_ UINT /*n*/ ) {
+    CsyServiceConfig _config;
+    SY_CHECK( r, SUCCEEDED( sy_config_parse( SY_TEST_XML, sizeof( SY_TEST_XML ) - 1, _config ) ) );
+
+    CsySnapshotWriter _writer;
+    sy_serialize( _writer, _config );
+    const std::vector<BYTE>& _body = _writer.IsBody();
+    SY_CHECK( r, !_body.empty() );
+
+    CsyServiceConfig  _loaded;
+    CsySnapshotReader _reader( _body.data(), _body.size() );
+    sy_serialize( _reader, _loaded );
+    SY_CHECK( r, _reader.IsValid() );
+    SY_CHECK( r, _loaded.m_service_name    == _config.m_service_name );
+    SY_CHECK( r, _loaded.m_start_type      == _config.m_start_type );
+    SY_CHECK( r, _loaded.m_event_log       == _config.m_event_log );
+    SY_CHECK( r, _loaded.m_sample_interval == _config.m_sample_interval );
+    SY_CHECK( r, _loaded.m_trace           == _config.m_trace );
+    SY_CHECK( r, _loaded.m_journal         == _config.m_journal );
+    SY_CHECK( r, _loaded.m_processes.size() == _config.m_processes.size() );
+    for ( size_t i = 0; i < _loaded.m_processes.size() && i < _config.m_processes.size(); i++ )
+        SY_CHECK( r, _loaded.m_processes[ i ] == _config.m_processes[ i ] );
+
+    // 同じ設定は同じバイト列
+    CsySnapshotWriter _again;
+    sy_serialize( _again, _loaded );
+    SY_CHECK( r, _again.IsBody() == _body );
+
+    // 途中で切れた / 余りのある snapshot は無効
+    for ( size_t _size : { _body.size() / 2, _body.size() - 1 } ) {
+        CsyServiceConfig  _broken;
+        CsySnapshotReader _short( _body.data(), _size );
+        sy_serialize( _short, _broken );
+        SY_CHECK( r, !_short.IsValid() );
+    }
+    std::vector<BYTE> _extra( _body );
+    _extra.push_back( 0 );
+    CsyServiceConfig  _broken;
+    CsySnapshotReader _long( _extra.data(), _extra.size() );
+    sy_serialize( _long, _broken );
+    SY_CHECK( r, !_long.IsValid() );
+}
+
+/**
+ * @brief 同じ (種別, format, entry名) の Event を、PID など文面が違ってもまとめること (CsyEventSink)
+ */
+static void
+test_event_coalesce( _Inout_ CsyTestResult& r, _In_ UINT /*n*/ ) {
+    LPCTSTR _adopted = TEXT("Adopted. [PID:%d] %s");
+    LPCTSTR _killed  = TEXT("Stop timeout. force killed PID :%d");
+
+    std::vector< std::pair<WORD, CAtlString> > _records;
+    {
+        CsyEventSink _sink;
+        _sink.SetBackend( new CsyTestEventBackend( _records ) );
+        _sink.SetSourceName( TEXT("SylphTestRenamed") );    // 差し替えた出力先はそのまま
+        for ( int i = 0; i < 5; i++ )
+            _sink.ReportEntry( EVENTLOG_WARNING_TYPE, TEXT("web"), _adopted, 100 + i, TEXT("web") );
+        _sink.ReportEntry( EVENTLOG_ERROR_TYPE,   TEXT("web"), _adopted, 200, TEXT("web") );    // 種別が違う
+        _sink.ReportEntry( EVENTLOG_WARNING_TYPE, TEXT("db"),  _adopted, 300, TEXT("db") );     // entry が違う
+        for ( int i = 0; i < 3; i++ )
+            _sink.Report( EVENTLOG_WARNING_TYPE, _killed, 400 + i );                             // entry 無し
+        _sink.Shutdown();       // まとめ中の件数を出力する
+    }
+
+    auto _count = [&]( WORD type, LPCTSTR text ) {
+        return std::count_if( _records.begin(), _records.end(), [&]( const std::pair<WORD, CAtlString>& e ) {
+            return e.first == type && e.second == text;
+        } );
+    };
+    SY_CHECK( r, _records.size() == 6 );
+    SY_CHECK( r, _count( EVENTLOG_WARNING_TYPE, TEXT("Adopted. [PID:100] web") ) == 1 );
+    SY_CHECK( r, _count( EVENTLOG_ERROR_TYPE,   TEXT("Adopted. [PID:200] web") ) == 1 );
+    SY_CHECK( r, _count( EVENTLOG_WARNING_TYPE, TEXT("Adopted. [PID:300] db") )  == 1 );
+    SY_CHECK( r, _count( EVENTLOG_WARNING_TYPE, TEXT("Adopted. [PID:100] web (repeated 4 times in 0s)") ) == 1 );
+    SY_CHECK( r, _count( EVENTLOG_WARNING_TYPE, TEXT("Stop timeout. force killed PID :400") ) == 1 );
+    SY_CHECK( r, _count( EVENTLOG_WARNING_TYPE, TEXT("Stop timeout. force killed PID :400 (repeated 2 times in 0s)") ) == 1 );
+    SY_CHECK( r, !_records.empty() && _records[ 0 ].second == TEXT("Adopted. [PID:100] web") );
+}
+
+/**
+ * @brief 設定の反映 (reload) の差分を entry名毎に数えること (sy_reload_diff)
+ */
+static void
+test_reload_diff( _Inout_ CsyTestResult& r, _In_ UINT /*n*/ ) {
+    SYCONFIGS _configs;
+    for ( LPCTSTR name : { TEXT("same"), TEXT("changed"), TEXT("new1"), TEXT("new2") } )
+        _configs.push_back( test_config( name, TEXT("idle") ) );
+
+    // 反映前 : same / changed / gone（replica の数は数えない）
+    std::set<CAtlString> _current, _kept;
+    _current.insert( TEXT("same") );
+    _current.insert( TEXT("changed") );
+    _current.insert( TEXT("gone") );
+    _kept.insert( TEXT("same") );
+
+    TSY_RELOAD_DIFF _diff = sy_reload_diff( _configs, _current, _kept );
+    SY_CHECK( r, _diff.added     == 2 );
+    SY_CHECK( r, _diff.modified  == 1 );
+    SY_CHECK( r, _diff.removed   == 1 );
+    SY_CHECK( r, _diff.unchanged == 1 );
+
+    // 全て変更 / 全て削除 / 全て追加
+    std::set<CAtlString> _none;
+    std::set<CAtlString> _all;
+    for ( auto& c : _configs ) _all.insert( c.m_name );
+    _diff = sy_reload_diff( _configs, _all, _none );
+    SY_CHECK( r, _diff.added == 0 && _diff.modified == 4 && _diff.removed == 0 && _diff.unchanged == 0 );
+    _diff = sy_reload_diff( SYCONFIGS(), _all, _none );
+    SY_CHECK( r, _diff.added == 0 && _diff.modified == 0 && _diff.removed == 4 && _diff.unchanged == 0 );
+    _diff = sy_reload_diff( _configs, _none, _none );
+    SY_CHECK( r, _diff.added == 4 && _diff.modified == 0 && _diff.removed == 0 && _diff.unchanged == 0 );
+}
+
+/**
+ * @brief depends_on から起動段を求め、循環 / 未定義のentry / 後のgroupへの依存を拒否すること
+ *        (sy_resolve_start_levels)
+ */
+static void
+test_start_levels( _Inout_ CsyTestResult& r, _In_ UINT /*n*/ ) {
+    std::vector<UINT> _levels;
+
+    // a <- b <- c (a にも依存)、d は次の group で c に依存、e は依存無し
+    SYCONFIGS _dag;
+    _dag.push_back( test_config( TEXT("c"), TEXT("idle") ) );
+    _dag.push_back( test_config( TEXT("b"), TEXT("idle") ) );
+    _dag.push_back( test_config( TEXT("a"), TEXT("idle") ) );
+    _dag.push_back( test_config( TEXT("d"), TEXT("idle") ) );
+    _dag.push_back( test_config( TEXT("e"), TEXT("idle") ) );
+    _dag[ 0 ].SetDependsOn( TEXT("a, b") );
+    _dag[ 1 ].SetDependsOn( TEXT("a") );
+    _dag[ 3 ].SetDependsOn( TEXT("c") );
+    _dag[ 3 ].m_group = 1;
+    SY_CHECK( r, sy_resolve_start_levels( _dag, _levels ) == S_OK );
+    SY_CHECK( r, _levels.size() == 5 );
+    if ( _levels.size() == 5 ) {
+        SY_CHECK( r, _levels[ 0 ] == 2 );
+        SY_CHECK( r, _levels[ 1 ] == 1 );
+        SY_CHECK( r, _levels[ 2 ] == 0 );
+        SY_CHECK( r, _levels[ 3 ] == 0 );   // 前の group への依存は段を増やさない
+        SY_CHECK( r, _levels[ 4 ] == 0 );
+    }
+
+    // 循環 (x -> y -> z -> x) / 自分自身
+    SYCONFIGS _cycle;
+    _cycle.push_back( test_config( TEXT("x"), TEXT("idle") ) );
+    _cycle.push_back( test_config( TEXT("y"), TEXT("idle") ) );
+    _cycle.push_back( test_config( TEXT("z"), TEXT("idle") ) );
+    _cycle[ 0 ].SetDependsOn( TEXT("y") );
+    _cycle[ 1 ].SetDependsOn( TEXT("z") );
+    _cycle[ 2 ].SetDependsOn( TEXT("x") );
+    SY_CHECK( r, sy_resolve_start_levels( _cycle, _levels ) == E_INVALIDARG );
+
+    SYCONFIGS _self;
+    _self.push_back( test_config( TEXT("self"), TEXT("idle") ) );
+    _self[ 0 ].SetDependsOn( TEXT("self") );
+    SY_CHECK( r, sy_resolve_start_levels( _self, _levels ) == E_INVALIDARG );
+
+    // 未定義のentry
+    SYCONFIGS _unknown;
+    _unknown.push_back( test_config( TEXT("p"), TEXT("idle") ) );
+    _unknown[ 0 ].SetDependsOn( TEXT("missing") );
+    SY_CHECK( r, sy_resolve_start_levels( _unknown, _levels ) == E_INVALIDARG );
+
+    // 後の group への依存
+    SYCONFIGS _later;
+    _later.push_back( test_config( TEXT("early"), TEXT("idle") ) );
+    _later.push_back( test_config( TEXT("late"),  TEXT("idle") ) );
+    _later[ 0 ].SetDependsOn( TEXT("late") );
+    _later[ 1 ].m_group = 1;
+    SY_CHECK( r, sy_resolve_start_levels( _later, _levels ) == E_INVALIDARG );
+}
+
+//
+// integration tests
+//
+
+/**
+ * @brief 停止要求を無視する N 個の子プロセスの一斉停止が、stop_timeout 1回分程度で終わること
+ */
+static void
+test_stop_parallel( _Inout_ CsyTestResult& r, _In_ UINT n ) {
+    SYCONFIGS _configs;
+    for ( UINT i = 0; i < n; i++ ) {
+        CAtlString _name;
+        _name.Format( TEXT("stubborn%04u"), i );
+        CsyProcConfig _c = test_config( _name, TEXT("stubborn") );
+        _c.m_stop_timeout = SY_TEST_STOP_TIMEOUT_MS;
+        _configs.push_back( _c );
+    }
+
+    CsylphProcessManager _proc;
+    _proc.SetSampleInterval( 0 );
+    SY_CHECK( r, SUCCEEDED( _proc.StartEntries( _configs ) ) );
+    std::vector<HANDLE> _handles = test_open_processes( _proc );
+    SY_CHECK( r, _handles.size() == n );
+
+    LONGLONG _begin = sy_perf_counter();
+    _proc.PurgeProcesses();
+    double   _ms    = sy_perf_ms( _begin );
+    _SLOG( TEXT("==> stop : %u processes in %.1f ms (stop_timeout %d ms)\n"), n, _ms, SY_TEST_STOP_TIMEOUT_MS );
+
+    SY_CHECK( r, _ms >= SY_TEST_STOP_TIMEOUT_MS - 100 );        // 猶予は待つ
+    SY_CHECK( r, _ms <  SY_TEST_STOP_TIMEOUT_MS * 3 );          // N 回分は待たない
+    SY_CHECK( r, test_survivors( _handles, 0 ) == 0 );
+}
+
+/**
+ * @brief 3段のプロセスツリー（entry → 子 → 孫）が停止後に1つも残らないこと
+ *        （停止要求で本体だけが終了する場合と、Kill の場合）
+ */
+static void
+test_tree_teardown( _Inout_ CsyTestResult& r, _In_ UINT /*n*/ ) {
+    CAtlString _args;
+    _args.Format( TEXT("tree %d"), SY_TEST_TREE_DEPTH );
+
+    SYCONFIGS _configs;
+    _configs.push_back( test_config( TEXT("tree_ctrl_c"), _args ) );
+    _configs.push_back( test_config( TEXT("tree_kill"),   _args ) );
+    _configs.back().m_stop_signal = SY_STOP_KILL;
+
+    CsylphProcessManager _proc;
+    _proc.SetSampleInterval( 0 );
+    SY_CHECK( r, SUCCEEDED( _proc.StartEntries( _configs ) ) );
+
+    std::set<DWORD> _roots;
+    _proc.ForEach( [&]( CsyProcess* p ) { _roots.insert( p->IsProcessID() ); } );
+
+    // 全ての孫まで起動するまで
+    size_t _expected = _configs.size() * SY_TEST_TREE_DEPTH;
+    std::vector<HANDLE> _descendants;
+    test_wait_descendants( _roots, _expected, _descendants );
+    SY_CHECK( r, _descendants.size() == _expected );
+
+    std::vector<HANDLE> _handles = test_open_processes( _proc );
+    _handles.insert( _handles.end(), _descendants.begin(), _descendants.end() );
+    _proc.PurgeProcesses();
+    SY_CHECK( r, test_survivors( _handles, SY_KILL_WAIT_MS ) == 0 );
+}
+
+/**
+ * @brief cpu_set の affinity が子プロセスに設定されること（auto は replica 毎に別のコア）
+ */
+static void
+test_placement( _Inout_ CsyTestResult& r, _In_ UINT /*n*/ ) {
+    DWORD_PTR _process_mask = 0, _system_mask = 0;
+    SY_CHECK( r, ::GetProcessAffinityMask( ::GetCurrentProcess(), &_process_mask, &_system_mask ) );
+    DWORD_PTR _first = _system_mask & ( ~_system_mask + 1 );    // 最小の CPU
+
+    SYCONFIGS _configs;
+    _configs.push_back( test_config( TEXT("pinned"), TEXT("idle") ) );
+    _configs.back().m_cpu_set = _first;
+    _configs.push_back( test_config( TEXT("spread"), TEXT("idle") ) );
+    _configs.back().m_cpu_auto      = TRUE;
+    _configs.back().m_instances_min = 2;
+    _configs.back().m_instances_max = 2;
+
+    CsylphProcessManager _proc;
+    _proc.SetSampleInterval( 0 );
+    SY_CHECK( r, SUCCEEDED( _proc.StartEntries( _configs ) ) );
+
+    std::vector<DWORD_PTR> _spread;
+    _proc.ForEach( [&]( CsyProcess* p ) {
+        DWORD_PTR _mask = 0, _system = 0;
+        SY_CHECK( r, ::GetProcessAffinityMask( p->IsProcessHandle(), &_mask, &_system ) );
+        if ( p->IsConfig().m_name == TEXT("pinned") ) {
+            SY_CHECK( r, _mask == _first );
+        } else {
+            SY_CHECK( r, _mask && !( _mask & ( _mask - 1 ) ) );     // 1コアだけ
+            _spread.push_back( _mask );
+        }
+    } );
+    SY_CHECK( r, _spread.size() == 2 );
+    if ( _spread.size() == 2 && ( _system_mask & ( _system_mask - 1 ) ) )
+        SY_CHECK( r, _spread[ 0 ] != _spread[ 1 ] );    // CPU が2つ以上あれば別のコア
+
+    _proc.PurgeProcesses();
+}
+
+/**
+ * @brief <listen> の entry の子プロセスを Kill し続けても、接続が拒否されないこと
+ */
+static void
+test_listen_restart( _Inout_ CsyTestResult& r, _In_ UINT /*n*/ ) {
+    WSADATA _wsa;
+    SY_CHECK( r, ::WSAStartup( MAKEWORD( 2, 2 ), &_wsa ) == 0 );
+
+    // 空いているポート
+    sockaddr_in _addr = { 0 };
+    _addr.sin_family      = AF_INET;
+    _addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    int    _len  = sizeof( _addr );
+    SOCKET _probe = ::socket( AF_INET, SOCK_STREAM, IPPROTO_TCP );
+    ::bind( _probe, reinterpret_cast<sockaddr*>( &_addr ), sizeof( _addr ) );
+    ::getsockname( _probe, reinterpret_cast<sockaddr*>( &_addr ), &_len );
+    ::closesocket( _probe );
+
+    CAtlString _listen;
+    _listen.Format( TEXT("127.0.0.1:%d"), ntohs( _addr.sin_port ) );
+    CsyProcConfig _c = test_config( TEXT("serve"), TEXT("serve") );
+    _c.m_listen.push_back( _listen );
+    _c.m_max_retry       = 1000;
+    _c.m_retry_delay     = 0;
+    _c.m_retry_delay_max = 0;
+    _c.m_crash_limit     = 0;
+
+    CsylphProcessManager _proc;
+    _proc.SetSampleInterval( 0 );
+    SY_CHECK( r, SUCCEEDED( _proc.StartEntries( SYCONFIGS( 1, _c ) ) ) );
+
+    // 0 : 接続し続ける  1 : 子プロセスを Kill し続ける
+    LONG      _connected = 0;
+    LONG      _refused   = 0;
+    UINT      _kills     = 0;
+    ULONGLONG _deadline  = ::GetTickCount64() + SY_TEST_LISTEN_MS;
+    sy_parallel_for( 2, [&]( size_t n ) {
+        while ( ::GetTickCount64() < _deadline ) {
+            if ( n == 0 ) {
+                SOCKET _s = ::socket( AF_INET, SOCK_STREAM, IPPROTO_TCP );
+                if ( ::connect( _s, reinterpret_cast<sockaddr*>( &_addr ), sizeof( _addr ) ) == 0 )
+                    _connected++;
+                else
+                    _refused++;
+                ::closesocket( _s );
+                ::Sleep( 1 );
+            } else {
+                ::Sleep( SY_TEST_KILL_INTERVAL );
+                _proc.ForEach( [&]( CsyProcess* p ) {
+                    if ( p->IsState() == SY_PROC_RUNNING && ::TerminateProcess( p->IsProcessHandle(), 1 ) )
+                        _kills++;
+                } );
+            }
+        }
+    } );
+    _proc.PurgeProcesses();
+    ::WSACleanup();
+
+    _SLOG( TEXT("==> listen : %d connected, %d refused, %u kills\n"), _connected, _refused, _kills );
+    SY_CHECK( r, _kills > 0 );
+    SY_CHECK( r, _connected > 0 );
+    SY_CHECK( r, _refused == 0 );
+}
+
+/** journal の記録を1件追加します（CsyJournal と同じ形式） */
+static void
+test_journal_append( _Inout_ std::vector<BYTE>& data, _In_ SY_JOURNAL_RECORD type, _In_ const TSY_JOURNAL_ENTRY& entry ) {
+    TSY_JOURNAL_ENTRY _e( entry );
+    CsySnapshotWriter _writer;
+    sy_serialize( _writer, _e );
+
+    TSY_JOURNAL_RECORD_HEADER _head;
+    _head.type = type;
+    _head.size = static_cast<DWORD>( _writer.IsBody().size() );
+    _head.hash = sy_hash64( _writer.IsBody().data(), _writer.IsBody().size() );
+
+    const BYTE* _p = reinterpret_cast<const BYTE*>( &_head );
+    data.insert( data.end(), _p, _p + sizeof( _head ) );
+    data.insert( data.end(), _writer.IsBody().begin(), _writer.IsBody().end() );
+}
+
+/** ファイルのバイト数 (-1.. 無い) */
+static LONGLONG
+test_file_size( _In_ const CAtlString& path ) {
+    WIN32_FILE_ATTRIBUTE_DATA _attr;
+    if ( !::GetFileAttributesEx( path, GetFileExInfoStandard, &_attr ) )
+        return -1;
+    return ( static_cast<LONGLONG>( _attr.nFileSizeHigh ) << 32 ) | _attr.nFileSizeLow;
+}
+
+/**
+ * @brief journal の再生（FNV の不一致 / 途中で切れた末尾の記録は捨てる）、生存分への書き直し、
+ *        引き継げない子プロセスをツリーごと停止し、引き継げるものは残すこと (CsyJournal)
+ */
+static void
+test_journal( _Inout_ CsyTestResult& r, _In_ UINT /*n*/ ) {
+    TCHAR _dir[ MAX_PATH ] = { 0 };
+    ::GetTempPath( _countof( _dir ), _dir );
+    CAtlString _path;
+    _path.Format( TEXT("%ssylphtest_%u.journal"), _dir, ::GetCurrentProcessId() );
+
+    // 前の supervisor が起動した子プロセス（それぞれ子を1つ持つ）。keep.. 引き継ぐ  drop.. 設定が変わった
+    CsyProcConfig _configs[ 2 ] = { test_config( TEXT("keep"), TEXT("tree 1") ), test_config( TEXT("drop"), TEXT("tree 1") ) };
+    PROCESS_INFORMATION  _pi[ 2 ];
+    TSY_JOURNAL_ENTRY    _e[ 2 ];
+    std::vector<HANDLE>  _trees[ 2 ];     // 子孫（本体を含む）
+    for ( int i = 0; i < 2; i++ ) {
+        SY_CHECK( r, SUCCEEDED( sy_create_process( _configs[ i ].m_commandline, _pi[ i ] ) ) );
+        ::CloseHandle( _pi[ i ].hThread );
+        _e[ i ].name        = _configs[ i ].m_name;
+        _e[ i ].pid         = _pi[ i ].dwProcessId;
+        _e[ i ].create_time = sy_process_create_time( _pi[ i ].hProcess );
+        _e[ i ].config_hash = sy_config_hash( _configs[ i ] );
+        test_wait_descendants( std::set<DWORD>( &_e[ i ].pid, &_e[ i ].pid + 1 ), 1, _trees[ i ] );
+        SY_CHECK( r, _trees[ i ].size() == 1 );
+        _trees[ i ].push_back( _pi[ i ].hProcess );
+    }
+
+    // header + 起動2件 + 終了済み100組 + FNV の合わない drop の終了 + 途中で切れた keep の終了
+    std::vector<BYTE> _data;
+    TSY_JOURNAL_HEADER _head = { SY_JOURNAL_MAGIC, SY_JOURNAL_VERSION };
+    _data.insert( _data.end(), reinterpret_cast<const BYTE*>( &_head ), reinterpret_cast<const BYTE*>( &_head + 1 ) );
+    for ( int i = 0; i < 2; i++ )
+        test_journal_append( _data, SY_JOURNAL_SPAWN, _e[ i ] );
+    for ( DWORD i = 0; i < 100; i++ ) {
+        TSY_JOURNAL_ENTRY _dead;
+        _dead.name = TEXT("dead");
+        _dead.pid  = 0xFFFFFF00 - i * 4;
+        test_journal_append( _data, SY_JOURNAL_SPAWN, _dead );
+        test_journal_append( _data, SY_JOURNAL_EXIT,  _dead );
+    }
+    test_journal_append( _data, SY_JOURNAL_EXIT, _e[ 1 ] );
+    _data.back() ^= 0xFF;                   // 本体を壊す
+    std::vector<BYTE> _torn;
+    test_journal_append( _torn, SY_JOURNAL_EXIT, _e[ 0 ] );
+    _data.insert( _data.end(), _torn.begin(), _torn.begin() + _torn.size() / 2 );
+
+    HANDLE _file = ::CreateFile( _path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+    DWORD  _written = 0;
+    SY_CHECK( r, _file != INVALID_HANDLE_VALUE &&
+                 ::WriteFile( _file, _data.data(), static_cast<DWORD>( _data.size() ), &_written, NULL ) );
+    if ( _file != INVALID_HANDLE_VALUE ) ::CloseHandle( _file );
+
+    // 生存分だけのサイズ
+    std::vector<BYTE> _live;
+    for ( int i = 0; i < 2; i++ )
+        test_journal_append( _live, SY_JOURNAL_SPAWN, _e[ i ] );
+    LONGLONG _compacted = static_cast<LONGLONG>( sizeof( TSY_JOURNAL_HEADER ) + _live.size() );
+
+    {
+        CsyJournal _journal;
+        SY_CHECK( r, SUCCEEDED( _journal.Open( _path ) ) );
+        SY_CHECK( r, test_file_size( _path ) == _compacted );
+        SY_CHECK( r, test_file_size( _path + TEXT(".tmp") ) == -1 );
+
+        // drop は設定が変わったので子孫ごと停止、keep は残る
+        SYCONFIGS _recover( 1, _configs[ 0 ] );
+        _recover.push_back( _configs[ 1 ] );
+        _recover.back().m_stop_timeout++;
+        _journal.Recover( _recover );
+        for ( auto h : _trees[ 1 ] )
+            SY_CHECK( r, ::WaitForSingleObject( h, SY_KILL_WAIT_MS ) == WAIT_OBJECT_0 );
+        for ( auto h : _trees[ 0 ] )
+            SY_CHECK( r, ::WaitForSingleObject( h, 0 ) == WAIT_TIMEOUT );
+
+        PROCESS_INFORMATION _info;
+        SY_CHECK( r, !_journal.Adopt( _configs[ 1 ], 0, _info ) );
+        SY_CHECK( r, _journal.Adopt( _configs[ 0 ], 0, _info ) && _info.dwProcessId == _e[ 0 ].pid );
+        if ( _info.hProcess ) ::CloseHandle( _info.hProcess );
+        _journal.Close();
+    }
+
+    // 書き直した後も追記できる（drop の終了が1件増える）
+    std::vector<BYTE> _exit;
+    test_journal_append( _exit, SY_JOURNAL_EXIT, _e[ 1 ] );
+    SY_CHECK( r, test_file_size( _path ) == _compacted + static_cast<LONGLONG>( _exit.size() ) );
+    {
+        CsyJournal _journal;
+        SY_CHECK( r, SUCCEEDED( _journal.Open( _path ) ) );
+        PROCESS_INFORMATION _info;
+        SY_CHECK( r, _journal.Adopt( _configs[ 0 ], 0, _info ) && _info.dwProcessId == _e[ 0 ].pid );
+        if ( _info.hProcess ) ::CloseHandle( _info.hProcess );
+        _journal.Close();
+    }
+
+    test_survivors( _trees[ 0 ], 0 );
+    test_survivors( _trees[ 1 ], 0 );
+    ::DeleteFile( _path );
+}
+
+/** テスト一覧（実行順） */
+static const TTEST SY_TESTS[] = {
+    { TEXT("backoff"),  test_backoff            },
+    { TEXT("notify"),   test_notify_parse       },
+    { TEXT("config"),   test_config_parse       },
+    { TEXT("snapshot"), test_snapshot_roundtrip },
+    { TEXT("event"),    test_event_coalesce     },
+    { TEXT("reload"),   test_reload_diff        },
+    { TEXT("levels"),   test_start_levels       },
+    { TEXT("stop"),     test_stop_parallel      },
+    { TEXT("tree"),     test_tree_teardown      },
+    { TEXT("placement"), test_placement         },
+    { TEXT("listen"),   test_listen_restart     },
+    { TEXT("journal"),  test_journal            },
+    { NULL,             NULL                    },
+};
+
+/**
+ * @brief テストを実行します。
+ * @param[in] names ... 実行するテスト名（空.. 全て）
+ * @param[in] n ... 負荷テストの件数
+ * @retval 失敗した検査の数
+ */
+int run_tests( _In_ const std::set<CAtlString>& names, _In_ UINT n ) {
+    UINT _checks       = 0;
+    UINT _failures     = 0;
+    UINT _failed_tests = 0;
+    for ( const TTEST* t = SY_TESTS; t->name; t++ ) {
+        if ( !names.empty() && !names.count( t->name ) )
+            continue;
+
+        CsyTestResult _r;
+        LONGLONG      _begin = sy_perf_counter();
+        t->func( _r, n );
+        _SLOG( TEXT("[%s] %s (%u checks, %.1f ms)\n"),
+                _r.IsFailures() ? TEXT("FAIL") : TEXT(" OK "), t->name, _r.IsChecks(), sy_perf_ms( _begin ) );
+        _checks   += _r.IsChecks();
+        _failures += _r.IsFailures();
+        if ( _r.IsFailures() )
+            _failed_tests++;
+    }
+    _SLOG( TEXT("==> %u checks, %u failures (%u tests failed)\n"), _checks, _failures, _failed_tests );
+    return static_cast<int>( _failures );
+}